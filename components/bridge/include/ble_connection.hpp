@@ -0,0 +1,312 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+
+/// States of the connection to the BLE controller
+enum class BleState : uint8_t {
+  IDLE,        ///< Not looking for a controller
+  SCANNING,    ///< Scanning (or waiting to connect directly) for a controller
+  CONNECTING,  ///< Connecting to a controller
+  SECURING,    ///< Connected, bonding / restoring encryption
+  DISCOVERING, ///< Encrypted, finding the characteristics (or validating the cache)
+  SUBSCRIBING, ///< Enabling notifications on the characteristics
+  STREAMING,   ///< Subscribed, receiving reports
+};
+
+/// Get the name of a state, for logging.
+constexpr const char *to_string(BleState state) {
+  switch (state) {
+  case BleState::IDLE:
+    return "IDLE";
+  case BleState::SCANNING:
+    return "SCANNING";
+  case BleState::CONNECTING:
+    return "CONNECTING";
+  case BleState::SECURING:
+    return "SECURING";
+  case BleState::DISCOVERING:
+    return "DISCOVERING";
+  case BleState::SUBSCRIBING:
+    return "SUBSCRIBING";
+  case BleState::STREAMING:
+    return "STREAMING";
+  }
+  return "UNKNOWN";
+}
+
+/// Events which drive the connection, raised by the BLE stack callbacks and by
+/// the results of the actions
+enum class BleEvent : uint8_t {
+  START,             ///< (Re)start looking for a controller, e.g. to pair a new one
+  SCAN_ENDED,        ///< A scan (or a step of the search) ended without a connection
+  CONNECTING,        ///< A connection to a controller was started
+  CONNECTED,         ///< The link is up
+  CONNECT_FAILED,    ///< The connection attempt failed or timed out
+  ENCRYPTED,         ///< The link is encrypted (bonded)
+  ENCRYPTION_FAILED, ///< Bonding / encryption failed
+  DISCOVERED,        ///< The characteristics are known
+  DISCOVERY_FAILED,  ///< The peer does not have the characteristics we need
+  SUBSCRIBED,        ///< Notifications are enabled
+  SUBSCRIBE_FAILED,  ///< Enabling notifications failed
+  SERVICE_CHANGED,   ///< The peer's database changed, so its handles are stale
+  DISCONNECTED,      ///< The link went down
+};
+
+/// The operations the state machine asks of the BLE client.
+///
+/// Each operation only starts the work (or does it in place) and reports the
+/// result by raising an event later; it must not call
+/// BleConnectionStateMachine::handle() itself.
+class BleConnectionActions {
+public:
+  virtual ~BleConnectionActions() = default;
+
+  /// Start or continue looking for a controller. Raises CONNECTING when a
+  /// connection attempt starts.
+  virtual void start_search() = 0;
+
+  /// Bond with the controller, or restore the encryption of an existing bond.
+  /// Raises ENCRYPTED or ENCRYPTION_FAILED.
+  virtual void secure() = 0;
+
+  /// Find the characteristics to subscribe to. Raises DISCOVERED or
+  /// DISCOVERY_FAILED.
+  /// @param use_cache If true, the handles cached from a previous connection
+  ///        may be used instead of a full discovery
+  virtual void discover(bool use_cache) = 0;
+
+  /// Enable notifications on the discovered characteristics. Raises SUBSCRIBED
+  /// or SUBSCRIBE_FAILED.
+  virtual void subscribe() = 0;
+
+  /// Cancel the connection attempt, or disconnect. Raises CONNECT_FAILED or
+  /// DISCONNECTED.
+  virtual void disconnect() = 0;
+
+  /// Forget the controller (its bond and cached handles), because it does not
+  /// work with us.
+  virtual void forget_peer() = 0;
+
+  /// Forget the handles of the controller (the cached ones and the ones in
+  /// use), because its database changed.
+  virtual void forget_handles() = 0;
+};
+
+/// Event driven state machine for the connection to the BLE controller.
+///
+/// All BLE stack callbacks are turned into events and fed to handle(); each
+/// state runs its action on entry, and states which wait on the peer have a
+/// timeout after which the connection is dropped. check_timeout() must be
+/// called once get_deadline_ms() has passed, so the caller can sleep until
+/// the next event or deadline instead of polling.
+///
+/// Transitions are published to the listeners (with the previous and the new
+/// state) before the new state's action runs.
+///
+/// @note handle() and check_timeout() must be called from a single thread (the
+///       one running the actions), and listeners must be added before the
+///       first event. get_state() may be called from any thread.
+class BleConnectionStateMachine {
+public:
+  static constexpr size_t max_listeners = 4;
+
+  /// Called on each transition, with the previous state and the new state
+  typedef std::function<void(BleState from, BleState to)> Listener;
+
+  /// How long to wait in each state, 0 for no timeout
+  struct Timeouts {
+    uint32_t connecting_ms{10000};
+    uint32_t securing_ms{10000};
+    uint32_t discovering_ms{15000};
+    uint32_t subscribing_ms{5000};
+  };
+
+  explicit BleConnectionStateMachine(BleConnectionActions &actions)
+      : actions_(actions) {}
+
+  BleConnectionStateMachine(BleConnectionActions &actions, const Timeouts &timeouts)
+      : actions_(actions)
+      , timeouts_(timeouts) {}
+
+  /// Add a listener for the transitions.
+  /// @param listener The listener
+  /// @return True if it was added, false if there are too many listeners
+  bool add_listener(const Listener &listener) {
+    if (listener_count_ == max_listeners) {
+      return false;
+    }
+    listeners_[listener_count_++] = listener;
+    return true;
+  }
+
+  /// Get the current state.
+  BleState get_state() const { return state_.load(std::memory_order_acquire); }
+
+  /// Get the time at which the current state times out.
+  /// @return The deadline in milliseconds, or nullopt if the state has none
+  std::optional<uint64_t> get_deadline_ms() const { return deadline_ms_; }
+
+  /// Handle an event.
+  /// @param event The event
+  /// @param now_ms The current time in milliseconds
+  void handle(BleEvent event, uint64_t now_ms) {
+    BleState state = get_state();
+    if (event == BleEvent::START) {
+      if (is_connected(state)) {
+        // drop the current controller; the disconnection restarts the search
+        actions_.disconnect();
+      } else {
+        enter(BleState::SCANNING, now_ms);
+      }
+      return;
+    }
+    if (event == BleEvent::DISCONNECTED) {
+      if (state != BleState::IDLE) {
+        enter(BleState::SCANNING, now_ms);
+      }
+      return;
+    }
+    if (event == BleEvent::SERVICE_CHANGED) {
+      if (!is_connected(state)) {
+        return;
+      }
+      actions_.forget_handles();
+      // the handles found (or being found) must be found again; while securing
+      // there are none yet, and the discovery which follows finds no cache
+      if (state != BleState::SECURING) {
+        use_cache_ = false;
+        enter(BleState::DISCOVERING, now_ms);
+      }
+      return;
+    }
+    switch (state) {
+    case BleState::IDLE:
+      break;
+    case BleState::SCANNING:
+      if (event == BleEvent::SCAN_ENDED) {
+        // keep looking, the search decides how
+        actions_.start_search();
+      } else if (event == BleEvent::CONNECTING) {
+        enter(BleState::CONNECTING, now_ms);
+      } else if (event == BleEvent::CONNECTED) {
+        enter(BleState::SECURING, now_ms);
+      }
+      break;
+    case BleState::CONNECTING:
+      if (event == BleEvent::CONNECTED) {
+        enter(BleState::SECURING, now_ms);
+      } else if (event == BleEvent::CONNECT_FAILED) {
+        enter(BleState::SCANNING, now_ms);
+      }
+      break;
+    case BleState::SECURING:
+      if (event == BleEvent::ENCRYPTED) {
+        use_cache_ = true;
+        enter(BleState::DISCOVERING, now_ms);
+      } else if (event == BleEvent::ENCRYPTION_FAILED) {
+        actions_.disconnect();
+      }
+      break;
+    case BleState::DISCOVERING:
+      if (event == BleEvent::DISCOVERED) {
+        enter(BleState::SUBSCRIBING, now_ms);
+      } else if (event == BleEvent::DISCOVERY_FAILED) {
+        // the peer does not have what we need, so don't reconnect to it
+        actions_.forget_peer();
+        actions_.disconnect();
+      }
+      break;
+    case BleState::SUBSCRIBING:
+      if (event == BleEvent::SUBSCRIBED) {
+        enter(BleState::STREAMING, now_ms);
+      } else if (event == BleEvent::SUBSCRIBE_FAILED) {
+        if (use_cache_) {
+          // the cached handles may be stale, so rediscover once
+          use_cache_ = false;
+          enter(BleState::DISCOVERING, now_ms);
+        } else {
+          actions_.forget_peer();
+          actions_.disconnect();
+        }
+      }
+      break;
+    case BleState::STREAMING:
+      break;
+    }
+  }
+
+  /// Drop the connection if the current state has timed out.
+  /// @param now_ms The current time in milliseconds
+  void check_timeout(uint64_t now_ms) {
+    if (!deadline_ms_ || now_ms < *deadline_ms_) {
+      return;
+    }
+    timeout_count_++;
+    // retry the disconnection if it does not happen
+    deadline_ms_ = now_ms + get_timeout_ms(get_state());
+    actions_.disconnect();
+  }
+
+  /// Get the number of times a state timed out.
+  uint32_t get_timeout_count() const { return timeout_count_; }
+
+protected:
+  static constexpr bool is_connected(BleState state) {
+    return state == BleState::SECURING || state == BleState::DISCOVERING ||
+           state == BleState::SUBSCRIBING || state == BleState::STREAMING;
+  }
+
+  uint32_t get_timeout_ms(BleState state) const {
+    switch (state) {
+    case BleState::CONNECTING:
+      return timeouts_.connecting_ms;
+    case BleState::SECURING:
+      return timeouts_.securing_ms;
+    case BleState::DISCOVERING:
+      return timeouts_.discovering_ms;
+    case BleState::SUBSCRIBING:
+      return timeouts_.subscribing_ms;
+    default:
+      return 0;
+    }
+  }
+
+  void enter(BleState state, uint64_t now_ms) {
+    BleState previous = state_.exchange(state, std::memory_order_acq_rel);
+    uint32_t timeout_ms = get_timeout_ms(state);
+    deadline_ms_ = timeout_ms ? std::optional<uint64_t>(now_ms + timeout_ms) : std::nullopt;
+    for (size_t i = 0; i < listener_count_; i++) {
+      listeners_[i](previous, state);
+    }
+    switch (state) {
+    case BleState::SCANNING:
+      actions_.start_search();
+      break;
+    case BleState::SECURING:
+      actions_.secure();
+      break;
+    case BleState::DISCOVERING:
+      actions_.discover(use_cache_);
+      break;
+    case BleState::SUBSCRIBING:
+      actions_.subscribe();
+      break;
+    default:
+      break;
+    }
+  }
+
+  BleConnectionActions &actions_;
+  Timeouts timeouts_{};
+  std::atomic<BleState> state_{BleState::IDLE};
+  std::optional<uint64_t> deadline_ms_;
+  bool use_cache_{true};
+  uint32_t timeout_count_{0};
+  std::array<Listener, max_listeners> listeners_{};
+  size_t listener_count_{0};
+};
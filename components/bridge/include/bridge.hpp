@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+
+#include "gamepad_device.hpp"
+
+/// Translates input reports from a BLE gamepad (the Input device) into input
+/// reports for the USB host (the Output device).
+///
+/// When Input and Output are concrete (final) device types, e.g.
+/// Bridge<Xbox, SwitchPro>, every device call is statically bound so the
+/// compiler can devirtualize and inline the whole translation. When they are
+/// GamepadDevice, the devices are selected at runtime through virtual
+/// dispatch (DynamicBridge).
+template <typename Input, typename Output> class Bridge {
+public:
+  Bridge(std::shared_ptr<Input> input, std::shared_ptr<Output> output)
+      : input_(input)
+      , output_(output)
+      , input_report_id_(input->get_input_report_id())
+      , output_report_id_(output->get_input_report_id()) {}
+
+  const std::shared_ptr<Input> &input() const { return input_; }
+  const std::shared_ptr<Output> &output() const { return output_; }
+
+  /// Set the battery level (percent) to report to the USB host
+  void set_battery_level(uint8_t level) { battery_level_ = level; }
+
+  /// Translate an input report received from the input device into an input
+  /// report for the output device.
+  /// @param data The input report data (as received over BLE)
+  /// @param report_id The report id of the output report
+  /// @param report The buffer to write the output report into
+  /// @return The length of the output report, 0 if there is nothing to send
+  size_t translate(std::span<const uint8_t> data, uint8_t &report_id, std::span<uint8_t> report) {
+    // set the data in the ble gamepad
+    input_->set_report_data(input_report_id_, data);
+
+    // convert it to GamepadInputs
+    auto inputs = input_->get_gamepad_inputs();
+
+    // invert the y-axis for the joysticks
+    inputs.left_joystick.y = -inputs.left_joystick.y;
+    inputs.right_joystick.y = -inputs.right_joystick.y;
+
+    // now set the data in the usb gamepad
+    output_->set_gamepad_inputs(inputs);
+    output_->set_battery_level(battery_level_);
+
+    // then get the output report from the usb gamepad
+    report_id = output_report_id_;
+    return output_->get_report_data(output_report_id_, report);
+  }
+
+protected:
+  std::shared_ptr<Input> input_;
+  std::shared_ptr<Output> output_;
+  uint8_t input_report_id_;
+  uint8_t output_report_id_;
+  uint8_t battery_level_{100};
+};
+
+/// Bridge which dispatches to the devices at runtime
+using DynamicBridge = Bridge<GamepadDevice, GamepadDevice>;
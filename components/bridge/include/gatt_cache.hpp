@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+
+#include "notification_router.hpp"
+
+/// Attribute handles discovered on a bonded peer, so that a reconnection can
+/// subscribe directly instead of repeating the full GATT discovery.
+///
+/// The cache is only valid as long as the peer's GATT database does not
+/// change. If the peer exposes the Database Hash characteristic, its value is
+/// stored and compared on reconnection; otherwise the cache is invalidated by
+/// a Service Changed indication (or by a failed CCCD write).
+///
+/// serialize() / deserialize() convert the cache to a versioned, checksummed
+/// little endian blob suitable for storing in NVS.
+struct GattCache {
+  static constexpr uint8_t version = 1;
+  static constexpr size_t max_reports = 8;
+  static constexpr size_t db_hash_size = 16;
+
+  /// A subscribed HID input report
+  struct Report {
+    uint16_t value_handle{0}; ///< Handle of the Report characteristic value
+    uint16_t cccd_handle{0};  ///< Handle of its Client Characteristic Configuration
+    ReportKind kind{ReportKind::UNKNOWN};
+    uint8_t report_id{0};
+  };
+
+  std::array<uint8_t, db_hash_size> db_hash{};
+  uint16_t db_hash_handle{0};         ///< 0 if the peer has no Database Hash
+  uint16_t service_changed_handle{0}; ///< 0 if the peer has no Service Changed
+  uint16_t battery_handle{0};         ///< 0 if the peer has no battery level
+  uint16_t battery_cccd_handle{0};
+  uint16_t serial_number_handle{0}; ///< 0 if the peer has no serial number
+  uint8_t report_count{0};
+  std::array<Report, max_reports> reports{};
+
+  /// Add a report, if there is room.
+  /// @param report The report to add
+  /// @return True if it was added
+  bool add_report(const Report &report) {
+    if (report_count == max_reports) {
+      return false;
+    }
+    reports[report_count++] = report;
+    return true;
+  }
+
+  /// Get the reports which are in use.
+  std::span<const Report> get_reports() const { return {reports.data(), report_count}; }
+
+  // header (version, report count) + db hash + 5 handles + reports + checksum
+  static constexpr size_t header_size = 2;
+  static constexpr size_t report_size = 6;
+  static constexpr size_t checksum_size = 2;
+  static constexpr size_t max_serialized_size =
+      header_size + db_hash_size + 5 * 2 + max_reports * report_size + checksum_size;
+
+  /// Write the cache into a buffer.
+  /// @param buffer The buffer, at least max_serialized_size bytes
+  /// @return The number of bytes written, 0 if the buffer is too small
+  size_t serialize(std::span<uint8_t> buffer) const {
+    size_t size = serialized_size(report_count);
+    if (buffer.size() < size || report_count > max_reports) {
+      return 0;
+    }
+    size_t i = 0;
+    buffer[i++] = version;
+    buffer[i++] = report_count;
+    std::memcpy(&buffer[i], db_hash.data(), db_hash_size);
+    i += db_hash_size;
+    for (uint16_t handle : {db_hash_handle, service_changed_handle, battery_handle,
+                            battery_cccd_handle, serial_number_handle}) {
+      put_u16(buffer, i, handle);
+    }
+    for (const auto &report : get_reports()) {
+      put_u16(buffer, i, report.value_handle);
+      put_u16(buffer, i, report.cccd_handle);
+      buffer[i++] = static_cast<uint8_t>(report.kind);
+      buffer[i++] = report.report_id;
+    }
+    put_u16(buffer, i, checksum(buffer.first(i)));
+    return i;
+  }
+
+  /// Read a cache written by serialize().
+  /// @param data The serialized cache
+  /// @return The cache, or nullopt if the data is truncated, corrupt or from
+  ///         another version
+  static std::optional<GattCache> deserialize(std::span<const uint8_t> data) {
+    if (data.size() < header_size || data[0] != version || data[1] > max_reports ||
+        data.size() != serialized_size(data[1])) {
+      return {};
+    }
+    size_t i = data.size() - checksum_size;
+    if (get_u16(data, i) != checksum(data.first(data.size() - checksum_size))) {
+      return {};
+    }
+    GattCache cache;
+    i = header_size;
+    std::memcpy(cache.db_hash.data(), &data[i], db_hash_size);
+    i += db_hash_size;
+    cache.db_hash_handle = get_u16(data, i);
+    cache.service_changed_handle = get_u16(data, i);
+    cache.battery_handle = get_u16(data, i);
+    cache.battery_cccd_handle = get_u16(data, i);
+    cache.serial_number_handle = get_u16(data, i);
+    for (uint8_t r = 0; r < data[1]; r++) {
+      Report report;
+      report.value_handle = get_u16(data, i);
+      report.cccd_handle = get_u16(data, i);
+      report.kind = static_cast<ReportKind>(data[i++]);
+      report.report_id = data[i++];
+      cache.add_report(report);
+    }
+    return cache;
+  }
+
+protected:
+  static constexpr size_t serialized_size(size_t report_count) {
+    return header_size + db_hash_size + 5 * 2 + report_count * report_size + checksum_size;
+  }
+
+  static void put_u16(std::span<uint8_t> buffer, size_t &i, uint16_t value) {
+    buffer[i++] = value & 0xFF;
+    buffer[i++] = value >> 8;
+  }
+
+  static uint16_t get_u16(std::span<const uint8_t> data, size_t &i) {
+    uint16_t value = data[i] | (data[i + 1] << 8);
+    i += 2;
+    return value;
+  }
+
+  // Fletcher-16
+  static uint16_t checksum(std::span<const uint8_t> data) {
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+    for (auto byte : data) {
+      sum1 = (sum1 + byte) % 255;
+      sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+  }
+};
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+/// Histogram of latencies in microseconds, with fixed buckets so that
+/// recording never allocates.
+///
+/// Values below 8 us have a bucket each; above that, each power of two is
+/// split into 4 linear buckets (so a bucket is at most 25% wide), up to ~16.7
+/// s. Larger values go into the last bucket. Percentiles are reported as the
+/// upper bound of their bucket, clamped to the largest value recorded.
+///
+/// @note record() may be called from several threads at once; the summary is
+///       only approximate while values are being recorded.
+class LatencyHistogram {
+public:
+  static constexpr size_t num_buckets = 92;
+
+  /// Percentiles and range of the recorded values
+  struct Summary {
+    uint32_t count{0};
+    uint32_t min_us{0};
+    uint32_t p50_us{0};
+    uint32_t p90_us{0};
+    uint32_t p99_us{0};
+    uint32_t max_us{0};
+    float mean_us{0};
+  };
+
+  /// Get the bucket a value falls into.
+  static constexpr size_t bucket_index(uint32_t value_us) {
+    if (value_us < 8) {
+      return value_us;
+    }
+    size_t msb = std::bit_width(value_us) - 1;
+    size_t sub = (value_us >> (msb - 2)) & 0x3;
+    return std::min(8 + (msb - 3) * 4 + sub, num_buckets - 1);
+  }
+
+  /// Get the largest value which falls into a bucket.
+  static constexpr uint32_t bucket_upper_bound(size_t index) {
+    if (index < 8) {
+      return index;
+    }
+    size_t msb = (index - 8) / 4 + 3;
+    size_t sub = (index - 8) % 4;
+    return uint32_t(((5 + sub) << (msb - 2)) - 1);
+  }
+
+  /// Record a latency.
+  /// @param value_us The latency in microseconds
+  void record(uint32_t value_us) {
+    buckets_[bucket_index(value_us)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_us_.fetch_add(value_us, std::memory_order_relaxed);
+    uint32_t min = min_us_.load(std::memory_order_relaxed);
+    while (value_us < min &&
+           !min_us_.compare_exchange_weak(min, value_us, std::memory_order_relaxed)) {
+    }
+    uint32_t max = max_us_.load(std::memory_order_relaxed);
+    while (value_us > max &&
+           !max_us_.compare_exchange_weak(max, value_us, std::memory_order_relaxed)) {
+    }
+  }
+
+  /// Forget all the recorded values.
+  void reset() {
+    for (auto &bucket : buckets_) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_us_.store(0, std::memory_order_relaxed);
+    min_us_.store(UINT32_MAX, std::memory_order_relaxed);
+    max_us_.store(0, std::memory_order_relaxed);
+  }
+
+  /// Get the percentiles and range of the recorded values.
+  Summary summarize() const {
+    Summary summary;
+    std::array<uint32_t, num_buckets> counts;
+    uint32_t count = 0;
+    for (size_t i = 0; i < num_buckets; i++) {
+      counts[i] = buckets_[i].load(std::memory_order_relaxed);
+      count += counts[i];
+    }
+    if (count == 0) {
+      return summary;
+    }
+    summary.count = count;
+    summary.min_us = min_us_.load(std::memory_order_relaxed);
+    summary.max_us = max_us_.load(std::memory_order_relaxed);
+    summary.mean_us = float(sum_us_.load(std::memory_order_relaxed)) / count;
+    summary.p50_us = percentile(counts, count, 50, summary.max_us);
+    summary.p90_us = percentile(counts, count, 90, summary.max_us);
+    summary.p99_us = percentile(counts, count, 99, summary.max_us);
+    return summary;
+  }
+
+protected:
+  static uint32_t percentile(const std::array<uint32_t, num_buckets> &counts, uint32_t count,
+                             uint32_t percent, uint32_t max_us) {
+    // the rank of the value, rounding up (the nearest rank method)
+    uint64_t rank = (uint64_t(count) * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < num_buckets; i++) {
+      seen += counts[i];
+      if (seen >= rank) {
+        return std::min(bucket_upper_bound(i), max_us);
+      }
+    }
+    return max_us;
+  }
+
+  std::array<std::atomic<uint32_t>, num_buckets> buckets_{};
+  std::atomic<uint32_t> count_{0};
+  std::atomic<uint64_t> sum_us_{0};
+  std::atomic<uint32_t> min_us_{UINT32_MAX};
+  std::atomic<uint32_t> max_us_{0};
+};
+
+/// The stages of the BLE -> USB path of an input report
+enum class LatencyStage : uint8_t {
+  QUEUE,     ///< BLE notification -> bridge task starts decoding
+  TRANSLATE, ///< decode -> encode of the USB report
+  SUBMIT,    ///< encoded -> handed to the USB endpoint (tud_hid_report)
+  COMPLETE,  ///< submitted -> the host read it (tud_hid_report_complete_cb)
+  TOTAL,     ///< BLE notification -> the host read it
+};
+
+/// Get the name of a stage, for logging.
+constexpr const char *to_string(LatencyStage stage) {
+  switch (stage) {
+  case LatencyStage::QUEUE:
+    return "queue";
+  case LatencyStage::TRANSLATE:
+    return "translate";
+  case LatencyStage::SUBMIT:
+    return "submit";
+  case LatencyStage::COMPLETE:
+    return "complete";
+  case LatencyStage::TOTAL:
+    return "total";
+  }
+  return "unknown";
+}
+
+/// The times (in microseconds, 0 if not reached) at which an input report
+/// passed each point of the BLE -> USB path
+struct ReportTimestamps {
+  int64_t notify_us{0};   ///< BLE notification received
+  int64_t decode_us{0};   ///< Bridge task started decoding it
+  int64_t encode_us{0};   ///< USB report encoded
+  int64_t submit_us{0};   ///< Handed to the USB endpoint
+  int64_t complete_us{0}; ///< The host read it
+};
+
+/// Per-stage latency histograms of the BLE -> USB path.
+///
+/// Each report's timestamps are recorded once it is done with: when the host
+/// has read it, or when it was dropped (suppressed or replaced by a newer
+/// report), in which case only the stages it went through are recorded. The
+/// timestamps come from the caller, so a recorded trace replayed on the host
+/// gives the same statistics as on the device.
+class LatencyTracer {
+public:
+  static constexpr size_t num_stages = 5;
+
+  /// Record the stages a report went through.
+  /// @param timestamps The report's timestamps
+  void record(const ReportTimestamps &timestamps) {
+    record_stage(LatencyStage::QUEUE, timestamps.notify_us, timestamps.decode_us);
+    record_stage(LatencyStage::TRANSLATE, timestamps.decode_us, timestamps.encode_us);
+    record_stage(LatencyStage::SUBMIT, timestamps.encode_us, timestamps.submit_us);
+    record_stage(LatencyStage::COMPLETE, timestamps.submit_us, timestamps.complete_us);
+    record_stage(LatencyStage::TOTAL, timestamps.notify_us, timestamps.complete_us);
+  }
+
+  /// Get the histogram of a stage.
+  const LatencyHistogram &get(LatencyStage stage) const {
+    return histograms_[static_cast<size_t>(stage)];
+  }
+
+  /// Forget all the recorded latencies.
+  void reset() {
+    for (auto &histogram : histograms_) {
+      histogram.reset();
+    }
+  }
+
+protected:
+  void record_stage(LatencyStage stage, int64_t start_us, int64_t end_us) {
+    if (start_us == 0 || end_us == 0 || end_us < start_us) {
+      return;
+    }
+    int64_t latency_us = std::min<int64_t>(end_us - start_us, UINT32_MAX);
+    histograms_[static_cast<size_t>(stage)].record(latency_us);
+  }
+
+  std::array<LatencyHistogram, num_stages> histograms_{};
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+/// Watches the activity and quality of the BLE link, and decides how the link
+/// should be set up:
+///
+/// - ACTIVE: the inputs are changing, so use the link profile's (tight)
+///   connection interval.
+/// - IDLE: the inputs have not changed for a while, so relax the interval and
+///   latency to save airtime. Any input change goes straight back to ACTIVE.
+/// - DEGRADED: the signal is weak, notifications arrive late, or the gaps
+///   between them get close to the supervision timeout, so switch to the coded
+///   PHY (longer range) until the link has been good for a few samples.
+///
+/// The controller only notifies when its inputs change, so gaps between
+/// notifications are only counted while the inputs keep changing (a long gap
+/// between two changing reports means connection events were missed).
+///
+/// on_notification() is called for each gamepad notification and sample()
+/// periodically (e.g. every second) with the RSSI of the connection.
+///
+/// @note Not thread safe; the caller must serialize the calls.
+class LinkMonitor {
+public:
+  enum class Mode : uint8_t { ACTIVE, IDLE, DEGRADED };
+
+  struct Config {
+    int64_t idle_after_us{2'000'000}; ///< Go idle when the inputs haven't changed for this long
+    int64_t late_gap_us{50'000};      ///< A gap between changing reports which counts as late
+    int8_t degraded_rssi{-85};        ///< RSSI (dBm) at or below which the link is degraded
+    int8_t recovered_rssi{-78};       ///< RSSI (dBm) above which it may recover
+    float degraded_late_ratio{0.2f};  ///< Fraction of late notifications which is degraded
+    uint32_t min_notifications{10};   ///< Notifications needed to judge the late fraction
+    uint8_t recover_samples{5};       ///< Good samples in a row needed to recover
+  };
+
+  /// The link quality over one sample period
+  struct Sample {
+    int8_t rssi{0};               ///< RSSI in dBm, 0 if unknown
+    uint32_t notifications{0};    ///< Gamepad notifications received
+    uint32_t late{0};             ///< Notifications which arrived late
+    int64_t max_gap_us{0};        ///< Longest gap between changing reports
+    bool supervision_risk{false}; ///< The longest gap came close to the supervision timeout
+    Mode mode{Mode::ACTIVE};      ///< The mode after the sample
+  };
+
+  LinkMonitor() = default;
+
+  explicit LinkMonitor(const Config &config)
+      : config_(config) {}
+
+  /// Start monitoring a new connection.
+  /// @param now_us The current time in microseconds
+  void reset(int64_t now_us) {
+    mode_ = Mode::ACTIVE;
+    last_change_us_ = now_us;
+    last_notification_us_ = 0;
+    good_samples_ = 0;
+    current_ = {};
+  }
+
+  /// Set the supervision timeout of the connection, so the gaps between
+  /// notifications can be compared to it.
+  /// @param timeout_us The supervision timeout in microseconds, 0 if unknown
+  void set_supervision_timeout_us(int64_t timeout_us) { supervision_timeout_us_ = timeout_us; }
+
+  /// Record a gamepad notification.
+  /// @param now_us The current time in microseconds
+  /// @param inputs_changed Whether the report differs from the previous one
+  /// @return True if the link should leave IDLE (and be set up as ACTIVE) now
+  bool on_notification(int64_t now_us, bool inputs_changed) {
+    current_.notifications++;
+    if (!inputs_changed) {
+      return false;
+    }
+    // only gaps between changing reports say something about the link
+    if (last_notification_us_ && now_us - last_change_us_ < config_.idle_after_us) {
+      int64_t gap = now_us - last_notification_us_;
+      current_.max_gap_us = std::max(current_.max_gap_us, gap);
+      if (gap > config_.late_gap_us) {
+        current_.late++;
+      }
+    }
+    last_notification_us_ = now_us;
+    last_change_us_ = now_us;
+    if (mode_ == Mode::IDLE) {
+      mode_ = Mode::ACTIVE;
+      return true;
+    }
+    return false;
+  }
+
+  /// Evaluate the link over the last sample period, and start a new one.
+  /// @param now_us The current time in microseconds
+  /// @param rssi The RSSI of the connection in dBm, 0 if unknown
+  /// @return The sample, with the mode the link should be in
+  Sample sample(int64_t now_us, int8_t rssi) {
+    Sample sample = current_;
+    current_ = {};
+    sample.rssi = rssi;
+    sample.supervision_risk =
+        supervision_timeout_us_ && sample.max_gap_us * 2 > supervision_timeout_us_;
+    bool weak = rssi != 0 && rssi <= config_.degraded_rssi;
+    bool late = sample.notifications >= config_.min_notifications &&
+                sample.late > sample.notifications * config_.degraded_late_ratio;
+    if (weak || late || sample.supervision_risk) {
+      mode_ = Mode::DEGRADED;
+      good_samples_ = 0;
+    } else if (mode_ == Mode::DEGRADED) {
+      bool recovered = rssi == 0 || rssi > config_.recovered_rssi;
+      good_samples_ = recovered ? good_samples_ + 1 : 0;
+      if (good_samples_ >= config_.recover_samples) {
+        mode_ = get_activity_mode(now_us);
+      }
+    } else {
+      mode_ = get_activity_mode(now_us);
+    }
+    sample.mode = mode_;
+    return sample;
+  }
+
+  /// Get the mode the link should be in.
+  Mode get_mode() const { return mode_; }
+
+protected:
+  Mode get_activity_mode(int64_t now_us) const {
+    return now_us - last_change_us_ < config_.idle_after_us ? Mode::ACTIVE : Mode::IDLE;
+  }
+
+  Config config_{};
+  Mode mode_{Mode::ACTIVE};
+  int64_t last_change_us_{0};
+  int64_t last_notification_us_{0};
+  int64_t supervision_timeout_us_{0};
+  uint8_t good_samples_{0};
+  Sample current_{};
+};
+
+/// Get the name of a link mode, for logging.
+constexpr const char *to_string(LinkMonitor::Mode mode) {
+  switch (mode) {
+  case LinkMonitor::Mode::ACTIVE:
+    return "active";
+  case LinkMonitor::Mode::IDLE:
+    return "idle";
+  case LinkMonitor::Mode::DEGRADED:
+    return "degraded";
+  }
+  return "unknown";
+}
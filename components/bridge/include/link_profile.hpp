@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+/// BLE connection parameters, in the units of the HCI commands
+struct ConnParams {
+  uint16_t min_interval;        ///< Minimum connection interval, 1.25 ms units
+  uint16_t max_interval;        ///< Maximum connection interval, 1.25 ms units
+  uint16_t latency;             ///< Connection events the peripheral may skip
+  uint16_t supervision_timeout; ///< Supervision timeout, 10 ms units
+};
+
+/// Convert a connection interval to milliseconds.
+constexpr float conn_interval_to_ms(uint16_t interval) { return interval * 1.25f; }
+
+/// Check that the supervision timeout outlasts the longest time the
+/// peripheral may stay silent, as the specification requires.
+constexpr bool is_valid(const ConnParams &params) {
+  // timeout (10 ms units) > (1 + latency) * max interval (1.25 ms units) * 2
+  return params.min_interval >= 6 && params.min_interval <= params.max_interval &&
+         params.supervision_timeout * 8u > (1u + params.latency) * params.max_interval * 2u;
+}
+
+/// How the link to the controller is set up once connected
+struct LinkProfile {
+  const char *name;
+  ConnParams params;                     ///< Parameters to request first
+  uint16_t max_interval;                 ///< Largest interval to fall back to on rejection
+  bool use_2m_phy;                       ///< Request the 2M PHY
+  bool data_length_extension;            ///< Request the largest link layer packets
+  bool exchange_mtu;                     ///< Exchange the ATT MTU when connecting
+  ConnParams idle_params;                ///< Relaxed parameters for when the inputs are idle
+  uint16_t degraded_supervision_timeout; ///< Supervision timeout on a degraded link, 10 ms units
+};
+
+namespace link_profiles {
+/// 15 ms interval, letting the peripheral skip up to 4 connection events when
+/// it has nothing to send
+inline constexpr LinkProfile balanced{
+    .name = "balanced",
+    .params = {.min_interval = 12, .max_interval = 12, .latency = 4, .supervision_timeout = 400},
+    .max_interval = 12,
+    .use_2m_phy = false,
+    .data_length_extension = false,
+    .exchange_mtu = false,
+    .idle_params = {.min_interval = 24, .max_interval = 24, .latency = 10,
+                    .supervision_timeout = 400},
+    .degraded_supervision_timeout = 600,
+};
+
+/// The shortest interval the peripheral accepts, starting from 7.5 ms, with no
+/// peripheral latency so each report goes out on the next connection event
+inline constexpr LinkProfile low_latency{
+    .name = "low latency",
+    .params = {.min_interval = 6, .max_interval = 6, .latency = 0, .supervision_timeout = 400},
+    .max_interval = 12,
+    .use_2m_phy = true,
+    .data_length_extension = true,
+    .exchange_mtu = true,
+    .idle_params = {.min_interval = 24, .max_interval = 24, .latency = 10,
+                    .supervision_timeout = 400},
+    .degraded_supervision_timeout = 600,
+};
+} // namespace link_profiles
+
+/// Get the parameters to request after the peripheral rejected some.
+///
+/// The interval steps up through the values peripherals commonly accept
+/// (7.5, 10, 11.25, 15, 20, 30 ms), keeping the latency and timeout.
+/// @param rejected The parameters which were rejected
+/// @param max_interval The largest interval to fall back to
+/// @return The parameters to try next, or nullopt if there are none left
+constexpr std::optional<ConnParams> fallback_conn_params(const ConnParams &rejected,
+                                                         uint16_t max_interval) {
+  constexpr uint16_t intervals[] = {6, 8, 9, 12, 16, 24};
+  for (uint16_t interval : intervals) {
+    if (interval > rejected.min_interval && interval <= max_interval) {
+      ConnParams params = rejected;
+      params.min_interval = interval;
+      params.max_interval = interval;
+      if (!is_valid(params)) {
+        continue;
+      }
+      return params;
+    }
+  }
+  return {};
+}
+
+/// The state of the link, as negotiated with the peripheral
+struct LinkStatus {
+  uint16_t interval{0};            ///< Connection interval, 1.25 ms units
+  uint16_t latency{0};             ///< Peripheral latency
+  uint16_t supervision_timeout{0}; ///< Supervision timeout, 10 ms units
+  uint8_t tx_phy{1};               ///< 1 = 1M, 2 = 2M, 3 = coded
+  uint8_t rx_phy{1};               ///< 1 = 1M, 2 = 2M, 3 = coded
+  uint16_t mtu{23};                ///< ATT MTU
+  uint16_t tx_octets{27};          ///< Link layer payload size
+};
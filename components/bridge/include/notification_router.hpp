@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+/// The kind of data a BLE notification carries, which decides how it is decoded
+enum class ReportKind : uint8_t {
+  UNKNOWN,
+  GAMEPAD,  ///< HID gamepad / joystick input report
+  KEYBOARD, ///< HID keyboard / keypad input report
+  CONSUMER, ///< HID consumer control input report
+  BATTERY,  ///< Battery level (percent)
+};
+
+/// Classify a top level HID application collection by its usage.
+/// @param usage_page The usage page of the collection
+/// @param usage The usage of the collection
+/// @return The kind of report the collection produces
+constexpr ReportKind report_kind_from_usage(uint16_t usage_page, uint16_t usage) {
+  constexpr uint16_t generic_desktop_page = 0x01;
+  constexpr uint16_t consumer_page = 0x0C;
+  if (usage_page == generic_desktop_page) {
+    switch (usage) {
+    case 0x04: // joystick
+    case 0x05: // gamepad
+      return ReportKind::GAMEPAD;
+    case 0x06: // keyboard
+    case 0x07: // keypad
+      return ReportKind::KEYBOARD;
+    default:
+      return ReportKind::UNKNOWN;
+    }
+  }
+  if (usage_page == consumer_page && usage == 0x01) {
+    return ReportKind::CONSUMER;
+  }
+  return ReportKind::UNKNOWN;
+}
+
+/// Find which top level application collection of a HID report map (report
+/// descriptor) a report id belongs to, and classify it.
+///
+/// Only the items needed for that are interpreted: usage page, usage, report
+/// id and (end) collection; everything else is skipped.
+/// @param report_map The HID report map
+/// @param report_id The report id to classify, or 0 if the device does not use
+///        report ids (in which case the first application collection is used)
+/// @return The kind of report, or UNKNOWN if the report id was not found
+constexpr ReportKind classify_report(std::span<const uint8_t> report_map, uint8_t report_id) {
+  uint16_t usage_page = 0;
+  uint32_t usage = 0;
+  bool has_usage = false;
+  bool usage_has_page = false;
+  bool report_id_pending = false;
+  int depth = 0;
+  ReportKind collection_kind = ReportKind::UNKNOWN;
+  size_t i = 0;
+  while (i < report_map.size()) {
+    uint8_t prefix = report_map[i];
+    if (prefix == 0xFE) {
+      // long item: prefix, data size, long item tag, data
+      if (i + 1 >= report_map.size()) {
+        break;
+      }
+      i += 3 + report_map[i + 1];
+      continue;
+    }
+    size_t size = (prefix & 0x03) == 3 ? 4 : (prefix & 0x03);
+    if (i + size >= report_map.size()) {
+      break;
+    }
+    uint32_t value = 0;
+    for (size_t b = 0; b < size; b++) {
+      value |= uint32_t(report_map[i + 1 + b]) << (8 * b);
+    }
+    switch (prefix & 0xFC) {
+    case 0x04: // usage page (global)
+      usage_page = value;
+      break;
+    case 0x08: // usage (local)
+      if (!has_usage) {
+        usage = value;
+        // 4 byte usages carry their own usage page in the upper 16 bits
+        usage_has_page = size == 4;
+        has_usage = true;
+      }
+      break;
+    case 0x84: // report id (global)
+      if (value == report_id) {
+        if (depth > 0) {
+          return collection_kind;
+        }
+        // declared before the collection it belongs to
+        report_id_pending = true;
+      }
+      break;
+    case 0xA0: // collection (main)
+      if (depth == 0) {
+        uint16_t page = usage_has_page ? (usage >> 16) : usage_page;
+        collection_kind = report_kind_from_usage(page, usage & 0xFFFF);
+        if (report_id == 0 || report_id_pending) {
+          return collection_kind;
+        }
+      }
+      depth++;
+      has_usage = false;
+      break;
+    case 0xC0: // end collection (main)
+      depth = depth > 0 ? depth - 1 : 0;
+      has_usage = false;
+      break;
+    default:
+      // other main items clear the local items
+      if ((prefix & 0x0C) == 0x00) {
+        has_usage = false;
+      }
+      break;
+    }
+    i += 1 + size;
+  }
+  return ReportKind::UNKNOWN;
+}
+
+/// Where a BLE notification should be dispatched
+struct NotificationRoute {
+  uint16_t handle{0};                   ///< Attribute handle of the characteristic
+  ReportKind kind{ReportKind::UNKNOWN}; ///< How to decode the notification
+  uint8_t report_id{0};                 ///< HID report id (from the Report Reference)
+};
+
+/// Table of notification routes keyed by characteristic handle.
+///
+/// Built once per connection (when subscribing) so that the notification
+/// callback only has to do one lookup, instead of comparing UUIDs or guessing
+/// the kind of report from its length. A peer only exposes a handful of
+/// notifying characteristics, so the lookup is a linear scan over a small
+/// fixed array.
+///
+/// The writer may rebuild the table while notifications are being routed
+/// (e.g. when it re-subscribes after a rediscovery), so the table is double
+/// buffered like SeqLock: routes are added to a pending table and publish()
+/// copies it into the slot readers are not pointed at before switching to it.
+/// find() copies the route out and retries if the writer published twice
+/// while it was scanning, so it never returns a route from a half written
+/// table. The slots are relaxed atomic words so that the concurrent scan is
+/// well defined.
+///
+/// @note Only one thread may call add(), publish() and clear(); find() and
+///       size() may be called from any thread.
+class NotificationRouter {
+public:
+  static constexpr size_t max_routes = 16;
+
+  /// Add a route to the pending table. It is not used until publish().
+  /// @param route The route to add
+  /// @return True if the route was added, false if the table is full
+  bool add(const NotificationRoute &route) {
+    if (pending_count_ == max_routes) {
+      return false;
+    }
+    pending_[pending_count_++] = route;
+    return true;
+  }
+
+  /// Replace the routes in use with the ones added since the last publish()
+  /// or clear(), and start a new pending table.
+  void publish() {
+    uint32_t next = sequence_.load(std::memory_order_relaxed) + 1;
+    // announce which slot is about to be overwritten before touching it
+    writing_.store(next, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    auto &table = tables_[next & 1];
+    for (size_t i = 0; i < pending_count_; i++) {
+      table.routes[i].store(encode(pending_[i]), std::memory_order_relaxed);
+    }
+    table.count.store(pending_count_, std::memory_order_relaxed);
+    sequence_.store(next, std::memory_order_release);
+    pending_count_ = 0;
+  }
+
+  /// Remove all routes, e.g. when the peer disconnects.
+  void clear() {
+    pending_count_ = 0;
+    publish();
+  }
+
+  /// Find the route for a characteristic.
+  /// @param handle The attribute handle of the characteristic
+  /// @return A copy of the route, or nullopt if there is none
+  std::optional<NotificationRoute> find(uint16_t handle) const {
+    while (true) {
+      uint32_t sequence = sequence_.load(std::memory_order_acquire);
+      const auto &table = tables_[sequence & 1];
+      size_t count = std::min<size_t>(table.count.load(std::memory_order_relaxed), max_routes);
+      std::optional<NotificationRoute> route;
+      for (size_t i = 0; i < count; i++) {
+        uint32_t word = table.routes[i].load(std::memory_order_relaxed);
+        if (uint16_t(word) == handle) {
+          route = decode(word);
+          break;
+        }
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // the slot we scanned is only overwritten by the publish after next
+      if (writing_.load(std::memory_order_relaxed) - sequence < 2) {
+        return route;
+      }
+    }
+  }
+
+  /// Get the number of routes in use.
+  size_t size() const {
+    while (true) {
+      uint32_t sequence = sequence_.load(std::memory_order_acquire);
+      size_t count = tables_[sequence & 1].count.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (writing_.load(std::memory_order_relaxed) - sequence < 2) {
+        return count;
+      }
+    }
+  }
+
+protected:
+  // a route packed into one word: handle, kind, report id
+  static constexpr uint32_t encode(const NotificationRoute &route) {
+    return route.handle | uint32_t(route.kind) << 16 | uint32_t(route.report_id) << 24;
+  }
+
+  static constexpr NotificationRoute decode(uint32_t word) {
+    return {.handle = uint16_t(word),
+            .kind = ReportKind((word >> 16) & 0xFF),
+            .report_id = uint8_t(word >> 24)};
+  }
+
+  struct Table {
+    std::array<std::atomic<uint32_t>, max_routes> routes{};
+    std::atomic<uint32_t> count{0};
+  };
+
+  std::array<NotificationRoute, max_routes> pending_{};
+  size_t pending_count_{0};
+  std::atomic<uint32_t> sequence_{0};
+  std::atomic<uint32_t> writing_{0};
+  Table tables_[2]{};
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+
+/// Sequence of steps used to reconnect to a bonded controller.
+///
+/// 1. DIRECT_CONNECT: connect straight to the most recently used bond (no
+///    scanning at all), for a short time.
+/// 2. FAST_SCAN: passive scan filtered by the controller's accept list (loaded
+///    with all bonded addresses) at a high duty cycle, so a controller which is
+///    just waking up is found quickly.
+/// 3. SLOW_SCAN: the same filtered passive scan at a low duty cycle, repeated
+///    until a bonded controller shows up, to save radio time and CPU.
+///
+/// Each step ends either with a connection or with its timeout, after which
+/// next() gives the step to run.
+class ReconnectPolicy {
+public:
+  enum class Phase : uint8_t { DIRECT_CONNECT, FAST_SCAN, SLOW_SCAN };
+
+  /// Scan timing, in milliseconds
+  struct ScanParams {
+    uint16_t interval_ms; ///< Time between the start of two scan windows
+    uint16_t window_ms;   ///< Time spent scanning in each interval
+  };
+
+  struct Config {
+    uint32_t direct_connect_ms{3000}; ///< How long to try connecting directly
+    uint32_t fast_scan_ms{10000};     ///< How long to scan at the high duty cycle
+    uint32_t slow_scan_ms{30000};     ///< Length of each low duty cycle scan
+    ScanParams fast_scan{.interval_ms = 60, .window_ms = 30};
+    ScanParams slow_scan{.interval_ms = 1280, .window_ms = 30};
+  };
+
+  /// A step of the reconnection
+  struct Step {
+    Phase phase;
+    uint32_t duration_ms; ///< Connect timeout / scan duration
+    ScanParams scan;      ///< Scan timing (unused for DIRECT_CONNECT)
+  };
+
+  ReconnectPolicy() = default;
+
+  explicit ReconnectPolicy(const Config &config)
+      : config_(config) {}
+
+  /// Get the first step of a reconnection.
+  /// @param has_recent_peer Whether we know the most recently used bond
+  /// @return The step to run
+  Step first(bool has_recent_peer) const {
+    if (has_recent_peer && config_.direct_connect_ms) {
+      return {Phase::DIRECT_CONNECT, config_.direct_connect_ms, {}};
+    }
+    return next(Phase::DIRECT_CONNECT);
+  }
+
+  /// Get the step which follows a step that timed out.
+  /// @param finished The phase of the step which timed out
+  /// @return The step to run
+  Step next(Phase finished) const {
+    if (finished == Phase::DIRECT_CONNECT && config_.fast_scan_ms) {
+      return {Phase::FAST_SCAN, config_.fast_scan_ms, config_.fast_scan};
+    }
+    return {Phase::SLOW_SCAN, config_.slow_scan_ms, config_.slow_scan};
+  }
+
+  /// Get the fraction of time the radio spends scanning with the given timing.
+  static constexpr float duty_cycle(const ScanParams &scan) {
+    return scan.interval_ms ? float(scan.window_ms) / scan.interval_ms : 0.0f;
+  }
+
+  const Config &get_config() const { return config_; }
+
+protected:
+  Config config_{};
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <span>
+
+#include "gamepad_device.hpp"
+
+/// Suppresses output reports which are identical to the last one sent.
+///
+/// BLE controllers often resend the same state, which would otherwise turn
+/// into a full USB report each time. A report is sent if its id or contents
+/// (excluding the output device's ignored byte range, e.g. a counter) differ
+/// from the last sent report, or if the output device's keepalive interval has
+/// elapsed since then.
+///
+/// Since the controller only sends reports when its input changes, the filter
+/// also hands back the last sent report once its keepalive is due (see
+/// take_keepalive()), so that it can be resent while the input is steady.
+///
+/// @note should_send() and take_keepalive() must only be called from one
+///       thread, but the counters may be read from any thread.
+class ReportFilter {
+public:
+  typedef GamepadDevice::ReportFilterConfig Config;
+
+  explicit ReportFilter(const Config &config = {})
+      : config_(config) {}
+
+  /// Decide whether a report should be sent, and remember it if so.
+  /// @param report_id The id of the report
+  /// @param report The report data
+  /// @param now_us The current time in microseconds
+  /// @return True if the report should be sent
+  bool should_send(uint8_t report_id, std::span<const uint8_t> report, int64_t now_us) {
+    bool keepalive_due = config_.keepalive_us && now_us - last_sent_us_ >= config_.keepalive_us;
+    if (has_last_ && !keepalive_due && report_id == last_id_ && is_unchanged(report)) {
+      suppressed_count_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    size_t len = std::min(report.size(), last_.size());
+    std::copy_n(report.begin(), len, last_.begin());
+    last_len_ = len;
+    last_id_ = report_id;
+    last_sent_us_ = now_us;
+    has_last_ = true;
+    sent_count_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /// Get the time until the last sent report has to be resent.
+  /// @param now_us The current time in microseconds
+  /// @return The time in microseconds (0 if it is due), or -1 if there is no
+  ///         keepalive to send
+  int64_t get_time_until_keepalive(int64_t now_us) const {
+    if (!has_last_ || !config_.keepalive_us) {
+      return -1;
+    }
+    return std::max<int64_t>(last_sent_us_ + config_.keepalive_us - now_us, 0);
+  }
+
+  /// Take the last sent report if its keepalive is due, to resend it.
+  /// @param now_us The current time in microseconds
+  /// @param report_id Set to the id of the report
+  /// @param report The buffer to copy the report into
+  /// @return The length of the report, or 0 if no keepalive is due
+  size_t take_keepalive(int64_t now_us, uint8_t &report_id, std::span<uint8_t> report) {
+    if (get_time_until_keepalive(now_us) != 0) {
+      return 0;
+    }
+    size_t len = std::min(report.size(), last_len_);
+    std::copy_n(last_.begin(), len, report.begin());
+    report_id = last_id_;
+    last_sent_us_ = now_us;
+    sent_count_.fetch_add(1, std::memory_order_relaxed);
+    keepalive_count_.fetch_add(1, std::memory_order_relaxed);
+    return len;
+  }
+
+  /// Forget the last report, so the next one is always sent.
+  void reset() { has_last_ = false; }
+
+  /// Get the number of reports which were sent.
+  uint32_t get_sent_count() const { return sent_count_.load(std::memory_order_relaxed); }
+
+  /// Get the number of the sent reports which were resent by take_keepalive().
+  uint32_t get_keepalive_count() const { return keepalive_count_.load(std::memory_order_relaxed); }
+
+  /// Get the number of reports which were suppressed because they had not changed.
+  uint32_t get_suppressed_count() const {
+    return suppressed_count_.load(std::memory_order_relaxed);
+  }
+
+protected:
+  bool is_unchanged(std::span<const uint8_t> report) const {
+    if (report.size() != last_len_) {
+      return false;
+    }
+    size_t ignore_begin = std::min(config_.ignore_offset, last_len_);
+    size_t ignore_end = std::min(config_.ignore_offset + config_.ignore_size, last_len_);
+    return std::equal(report.begin(), report.begin() + ignore_begin, last_.begin()) &&
+           std::equal(report.begin() + ignore_end, report.end(), last_.begin() + ignore_end);
+  }
+
+  Config config_;
+  std::array<uint8_t, GamepadDevice::max_report_size> last_{};
+  size_t last_len_{0};
+  uint8_t last_id_{0};
+  int64_t last_sent_us_{0};
+  bool has_last_{false};
+  std::atomic<uint32_t> sent_count_{0};
+  std::atomic<uint32_t> suppressed_count_{0};
+  std::atomic<uint32_t> keepalive_count_{0};
+};
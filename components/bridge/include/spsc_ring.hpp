@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/// Lock-free single-producer / single-consumer ring of trivially copyable
+/// values with a latest-wins overflow policy.
+///
+/// When the ring is full, push() drops the oldest queued value to make room
+/// for the new one (counted in get_drop_count()), so the producer never blocks
+/// and the consumer always sees the most recent values. To allow the producer
+/// to drop a value the consumer may be copying at the same time, the tail is
+/// advanced with a compare-exchange by both sides: a consumer whose value was
+/// dropped mid-copy fails the exchange and simply retries with the next one.
+/// The slots are stored as relaxed atomic words (like SeqLock) so that such a
+/// concurrent copy is well defined.
+///
+/// @note Only one thread may call push() and only one thread may call pop().
+template <typename T, size_t Capacity> class SpscRing {
+  static_assert(std::is_trivially_copyable_v<T>, "SpscRing requires a trivially copyable type");
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "SpscRing capacity must be a power of two");
+
+public:
+  static constexpr size_t capacity = Capacity;
+
+  /// Queue a value, dropping the oldest queued value if the ring is full.
+  /// @param value The value to queue
+  /// @return True if the value was queued without dropping another one
+  bool push(const T &value) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    bool dropped = false;
+    if (head - tail >= Capacity) {
+      // full: drop the oldest value, unless the consumer just took it
+      if (tail_.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+        drop_count_.fetch_add(1, std::memory_order_relaxed);
+        dropped = true;
+        tail++;
+      }
+    }
+    Words words{};
+    std::memcpy(words.data(), &value, sizeof(T));
+    auto &slot = slots_[head & mask];
+    for (size_t i = 0; i < word_count; i++) {
+      slot[i].store(words[i], std::memory_order_relaxed);
+    }
+    head_.store(head + 1, std::memory_order_release);
+    push_count_.fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t depth = head + 1 - tail;
+    if (depth > max_depth_.load(std::memory_order_relaxed)) {
+      max_depth_.store(depth, std::memory_order_relaxed);
+    }
+    return !dropped;
+  }
+
+  /// Take the oldest queued value.
+  /// @param value The value to fill in
+  /// @return True if a value was taken, false if the ring was empty
+  bool pop(T &value) {
+    Words words;
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    while (true) {
+      uint32_t head = head_.load(std::memory_order_acquire);
+      if (tail == head) {
+        return false;
+      }
+      const auto &slot = slots_[tail & mask];
+      for (size_t i = 0; i < word_count; i++) {
+        words[i] = slot[i].load(std::memory_order_relaxed);
+      }
+      // if the producer dropped this value while we were copying it, the
+      // exchange fails, reloads the tail and we try again with the next value
+      if (tail_.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+        break;
+      }
+    }
+    std::memcpy(&value, words.data(), sizeof(T));
+    return true;
+  }
+
+  /// Get the number of values currently queued.
+  size_t size() const {
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    uint32_t head = head_.load(std::memory_order_acquire);
+    return head - tail;
+  }
+
+  /// Return true if no values are queued.
+  bool empty() const { return size() == 0; }
+
+  /// Get the number of values which have been pushed.
+  uint32_t get_push_count() const { return push_count_.load(std::memory_order_relaxed); }
+
+  /// Get the number of values which were dropped because the ring was full.
+  uint32_t get_drop_count() const { return drop_count_.load(std::memory_order_relaxed); }
+
+  /// Get the largest number of values which have been queued at once.
+  uint32_t get_max_depth() const { return max_depth_.load(std::memory_order_relaxed); }
+
+protected:
+  static constexpr uint32_t mask = Capacity - 1;
+  static constexpr size_t word_count = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+  typedef std::array<uint32_t, word_count> Words;
+
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+  std::array<std::atomic<uint32_t>, word_count> slots_[Capacity]{};
+  std::atomic<uint32_t> push_count_{0};
+  std::atomic<uint32_t> drop_count_{0};
+  std::atomic<uint32_t> max_depth_{0};
+};
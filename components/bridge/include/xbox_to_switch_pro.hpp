@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+
+#include "switch_pro.hpp"
+#include "xbox.hpp"
+
+/// Direct Xbox -> Switch Pro report transcoding.
+///
+/// Maps the raw Xbox BLE input report straight into the Switch Pro controller
+/// state (buttons + 12-bit packed joysticks) with integer math and constexpr
+/// lookup tables, instead of decoding into the float GamepadInputs and
+/// re-encoding. The output matches the GamepadInputs path (including the
+/// inverted y axes).
+namespace xbox_to_switch_pro {
+
+using XboxReport = espp::XboxGamepadInputReport<>;
+using SwitchProReport = espp::SwitchProGamepadInputReport<>;
+
+// Layout of the Xbox input report data
+static constexpr size_t XBOX_REPORT_SIZE = 16;
+static constexpr size_t XBOX_LEFT_X_OFFSET = 0;
+static constexpr size_t XBOX_LEFT_Y_OFFSET = 2;
+static constexpr size_t XBOX_RIGHT_X_OFFSET = 4;
+static constexpr size_t XBOX_RIGHT_Y_OFFSET = 6;
+static constexpr size_t XBOX_BRAKE_OFFSET = 8;
+static constexpr size_t XBOX_ACCELERATOR_OFFSET = 10;
+static constexpr size_t XBOX_HAT_OFFSET = 12;
+static constexpr size_t XBOX_BUTTONS_OFFSET = 13;
+// NOTE: the consumer (share) byte at offset 15 is not mapped, matching the
+//       GamepadInputs path which does not read it either.
+
+// Bit indices within the 16-bit Xbox button field
+static constexpr int XBOX_BUTTON_A = 0;
+static constexpr int XBOX_BUTTON_B = 1;
+static constexpr int XBOX_BUTTON_X = 3;
+static constexpr int XBOX_BUTTON_Y = 4;
+static constexpr int XBOX_BUTTON_LB = 6;
+static constexpr int XBOX_BUTTON_RB = 7;
+static constexpr int XBOX_BUTTON_VIEW = 10;
+static constexpr int XBOX_BUTTON_MENU = 11;
+static constexpr int XBOX_BUTTON_HOME = 12;
+static constexpr int XBOX_BUTTON_LS = 13;
+static constexpr int XBOX_BUTTON_RS = 14;
+
+/// Xbox button bit -> Switch Pro button mask (same pairing as the
+/// GamepadInputs::Buttons overlaps)
+static constexpr std::array<std::pair<int, uint32_t>, 11> button_map = {{
+    {XBOX_BUTTON_A, sp::button::A},
+    {XBOX_BUTTON_B, sp::button::B},
+    {XBOX_BUTTON_X, sp::button::X},
+    {XBOX_BUTTON_Y, sp::button::Y},
+    {XBOX_BUTTON_LB, sp::button::L},
+    {XBOX_BUTTON_RB, sp::button::R},
+    {XBOX_BUTTON_VIEW, sp::button::MINUS},
+    {XBOX_BUTTON_MENU, sp::button::PLUS},
+    {XBOX_BUTTON_HOME, sp::button::HOME},
+    {XBOX_BUTTON_LS, sp::button::THUMB_L},
+    {XBOX_BUTTON_RS, sp::button::THUMB_R},
+}};
+
+/// Build the lookup table which maps one byte of the Xbox button field to
+/// the corresponding Switch Pro button mask.
+/// @param byte_index Which byte of the button field (0 = low, 1 = high)
+constexpr std::array<uint32_t, 256> make_button_lut(int byte_index) {
+  std::array<uint32_t, 256> lut{};
+  for (int value = 0; value < 256; value++) {
+    uint32_t mask = 0;
+    for (const auto &[xbox_bit, switch_mask] : button_map) {
+      int bit = xbox_bit - byte_index * 8;
+      if (bit >= 0 && bit < 8 && (value & (1 << bit))) {
+        mask |= switch_mask;
+      }
+    }
+    lut[value] = mask;
+  }
+  return lut;
+}
+
+static constexpr auto button_lut_low = make_button_lut(0);
+static constexpr auto button_lut_high = make_button_lut(1);
+
+/// Xbox hat switch value (1-8 = N, NE, E, SE, S, SW, W, NW, anything else is
+/// centered) -> Switch Pro d-pad mask
+static constexpr std::array<uint32_t, 16> hat_lut = {
+    0,
+    sp::button::DPAD_UP,
+    sp::button::DPAD_UP | sp::button::DPAD_RIGHT,
+    sp::button::DPAD_RIGHT,
+    sp::button::DPAD_DOWN | sp::button::DPAD_RIGHT,
+    sp::button::DPAD_DOWN,
+    sp::button::DPAD_DOWN | sp::button::DPAD_LEFT,
+    sp::button::DPAD_LEFT,
+    sp::button::DPAD_UP | sp::button::DPAD_LEFT,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+};
+
+constexpr uint16_t read_u16(std::span<const uint8_t> data, size_t offset) {
+  return data[offset] | (data[offset + 1] << 8);
+}
+
+/// Floor division (rounds towards negative infinity)
+constexpr int32_t floor_div(int32_t num, int32_t den) {
+  int32_t q = num / den;
+  return (num % den != 0 && (num < 0) != (den < 0)) ? q - 1 : q;
+}
+
+/// Map an Xbox joystick axis to a Switch Pro joystick axis.
+///
+/// Equivalent to the GamepadInputs path, which normalizes to [-1, 1] around
+/// the Xbox center (hid-rp's to_float) and scales back up around the Switch
+/// Pro center, truncating (from_float), but computed exactly in integers. The
+/// float path rounds its intermediate results, so for the few values which
+/// land within float error of an integer boundary it can come out 1 LSB
+/// lower or higher; the golden test allows for that.
+/// @param value The Xbox axis value
+/// @param invert Whether to invert the axis
+/// @return The 12-bit Switch Pro axis value
+constexpr uint16_t map_axis(uint16_t value, bool invert) {
+  constexpr int32_t in_center = XboxReport::joystick_center;
+  constexpr int32_t in_range = (XboxReport::joystick_max - XboxReport::joystick_min) / 2;
+  constexpr int32_t out_center = SwitchProReport::joystick_center;
+  constexpr int32_t out_range = (SwitchProReport::joystick_max - SwitchProReport::joystick_min) / 2;
+  int32_t offset = int32_t(value) - in_center;
+  if (invert) {
+    offset = -offset;
+  }
+  // truncating the (non-negative) float result is the floor of the exact one
+  return std::clamp<int32_t>(out_center + floor_div(offset * out_range, in_range),
+                             SwitchProReport::joystick_min, SwitchProReport::joystick_max);
+}
+
+/// The analog triggers are digital (ZL / ZR) on the Switch Pro; they are
+/// pressed when more than halfway down.
+constexpr bool trigger_pressed(uint16_t value) {
+  value &= 0x3FF;
+  return 2 * (int32_t(value) - XboxReport::trigger_min) >
+         (XboxReport::trigger_max - XboxReport::trigger_min);
+}
+
+/// Transcode an Xbox input report into the Switch Pro controller state.
+/// @param data The Xbox input report data
+/// @param state The Switch Pro controller state to fill out
+/// @return True if the report was transcoded, false if it was too short
+constexpr bool transcode(std::span<const uint8_t> data, sp::ControllerState &state) {
+  if (data.size() < XBOX_REPORT_SIZE) {
+    return false;
+  }
+
+  uint32_t buttons = button_lut_low[data[XBOX_BUTTONS_OFFSET]] |
+                     button_lut_high[data[XBOX_BUTTONS_OFFSET + 1]] |
+                     hat_lut[data[XBOX_HAT_OFFSET] & 0x0F];
+  if (trigger_pressed(read_u16(data, XBOX_BRAKE_OFFSET))) {
+    buttons |= sp::button::ZL;
+  }
+  if (trigger_pressed(read_u16(data, XBOX_ACCELERATOR_OFFSET))) {
+    buttons |= sp::button::ZR;
+  }
+  state.buttons[0] = buttons & 0xFF;
+  state.buttons[1] = (buttons >> 8) & 0xFF;
+  state.buttons[2] = (buttons >> 16) & 0xFF;
+
+  constexpr bool invert_y = true;
+  sp::pack_stick(map_axis(read_u16(data, XBOX_LEFT_X_OFFSET), false),
+                 map_axis(read_u16(data, XBOX_LEFT_Y_OFFSET), invert_y), state.left_stick);
+  sp::pack_stick(map_axis(read_u16(data, XBOX_RIGHT_X_OFFSET), false),
+                 map_axis(read_u16(data, XBOX_RIGHT_Y_OFFSET), invert_y), state.right_stick);
+  return true;
+}
+
+} // namespace xbox_to_switch_pro
+
+/// Bridge which transcodes Xbox reports directly into Switch Pro reports,
+/// with the same interface as Bridge<Xbox, SwitchPro>.
+class XboxToSwitchProBridge {
+public:
+  XboxToSwitchProBridge(std::shared_ptr<Xbox> input, std::shared_ptr<SwitchPro> output)
+      : input_(input)
+      , output_(output)
+      , input_report_id_(input->get_input_report_id())
+      , output_report_id_(output->get_input_report_id()) {}
+
+  const std::shared_ptr<Xbox> &input() const { return input_; }
+  const std::shared_ptr<SwitchPro> &output() const { return output_; }
+
+  /// Set the battery level (percent) to report to the USB host
+  void set_battery_level(uint8_t level) { battery_level_ = level; }
+
+  /// Translate an Xbox input report into a Switch Pro input report.
+  /// @param data The Xbox input report data (as received over BLE)
+  /// @param report_id The report id of the output report
+  /// @param report The buffer to write the output report into
+  /// @return The length of the output report, 0 if there is nothing to send
+  size_t translate(std::span<const uint8_t> data, uint8_t &report_id, std::span<uint8_t> report) {
+    // keep the xbox device state up to date
+    input_->set_report_data(input_report_id_, data);
+
+    sp::ControllerState state;
+    if (!xbox_to_switch_pro::transcode(data, state)) {
+      return 0;
+    }
+    output_->set_controller_state(state);
+    output_->set_battery_level(battery_level_);
+
+    report_id = output_report_id_;
+    return output_->get_report_data(output_report_id_, report);
+  }
+
+protected:
+  std::shared_ptr<Xbox> input_;
+  std::shared_ptr<SwitchPro> output_;
+  uint8_t input_report_id_;
+  uint8_t output_report_id_;
+  uint8_t battery_level_{100};
+};
@@ -0,0 +1 @@
+#include "bridge.hpp"
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <esp_timer.h>
+#include <fmt/args.h>
+#include <fmt/format.h>
+
+#if defined(ESP_PLATFORM)
+#include <sdkconfig.h>
+#endif
+
+/// Levels of the deferred log messages
+enum class LogLevel : uint8_t { DEBUG, INFO, WARN, ERROR, NONE };
+
+// Messages below this level are compiled out (0 = debug ... 4 = none)
+#if defined(CONFIG_DEFERRED_LOG_LEVEL)
+#define DEFERRED_LOG_LEVEL CONFIG_DEFERRED_LOG_LEVEL
+#elif !defined(DEFERRED_LOG_LEVEL)
+#define DEFERRED_LOG_LEVEL 1
+#endif
+inline constexpr LogLevel deferred_log_min_level = static_cast<LogLevel>(DEFERRED_LOG_LEVEL);
+
+/// A place in the code which logs a message, with its format and rate limit.
+/// Use LogSite, which carries the level in its type.
+class LogSiteBase {
+public:
+  /// Return true if a message may be logged now, counting it as suppressed
+  /// otherwise.
+  /// @param now_us The current time in microseconds
+  bool allow(int64_t now_us) {
+    if (min_interval_us == 0) {
+      return true;
+    }
+    int64_t last = last_us_.load(std::memory_order_relaxed);
+    if ((last != never && now_us - last < min_interval_us) ||
+        !last_us_.compare_exchange_strong(last, now_us, std::memory_order_relaxed)) {
+      suppressed_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  /// Get (and reset) the number of messages suppressed by the rate limit.
+  uint32_t take_suppressed() { return suppressed_.exchange(0, std::memory_order_relaxed); }
+
+  const LogLevel level;
+  const char *const tag;
+  const char *const format;         ///< fmt format string for the arguments
+  const int64_t min_interval_us{0}; ///< Minimum time between messages, 0 for no limit
+
+protected:
+  static constexpr int64_t never = std::numeric_limits<int64_t>::min();
+
+  constexpr LogSiteBase(LogLevel level, const char *tag, const char *format,
+                        int64_t min_interval_us)
+      : level(level)
+      , tag(tag)
+      , format(format)
+      , min_interval_us(min_interval_us) {}
+
+  std::atomic<int64_t> last_us_{never};
+  std::atomic<uint32_t> suppressed_{0};
+};
+
+/// A place in the code which logs a message at a fixed level. Declare it
+/// static next to the call to deferred_log(), e.g.
+///
+///   static LogSite<LogLevel::WARN> site{"Xbox", "Unknown report id: {}", 1'000'000};
+///   deferred_log(site, report_id);
+template <LogLevel Level> class LogSite : public LogSiteBase {
+public:
+  /// @param tag The tag of the message
+  /// @param format The fmt format string, which must match the arguments
+  /// @param min_interval_us Minimum time between messages, 0 for no limit
+  constexpr LogSite(const char *tag, const char *format, int64_t min_interval_us = 0)
+      : LogSiteBase(Level, tag, format, min_interval_us) {}
+};
+
+/// Logger which keeps formatting off the hot paths.
+///
+/// log() only copies the call site and the arguments into a lock-free ring, and
+/// flush() formats the queued messages later, e.g. on a low priority task. The
+/// arguments must be numbers, enums or static strings (e.g. the names returned
+/// by to_string()), since only the pointer of a string is kept. Any number of
+/// threads may log; if the ring is full the message is dropped (counted in
+/// get_drop_count()). Only one thread may flush.
+class DeferredLogger {
+public:
+  static constexpr size_t capacity = 64;
+  static constexpr size_t max_args = 6;
+
+  /// A formatted message
+  struct Message {
+    LogLevel level;
+    const char *tag;
+    int64_t timestamp_us;
+    uint32_t suppressed; ///< Messages from the same site suppressed before this one
+    std::string_view text;
+  };
+
+  /// Function which writes out a formatted message
+  typedef std::function<void(const Message &message)> Sink;
+
+  /// Get the logger of the application.
+  static DeferredLogger &get() {
+    static DeferredLogger logger;
+    return logger;
+  }
+
+  DeferredLogger() {
+    for (size_t i = 0; i < capacity; i++) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /// Queue a message, unless the site's rate limit suppresses it.
+  /// @param site The call site
+  /// @param args The arguments (numbers, enums or static strings), at most max_args
+  template <typename... Args> void log(LogSiteBase &site, Args... args) {
+    static_assert(sizeof...(Args) <= max_args, "Too many deferred log arguments");
+    int64_t now = esp_timer_get_time();
+    if (!site.allow(now)) {
+      return;
+    }
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[head % capacity];
+      uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+      int32_t diff = int32_t(sequence - head);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // full
+        drop_count_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      } else {
+        head = head_.load(std::memory_order_relaxed);
+      }
+    }
+    auto &entry = slot->entry;
+    entry.site = &site;
+    entry.timestamp_us = now;
+    entry.suppressed = site.take_suppressed();
+    entry.arg_count = sizeof...(Args);
+    [[maybe_unused]] size_t i = 0;
+    ((set_arg(entry, i++, args)), ...);
+    slot->sequence.store(head + 1, std::memory_order_release);
+  }
+
+  /// Format and write out the queued messages.
+  /// @param sink The function to write each message with
+  /// @param max_messages The most messages to write
+  /// @return The number of messages written
+  size_t flush(const Sink &sink, size_t max_messages = capacity) {
+    size_t count = 0;
+    while (count < max_messages) {
+      auto &slot = slots_[tail_ % capacity];
+      if (slot.sequence.load(std::memory_order_acquire) != tail_ + 1) {
+        break; // empty
+      }
+      Entry entry = slot.entry;
+      slot.sequence.store(tail_ + capacity, std::memory_order_release);
+      tail_++;
+      write(entry, sink);
+      count++;
+    }
+    return count;
+  }
+
+  /// Get the number of messages dropped because the ring was full.
+  uint32_t get_drop_count() const { return drop_count_.load(std::memory_order_relaxed); }
+
+protected:
+  enum class ArgType : uint8_t { INT, UINT, FLOAT, STRING };
+
+  union ArgValue {
+    int64_t i;
+    uint64_t u;
+    double f;
+    const char *s;
+  };
+
+  struct Entry {
+    LogSiteBase *site;
+    int64_t timestamp_us;
+    uint32_t suppressed;
+    uint8_t arg_count;
+    std::array<ArgType, max_args> arg_types;
+    std::array<ArgValue, max_args> args;
+  };
+
+  struct Slot {
+    std::atomic<uint32_t> sequence;
+    Entry entry;
+  };
+
+  template <typename T> static void set_arg(Entry &entry, size_t index, T value) {
+    static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T> || std::is_same_v<T, const char *>,
+                  "Deferred log arguments must be numbers or static strings, the message is "
+                  "formatted later");
+    if constexpr (std::is_same_v<T, const char *>) {
+      entry.arg_types[index] = ArgType::STRING;
+      entry.args[index].s = value;
+    } else if constexpr (std::is_enum_v<T>) {
+      set_arg(entry, index, static_cast<std::underlying_type_t<T>>(value));
+    } else if constexpr (std::is_floating_point_v<T>) {
+      entry.arg_types[index] = ArgType::FLOAT;
+      entry.args[index].f = value;
+    } else if constexpr (std::is_signed_v<T>) {
+      entry.arg_types[index] = ArgType::INT;
+      entry.args[index].i = value;
+    } else {
+      entry.arg_types[index] = ArgType::UINT;
+      entry.args[index].u = value;
+    }
+  }
+
+  void write(const Entry &entry, const Sink &sink) {
+    fmt::dynamic_format_arg_store<fmt::format_context> store;
+    for (size_t i = 0; i < entry.arg_count; i++) {
+      const auto &arg = entry.args[i];
+      switch (entry.arg_types[i]) {
+      case ArgType::INT:
+        store.push_back(arg.i);
+        break;
+      case ArgType::UINT:
+        store.push_back(arg.u);
+        break;
+      case ArgType::FLOAT:
+        store.push_back(arg.f);
+        break;
+      case ArgType::STRING:
+        store.push_back(arg.s);
+        break;
+      }
+    }
+    text_.clear();
+    fmt::vformat_to(std::back_inserter(text_), entry.site->format, store);
+    sink({.level = entry.site->level,
+          .tag = entry.site->tag,
+          .timestamp_us = entry.timestamp_us,
+          .suppressed = entry.suppressed,
+          .text = text_});
+  }
+
+  std::array<Slot, capacity> slots_;
+  std::atomic<uint32_t> head_{0};
+  uint32_t tail_{0};
+  std::atomic<uint32_t> drop_count_{0};
+  std::string text_;
+};
+
+/// Log a message through the application's DeferredLogger. Messages below
+/// DEFERRED_LOG_LEVEL are compiled out.
+/// @param site The call site
+/// @param args The arguments (numbers, enums or static strings), at most
+///        DeferredLogger::max_args
+template <LogLevel Level, typename... Args> void deferred_log(LogSite<Level> &site, Args... args) {
+  if constexpr (Level >= deferred_log_min_level) {
+    DeferredLogger::get().log(site, args...);
+  }
+}
+
+/// Get the single character name of a level, as espp::Logger prints it.
+constexpr char to_char(LogLevel level) {
+  switch (level) {
+  case LogLevel::DEBUG:
+    return 'D';
+  case LogLevel::INFO:
+    return 'I';
+  case LogLevel::WARN:
+    return 'W';
+  case LogLevel::ERROR:
+    return 'E';
+  case LogLevel::NONE:
+    break;
+  }
+  return '?';
+}
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <optional>
+#include <span>
 #include <string>
 #include <utility>
 #include <vector>
@@ -26,27 +28,109 @@ public:
 
   typedef std::pair<uint8_t, std::vector<uint8_t>> ReportData;
 
+  /// Largest report (in bytes, excluding report id) produced by any device.
+  /// Buffers passed to the span-based API below should be at least this big.
+  static constexpr size_t max_report_size = 64;
+
   // Info
   virtual const DeviceInfo &get_device_info() const = 0;
 
   // Report Data
   virtual uint8_t get_input_report_id() const { return 0; }
   virtual std::vector<uint8_t> get_report_descriptor() const { return {}; }
-  virtual void set_report_data(uint8_t report_id, const uint8_t *data, size_t len) {}
-  virtual std::vector<uint8_t> get_report_data(uint8_t report_id) const { return {}; }
+  virtual void set_report_data(uint8_t, const uint8_t *, size_t) {}
+  virtual std::vector<uint8_t> get_report_data(uint8_t) const { return {}; }
 
   // Gamepad inputs
   virtual GamepadInputs get_gamepad_inputs() const { return {}; }
-  virtual void set_gamepad_inputs(const GamepadInputs &inputs) {}
+  virtual void set_gamepad_inputs(const GamepadInputs &) {}
 
   // Battery level
-  virtual void set_battery_level(uint8_t level) {}
+  virtual void set_battery_level(uint8_t) {}
   virtual uint8_t get_battery_level() const { return 0; }
 
+  // Report filtering
+
+  /// How the bridge should filter input reports which have not changed
+  struct ReportFilterConfig {
+    uint32_t keepalive_us{0}; ///< Resend an unchanged report after this long (0 = never)
+    size_t ignore_offset{0};  ///< Offset of a byte range which is ignored when comparing
+    size_t ignore_size{0};    ///< Size of that byte range (e.g. a free running counter)
+  };
+  virtual ReportFilterConfig get_report_filter_config() const { return {}; }
+
   // HID handlers
   virtual std::optional<ReportData> on_attach() { return {}; }
-  virtual std::optional<ReportData> on_hid_report(uint8_t report_id, const uint8_t *data,
-                                                  size_t len) {
-    return {};
+  virtual std::optional<ReportData> on_hid_report(uint8_t, const uint8_t *, size_t) { return {}; }
+
+  // Zero-allocation API
+  //
+  // These mirror the API above, but read from caller-provided spans and write
+  // into caller-provided buffers, returning the number of bytes written (0 if
+  // there is nothing to send). The default implementations fall back to the
+  // std::vector based API, so devices only need to override them if they are
+  // used on a hot path.
+
+  virtual void set_report_data(uint8_t report_id, std::span<const uint8_t> data) {
+    set_report_data(report_id, data.data(), data.size());
+  }
+
+  virtual size_t get_report_data(uint8_t report_id, std::span<uint8_t> buffer) const {
+    return copy_to_buffer(get_report_data(report_id), buffer);
+  }
+
+  virtual size_t on_attach(uint8_t &report_id, std::span<uint8_t> buffer) {
+    auto maybe_report = on_attach();
+    if (!maybe_report.has_value()) {
+      return 0;
+    }
+    report_id = maybe_report->first;
+    return copy_to_buffer(maybe_report->second, buffer);
+  }
+
+  virtual size_t on_hid_report(uint8_t report_id, std::span<const uint8_t> data,
+                               uint8_t &response_report_id, std::span<uint8_t> response) {
+    auto maybe_report = on_hid_report(report_id, data.data(), data.size());
+    if (!maybe_report.has_value()) {
+      return 0;
+    }
+    response_report_id = maybe_report->first;
+    return copy_to_buffer(maybe_report->second, response);
+  }
+
+protected:
+  static size_t copy_to_buffer(std::span<const uint8_t> data, std::span<uint8_t> buffer) {
+    if (data.size() > buffer.size()) {
+      return 0;
+    }
+    std::copy(data.begin(), data.end(), buffer.begin());
+    return data.size();
+  }
+
+  /// Copy the data of a hid-rp report (everything after the report id) into
+  /// the buffer without going through the report's std::vector accessors.
+  /// @param report The report to read from
+  /// @param report_size Size of the report data, excluding the report id
+  /// @param buffer The buffer to write into
+  /// @return Number of bytes written, 0 if the buffer is too small
+  template <typename Report>
+  static size_t read_report(const Report &report, size_t report_size, std::span<uint8_t> buffer) {
+    return copy_to_buffer({report.data() + 1, report_size}, buffer);
+  }
+
+  /// Overwrite the data of a hid-rp report (everything after the report id)
+  /// with the given data, without going through the report's std::vector accessors.
+  /// @param report The report to write to
+  /// @param report_size Size of the report data, excluding the report id
+  /// @param data The data to write, truncated to report_size
+  /// @param offset Offset into the report data to start writing at
+  template <typename Report>
+  static void write_report(Report &report, size_t report_size, std::span<const uint8_t> data,
+                           size_t offset = 0) {
+    if (offset >= report_size) {
+      return;
+    }
+    auto report_data = const_cast<uint8_t *>(report.data()) + 1 + offset;
+    std::copy_n(data.begin(), std::min(report_size - offset, data.size()), report_data);
   }
 }; // GamepadDevice
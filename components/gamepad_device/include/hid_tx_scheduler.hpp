@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <span>
+
+#include "gamepad_device.hpp"
+
+/// Completion-driven scheduler for a single HID IN endpoint.
+///
+/// Only one report can be in flight on the endpoint at a time, so reports are
+/// queued here and the next one is started when the previous transfer
+/// completes (see on_complete()). Subcommand replies are kept in a small FIFO
+/// and always go out before input reports, while input reports are coalesced
+/// into a single slot which only holds the latest state. If the send function
+/// refuses a report (e.g. the endpoint is not ready) it stays queued and is
+/// retried on the next queue / completion event, or the next poll(), which
+/// should be called periodically (e.g. on each USB start of frame) so that a
+/// refused report never waits for other traffic.
+///
+/// The scheduler is agnostic to the USB stack: the send function is expected
+/// to start the transfer (e.g. with tud_hid_report) and return whether it did.
+class HidTxScheduler {
+public:
+  static constexpr size_t max_report_size = GamepadDevice::max_report_size;
+  static constexpr size_t reply_queue_size = 4;
+
+  /// Function which starts sending a report, returning true if it was started
+  typedef std::function<bool(uint8_t report_id, std::span<const uint8_t> data)> send_fn;
+
+  /// Counters for the reports which have passed through the scheduler
+  struct Stats {
+    uint32_t replies_sent{0};     ///< Subcommand replies handed to the endpoint
+    uint32_t inputs_sent{0};      ///< Input reports handed to the endpoint
+    uint32_t replies_dropped{0};  ///< Replies dropped because the reply queue was full
+    uint32_t inputs_coalesced{0}; ///< Input reports replaced by a newer one before sending
+    uint32_t retries{0};          ///< Times the send function refused a report
+  };
+
+  explicit HidTxScheduler(const send_fn &send)
+      : send_(send) {}
+
+  /// Queue a reply (e.g. to a subcommand), which is sent ahead of input reports.
+  /// @param report_id The report id to send
+  /// @param data The report data (excluding the report id)
+  /// @return True if the reply was queued, false if it was dropped
+  bool queue_reply(uint8_t report_id, std::span<const uint8_t> data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (data.empty() || data.size() > max_report_size) {
+      return false;
+    }
+    if (reply_count_ == reply_queue_size) {
+      stats_.replies_dropped++;
+      return false;
+    }
+    auto &reply = replies_[(reply_head_ + reply_count_) % reply_queue_size];
+    reply.set(report_id, data);
+    reply_count_++;
+    kick();
+    return true;
+  }
+
+  /// Queue an input report, replacing any input report which has not been sent yet.
+  /// @param report_id The report id to send
+  /// @param data The report data (excluding the report id)
+  /// @return True if the report was queued
+  bool queue_input(uint8_t report_id, std::span<const uint8_t> data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (data.empty() || data.size() > max_report_size) {
+      return false;
+    }
+    if (input_pending_) {
+      stats_.inputs_coalesced++;
+    }
+    input_.set(report_id, data);
+    input_pending_ = true;
+    kick();
+    return true;
+  }
+
+  /// Notify the scheduler that the in-flight report has been sent, which starts
+  /// the next queued report (if any).
+  /// @return True if another report was started, i.e. the endpoint stays busy
+  bool on_complete() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    busy_ = false;
+    kick();
+    return busy_;
+  }
+
+  /// Retry sending any queued report, e.g. after the endpoint becomes ready.
+  void poll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    kick();
+  }
+
+  /// Drop all queued reports and forget about the in-flight one, e.g. when the
+  /// device is unmounted.
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reply_count_ = 0;
+    input_pending_ = false;
+    busy_ = false;
+  }
+
+  /// Copy the most recently queued input report, e.g. for a GET_REPORT request.
+  /// @param buffer The buffer to copy into
+  /// @return The number of bytes copied
+  size_t get_last_input(std::span<uint8_t> buffer) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t len = std::min(buffer.size(), input_.len);
+    std::memcpy(buffer.data(), input_.data.data(), len);
+    return len;
+  }
+
+  /// Return true if a report is in flight on the endpoint.
+  bool is_busy() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return busy_;
+  }
+
+  /// Get the number of reports waiting to be sent.
+  size_t get_pending_count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reply_count_ + (input_pending_ ? 1 : 0);
+  }
+
+  /// Get a copy of the counters.
+  Stats get_stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+protected:
+  struct Report {
+    uint8_t id{0};
+    size_t len{0};
+    std::array<uint8_t, max_report_size> data{};
+
+    void set(uint8_t report_id, std::span<const uint8_t> report) {
+      id = report_id;
+      len = report.size();
+      std::memcpy(data.data(), report.data(), len);
+    }
+
+    std::span<const uint8_t> span() const { return {data.data(), len}; }
+  };
+
+  // start the next report if the endpoint is idle. must hold mutex_
+  void kick() {
+    if (busy_) {
+      return;
+    }
+    if (reply_count_) {
+      const auto &reply = replies_[reply_head_];
+      if (!send_(reply.id, reply.span())) {
+        stats_.retries++;
+        return;
+      }
+      reply_head_ = (reply_head_ + 1) % reply_queue_size;
+      reply_count_--;
+      stats_.replies_sent++;
+      busy_ = true;
+    } else if (input_pending_) {
+      if (!send_(input_.id, input_.span())) {
+        stats_.retries++;
+        return;
+      }
+      input_pending_ = false;
+      stats_.inputs_sent++;
+      busy_ = true;
+    }
+  }
+
+  send_fn send_;
+  mutable std::mutex mutex_;
+  std::array<Report, reply_queue_size> replies_;
+  size_t reply_head_{0};
+  size_t reply_count_{0};
+  Report input_;
+  bool input_pending_{false};
+  bool busy_{false};
+  Stats stats_;
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/// The counters and gauges of the bridge
+enum class Metric : uint8_t {
+  BLE_NOTIFY_GAMEPAD,    ///< Gamepad report notifications received
+  BLE_NOTIFY_KEYBOARD,   ///< Keyboard report notifications received
+  BLE_NOTIFY_CONSUMER,   ///< Consumer control report notifications received
+  BLE_NOTIFY_BATTERY,    ///< Battery level notifications received
+  REPORTS_DECODED,       ///< BLE gamepad reports translated into USB reports
+  USB_REPORTS_SUBMITTED, ///< Reports handed to the USB endpoint
+  USB_REPORTS_FAILED,    ///< Times the USB endpoint refused a report
+  USB_REPORTS_COMPLETED, ///< Reports the host read
+  SUBCOMMANDS,           ///< Subcommands from the host (all ids)
+  RECONNECTS,            ///< Connections to a bonded controller
+  SCAN_RESULTS,          ///< Advertisements seen while scanning
+  GATT_DISCOVERY_US,     ///< Gauge: time to find the characteristics on the last connection
+  COUNT,
+};
+
+/// Get the name of a metric, for logging.
+constexpr const char *to_string(Metric metric) {
+  switch (metric) {
+  case Metric::BLE_NOTIFY_GAMEPAD:
+    return "ble_notify_gamepad";
+  case Metric::BLE_NOTIFY_KEYBOARD:
+    return "ble_notify_keyboard";
+  case Metric::BLE_NOTIFY_CONSUMER:
+    return "ble_notify_consumer";
+  case Metric::BLE_NOTIFY_BATTERY:
+    return "ble_notify_battery";
+  case Metric::REPORTS_DECODED:
+    return "reports_decoded";
+  case Metric::USB_REPORTS_SUBMITTED:
+    return "usb_reports_submitted";
+  case Metric::USB_REPORTS_FAILED:
+    return "usb_reports_failed";
+  case Metric::USB_REPORTS_COMPLETED:
+    return "usb_reports_completed";
+  case Metric::SUBCOMMANDS:
+    return "subcommands";
+  case Metric::RECONNECTS:
+    return "reconnects";
+  case Metric::SCAN_RESULTS:
+    return "scan_results";
+  case Metric::GATT_DISCOVERY_US:
+    return "gatt_discovery_us";
+  case Metric::COUNT:
+    break;
+  }
+  return "unknown";
+}
+
+/// Return true if the metric is a gauge (holds a value) rather than a counter.
+constexpr bool is_gauge(Metric metric) { return metric == Metric::GATT_DISCOVERY_US; }
+
+/// Registry of the bridge's counters and gauges.
+///
+/// All the values live in one contiguous array of atomics which are updated
+/// with relaxed ordering, so recording a metric is a single atomic add or store
+/// from any task or callback, without locks or allocation. The counters wrap
+/// around at 2^32; use MetricsRates to turn them into rates.
+///
+/// Besides the fixed metrics, the subcommands from the host are counted per id.
+class MetricsRegistry {
+public:
+  static constexpr size_t metric_count = static_cast<size_t>(Metric::COUNT);
+  static constexpr size_t subcommand_id_count = 256;
+
+  /// Get the registry of the application.
+  static MetricsRegistry &get() {
+    static MetricsRegistry registry;
+    return registry;
+  }
+
+  /// Add to a counter.
+  /// @param metric The counter
+  /// @param count The amount to add
+  void increment(Metric metric, uint32_t count = 1) {
+    values_[index(metric)].fetch_add(count, std::memory_order_relaxed);
+  }
+
+  /// Set a gauge.
+  /// @param metric The gauge
+  /// @param value The new value
+  void set(Metric metric, uint32_t value) {
+    values_[index(metric)].store(value, std::memory_order_relaxed);
+  }
+
+  /// Get the value of a counter or gauge.
+  uint32_t get_value(Metric metric) const {
+    return values_[index(metric)].load(std::memory_order_relaxed);
+  }
+
+  /// Count a subcommand from the host.
+  /// @param id The id of the subcommand
+  void increment_subcommand(uint8_t id) {
+    values_[metric_count + id].fetch_add(1, std::memory_order_relaxed);
+    increment(Metric::SUBCOMMANDS);
+  }
+
+  /// Get the number of subcommands received with an id.
+  uint32_t get_subcommand_count(uint8_t id) const {
+    return values_[metric_count + id].load(std::memory_order_relaxed);
+  }
+
+  /// Set all the metrics back to 0.
+  void reset() {
+    for (auto &value : values_) {
+      value.store(0, std::memory_order_relaxed);
+    }
+  }
+
+protected:
+  static constexpr size_t index(Metric metric) { return static_cast<size_t>(metric); }
+
+  std::array<std::atomic<uint32_t>, metric_count + subcommand_id_count> values_{};
+};
+
+/// Per-second rates of the counters of a MetricsRegistry, from the difference
+/// between two snapshots.
+///
+/// update() is called periodically (e.g. every second for the display, or
+/// every 10 seconds for the logs), each caller with its own MetricsRates.
+///
+/// @note Not thread safe; the caller must serialize the calls.
+class MetricsRates {
+public:
+  static constexpr size_t metric_count = MetricsRegistry::metric_count;
+
+  /// Take a snapshot of the registry and compute the rates since the last one.
+  /// The first update only takes the snapshot, so all its rates are 0.
+  /// @param registry The registry
+  /// @param now_us The current time in microseconds
+  void update(const MetricsRegistry &registry, int64_t now_us) {
+    interval_us_ = has_snapshot_ ? now_us - snapshot_us_ : 0;
+    for (size_t i = 0; i < metric_count; i++) {
+      uint32_t value = registry.get_value(static_cast<Metric>(i));
+      // unsigned subtraction handles the counters wrapping around
+      deltas_[i] = has_snapshot_ ? value - values_[i] : 0;
+      values_[i] = value;
+    }
+    snapshot_us_ = now_us;
+    has_snapshot_ = true;
+  }
+
+  /// Get the rate of a counter over the last interval.
+  /// @return The rate in events per second, 0 if there was no interval
+  float get_rate(Metric metric) const {
+    if (interval_us_ <= 0) {
+      return 0;
+    }
+    return get_delta(metric) * 1e6f / interval_us_;
+  }
+
+  /// Get the change of a counter over the last interval.
+  uint32_t get_delta(Metric metric) const { return deltas_[static_cast<size_t>(metric)]; }
+
+  /// Get the value of a counter or gauge at the last snapshot.
+  uint32_t get_value(Metric metric) const { return values_[static_cast<size_t>(metric)]; }
+
+  /// Get the length of the last interval.
+  int64_t get_interval_us() const { return interval_us_; }
+
+protected:
+  bool has_snapshot_{false};
+  int64_t snapshot_us_{0};
+  int64_t interval_us_{0};
+  std::array<uint32_t, metric_count> values_{};
+  std::array<uint32_t, metric_count> deltas_{};
+};
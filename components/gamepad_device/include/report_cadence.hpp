@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+/// Divides the USB start-of-frame (SOF) stream into a fixed report cadence.
+///
+/// Full-speed devices receive an SOF every 1 ms carrying an 11-bit frame
+/// number. on_frame() returns true once every `period` frames, measured from
+/// the frame numbers themselves so that the cadence stays aligned to the host's
+/// frame timing even if some SOF callbacks are missed or coalesced.
+class FrameCadence {
+public:
+  static constexpr uint32_t frame_number_mask = 0x7FF;
+
+  /// @param period The number of frames between reports
+  explicit FrameCadence(uint32_t period)
+      : period_(std::max<uint32_t>(period, 1)) {}
+
+  /// Handle an SOF.
+  /// @param frame_number The frame number from the SOF (only the low 11 bits are used)
+  /// @return True if a report is due in this frame
+  bool on_frame(uint32_t frame_number) {
+    frame_number &= frame_number_mask;
+    if (!started_) {
+      started_ = true;
+      last_frame_ = frame_number;
+      return true;
+    }
+    uint32_t elapsed = (frame_number - last_frame_) & frame_number_mask;
+    if (elapsed < period_) {
+      return false;
+    }
+    // stay on the original grid, even if we missed a whole period
+    last_frame_ = (frame_number - elapsed % period_) & frame_number_mask;
+    missed_ += elapsed / period_ - 1;
+    return true;
+  }
+
+  /// Restart the cadence on the next SOF, e.g. after a bus reset.
+  void reset() { started_ = false; }
+
+  /// Get the number of frames between reports.
+  uint32_t get_period() const { return period_; }
+
+  /// Get the number of report slots skipped because no SOF was seen for them.
+  uint32_t get_missed_count() const { return missed_; }
+
+protected:
+  uint32_t period_;
+  uint32_t last_frame_{0};
+  bool started_{false};
+  uint32_t missed_{0};
+};
+
+/// Accumulates the intervals between periodic events (e.g. completed input
+/// reports) and summarizes their rate and jitter over a window.
+///
+/// @note Not thread safe; the owner must serialize add_event() / add_interval() and
+/// take_stats()..
+class IntervalMonitor {
+public:
+  /// Summary of the intervals since the last take_stats()
+  struct Stats {
+    uint32_t count{0};  ///< Number of intervals
+    int64_t min_us{0};  ///< Shortest interval
+    int64_t max_us{0};  ///< Longest interval
+    float mean_us{0};   ///< Mean interval
+    float jitter_us{0}; ///< Standard deviation of the interval
+    float rate_hz{0};   ///< Events per second implied by the mean interval
+  };
+
+  /// Record an event.
+  /// @param timestamp_us The time of the event in microseconds
+  void add_event(int64_t timestamp_us) {
+    if (has_last_) {
+      add_interval(timestamp_us - last_us_);
+    }
+    has_last_ = true;
+    last_us_ = timestamp_us;
+  }
+
+  /// Record an interval directly.
+  /// @param interval_us The interval in microseconds
+  void add_interval(int64_t interval_us) {
+    count_++;
+    sum_ += interval_us;
+    sum_squares_ += interval_us * interval_us;
+    min_us_ = std::min(min_us_, interval_us);
+    max_us_ = std::max(max_us_, interval_us);
+  }
+
+  /// Forget the last event, so the next one does not start an interval.
+  void restart() { has_last_ = false; }
+
+  /// Summarize the intervals recorded so far and start a new window.
+  Stats take_stats() {
+    Stats stats;
+    stats.count = count_;
+    if (count_) {
+      stats.min_us = min_us_;
+      stats.max_us = max_us_;
+      double mean = double(sum_) / count_;
+      double variance = std::max(double(sum_squares_) / count_ - mean * mean, 0.0);
+      stats.mean_us = mean;
+      stats.jitter_us = std::sqrt(variance);
+      stats.rate_hz = mean > 0 ? 1e6 / mean : 0;
+    }
+    count_ = 0;
+    sum_ = 0;
+    sum_squares_ = 0;
+    min_us_ = std::numeric_limits<int64_t>::max();
+    max_us_ = std::numeric_limits<int64_t>::min();
+    return stats;
+  }
+
+protected:
+  bool has_last_{false};
+  int64_t last_us_{0};
+  uint32_t count_{0};
+  int64_t sum_{0};
+  int64_t sum_squares_{0};
+  int64_t min_us_{std::numeric_limits<int64_t>::max()};
+  int64_t max_us_{std::numeric_limits<int64_t>::min()};
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/// Single-writer, multi-reader snapshot of a trivial value.
+///
+/// The value is double-buffered: the writer fills the slot which readers are
+/// not currently pointed at and then publishes it by bumping the sequence
+/// number, so neither side ever blocks. Unlike a plain seqlock, a reader which
+/// preempts the writer on the same core (e.g. a higher priority task) does not
+/// have to wait for the write to finish, since it reads the other slot. A
+/// reader only has to retry if the writer published twice while it was copying
+/// (which can only happen when they run on different cores); those retries are
+/// counted in get_retry_count().
+///
+/// The slots are stored as relaxed atomic words so that the concurrent copy is
+/// well defined.
+///
+/// @note Only one thread may call store() at a time.
+template <typename T> class SeqLock {
+  // trivial rather than just trivially copyable, since the value is copied
+  // with memcpy (which -Wclass-memaccess rejects for types with default member
+  // initializers) and load() default-constructs it first
+  static_assert(std::is_trivial_v<T>, "SeqLock requires a trivial type");
+
+public:
+  SeqLock() { store(T{}); }
+
+  explicit SeqLock(const T &value) { store(value); }
+
+  /// Publish a new value.
+  /// @param value The value to publish
+  void store(const T &value) {
+    uint32_t next = sequence_.load(std::memory_order_relaxed) + 1;
+    // announce which slot is about to be overwritten before touching it
+    writing_.store(next, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    Words words{};
+    std::memcpy(words.data(), &value, sizeof(T));
+    auto &slot = slots_[next & 1];
+    for (size_t i = 0; i < word_count; i++) {
+      slot[i].store(words[i], std::memory_order_relaxed);
+    }
+    sequence_.store(next, std::memory_order_release);
+  }
+
+  /// Read the most recently published value.
+  /// @return A consistent copy of the value
+  T load() const {
+    Words words;
+    while (true) {
+      uint32_t sequence = sequence_.load(std::memory_order_acquire);
+      const auto &slot = slots_[sequence & 1];
+      for (size_t i = 0; i < word_count; i++) {
+        words[i] = slot[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // the slot we read is only overwritten by the write after next
+      if (writing_.load(std::memory_order_relaxed) - sequence < 2) {
+        break;
+      }
+      retry_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    T value;
+    std::memcpy(&value, words.data(), sizeof(T));
+    return value;
+  }
+
+  /// Get the number of values which have been published.
+  uint32_t get_sequence() const { return sequence_.load(std::memory_order_acquire); }
+
+  /// Get the number of times a reader had to retry because the writer
+  /// overwrote the slot it was reading.
+  uint32_t get_retry_count() const { return retry_count_.load(std::memory_order_relaxed); }
+
+protected:
+  static constexpr size_t word_count = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+  typedef std::array<uint32_t, word_count> Words;
+
+  std::atomic<uint32_t> sequence_{0};
+  std::atomic<uint32_t> writing_{0};
+  std::array<std::atomic<uint32_t>, word_count> slots_[2]{};
+  mutable std::atomic<uint32_t> retry_count_{0};
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+/// A sample of one task, taken from the FreeRTOS run-time statistics
+/// (uxTaskGetSystemState())
+struct TaskSample {
+  uint32_t id;               ///< Task number, unique for the lifetime of the task
+  const char *name;          ///< Task name
+  int core;                  ///< Core the task is pinned to, -1 if it runs on either
+  bool idle;                 ///< Whether this is the idle task of its core
+  uint32_t run_time;         ///< Run time counter (microseconds of the run time clock)
+  uint32_t stack_free_bytes; ///< Stack high water mark: the least free stack ever
+};
+
+/// Computes the CPU utilisation of each core and each task from periodic
+/// samples of the FreeRTOS run-time statistics, and tracks the stack headroom
+/// of each task.
+///
+/// The load of a core is the share of the interval its idle task did not run.
+/// The load of a task is its run time over the interval as a percentage of one
+/// core, like top, so a task which can run on either core may exceed 100%.
+class TaskMonitor {
+public:
+  static constexpr size_t num_cores = 2;
+
+  /// The statistics of one task over the last interval
+  struct TaskStats {
+    uint32_t id;
+    std::string name;
+    int core;                  ///< Core the task is pinned to, -1 if it runs on either
+    bool idle;                 ///< Whether this is the idle task of its core
+    float cpu_percent;         ///< Run time over the interval, as a percentage of one core
+    uint32_t stack_free_bytes; ///< Least free stack ever
+    uint32_t run_time;         ///< Run time counter at the last sample
+  };
+
+  /// Compute the statistics since the last sample. The first update only takes
+  /// the sample, so all loads are 0 until the second one.
+  /// @param tasks The tasks which currently exist
+  /// @param total_run_time The run time clock at the sample
+  void update(std::span<const TaskSample> tasks, uint32_t total_run_time) {
+    // unsigned subtraction handles the run time counters wrapping around
+    uint32_t elapsed = has_sample_ ? total_run_time - total_run_time_ : 0;
+    std::vector<TaskStats> stats;
+    stats.reserve(tasks.size());
+    core_load_.fill(0);
+    for (const auto &task : tasks) {
+      uint32_t delta = 0;
+      if (has_sample_) {
+        auto previous = std::find_if(tasks_.begin(), tasks_.end(),
+                                     [&](const auto &stats) { return stats.id == task.id; });
+        // a task which was not in the last sample was created since, so all
+        // of its run time is in this interval
+        delta = task.run_time - (previous != tasks_.end() ? previous->run_time : 0);
+      }
+      float cpu_percent = elapsed ? std::min(100.0f * delta / elapsed, 100.0f * num_cores) : 0;
+      if (task.idle && task.core >= 0 && size_t(task.core) < num_cores && elapsed) {
+        core_load_[task.core] = std::clamp(100.0f - cpu_percent, 0.0f, 100.0f);
+      }
+      stats.push_back({.id = task.id,
+                       .name = task.name,
+                       .core = task.core,
+                       .idle = task.idle,
+                       .cpu_percent = cpu_percent,
+                       .stack_free_bytes = task.stack_free_bytes,
+                       .run_time = task.run_time});
+    }
+    // busiest first
+    std::stable_sort(stats.begin(), stats.end(), [](const auto &a, const auto &b) {
+      return a.cpu_percent > b.cpu_percent;
+    });
+    tasks_ = std::move(stats);
+    total_run_time_ = total_run_time;
+    elapsed_ = elapsed;
+    has_sample_ = true;
+  }
+
+  /// Get the load of a core over the last interval.
+  /// @param core The core
+  /// @return The percentage of the interval the core was busy, 0 if unknown
+  float get_core_load(size_t core) const { return core < num_cores ? core_load_[core] : 0; }
+
+  /// Get the statistics of the tasks over the last interval, busiest first.
+  const std::vector<TaskStats> &get_tasks() const { return tasks_; }
+
+  /// Get the task with the least free stack.
+  /// @return The task, or nullptr if there are none
+  const TaskStats *get_lowest_stack() const {
+    auto lowest = std::min_element(tasks_.begin(), tasks_.end(), [](const auto &a, const auto &b) {
+      return a.stack_free_bytes < b.stack_free_bytes;
+    });
+    return lowest != tasks_.end() ? &*lowest : nullptr;
+  }
+
+  /// Get the length of the last interval, in ticks of the run time clock.
+  uint32_t get_elapsed() const { return elapsed_; }
+
+protected:
+  bool has_sample_{false};
+  uint32_t total_run_time_{0};
+  uint32_t elapsed_{0};
+  std::array<float, num_cores> core_load_{};
+  std::vector<TaskStats> tasks_;
+};
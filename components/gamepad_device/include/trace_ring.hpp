@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#include <esp_timer.h>
+
+#if defined(ESP_PLATFORM)
+#include <esp_cpu.h>
+#endif
+
+/// Events recorded in the trace, with the meaning of their arguments
+enum class TraceEvent : uint8_t {
+  BLE_CONNECT,         ///< arg0: connection handle
+  BLE_DISCONNECT,      ///< arg1: reason
+  BLE_ENCRYPTED,       ///< arg0: 1 if encrypted, 0 if it failed
+  BLE_STATE,           ///< arg0: previous BleState, arg1: new BleState
+  BLE_NOTIFY,          ///< arg0: attribute handle, arg1: length
+  BLE_CONN_UPDATE,     ///< arg0: interval (1.25 ms), arg1: latency, arg2: timeout (10 ms)
+  USB_MOUNT,           ///< no arguments
+  USB_UNMOUNT,         ///< no arguments
+  USB_SET_REPORT,      ///< arg0: report id, arg1: length, arg2: first 4 bytes (little endian)
+  USB_REPORT_SUBMIT,   ///< arg0: report id, arg1: length
+  USB_REPORT_COMPLETE, ///< arg1: length
+  INIT_COMMAND,        ///< arg0: 0x80 command
+  SUBCOMMAND_BEGIN,    ///< arg0: subcommand id, arg1: subcommand length
+  SUBCOMMAND_END,      ///< arg0: subcommand id, arg1: ACK byte (0 if ignored)
+  LINK_MONITOR_TIMER,  ///< arg0: link mode, arg1: RSSI (dBm, as int8_t)
+  PAIRING_TIMER,       ///< no arguments
+  COUNT,
+};
+
+/// Get the name of an event, for the trace viewers.
+constexpr const char *to_string(TraceEvent event) {
+  switch (event) {
+  case TraceEvent::BLE_CONNECT:
+    return "ble_connect";
+  case TraceEvent::BLE_DISCONNECT:
+    return "ble_disconnect";
+  case TraceEvent::BLE_ENCRYPTED:
+    return "ble_encrypted";
+  case TraceEvent::BLE_STATE:
+    return "ble_state";
+  case TraceEvent::BLE_NOTIFY:
+    return "ble_notify";
+  case TraceEvent::BLE_CONN_UPDATE:
+    return "ble_conn_update";
+  case TraceEvent::USB_MOUNT:
+    return "usb_mount";
+  case TraceEvent::USB_UNMOUNT:
+    return "usb_unmount";
+  case TraceEvent::USB_SET_REPORT:
+    return "usb_set_report";
+  case TraceEvent::USB_REPORT_SUBMIT:
+    return "usb_report_submit";
+  case TraceEvent::USB_REPORT_COMPLETE:
+    return "usb_report_complete";
+  case TraceEvent::INIT_COMMAND:
+    return "init_command";
+  case TraceEvent::SUBCOMMAND_BEGIN:
+  case TraceEvent::SUBCOMMAND_END:
+    return "subcommand";
+  case TraceEvent::LINK_MONITOR_TIMER:
+    return "link_monitor_timer";
+  case TraceEvent::PAIRING_TIMER:
+    return "pairing_timer";
+  case TraceEvent::COUNT:
+    break;
+  }
+  return "unknown";
+}
+
+/// One event in the trace
+struct TraceRecord {
+  uint32_t timestamp_us; ///< esp_timer time, wrapping around every ~71 minutes
+  TraceEvent event;
+  uint8_t core; ///< Core the event was recorded on
+  uint16_t arg0;
+  uint32_t arg1;
+  uint32_t arg2;
+};
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord must stay 16 bytes");
+
+/// Header of a trace saved to flash or dumped to the log, followed by `count`
+/// records (oldest first), all little endian
+struct TraceHeader {
+  static constexpr uint32_t magic_value = 0x43525442; // "BTRC"
+  static constexpr uint16_t current_version = 1;
+
+  uint32_t magic{magic_value};
+  uint16_t version{current_version};
+  uint16_t record_size{sizeof(TraceRecord)};
+  uint32_t count{0}; ///< Number of records which follow
+  uint32_t total{0}; ///< Number of events recorded, including the overwritten ones
+};
+static_assert(sizeof(TraceHeader) == 16, "TraceHeader must stay 16 bytes");
+
+/// Fixed size ring of trace records, which keeps the most recent events.
+///
+/// Recording claims a slot with a single atomic increment and stores the
+/// record as relaxed atomic words (like SpscRing), so any task, callback or
+/// core may record without locks and a reader copying the ring at the same
+/// time is well defined. A record being written while the ring is copied may
+/// be torn, so set_enabled(false) before copying for a consistent trace.
+template <size_t Capacity> class TraceRing {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "TraceRing capacity must be a power of two");
+
+public:
+  static constexpr size_t capacity = Capacity;
+
+  /// Record an event, overwriting the oldest one if the ring is full.
+  /// @param record The event
+  void record(const TraceRecord &record) {
+    if (!enabled_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    uint32_t index = head_.fetch_add(1, std::memory_order_relaxed);
+    Words words;
+    std::memcpy(words.data(), &record, sizeof(TraceRecord));
+    auto &slot = slots_[index & mask];
+    for (size_t i = 0; i < word_count; i++) {
+      slot[i].store(words[i], std::memory_order_relaxed);
+    }
+  }
+
+  /// Copy the most recent events, oldest first.
+  /// @param records The buffer to copy into
+  /// @return The number of events copied
+  size_t copy(std::span<TraceRecord> records) const {
+    uint32_t head = head_.load(std::memory_order_acquire);
+    size_t count = std::min({size_t(head), Capacity, records.size()});
+    for (size_t i = 0; i < count; i++) {
+      const auto &slot = slots_[(head - count + i) & mask];
+      Words words;
+      for (size_t j = 0; j < word_count; j++) {
+        words[j] = slot[j].load(std::memory_order_relaxed);
+      }
+      std::memcpy(&records[i], words.data(), sizeof(TraceRecord));
+    }
+    return count;
+  }
+
+  /// Get the number of events recorded, including the overwritten ones.
+  uint32_t get_total() const { return head_.load(std::memory_order_relaxed); }
+
+  /// Start or stop recording events.
+  void set_enabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+
+  /// Return true if events are being recorded.
+  bool is_enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  /// Forget all the events.
+  void clear() { head_.store(0, std::memory_order_release); }
+
+protected:
+  static constexpr size_t mask = Capacity - 1;
+  static constexpr size_t word_count = sizeof(TraceRecord) / sizeof(uint32_t);
+  typedef std::array<uint32_t, word_count> Words;
+
+  std::atomic<bool> enabled_{true};
+  std::atomic<uint32_t> head_{0};
+  std::array<std::array<std::atomic<uint32_t>, word_count>, Capacity> slots_{};
+};
+
+/// The trace of the application
+typedef TraceRing<1024> BridgeTraceRing;
+
+/// Get the trace of the application.
+inline BridgeTraceRing &get_trace_ring() {
+  static BridgeTraceRing ring;
+  return ring;
+}
+
+/// Record an event in the trace of the application, with the current time and
+/// core.
+inline void trace(TraceEvent event, uint16_t arg0 = 0, uint32_t arg1 = 0, uint32_t arg2 = 0) {
+#if defined(ESP_PLATFORM)
+  uint8_t core = esp_cpu_get_core_id();
+#else
+  uint8_t core = 0;
+#endif
+  get_trace_ring().record({.timestamp_us = uint32_t(esp_timer_get_time()),
+                           .event = event,
+                           .core = core,
+                           .arg0 = arg0,
+                           .arg1 = arg1,
+                           .arg2 = arg2});
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+/// Fixed-point replacement for espp::FloatRangeMapper.
+///
+/// Maps a raw integer input (e.g. a 16-bit joystick or 10-bit trigger value)
+/// with a per-axis calibration into a signed integer output range of
+/// [-output_max, output_max] (or [0, output_max] for unipolar inputs such as
+/// triggers, where center == minimum). The scale factors are computed once in
+/// the constructor so that map() is a clamp, a subtract, a multiply and a shift.
+class FixedRangeMapper {
+public:
+  /// Per-axis calibration
+  struct Config {
+    int32_t center;                ///< Raw value which maps to 0
+    int32_t minimum;               ///< Raw value which maps to -output_max
+    int32_t maximum;               ///< Raw value which maps to output_max
+    int32_t deadzone{0};           ///< Raw distance around center which maps to 0
+    int32_t range_deadzone{0};     ///< Raw distance from min / max which saturates
+    int32_t output_max{INT16_MAX}; ///< Magnitude of the output range
+    bool invert_output{false};     ///< Whether to negate the output
+  };
+
+  constexpr FixedRangeMapper() = default;
+
+  /// Construct the mapper and compute its scale factors
+  /// @param config The calibration for this axis
+  explicit constexpr FixedRangeMapper(const Config &config) { configure(config); }
+
+  /// Update the calibration and recompute the scale factors
+  /// @param config The calibration for this axis
+  constexpr void configure(const Config &config) {
+    config_ = config;
+    config_.deadzone = config.deadzone < 0 ? -config.deadzone : config.deadzone;
+    config_.range_deadzone = config.range_deadzone < 0 ? -config.range_deadzone
+                                                       : config.range_deadzone;
+    pos_scale_ = compute_scale(config_.maximum - config_.center - config_.deadzone -
+                               config_.range_deadzone);
+    neg_scale_ = compute_scale(config_.center - config_.minimum - config_.deadzone -
+                               config_.range_deadzone);
+  }
+
+  /// Get the current calibration
+  constexpr const Config &get_config() const { return config_; }
+
+  /// Map a raw input value into the output range
+  /// @param value The raw input value
+  /// @return The mapped value in [-output_max, output_max]
+  constexpr int32_t map(int32_t value) const {
+    int32_t offset = std::clamp(value, config_.minimum, config_.maximum) - config_.center;
+    int32_t out = 0;
+    if (offset > config_.deadzone) {
+      out = scale(offset - config_.deadzone, pos_scale_);
+    } else if (offset < -config_.deadzone) {
+      out = -scale(-offset - config_.deadzone, neg_scale_);
+    }
+    return config_.invert_output ? -out : out;
+  }
+
+protected:
+  static constexpr int fraction_bits = 16;
+
+  // Q16 factor which maps [0, range] to [0, output_max]
+  constexpr int64_t compute_scale(int32_t range) const {
+    if (range <= 0) {
+      return 0;
+    }
+    return ((int64_t(config_.output_max) << fraction_bits) + range / 2) / range;
+  }
+
+  constexpr int32_t scale(int32_t magnitude, int64_t factor) const {
+    int64_t out = (int64_t(magnitude) * factor + (int64_t(1) << (fraction_bits - 1))) >>
+                  fraction_bits;
+    return int32_t(std::min<int64_t>(out, config_.output_max));
+  }
+
+  Config config_{.center = 0, .minimum = 0, .maximum = 0};
+  int64_t pos_scale_{0};
+  int64_t neg_scale_{0};
+};
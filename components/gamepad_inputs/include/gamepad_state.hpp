@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include "gamepad_inputs.hpp"
+
+/// Integer representation of the gamepad state.
+///
+/// Equivalent to GamepadInputs, but the joysticks are stored as int16_t in
+/// [-axis_max, axis_max], the triggers as uint16_t in [0, trigger_max] and the
+/// buttons as an explicit bitmask (using the same bit positions as
+/// GamepadInputs::Buttons::raw), so devices which produce / consume integer
+/// report fields do not need to convert through float.
+struct GamepadState {
+  static constexpr int16_t axis_max = INT16_MAX;
+  static constexpr uint16_t trigger_max = UINT16_MAX;
+
+  /// Button masks for GamepadState::buttons
+  enum Button : uint32_t {
+    // byte 0
+    A = (1 << 0),
+    B = (1 << 1),
+    X = (1 << 2),
+    Y = (1 << 3),
+    L1 = (1 << 4),
+    R1 = (1 << 5),
+    L2 = (1 << 6),
+    R2 = (1 << 7),
+    // byte 1
+    L3 = (1 << 8),
+    R3 = (1 << 9),
+    UP = (1 << 10),
+    DOWN = (1 << 11),
+    LEFT = (1 << 12),
+    RIGHT = (1 << 13),
+    HOME = (1 << 14),
+    CAPTURE = (1 << 15),
+    // byte 2
+    START = (1 << 16),
+    SELECT = (1 << 17),
+    RIGHT_SR = (1 << 18),
+    RIGHT_SL = (1 << 19),
+    LEFT_SR = (1 << 20),
+    LEFT_SL = (1 << 21),
+    // aliases, see GamepadInputs::Buttons
+    MENU = START,
+    OPTIONS = SELECT,
+    PLUS = START,
+    MINUS = SELECT,
+  };
+
+  struct Joystick {
+    int16_t x{0}; // range [-axis_max, axis_max]
+    int16_t y{0}; // range [-axis_max, axis_max]
+  };
+
+  uint32_t buttons{0};
+  Joystick left_joystick;
+  Joystick right_joystick;
+  uint16_t l2{0}; // range [0, trigger_max]
+  uint16_t r2{0}; // range [0, trigger_max]
+
+  constexpr bool is_pressed(uint32_t mask) const { return (buttons & mask) == mask; }
+
+  constexpr void set_button(uint32_t mask, bool value) {
+    buttons = value ? (buttons | mask) : (buttons & ~mask);
+  }
+
+  /// Convert a float joystick value in [-1, 1] to an axis value
+  static constexpr int16_t axis_from_float(float value) {
+    float scaled = std::clamp(value, -1.0f, 1.0f) * axis_max;
+    return static_cast<int16_t>(scaled + (scaled < 0 ? -0.5f : 0.5f));
+  }
+
+  /// Convert an axis value to a float joystick value in [-1, 1]
+  static constexpr float axis_to_float(int16_t value) {
+    return std::clamp(value / static_cast<float>(axis_max), -1.0f, 1.0f);
+  }
+
+  /// Convert a float trigger value in [0, 1] to a trigger value
+  static constexpr uint16_t trigger_from_float(float value) {
+    return static_cast<uint16_t>(std::clamp(value, 0.0f, 1.0f) * trigger_max + 0.5f);
+  }
+
+  /// Convert a trigger value to a float trigger value in [0, 1]
+  static constexpr float trigger_to_float(uint16_t value) {
+    return value / static_cast<float>(trigger_max);
+  }
+
+  /// Create the integer state from the float GamepadInputs
+  static constexpr GamepadState from_gamepad_inputs(const GamepadInputs &inputs) {
+    GamepadState state;
+    state.buttons = inputs.buttons.raw;
+    state.left_joystick.x = axis_from_float(inputs.left_joystick.x);
+    state.left_joystick.y = axis_from_float(inputs.left_joystick.y);
+    state.right_joystick.x = axis_from_float(inputs.right_joystick.x);
+    state.right_joystick.y = axis_from_float(inputs.right_joystick.y);
+    state.l2 = trigger_from_float(inputs.l2.value);
+    state.r2 = trigger_from_float(inputs.r2.value);
+    return state;
+  }
+
+  /// Convert the integer state into the float GamepadInputs
+  GamepadInputs to_gamepad_inputs() const {
+    GamepadInputs inputs{};
+    inputs.buttons.raw = buttons;
+    inputs.left_joystick.x = axis_to_float(left_joystick.x);
+    inputs.left_joystick.y = axis_to_float(left_joystick.y);
+    inputs.right_joystick.x = axis_to_float(right_joystick.x);
+    inputs.right_joystick.y = axis_to_float(right_joystick.y);
+    inputs.l2.value = trigger_to_float(l2);
+    inputs.r2.value = trigger_to_float(r2);
+    return inputs;
+  }
+};
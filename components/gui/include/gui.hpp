@@ -47,6 +47,20 @@ public:
     lv_label_set_text(label_, text.data());
   }
 
+  /// Set the text of the small label at the bottom of the screen, which shows
+  /// the state of the BLE link.
+  void set_link_text(std::string_view text) {
+    std::lock_guard<std::recursive_mutex> lk(mutex_);
+    lv_label_set_text(link_label_, text.data());
+  }
+
+  /// Set the text of the small label at the top of the screen, which shows
+  /// the report rates, the BLE to USB latency and the CPU load.
+  void set_stats_text(std::string_view text) {
+    std::lock_guard<std::recursive_mutex> lk(mutex_);
+    lv_label_set_text(stats_label_, text.data());
+  }
+
 protected:
   void init_ui();
   void deinit_ui();
@@ -94,6 +108,8 @@ protected:
   void on_scroll(lv_event_t *e);
 
   lv_obj_t *label_{nullptr};
+  lv_obj_t *link_label_{nullptr};
+  lv_obj_t *stats_label_{nullptr};
 
   std::atomic<bool> paused_{false};
   espp::HighResolutionTimer task_{{
@@ -25,6 +25,18 @@ void Gui::init_ui() {
   lv_obj_align(label_, LV_ALIGN_CENTER, 0, 0);
   lv_obj_set_style_text_align(label_, LV_TEXT_ALIGN_CENTER, 0);
   lv_obj_set_width(label_, 150);
+
+  // make the link label and put it at the bottom
+  link_label_ = lv_label_create(lv_screen_active());
+  lv_label_set_text(link_label_, "");
+  lv_obj_align(link_label_, LV_ALIGN_BOTTOM_MID, 0, 0);
+  lv_obj_set_style_text_align(link_label_, LV_TEXT_ALIGN_CENTER, 0);
+
+  // make the stats label and put it at the top
+  stats_label_ = lv_label_create(lv_screen_active());
+  lv_label_set_text(stats_label_, "");
+  lv_obj_align(stats_label_, LV_ALIGN_TOP_MID, 0, 0);
+  lv_obj_set_style_text_align(stats_label_, LV_TEXT_ALIGN_CENTER, 0);
 }
 
 void Gui::set_usb_connected(bool connected) {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <string>
@@ -40,29 +41,39 @@ namespace sp {
 // { 0x51, "Set GPIO Pin Output value (7 & 15 @Port 1)"},
 // { 0x52, "Get GPIO Pin Input/Output value"},
 
-enum class Response {
-  NO_DATA = -1,
-  MALFORMED = -2,
-  TOO_SHORT = -3,
-  UNKNOWN_SUBCOMMAND = -4,
+// Subcommand ids
+enum class Response : uint8_t {
   ONLY_CONTROLLER_STATE = 0x00,
   BT_MANUAL_PAIRING = 0x01,
   REQUEST_DEVICE_INFO = 0x02,
   SET_MODE = 0x03,
   TRIGGER_BUTTONS_ELAPSED = 0x04,
+  GET_PAGE_LIST_STATE = 0x05,
+  SET_HCI_STATE = 0x06,
   SET_SHIPMENT = 0x08,
   SPI_READ = 0x10,
-  SET_NFC_IR_STATE = 0x22,
+  SPI_WRITE = 0x11,
+  SPI_SECTOR_ERASE = 0x12,
+  RESET_NFC_IR = 0x20,
   SET_NFC_IR_CONFIG = 0x21,
+  SET_NFC_IR_STATE = 0x22,
   SET_UNKNOWN_DATA = 0x24,          // replies with 0x80 24 00 always
   RESET_UNKNOWN_DATA = 0x25,        // replies with 0x80 25 00 always
   SET_UNKNOWN_NFC_IR_DATA_A = 0x28, // replies with 0x80 28 always
   GET_UNKNOWN_NFC_IR_DATA_A = 0x29,
+  SET_GPIO_PORT_2 = 0x2A,
+  GET_NFC_IR_DATA_29 = 0x2B,
   SET_PLAYER = 0x30,
   GET_PLAYER = 0x31,
   SET_HOME_LIGHT = 0x38,
   TOGGLE_IMU = 0x40,
+  SET_IMU_SENSITIVITY = 0x41,
+  WRITE_IMU_REGISTERS = 0x42,
+  READ_IMU_REGISTERS = 0x43,
   ENABLE_VIBRATION = 0x48,
+  GET_REGULATED_VOLTAGE = 0x50,
+  SET_GPIO_PORT_1 = 0x51,
+  GET_GPIO_VALUE = 0x52,
 };
 
 union TriggerTimes {
@@ -79,6 +90,53 @@ union TriggerTimes {
   uint8_t bytes[14] = {0};
 } __attribute__((packed));
 
+// Controller state portion of the standard input report: the three button
+// bytes followed by the 12-bit packed left and right joysticks (bytes 2-10 of
+// the input report data).
+struct ControllerState {
+  uint8_t buttons[3]; // right, shared, left
+  uint8_t left_stick[3];
+  uint8_t right_stick[3];
+} __attribute__((packed));
+
+static constexpr size_t CONTROLLER_STATE_OFFSET = 2;
+
+// Button masks for the 24-bit little-endian value of ControllerState::buttons
+namespace button {
+// right byte
+static constexpr uint32_t Y = (1 << 0);
+static constexpr uint32_t X = (1 << 1);
+static constexpr uint32_t B = (1 << 2);
+static constexpr uint32_t A = (1 << 3);
+static constexpr uint32_t RIGHT_SR = (1 << 4);
+static constexpr uint32_t RIGHT_SL = (1 << 5);
+static constexpr uint32_t R = (1 << 6);
+static constexpr uint32_t ZR = (1 << 7);
+// shared byte
+static constexpr uint32_t MINUS = (1 << 8);
+static constexpr uint32_t PLUS = (1 << 9);
+static constexpr uint32_t THUMB_R = (1 << 10);
+static constexpr uint32_t THUMB_L = (1 << 11);
+static constexpr uint32_t HOME = (1 << 12);
+static constexpr uint32_t CAPTURE = (1 << 13);
+// left byte
+static constexpr uint32_t DPAD_DOWN = (1 << 16);
+static constexpr uint32_t DPAD_UP = (1 << 17);
+static constexpr uint32_t DPAD_RIGHT = (1 << 18);
+static constexpr uint32_t DPAD_LEFT = (1 << 19);
+static constexpr uint32_t LEFT_SR = (1 << 20);
+static constexpr uint32_t LEFT_SL = (1 << 21);
+static constexpr uint32_t L = (1 << 22);
+static constexpr uint32_t ZL = (1 << 23);
+} // namespace button
+
+/// Pack a 12-bit joystick x / y pair into the 3 byte input report format
+constexpr void pack_stick(uint16_t x, uint16_t y, uint8_t *out) {
+  out[0] = x & 0xFF;
+  out[1] = ((x >> 8) & 0x0F) | ((y & 0x0F) << 4);
+  out[2] = (y >> 4) & 0xFF;
+}
+
 struct Controller {
   uint8_t id;
   uint8_t connection_info;
@@ -124,70 +182,33 @@ static constexpr uint8_t device_info[] = {
 
 static constexpr uint8_t vibrator_bytes[] = {0xA0, 0xB0, 0xC0, 0x90};
 
-typedef std::pair<uint8_t, Response> SubcommandResponse;
-static constexpr const std::array<SubcommandResponse, 14> subcommands = {
-    {{0x00, Response::ONLY_CONTROLLER_STATE},
-     {0x01, Response::BT_MANUAL_PAIRING},
-     {0x02, Response::REQUEST_DEVICE_INFO},
-     {0x03, Response::SET_MODE},
-     {0x04, Response::TRIGGER_BUTTONS_ELAPSED},
-     {0x08, Response::SET_SHIPMENT},
-     {0x10, Response::SPI_READ},
-     {0x22, Response::SET_NFC_IR_STATE},
-     {0x21, Response::SET_NFC_IR_CONFIG},
-     {0x30, Response::SET_PLAYER},
-     {0x31, Response::GET_PLAYER},
-     {0x38, Response::SET_HOME_LIGHT},
-     {0x40, Response::TOGGLE_IMU},
-     {0x48, Response::ENABLE_VIBRATION}}};
-
 // message represents:
-// - response (of type Response enum)
 // - subcommand (uint8_t array) which is the data starting at byte 10 and onwards
+//   (nullptr if the message is too short to contain a subcommand)
+// - subcommand_size which is the number of subcommand bytes (including the id)
 // - subcommand_id which is the first byte of the subcommand
 struct Message {
   const uint8_t *payload;
-  const uint8_t *subcommand;
-  uint8_t subcommand_id;
-  Response response;
+  const uint8_t *subcommand{nullptr};
+  size_t subcommand_size{0};
+  uint8_t subcommand_id{0};
 
   static constexpr size_t subcommand_offset = 10;
 
   Message(const uint8_t *payload, size_t size)
       : payload(payload) {
-    if (payload == nullptr) {
-      response = Response::NO_DATA;
+    if (payload == nullptr || size <= subcommand_offset) {
       return;
     }
 
-    // if (size < subcommand_offset+1) {
-    //   response = Response::TOO_SHORT;
-    //   return;
-    // }
-
     // // First byte check
     // if (payload[0] != 0xA2) {
-    //   response = Response::MALFORMED;
     //   return;
     // }
 
     subcommand = payload + subcommand_offset;
+    subcommand_size = size - subcommand_offset;
     subcommand_id = subcommand[0];
-
-    const auto it =
-        std::find_if(subcommands.begin(), subcommands.end(), [&](const SubcommandResponse &sub) {
-          if (sub.first == subcommand_id) {
-            response = sub.second;
-            return true;
-          }
-          return false;
-        });
-
-    if (it != subcommands.end()) {
-      response = it->second;
-    } else {
-      response = Response::UNKNOWN_SUBCOMMAND;
-    }
   }
 };
 } // namespace sp
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstring>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -10,16 +12,18 @@
 #include <random>
 #endif
 
+#include <esp_timer.h>
+
 #include "hid-rp-switch-pro.hpp"
 #include "range_mapper.hpp"
 
 #include "gamepad_device.hpp"
-#include "high_resolution_timer.hpp"
+#include "seqlock.hpp"
 
 #include "switch_controller_protocol.hpp"
 #include "switch_pro_spi_rom_data.hpp"
 
-class SwitchPro : public GamepadDevice {
+class SwitchPro final : public GamepadDevice {
 public:
   // Constructor
   explicit SwitchPro()
@@ -27,8 +31,14 @@ public:
       , thumbstick_range_mapper_({.center = InputReport::joystick_center,
                                   .minimum = InputReport::joystick_min,
                                   .maximum = InputReport::joystick_max}) {
+    // cache the report size so that the span-based API does not need to
+    // allocate to find it
+    input_report_size_ = input_report_.get_report().size();
+    // make the initial (neutral) input report visible to readers
+    publish_input_report();
+
     // start the counter
-    counter_timer_.periodic(counter_period_us);
+    counter_start_us_ = esp_timer_get_time();
 
     // copy the SPI ROM data
     std::copy(std::begin(sp::spi_rom_data_60), std::end(sp::spi_rom_data_60),
@@ -70,6 +80,9 @@ public:
       mac_address_[i] = dist(gen);
     }
 #endif
+
+    // now that the mac address is known, build the subcommand replies
+    build_reply_templates();
   }
 
   // Info
@@ -82,18 +95,43 @@ public:
   }
   virtual void set_report_data(uint8_t report_id, const uint8_t *data, size_t len) override;
   virtual std::vector<uint8_t> get_report_data(uint8_t report_id) const override;
+  virtual void set_report_data(uint8_t report_id, std::span<const uint8_t> data) override;
+  virtual size_t get_report_data(uint8_t report_id, std::span<uint8_t> buffer) const override;
 
   // Gamepad inputs
   virtual GamepadInputs get_gamepad_inputs() const override;
   virtual void set_gamepad_inputs(const GamepadInputs &inputs) override;
 
+  /// Set the buttons and joysticks directly in the input report format,
+  /// bypassing the GamepadInputs conversion.
+  /// @param state The controller state (buttons and packed joysticks)
+  void set_controller_state(const sp::ControllerState &state);
+
   // Battery level
   virtual void set_battery_level(uint8_t level) override;
 
+  // Report filtering
+
+  /// The Switch expects the timer byte to keep advancing, so unchanged reports
+  /// are resent every 100 ms while the input is steady. That is well above the
+  /// BLE connection interval, so the controller's repeated reports are
+  /// suppressed in between. The timer byte itself is ignored when comparing.
+  virtual ReportFilterConfig get_report_filter_config() const override {
+    return {.keepalive_us = 100'000, .ignore_offset = 0, .ignore_size = 1};
+  }
+
+  /// Get the number of times a reader of the input report (USB task) had to
+  /// retry its snapshot because the writer (BLE task) published concurrently.
+  /// @return The number of snapshot retries
+  uint32_t get_input_report_retry_count() const { return input_snapshot_.get_retry_count(); }
+
   // HID handlers
   virtual std::optional<ReportData> on_attach() override;
   virtual std::optional<ReportData> on_hid_report(uint8_t report_id, const uint8_t *data,
                                                   size_t len) override;
+  virtual size_t on_attach(uint8_t &report_id, std::span<uint8_t> buffer) override;
+  virtual size_t on_hid_report(uint8_t report_id, std::span<const uint8_t> data,
+                               uint8_t &response_report_id, std::span<uint8_t> response) override;
 
 protected:
   static constexpr auto report_descriptor = espp::switch_pro_descriptor();
@@ -109,22 +147,64 @@ protected:
   static constexpr const char product[] = "Pro Controller";
   static constexpr const char usb_serial_number[] = "000000000001";
 
-  GamepadDevice::ReportData process_command(const uint8_t *data, size_t len);
-  void set_subcommand_reply(std::vector<uint8_t> &report);
-  void set_unknown_subcommand(std::vector<uint8_t> &report, uint8_t subcommand_id);
-  void set_full_input_report(std::vector<uint8_t> &report);
-  void set_standard_input_report(std::vector<uint8_t> &report);
-  void set_device_info(std::vector<uint8_t> &report);
-  void set_shipment(std::vector<uint8_t> &report);
-  void toggle_imu(std::vector<uint8_t> &report, sp::Message &message);
-  void set_imu_data(std::vector<uint8_t> &report);
-  void spi_read(std::vector<uint8_t> &report, sp::Message &message);
-  void set_mode(std::vector<uint8_t> &report, sp::Message &message);
-  void set_trigger_buttons(std::vector<uint8_t> &report);
-  void enable_vibration(std::vector<uint8_t> &report);
-  void set_player_lights(std::vector<uint8_t> &report, sp::Message &message);
-  void set_nfc_ir_state(std::vector<uint8_t> &report);
-  void set_nfc_ir_config(std::vector<uint8_t> &report);
+  /// Process a subcommand (0x01 output report) from the host
+  /// @param data The output report data
+  /// @param len The length of the output report data
+  /// @param report_id The report id of the reply
+  /// @param report The buffer to write the reply into
+  /// @return The length of the reply, 0 if the buffer is too small
+  size_t process_command(const uint8_t *data, size_t len, uint8_t &report_id,
+                         std::span<uint8_t> report);
+  /// Build the reply skeleton for each subcommand (reply_templates_)
+  void build_reply_templates();
+  void set_subcommand_reply(std::span<uint8_t> report);
+  void set_unknown_subcommand(std::span<uint8_t> report, uint8_t subcommand_id);
+  void set_full_input_report(std::span<uint8_t> report);
+  void set_standard_input_report(std::span<uint8_t> report);
+  void set_imu_data(std::span<uint8_t> report);
+
+  // Reply template builders (constant reply data)
+  void set_device_info(std::span<uint8_t> report);
+  void set_nfc_ir_config(std::span<uint8_t> report);
+  void set_regulated_voltage(std::span<uint8_t> report);
+
+  // Subcommand handlers (side effects and dynamic reply data)
+  void request_device_info(std::span<uint8_t> report, const sp::Message &message);
+  void set_mode(std::span<uint8_t> report, const sp::Message &message);
+  void set_trigger_buttons(std::span<uint8_t> report, const sp::Message &message);
+  void spi_read(std::span<uint8_t> report, const sp::Message &message);
+  void spi_write(std::span<uint8_t> report, const sp::Message &message);
+  void set_player_lights(std::span<uint8_t> report, const sp::Message &message);
+  void get_player_lights(std::span<uint8_t> report, const sp::Message &message);
+  void toggle_imu(std::span<uint8_t> report, const sp::Message &message);
+  void read_imu_registers(std::span<uint8_t> report, const sp::Message &message);
+  void enable_vibration(std::span<uint8_t> report, const sp::Message &message);
+
+  typedef void (SwitchPro::*ReplyBuilder)(std::span<uint8_t> report);
+  typedef void (SwitchPro::*SubcommandHandler)(std::span<uint8_t> report,
+                                               const sp::Message &message);
+
+  // How to reply to a subcommand
+  struct Subcommand {
+    sp::Response id;                   // subcommand id
+    uint8_t ack;                       // ACK byte of the reply, 0 if not supported
+    uint8_t min_size{1};               // number of subcommand bytes needed (incl. id)
+    ReplyBuilder build{nullptr};       // adds constant data to the reply template
+    SubcommandHandler handle{nullptr}; // applies side effects / adds dynamic data
+  };
+
+  // Number of supported subcommands (entries in make_subcommand_table())
+  static constexpr size_t subcommand_count = 31;
+
+  // Subcommand dispatch table: index maps a subcommand id to its entry in
+  // subcommands (and reply_templates_), where entry 0 is the (NACK-free)
+  // reply to unknown subcommands.
+  struct SubcommandTable {
+    std::array<uint8_t, 256> index{};
+    std::array<Subcommand, subcommand_count + 1> subcommands{};
+  };
+  static constexpr SubcommandTable make_subcommand_table();
+  static const SubcommandTable subcommand_table_;
 
   /// Read the SPI flash memory
   /// @param bank The bank to read from
@@ -134,6 +214,14 @@ protected:
   /// @return num bytes read
   uint8_t spi_read_impl(uint8_t bank, uint8_t reg, uint8_t read_length, uint8_t *response);
 
+  /// Write the SPI flash memory (factory and user calibration data only)
+  /// @param bank The bank to write to
+  /// @param reg The register to write to
+  /// @param write_length The number of bytes to write
+  /// @param data The data to write
+  /// @return True if the data was written
+  bool spi_write_impl(uint8_t bank, uint8_t reg, uint8_t write_length, const uint8_t *data);
+
   static const DeviceInfo device_info;
 
   std::array<uint8_t, 6> mac_address_{0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
@@ -141,27 +229,30 @@ protected:
   std::array<uint8_t, std::size(sp::spi_rom_data_60)> spi_rom_factory_data;
   std::array<uint8_t, std::size(sp::spi_rom_data_80)> spi_rom_user_data;
 
+  // Reply skeletons (ACK, subcommand id and constant data) for each entry of
+  // subcommand_table_, so that a reply is a copy of its template with the
+  // current inputs, counter and vibrator byte patched in.
+  std::array<std::array<uint8_t, sp::REPORT_SIZE>, subcommand_count + 1> reply_templates_;
+  // The inputs (battery / connection info, buttons and joysticks) copied from
+  // the input report into each reply
+  static constexpr size_t reply_inputs_offset = 1;
+  static constexpr size_t reply_inputs_size = 10;
+
   espp::FloatRangeMapper thumbstick_range_mapper_;
 
   bool hid_ready_ = false; // set after device info has been queried
 
   uint8_t input_report_mode_ = 0; // standard (0x30), nfc/ir (0x31), simpleHID (0x3F)
   uint8_t player_number_ = 0;     // valid values are 1, 2, 3, and 4
+  uint8_t player_lights_ = 0;     // player lights bitfield set by the host
   bool vibration_enabled_ = false;
   uint8_t vibrator_report_{0}; // randomly selected from sp::vibrator_bytes
   bool imu_enabled_ = false;
   uint8_t input_report_id_ = 0x21;
-  sp::TriggerTimes trigger_times_{};
-
-  struct TriggerButtonTimes {
-    uint64_t elapsed_time{0};
-    uint64_t press_start{0};
-  };
 
-  // Trigger button times for the 7 trigger buttons (l, r, zl, zr, sl, sr, home)
-  TriggerButtonTimes trigger_button_times_[7]{};
-  static constexpr size_t trigger_button_count =
-      sizeof(trigger_button_times_) / sizeof(trigger_button_times_[0]);
+  // Trigger buttons (l, r, zl, zr, sl, sr, home) whose elapsed press times are
+  // reported by subcommand 0x04
+  static constexpr size_t trigger_button_count = 7;
   static constexpr size_t l_trigger_index = 0;
   static constexpr size_t r_trigger_index = 1;
   static constexpr size_t zl_trigger_index = 2;
@@ -170,19 +261,53 @@ protected:
   static constexpr size_t sr_trigger_index = 5;
   static constexpr size_t home_trigger_index = 6;
 
-  void update_trigger_button_times(const GamepadInputs &inputs);
-  void update_trigger_button_index(bool pressed, size_t index, uint64_t &now);
+  // Press state of the trigger buttons. This only changes (and is only
+  // published) when a trigger button is pressed or released; the elapsed times
+  // are computed from it when the host actually requests them. It has no member
+  // initializers so that it stays trivial for the SeqLock; value-initialize it.
+  struct TriggerButtonState {
+    uint8_t pressed;                            // bitmask of trigger indices
+    uint64_t press_start[trigger_button_count]; // time of the last press (us)
+    uint64_t held_time[trigger_button_count];   // duration of the last press (us)
+  };
+
+  void update_trigger_button_times(bool l, bool r, bool zl, bool zr, bool home);
+  void set_housekeeping_data();
+
+  /// Compute the trigger button elapsed times (subcommand 0x04 reply)
+  /// @param now The current time in microseconds
+  /// @return The elapsed times, in units of 10ms
+  sp::TriggerTimes get_trigger_times(uint64_t now) const;
+
+  /// Get the value of the 4.96ms timer counter (byte 0 of the input report)
+  /// @return The counter value
+  uint8_t get_counter() const;
+
+  /// Publish input_report_ to the readers. Must be called with writer_mutex_
+  /// held.
+  void publish_input_report();
+
+  /// Copy the most recently published input report into the buffer, with the
+  /// current counter value.
+  /// @param buffer The buffer to copy the input report data into
+  /// @return The number of bytes copied, 0 if the buffer is too small
+  size_t read_input_report(std::span<uint8_t> buffer) const;
 
   using InputReport = espp::SwitchProGamepadInputReport<>;
+  typedef std::array<uint8_t, max_report_size> InputReportData;
+
+  // input_report_ and trigger_button_state_ are only touched by the writer
+  // (the BLE task); readers (the USB task) use the published snapshots, so
+  // they never wait on the writer (or vice versa). writer_mutex_ only
+  // serializes writers, of which there is normally one.
   InputReport input_report_;
-  std::recursive_mutex input_report_mutex_;
-
-  espp::HighResolutionTimer counter_timer_{{
-      .name = "Switch Pro Counter Timer",
-      .callback =
-          [this]() {
-            std::lock_guard<std::recursive_mutex> lock(input_report_mutex_);
-            input_report_.increment_counter();
-          },
-  }};
+  size_t input_report_size_{0};
+  TriggerButtonState trigger_button_state_{};
+  mutable std::mutex writer_mutex_;
+  SeqLock<InputReportData> input_snapshot_;
+  SeqLock<TriggerButtonState> trigger_button_snapshot_;
+
+  // The counter is derived from the time since construction when a report is
+  // built, rather than being incremented by a timer.
+  uint64_t counter_start_us_{0};
 }; // class SwitchPro
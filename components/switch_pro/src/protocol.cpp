@@ -1,5 +1,7 @@
+#include "metrics.hpp"
 #include "switch_pro.hpp"
 #include "switch_pro_spi_rom_data.hpp"
+#include "trace_ring.hpp"
 
 #if defined(ESP_PLATFORM)
 #include <esp_random.h>
@@ -11,7 +13,7 @@ using namespace sp;
 
 // SWITCH blocks on 0x81 0x01 and 0x21 0x03
 
-static void replace_subarray(std::vector<uint8_t> &arr, size_t start, size_t end,
+static void replace_subarray(std::span<uint8_t> arr, size_t start, size_t end,
                              const uint8_t *replace_arr) {
   for (size_t i = start; i < end; i++) {
     arr[i] = replace_arr[i - start];
@@ -23,91 +25,133 @@ static void replace_subarray(std::vector<uint8_t> &arr, size_t start, size_t end
 // the best protocol implementation I could find for Joycon / Switch Pro
 // controllers.
 
-GamepadDevice::ReportData SwitchPro::process_command(const uint8_t *data, size_t len) {
+constexpr SwitchPro::SubcommandTable SwitchPro::make_subcommand_table() {
+  // See
+  // https://github.com/dekuNukem/Nintendo_Switch_Reverse_Engineering/blob/master/bluetooth_hid_subcommands_notes.md
+  // for the ACK bytes / reply data. Subcommands which are not listed here get
+  // the unknown subcommand reply.
+  constexpr Subcommand subcommands[] = {
+      {Response::ONLY_CONTROLLER_STATE, 0x80},
+      {Response::BT_MANUAL_PAIRING, 0x81},
+      {Response::REQUEST_DEVICE_INFO, 0x82, 1, &SwitchPro::set_device_info,
+       &SwitchPro::request_device_info},
+      {Response::SET_MODE, 0x80, 2, nullptr, &SwitchPro::set_mode},
+      {Response::TRIGGER_BUTTONS_ELAPSED, 0x83, 1, nullptr, &SwitchPro::set_trigger_buttons},
+      {Response::GET_PAGE_LIST_STATE, 0x80},
+      {Response::SET_HCI_STATE, 0x80},
+      {Response::SET_SHIPMENT, 0x80},
+      {Response::SPI_READ, 0x90, 6, nullptr, &SwitchPro::spi_read},
+      {Response::SPI_WRITE, 0x80, 6, nullptr, &SwitchPro::spi_write},
+      {Response::SPI_SECTOR_ERASE, 0x80},
+      {Response::RESET_NFC_IR, 0x80},
+      {Response::SET_NFC_IR_CONFIG, 0xA0, 1, &SwitchPro::set_nfc_ir_config},
+      {Response::SET_NFC_IR_STATE, 0x80},
+      {Response::SET_UNKNOWN_DATA, 0x80},
+      {Response::RESET_UNKNOWN_DATA, 0x80},
+      {Response::SET_UNKNOWN_NFC_IR_DATA_A, 0x80},
+      {Response::GET_UNKNOWN_NFC_IR_DATA_A, 0xA8},
+      {Response::SET_GPIO_PORT_2, 0x80},
+      {Response::GET_NFC_IR_DATA_29, 0xA9},
+      {Response::SET_PLAYER, 0x80, 2, nullptr, &SwitchPro::set_player_lights},
+      {Response::GET_PLAYER, 0xB0, 1, nullptr, &SwitchPro::get_player_lights},
+      {Response::SET_HOME_LIGHT, 0x80},
+      {Response::TOGGLE_IMU, 0x80, 2, nullptr, &SwitchPro::toggle_imu},
+      {Response::SET_IMU_SENSITIVITY, 0x80},
+      {Response::WRITE_IMU_REGISTERS, 0x80},
+      {Response::READ_IMU_REGISTERS, 0xC0, 3, nullptr, &SwitchPro::read_imu_registers},
+      {Response::ENABLE_VIBRATION, 0x82, 1, nullptr, &SwitchPro::enable_vibration},
+      {Response::GET_REGULATED_VOLTAGE, 0xD0, 1, &SwitchPro::set_regulated_voltage},
+      {Response::SET_GPIO_PORT_1, 0x80},
+      {Response::GET_GPIO_VALUE, 0x80},
+  };
+  static_assert(std::size(subcommands) == subcommand_count,
+                "subcommand_count must match the number of supported subcommands");
+
+  SubcommandTable table{};
+  // entry 0 (which every unlisted id maps to) is the unknown subcommand
+  table.subcommands[0] = {Response::ONLY_CONTROLLER_STATE, 0};
+  for (size_t i = 0; i < std::size(subcommands); i++) {
+    table.subcommands[i + 1] = subcommands[i];
+    table.index[static_cast<uint8_t>(subcommands[i].id)] = i + 1;
+  }
+  return table;
+}
+
+const SwitchPro::SubcommandTable SwitchPro::subcommand_table_ = SwitchPro::make_subcommand_table();
+
+void SwitchPro::build_reply_templates() {
+  for (size_t i = 0; i < reply_templates_.size(); i++) {
+    const auto &subcommand = subcommand_table_.subcommands[i];
+    auto &reply = reply_templates_[i];
+    reply.fill(0);
+    if (subcommand.ack == 0) {
+      // the id is filled in by set_unknown_subcommand() when replying
+      set_unknown_subcommand(reply, 0x00);
+      continue;
+    }
+    // ACK byte
+    reply[12] = subcommand.ack;
+    // Subcommand reply
+    reply[13] = static_cast<uint8_t>(subcommand.id);
+    if (subcommand.build) {
+      (this->*subcommand.build)(reply);
+    }
+  }
+}
+
+size_t SwitchPro::process_command(const uint8_t *data, size_t len, uint8_t &report_id,
+                                  std::span<uint8_t> report) {
   // Parsing the Switch's message
   Message message(data, len);
 
-  // prep most common response, which contains the full input report
-  std::vector<uint8_t> report;
-
-  {
-    std::lock_guard<std::recursive_mutex> lock(input_report_mutex_);
-    report = input_report_.get_report();
+  if (report.size() < REPORT_SIZE) {
+    return 0;
   }
 
-  report[12] = 0x80;
-  report[13] = message.subcommand_id;
-
-  // for sanity, go ahead and set the next byte to 0
-  report[14] = 0;
+  if (message.subcommand) {
+    MetricsRegistry::get().increment_subcommand(message.subcommand_id);
+  }
+  trace(TraceEvent::SUBCOMMAND_BEGIN, message.subcommand_id, message.subcommand_size);
+
+  size_t index = message.subcommand ? subcommand_table_.index[message.subcommand_id] : 0;
+  const auto &subcommand = subcommand_table_.subcommands[index];
+
+  // start from the prebuilt reply (ACK, subcommand id and any constant data)
+  // and patch in the current inputs
+  const auto &reply = reply_templates_[index];
+  std::copy(reply.begin(), reply.end(), report.begin());
+  auto inputs = input_snapshot_.load();
+  std::copy_n(inputs.begin() + reply_inputs_offset, reply_inputs_size,
+              report.begin() + reply_inputs_offset);
+
+  if (subcommand.ack == 0 || message.subcommand_size < subcommand.min_size) {
+    // Currently set so that the controller ignores any unknown (or
+    // malformed) subcommands. This is better than sending a NACK response
+    // since we'd just get stuck in an infinite loop arguing with the Switch.
+    if (index != 0) {
+      std::copy(reply_templates_[0].begin(), reply_templates_[0].end(), report.begin());
+      std::copy_n(inputs.begin() + reply_inputs_offset, reply_inputs_size,
+                  report.begin() + reply_inputs_offset);
+    }
+    report[0] = get_counter();
+    set_unknown_subcommand(report, message.subcommand_id);
+    report_id = input_report_id_;
+    trace(TraceEvent::SUBCOMMAND_END, message.subcommand_id, 0);
+    return REPORT_SIZE;
+  }
 
   // Responding to the parsed message
-  if (message.response == Response::ONLY_CONTROLLER_STATE) {
-    set_subcommand_reply(report);
-    // ACK byte
-    report[12] = 0x80;
-    // Subcommand reply
-    report[13] = 0x00;
-  } else if (message.response == Response::BT_MANUAL_PAIRING) {
-    set_subcommand_reply(report);
-    // ACK byte
-    report[12] = 0x81;
-    // Subcommand reply
-    report[13] = 0x01;
-  } else if (message.response == Response::REQUEST_DEVICE_INFO) {
-    hid_ready_ = true;
-    set_subcommand_reply(report);
-    set_device_info(report);
-  } else if (message.response == Response::SET_SHIPMENT) {
-    set_subcommand_reply(report);
-    set_shipment(report);
-  } else if (message.response == Response::SPI_READ) {
-    set_subcommand_reply(report);
-    spi_read(report, message);
-  } else if (message.response == Response::SET_MODE) {
-    set_subcommand_reply(report);
-    set_mode(report, message);
-  } else if (message.response == Response::TRIGGER_BUTTONS_ELAPSED) {
-    set_subcommand_reply(report);
-    set_trigger_buttons(report);
-  } else if (message.response == Response::TOGGLE_IMU) {
-    set_subcommand_reply(report);
-    toggle_imu(report, message);
-  } else if (message.response == Response::ENABLE_VIBRATION) {
-    set_subcommand_reply(report);
-    enable_vibration(report);
-  } else if (message.response == Response::SET_PLAYER) {
-    set_subcommand_reply(report);
-    set_player_lights(report, message);
-  } else if (message.response == Response::SET_NFC_IR_STATE) {
-    set_subcommand_reply(report);
-    set_nfc_ir_state(report);
-  } else if (message.response == Response::SET_NFC_IR_CONFIG) {
-    set_subcommand_reply(report);
-    set_nfc_ir_config(report);
-    // Bad Packet handling statements
-  } else if (message.response == Response::UNKNOWN_SUBCOMMAND) {
-    // Currently set so that the controller ignores any unknown
-    // subcommands. This is better than sending a NACK response
-    // since we'd just get stuck in an infinite loop arguing
-    // with the Switch.
-    // set_full_input_report(report);
-    set_unknown_subcommand(report, message.subcommand_id);
-  } else if (message.response == Response::NO_DATA) {
-    set_unknown_subcommand(report, message.subcommand_id);
-    // set_full_input_report(report);
-  } else if (message.response == Response::TOO_SHORT) {
-    set_unknown_subcommand(report, message.subcommand_id);
-    // set_full_input_report(report);
-  } else if (message.response == Response::MALFORMED) {
-    set_unknown_subcommand(report, message.subcommand_id);
-    // set_full_input_report(report);
+  if (subcommand.handle) {
+    (this->*subcommand.handle)(report, message);
   }
 
-  return {input_report_id_, report};
+  set_subcommand_reply(report);
+  report_id = input_report_id_;
+  trace(TraceEvent::SUBCOMMAND_END, message.subcommand_id, subcommand.ack);
+  return REPORT_SIZE;
 }
 
-void SwitchPro::set_subcommand_reply(std::vector<uint8_t> &report) {
+void SwitchPro::set_subcommand_reply(std::span<uint8_t> report) {
   // Input Report ID
   input_report_id_ = 0x21;
 
@@ -123,8 +167,7 @@ void SwitchPro::set_subcommand_reply(std::vector<uint8_t> &report) {
 #if defined(ESP_PLATFORM)
   vibrator_report_ = sp::vibrator_bytes[esp_random() % max_index];
 #else
-  std::random_device rd;
-  std::mt19937 gen(rd());
+  static std::mt19937 gen(std::random_device{}());
   std::uniform_int_distribution<int> dis(0, max_index - 1);
   vibrator_report_ = sp::vibrator_bytes[dis(gen)];
 #endif
@@ -132,7 +175,7 @@ void SwitchPro::set_subcommand_reply(std::vector<uint8_t> &report) {
   set_standard_input_report(report);
 }
 
-void SwitchPro::set_unknown_subcommand(std::vector<uint8_t> &report, uint8_t subcommand_id) {
+void SwitchPro::set_unknown_subcommand(std::span<uint8_t> report, uint8_t subcommand_id) {
   // Set ACK
   report[12] = 0x80;
   // Set unknown subcommand ID
@@ -141,19 +184,16 @@ void SwitchPro::set_unknown_subcommand(std::vector<uint8_t> &report, uint8_t sub
   report[14] = 0x03;
 }
 
-void SwitchPro::set_full_input_report(std::vector<uint8_t> &report) {
+void SwitchPro::set_full_input_report(std::span<uint8_t> report) {
   // Setting Report ID to full standard input report ID
   input_report_id_ = 0x30;
   set_standard_input_report(report);
   set_imu_data(report);
 }
 
-void SwitchPro::set_standard_input_report(std::vector<uint8_t> &report) {
+void SwitchPro::set_standard_input_report(std::span<uint8_t> report) {
   // set the timer regardless
-  {
-    std::lock_guard<std::recursive_mutex> lock(input_report_mutex_);
-    report[0] = input_report_.get_counter();
-  }
+  report[0] = get_counter();
   if (hid_ready_) {
     // do nothing, we started off with the correct values. all we have to do is
     // set the vibrator byte
@@ -164,12 +204,7 @@ void SwitchPro::set_standard_input_report(std::vector<uint8_t> &report) {
   }
 }
 
-void SwitchPro::set_device_info(std::vector<uint8_t> &report) {
-  // ACK Reply
-  report[12] = 0x82;
-  // Subcommand Reply
-  report[13] = 0x02;
-
+void SwitchPro::set_device_info(std::span<uint8_t> report) {
   // copy the device info data into the report
   replace_subarray(report, 14, 14 + sizeof(sp::device_info), sp::device_info);
 
@@ -177,28 +212,29 @@ void SwitchPro::set_device_info(std::vector<uint8_t> &report) {
   std::memcpy(report.data() + 18, mac_address_.data(), mac_address_.size());
 }
 
-void SwitchPro::set_shipment(std::vector<uint8_t> &report) {
-  // ACK Reply
-  report[12] = 0x80;
-
-  // Subcommand reply
-  report[13] = 0x08;
+void SwitchPro::request_device_info(std::span<uint8_t>, const sp::Message &) {
+  // the device info itself is in the reply template
+  hid_ready_ = true;
 }
 
-void SwitchPro::toggle_imu(std::vector<uint8_t> &report, sp::Message &message) {
+void SwitchPro::toggle_imu(std::span<uint8_t>, const sp::Message &message) {
   if (message.subcommand[1] == 0x01)
     imu_enabled_ = true;
   else
     imu_enabled_ = false;
+}
 
-  // ACK Reply
-  report[12] = 0x80;
-
-  // Subcommand reply
-  report[13] = 0x40;
+void SwitchPro::read_imu_registers(std::span<uint8_t> report, const sp::Message &message) {
+  // Replies with the requested start address and count, followed by the
+  // register values. We don't have an IMU, so they read as 0.
+  uint8_t address = message.subcommand[1];
+  uint8_t count = std::min<uint8_t>(message.subcommand[2], 0x20);
+  report[14] = address;
+  report[15] = count;
+  std::fill_n(report.begin() + 16, count, 0);
 }
 
-void SwitchPro::set_imu_data(std::vector<uint8_t> &report) {
+void SwitchPro::set_imu_data(std::span<uint8_t> report) {
 
   if (!imu_enabled_)
     return;
@@ -207,7 +243,7 @@ void SwitchPro::set_imu_data(std::vector<uint8_t> &report) {
                                          0xFF, 0xE0, 0xFF, 0x72, 0xFD, 0xF9, 0xFF, 0x0A, 0x10,
                                          0x22, 0x00, 0xD5, 0xFF, 0xE0, 0xFF, 0x76, 0xFD, 0xFC,
                                          0xFF, 0x09, 0x10, 0x23, 0x00, 0xD5, 0xFF, 0xE0, 0xFF};
-  replace_subarray(report, 12, 49, imu_data);
+  replace_subarray(report, 12, 12 + sizeof(imu_data), imu_data);
 }
 
 uint8_t SwitchPro::spi_read_impl(uint8_t bank, uint8_t reg, uint8_t read_length,
@@ -230,13 +266,18 @@ uint8_t SwitchPro::spi_read_impl(uint8_t bank, uint8_t reg, uint8_t read_length,
   return 0;
 }
 
-void SwitchPro::spi_read(std::vector<uint8_t> &report, sp::Message &message) {
+void SwitchPro::spi_read(std::span<uint8_t> report, const sp::Message &message) {
   uint8_t addr_top = message.subcommand[2];
   uint8_t addr_bottom = message.subcommand[1];
   uint8_t read_length = message.subcommand[5];
 
+  // make sure the read fits in the reply, otherwise NACK it below
+  static constexpr size_t spi_data_offset = 19;
+  bool fits = spi_data_offset + read_length <= report.size();
+
   // try to read from SPI
-  if (spi_read_impl(addr_top, addr_bottom, read_length, report.data() + 19) > 0) {
+  if (fits &&
+      spi_read_impl(addr_top, addr_bottom, read_length, report.data() + spi_data_offset) > 0) {
     // If it succeeded, set the response / SPI header
     // ACK byte
     report[12] = 0x90;
@@ -259,23 +300,42 @@ void SwitchPro::spi_read(std::vector<uint8_t> &report, sp::Message &message) {
   return;
 }
 
-void SwitchPro::set_mode(std::vector<uint8_t> &report, sp::Message &message) {
-  // ACK byte
-  report[12] = 0x80;
+bool SwitchPro::spi_write_impl(uint8_t bank, uint8_t reg, uint8_t write_length,
+                               const uint8_t *data) {
+  using namespace sp;
+  if (bank == REG_BANK_FACTORY_CONFIG && reg + write_length <= spi_rom_factory_data.size()) {
+    std::memcpy(spi_rom_factory_data.begin() + reg, data, write_length);
+    return true;
+  } else if (bank == REG_BANK_USER_CAL && reg + write_length <= spi_rom_user_data.size()) {
+    std::memcpy(spi_rom_user_data.begin() + reg, data, write_length);
+    return true;
+  }
+  return false;
+}
 
-  // Subcommand reply
-  report[13] = 0x03;
+void SwitchPro::spi_write(std::span<uint8_t> report, const sp::Message &message) {
+  uint8_t addr_top = message.subcommand[2];
+  uint8_t addr_bottom = message.subcommand[1];
+  uint8_t write_length = message.subcommand[5];
 
-  input_report_mode_ = message.subcommand[1]; // 0x30 (standard), 0x31 (nfc/ir), 0x3F (simple)
-}
+  // the data to write follows the address and length
+  static constexpr size_t spi_write_data_offset = 6;
+  bool fits = spi_write_data_offset + write_length <= message.subcommand_size;
 
-void SwitchPro::set_trigger_buttons(std::vector<uint8_t> &report) {
-  // ACK byte
-  report[12] = 0x83;
+  // Status: 0x00 = success, 0x01 = write protected
+  if (fits && spi_write_impl(addr_top, addr_bottom, write_length,
+                             message.subcommand + spi_write_data_offset)) {
+    report[14] = 0x00;
+  } else {
+    report[14] = 0x01;
+  }
+}
 
-  // Subcommand reply
-  report[13] = 0x04;
+void SwitchPro::set_mode(std::span<uint8_t>, const sp::Message &message) {
+  input_report_mode_ = message.subcommand[1]; // 0x30 (standard), 0x31 (nfc/ir), 0x3F (simple)
+}
 
+void SwitchPro::set_trigger_buttons(std::span<uint8_t> report, const sp::Message &) {
   // see
   // https://github.com/dekuNukem/Nintendo_Switch_Reverse_Engineering/blob/master/bluetooth_hid_subcommands_notes.md#subcommand-0x04-trigger-buttons-elapsed-time
   //
@@ -287,28 +347,18 @@ void SwitchPro::set_trigger_buttons(std::vector<uint8_t> &report) {
   // e.g.
   // Left_trigger_ms = ((byte[1] << 8) | byte[0]) * 10;
 
-  std::memcpy(report.data() + 14, &trigger_times_, sizeof(trigger_times_));
+  auto trigger_times = get_trigger_times(esp_timer_get_time());
+  std::memcpy(report.data() + 14, &trigger_times, sizeof(trigger_times));
 }
 
-void SwitchPro::enable_vibration(std::vector<uint8_t> &report) {
-  // ACK Reply
-  report[12] = 0x82;
-
-  // Subcommand reply
-  report[13] = 0x48;
-
+void SwitchPro::enable_vibration(std::span<uint8_t>, const sp::Message &) {
   // Set class property
   vibration_enabled_ = true;
 }
 
-void SwitchPro::set_player_lights(std::vector<uint8_t> &report, sp::Message &message) {
-  // ACK byte
-  report[12] = 0x80;
-
-  // Subcommand reply
-  report[13] = 0x30;
-
+void SwitchPro::set_player_lights(std::span<uint8_t>, const sp::Message &message) {
   uint8_t bitfield = message.subcommand[1];
+  player_lights_ = bitfield;
 
   if (bitfield == 0x01 || bitfield == 0x10) {
     player_number_ = 1;
@@ -321,23 +371,21 @@ void SwitchPro::set_player_lights(std::vector<uint8_t> &report, sp::Message &mes
   }
 }
 
-void SwitchPro::set_nfc_ir_state(std::vector<uint8_t> &report) {
-  // ACK byte
-  report[12] = 0x80;
-
-  // Subcommand reply
-  report[13] = 0x22;
+void SwitchPro::get_player_lights(std::span<uint8_t> report, const sp::Message &) {
+  // Replies with the bitfield the host last set
+  report[14] = player_lights_;
 }
 
-void SwitchPro::set_nfc_ir_config(std::vector<uint8_t> &report) {
-  // ACK byte
-  report[12] = 0xA0;
-
-  // Subcommand reply
-  report[13] = 0x21;
+void SwitchPro::set_regulated_voltage(std::span<uint8_t> report) {
+  // Little-endian uint16 in mV, 1560 mV is a full battery
+  static constexpr uint16_t regulated_voltage_mv = 0x0618;
+  report[14] = regulated_voltage_mv & 0xFF;
+  report[15] = regulated_voltage_mv >> 8;
+}
 
+void SwitchPro::set_nfc_ir_config(std::span<uint8_t> report) {
   // NFC/IR state data
   static constexpr uint8_t params[] = {0x01, 0x00, 0xFF, 0x00, 0x08, 0x00, 0x1B, 0x01};
-  replace_subarray(report, 14, 8, params);
+  replace_subarray(report, 14, 14 + sizeof(params), params);
   report[47] = 0xC8;
 }
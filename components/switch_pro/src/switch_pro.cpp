@@ -1,4 +1,5 @@
 #include "switch_pro.hpp"
+#include "trace_ring.hpp"
 
 const DeviceInfo SwitchPro::device_info{
     .vid = SwitchPro::vid,
@@ -11,11 +12,15 @@ const DeviceInfo SwitchPro::device_info{
 };
 
 void SwitchPro::set_report_data(uint8_t report_id, const uint8_t *data, size_t len) {
+  set_report_data(report_id, std::span<const uint8_t>(data, len));
+}
+
+void SwitchPro::set_report_data(uint8_t report_id, std::span<const uint8_t> data) {
   switch (report_id) {
   case input_report_.ID: {
-    std::vector<uint8_t> data_vec(data, data + len);
-    std::lock_guard<std::recursive_mutex> lock(input_report_mutex_);
-    input_report_.set_data(data_vec);
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    write_report(input_report_, input_report_size_, data);
+    publish_input_report();
     break;
   }
   default:
@@ -29,16 +34,55 @@ std::vector<uint8_t> SwitchPro::get_report_data(uint8_t report_id) const {
     return {};
   }
   switch (report_id) {
-  case input_report_.ID:
-    return input_report_.get_report();
+  case input_report_.ID: {
+    std::vector<uint8_t> report(input_report_size_);
+    read_input_report(report);
+    return report;
+  }
   default:
     return {};
   }
 }
 
+size_t SwitchPro::get_report_data(uint8_t report_id, std::span<uint8_t> buffer) const {
+  if (!hid_ready_) {
+    return 0;
+  }
+  switch (report_id) {
+  case input_report_.ID:
+    return read_input_report(buffer);
+  default:
+    return 0;
+  }
+}
+
+size_t SwitchPro::read_input_report(std::span<uint8_t> buffer) const {
+  if (buffer.size() < input_report_size_) {
+    return 0;
+  }
+  auto snapshot = input_snapshot_.load();
+  std::copy_n(snapshot.begin(), input_report_size_, buffer.begin());
+  buffer[0] = get_counter();
+  return input_report_size_;
+}
+
+void SwitchPro::publish_input_report() {
+  InputReportData snapshot{};
+  read_report(input_report_, input_report_size_, snapshot);
+  input_snapshot_.store(snapshot);
+}
+
+uint8_t SwitchPro::get_counter() const {
+  // equivalent to incrementing the (wrapping) counter every counter_period_us
+  // since construction
+  uint64_t elapsed = esp_timer_get_time() - counter_start_us_;
+  return (elapsed / counter_period_us) & 0xFF;
+}
+
 // Gamepad inputs
 GamepadInputs SwitchPro::get_gamepad_inputs() const {
   GamepadInputs inputs{};
+  std::lock_guard<std::mutex> lock(writer_mutex_);
 
   input_report_.get_buttons(inputs.buttons);
   input_report_.get_left_joystick(inputs.left_joystick.x, inputs.left_joystick.y);
@@ -50,7 +94,7 @@ GamepadInputs SwitchPro::get_gamepad_inputs() const {
 }
 
 void SwitchPro::set_gamepad_inputs(const GamepadInputs &inputs) {
-  std::lock_guard<std::recursive_mutex> lock(input_report_mutex_);
+  std::lock_guard<std::mutex> lock(writer_mutex_);
   input_report_.reset();
 
   input_report_.set_buttons(inputs.buttons);
@@ -60,8 +104,29 @@ void SwitchPro::set_gamepad_inputs(const GamepadInputs &inputs) {
   input_report_.set_accelerator(inputs.r2.value);
 
   // update trigger buttons elapsed times (for l,r, zl, zr, sl, sr, and home).
-  update_trigger_button_times(inputs);
+  update_trigger_button_times(inputs.buttons.l1, inputs.buttons.r1, inputs.buttons.zl,
+                              inputs.buttons.zr, inputs.buttons.home);
+
+  set_housekeeping_data();
+  publish_input_report();
+}
+
+void SwitchPro::set_controller_state(const sp::ControllerState &state) {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  write_report(input_report_, input_report_size_,
+               std::span<const uint8_t>(reinterpret_cast<const uint8_t *>(&state), sizeof(state)),
+               sp::CONTROLLER_STATE_OFFSET);
+
+  uint32_t buttons = state.buttons[0] | (state.buttons[1] << 8) | (state.buttons[2] << 16);
+  update_trigger_button_times(buttons & sp::button::L, buttons & sp::button::R,
+                              buttons & sp::button::ZL, buttons & sp::button::ZR,
+                              buttons & sp::button::HOME);
 
+  set_housekeeping_data();
+  publish_input_report();
+}
+
+void SwitchPro::set_housekeeping_data() {
   // set housekeeping data
   input_report_.set_usb_powered(true);
   input_report_.set_battery_charging(true);
@@ -72,73 +137,112 @@ void SwitchPro::set_gamepad_inputs(const GamepadInputs &inputs) {
 }
 
 void SwitchPro::set_battery_level(uint8_t level) {
-  std::lock_guard<std::recursive_mutex> lock(input_report_mutex_);
+  std::lock_guard<std::mutex> lock(writer_mutex_);
   input_report_.set_battery_level(level);
+  publish_input_report();
 }
 
-void SwitchPro::update_trigger_button_times(const GamepadInputs &inputs) {
-  // for each of the trigger buttons, update the elapsed time.
-  uint64_t now = esp_timer_get_time();
-  update_trigger_button_index(inputs.buttons.l1, l_trigger_index, now);
-  update_trigger_button_index(inputs.buttons.r1, r_trigger_index, now);
-  update_trigger_button_index(inputs.buttons.zl, zl_trigger_index, now);
-  update_trigger_button_index(inputs.buttons.zr, zr_trigger_index, now);
+void SwitchPro::update_trigger_button_times(bool l, bool r, bool zl, bool zr, bool home) {
   // NOTE: we ignore sl/sr for now since we're a pro controller, so we just do home
-  update_trigger_button_index(inputs.buttons.home, home_trigger_index, now);
-
-  // Then for each of the trigger buttons, update the sp::TriggerTimes
-  // (trigger_times_) struct which holds the elapsed time in units of 10ms
-  // (i.e. 10 = 100ms)
+  uint8_t pressed = (l << l_trigger_index) | (r << r_trigger_index) | (zl << zl_trigger_index) |
+                    (zr << zr_trigger_index) | (home << home_trigger_index);
+  uint8_t changed = pressed ^ trigger_button_state_.pressed;
+  if (!changed) {
+    // nothing to record, the elapsed times are computed when requested
+    return;
+  }
+  uint64_t now = esp_timer_get_time();
   for (size_t i = 0; i < trigger_button_count; i++) {
-    trigger_times_.values[i] = trigger_button_times_[i].elapsed_time / 10'000; // convert us to 10ms
+    if (!(changed & (1 << i))) {
+      continue;
+    }
+    if (pressed & (1 << i)) {
+      trigger_button_state_.press_start[i] = now;
+    } else {
+      trigger_button_state_.held_time[i] = now - trigger_button_state_.press_start[i];
+    }
   }
+  trigger_button_state_.pressed = pressed;
+  trigger_button_snapshot_.store(trigger_button_state_);
 }
 
-void SwitchPro::update_trigger_button_index(bool pressed, size_t index, uint64_t &now) {
-  if (pressed) {
-    if (trigger_button_times_[index].press_start == 0) {
-      trigger_button_times_[index].press_start = now;
-    } else {
-      trigger_button_times_[index].elapsed_time = now - trigger_button_times_[index].press_start;
-    }
-  } else {
-    trigger_button_times_[index].press_start = 0;
+sp::TriggerTimes SwitchPro::get_trigger_times(uint64_t now) const {
+  auto state = trigger_button_snapshot_.load();
+  // The elapsed time is how long the button has been held, or, if it has been
+  // released, how long it was held for. The values are in units of 10ms (i.e.
+  // 10 = 100ms).
+  sp::TriggerTimes trigger_times{};
+  for (size_t i = 0; i < trigger_button_count; i++) {
+    uint64_t elapsed =
+        (state.pressed & (1 << i)) ? now - state.press_start[i] : state.held_time[i];
+    trigger_times.values[i] = elapsed / 10'000; // convert us to 10ms
   }
+  return trigger_times;
 }
 
 // HID handlers
 std::optional<GamepadDevice::ReportData> SwitchPro::on_attach() {
-  // copy the device init report data into a vector
-  auto data =
-      std::vector<uint8_t>(sp::device_init_report_data,
-                           sp::device_init_report_data + std::size(sp::device_init_report_data));
+  uint8_t report_id;
+  std::array<uint8_t, max_report_size> buffer;
+  size_t len = on_attach(report_id, buffer);
+  if (len == 0) {
+    return {};
+  }
+  return {{report_id, std::vector<uint8_t>(buffer.begin(), buffer.begin() + len)}};
+}
+
+size_t SwitchPro::on_attach(uint8_t &report_id, std::span<uint8_t> buffer) {
+  if (buffer.size() < sp::REPORT_SIZE) {
+    return 0;
+  }
+  // copy the device init report data into the buffer
+  std::copy(std::begin(sp::device_init_report_data), std::end(sp::device_init_report_data),
+            buffer.begin());
   // replace the mac address with our own
-  // then update the mac address
   std::copy(mac_address_.begin(), mac_address_.end(),
-            data.begin() + sp::device_init_report_data_mac_addr_offset);
+            buffer.begin() + sp::device_init_report_data_mac_addr_offset);
   // return data to start the initialization sequence
   // Kick off initialization sequence by providing device info
-  return {{sp::DEVICE_INIT_REPORT, data}};
+  report_id = sp::DEVICE_INIT_REPORT;
+  return sp::REPORT_SIZE;
 }
 
 std::optional<GamepadDevice::ReportData> SwitchPro::on_hid_report(uint8_t report_id,
                                                                   const uint8_t *data, size_t len) {
+  uint8_t response_report_id;
+  std::array<uint8_t, max_report_size> response;
+  size_t response_len = on_hid_report(report_id, std::span<const uint8_t>(data, len),
+                                      response_report_id, response);
+  if (response_len == 0) {
+    return {};
+  }
+  return {{response_report_id,
+           std::vector<uint8_t>(response.begin(), response.begin() + response_len)}};
+}
+
+size_t SwitchPro::on_hid_report(uint8_t report_id, std::span<const uint8_t> data,
+                                uint8_t &response_report_id, std::span<uint8_t> response) {
   // ignore the report_id
   (void)report_id;
 
   using namespace sp;
 
+  if (data.size() < 2 || response.size() < REPORT_SIZE) {
+    return 0;
+  }
+
   switch (data[0]) {
   case HOST_INIT_REPORT: {
     uint8_t cmd = data[1];
-    std::vector<uint8_t> resp(sp::REPORT_SIZE, 0);
-    resp[0] = cmd;
+    trace(TraceEvent::INIT_COMMAND, cmd);
+    std::fill_n(response.begin(), REPORT_SIZE, 0);
+    response[0] = cmd;
     switch (cmd) {
     case INIT_COMMAND_DEVICE_INFO:
       break;
     case INIT_COMMAND_HANDSHAKE:
       // copy the input data back into the response
-      std::copy(data + 1, data + len, resp.begin());
+      std::copy_n(data.begin() + 1, std::min(data.size() - 1, REPORT_SIZE), response.begin());
       break;
     case INIT_COMMAND_SET_BAUD_RATE:
       break;
@@ -150,10 +254,11 @@ std::optional<GamepadDevice::ReportData> SwitchPro::on_hid_report(uint8_t report
       // TODO: we should disable USB input reports, but probably doesn't matter
       break;
     }
-    return {{DEVICE_INIT_REPORT, resp}};
+    response_report_id = DEVICE_INIT_REPORT;
+    return REPORT_SIZE;
   }
   case HOST_OUTPUT_REPORT: {
-    return process_command(data, len);
+    return process_command(data.data(), data.size(), response_report_id, response);
   }
   case HOST_RUMBLE_REPORT: {
     // TODO: process the rumble packet
@@ -162,5 +267,5 @@ std::optional<GamepadDevice::ReportData> SwitchPro::on_hid_report(uint8_t report
     break;
   }
 
-  return {};
+  return 0;
 }
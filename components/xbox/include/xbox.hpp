@@ -8,7 +8,7 @@
 #include "gamepad_device.hpp"
 #include "hid-rp-xbox.hpp"
 
-class Xbox : public GamepadDevice {
+class Xbox final : public GamepadDevice {
 public:
   // Constructor
   explicit Xbox()
@@ -18,7 +18,13 @@ public:
                                  .maximum = InputReport::joystick_max})
       , trigger_range_mapper({.center = InputReport::trigger_center,
                               .minimum = InputReport::trigger_min,
-                              .maximum = InputReport::trigger_max}) {}
+                              .maximum = InputReport::trigger_max}) {
+    // cache the report sizes so that the span-based API does not need to
+    // allocate to find them
+    input_report_size_ = input_report.get_report().size();
+    rumble_report_size_ = rumble_report.get_report().size();
+    battery_report_size_ = battery_report.get_report().size();
+  }
 
   // Info
   virtual const DeviceInfo &get_device_info() const override { return device_info; }
@@ -30,6 +36,8 @@ public:
   }
   virtual void set_report_data(uint8_t report_id, const uint8_t *data, size_t len) override;
   std::vector<uint8_t> get_report_data(uint8_t report_id) const override;
+  virtual void set_report_data(uint8_t report_id, std::span<const uint8_t> data) override;
+  virtual size_t get_report_data(uint8_t report_id, std::span<uint8_t> buffer) const override;
 
   // Gamepad inputs
   virtual GamepadInputs get_gamepad_inputs() const override;
@@ -70,4 +78,8 @@ protected:
   using RumbleReport = espp::XboxRumbleOutputReport<>;
   RumbleReport rumble_report;
   static constexpr uint8_t rumble_report_id = RumbleReport::ID;
-}; // class SwitchPro
+
+  size_t input_report_size_{0};
+  size_t rumble_report_size_{0};
+  size_t battery_report_size_{0};
+}; // class Xbox
@@ -1,3 +1,4 @@
+#include "deferred_log.hpp"
 #include "xbox.hpp"
 
 const DeviceInfo Xbox::device_info = {.vid = Xbox::vid,
@@ -9,21 +10,27 @@ const DeviceInfo Xbox::device_info = {.vid = Xbox::vid,
                                       .serial_number = Xbox::serial};
 
 void Xbox::set_report_data(uint8_t report_id, const uint8_t *data, size_t len) {
-  std::vector<uint8_t> data_vec(data, data + len);
+  set_report_data(report_id, std::span<const uint8_t>(data, len));
+}
+
+void Xbox::set_report_data(uint8_t report_id, std::span<const uint8_t> data) {
   switch (report_id) {
   case input_report.ID:
-    input_report.set_data(data_vec);
+    write_report(input_report, input_report_size_, data);
     break;
   case rumble_report.ID:
-    rumble_report.set_data(data_vec);
+    write_report(rumble_report, rumble_report_size_, data);
     break;
   case battery_report.ID:
-    battery_report.set_data(data_vec);
+    write_report(battery_report, battery_report_size_, data);
     break;
-  default:
-    logger_.warn("Unknown report id: {}", report_id);
+  default: {
+    // this runs for every notification, so keep the formatting off this path
+    static LogSite<LogLevel::WARN> unknown_report_site{"Xbox", "Unknown report id: {}", 1'000'000};
+    deferred_log(unknown_report_site, report_id);
     break;
   }
+  }
 }
 
 std::vector<uint8_t> Xbox::get_report_data(uint8_t report_id) const {
@@ -39,6 +46,19 @@ std::vector<uint8_t> Xbox::get_report_data(uint8_t report_id) const {
   }
 }
 
+size_t Xbox::get_report_data(uint8_t report_id, std::span<uint8_t> buffer) const {
+  switch (report_id) {
+  case input_report.ID:
+    return read_report(input_report, input_report_size_, buffer);
+  case rumble_report.ID:
+    return read_report(rumble_report, rumble_report_size_, buffer);
+  case battery_report.ID:
+    return read_report(battery_report, battery_report_size_, buffer);
+  default:
+    return 0;
+  }
+}
+
 // Gamepad inputs
 GamepadInputs Xbox::get_gamepad_inputs() const {
   GamepadInputs inputs{};
@@ -76,7 +96,6 @@ void Xbox::set_gamepad_inputs(const GamepadInputs &inputs) {
 // HID handlers
 std::optional<GamepadDevice::ReportData> Xbox::on_attach() { return {}; }
 
-std::optional<GamepadDevice::ReportData> Xbox::on_hid_report(uint8_t report_id, const uint8_t *data,
-                                                             size_t len) {
+std::optional<GamepadDevice::ReportData> Xbox::on_hid_report(uint8_t, const uint8_t *, size_t) {
   return {};
 }
@@ -0,0 +1,103 @@
+// Counts heap allocations per report on the BLE -> USB translation path, for
+// both the std::vector based and the span-based (zero-allocation) device API.
+// Exits with a non-zero status if the span-based path allocates in steady
+// state.
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include "switch_pro.hpp"
+#include "xbox.hpp"
+
+#include "bench_common.hpp"
+
+static std::atomic<size_t> num_allocations{0};
+
+void *operator new(std::size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return ::operator new(size); }
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+/// Run fn(i) for iterations and return the number of allocations per call
+template <typename F> static double allocations_per_call(size_t iterations, F &&fn) {
+  // warm up, so that any lazy one-time allocations are not counted
+  fn(0);
+  size_t start = num_allocations.load();
+  for (size_t i = 0; i < iterations; i++) {
+    fn(i);
+  }
+  return double(num_allocations.load() - start) / iterations;
+}
+
+int main(int argc, char **argv) {
+  size_t iterations = bench::parse_iterations(argc, argv, 10'000);
+  auto reports = bench::make_xbox_reports(256);
+
+  std::shared_ptr<GamepadDevice> ble_gamepad = std::make_shared<Xbox>();
+  std::shared_ptr<GamepadDevice> usb_gamepad = std::make_shared<SwitchPro>();
+
+  const uint8_t enable_usb_hid[] = {sp::HOST_INIT_REPORT, sp::INIT_COMMAND_ENABLE_USB_HID};
+  usb_gamepad->on_hid_report(sp::HOST_INIT_REPORT, enable_usb_hid, sizeof(enable_usb_hid));
+
+  const uint8_t ble_report_id = ble_gamepad->get_input_report_id();
+  const uint8_t usb_report_id = usb_gamepad->get_input_report_id();
+
+  double vector_allocs = allocations_per_call(iterations, [&](size_t i) {
+    const auto &r = reports[i % reports.size()];
+    ble_gamepad->set_report_data(ble_report_id, r.data(), r.size());
+    auto inputs = ble_gamepad->get_gamepad_inputs();
+    inputs.left_joystick.y = -inputs.left_joystick.y;
+    inputs.right_joystick.y = -inputs.right_joystick.y;
+    usb_gamepad->set_gamepad_inputs(inputs);
+    auto report = usb_gamepad->get_report_data(usb_report_id);
+    bench::do_not_optimize(report.data());
+  });
+
+  std::array<uint8_t, GamepadDevice::max_report_size> report;
+  double span_allocs = allocations_per_call(iterations, [&](size_t i) {
+    const auto &r = reports[i % reports.size()];
+    ble_gamepad->set_report_data(ble_report_id, std::span<const uint8_t>(r));
+    auto inputs = ble_gamepad->get_gamepad_inputs();
+    inputs.left_joystick.y = -inputs.left_joystick.y;
+    inputs.right_joystick.y = -inputs.right_joystick.y;
+    usb_gamepad->set_gamepad_inputs(inputs);
+    size_t len = usb_gamepad->get_report_data(usb_report_id, report);
+    bench::do_not_optimize(len);
+  });
+
+  // a representative subcommand (0x10 SPI read of the stick calibration)
+  uint8_t spi_read[sp::REPORT_SIZE] = {sp::HOST_OUTPUT_REPORT};
+  spi_read[10] = 0x10;
+  spi_read[11] = 0x3D;
+  spi_read[12] = 0x60;
+  spi_read[15] = 0x12;
+  std::array<uint8_t, GamepadDevice::max_report_size> response;
+  double subcommand_allocs = allocations_per_call(iterations, [&](size_t) {
+    uint8_t response_report_id;
+    size_t len = usb_gamepad->on_hid_report(sp::HOST_OUTPUT_REPORT, spi_read, response_report_id,
+                                            response);
+    bench::do_not_optimize(len);
+  });
+
+  std::printf("heap allocations per report, %zu iterations\n", iterations);
+  std::printf("  vector api (notify path):  %.2f\n", vector_allocs);
+  std::printf("  span api   (notify path):  %.2f\n", span_allocs);
+  std::printf("  span api   (subcommand):   %.2f\n", subcommand_allocs);
+
+  if (span_allocs != 0.0) {
+    std::printf("FAIL: span-based notify path allocates in steady state\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bench {
+
+/// Size of the Xbox wireless controller BLE input report (without report id)
+static constexpr size_t xbox_report_size = 16;
+typedef std::array<uint8_t, xbox_report_size> XboxReport;
+
+/// Build a raw Xbox BLE input report.
+/// @param lx, ly, rx, ry Joystick axes [0, 65535]
+/// @param lt, rt Trigger axes [0, 1023]
+/// @param hat Hat switch (0 = centered, 1-8 = N, NE, E, ...)
+/// @param buttons Button bitfield (15 buttons)
+inline XboxReport make_xbox_report(uint16_t lx, uint16_t ly, uint16_t rx, uint16_t ry, uint16_t lt,
+                                   uint16_t rt, uint8_t hat, uint16_t buttons) {
+  XboxReport r{};
+  auto put16 = [&](size_t offset, uint16_t value) {
+    r[offset] = value & 0xFF;
+    r[offset + 1] = value >> 8;
+  };
+  put16(0, lx);
+  put16(2, ly);
+  put16(4, rx);
+  put16(6, ry);
+  put16(8, lt & 0x3FF);
+  put16(10, rt & 0x3FF);
+  r[12] = hat;
+  put16(13, buttons & 0x7FFF);
+  r[15] = 0;
+  return r;
+}
+
+/// Deterministic set of reports which sweeps the sticks, triggers, hat and
+/// buttons so that every branch of the translation path is exercised.
+inline std::vector<XboxReport> make_xbox_reports(size_t count) {
+  std::vector<XboxReport> reports;
+  reports.reserve(count);
+  uint32_t state = 0x12345678;
+  auto next = [&state]() {
+    // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  };
+  for (size_t i = 0; i < count; i++) {
+    uint32_t a = next();
+    uint32_t b = next();
+    uint32_t c = next();
+    reports.push_back(make_xbox_report(a & 0xFFFF, a >> 16, b & 0xFFFF, b >> 16, c & 0x3FF,
+                                       (c >> 10) & 0x3FF, (c >> 20) % 9, next() & 0x7FFF));
+  }
+  return reports;
+}
+
+/// Parse `--iterations N` from the command line
+inline size_t parse_iterations(int argc, char **argv, size_t default_iterations) {
+  for (int i = 1; i < argc - 1; i++) {
+    if (std::string_view(argv[i]) == "--iterations") {
+      return std::strtoull(argv[i + 1], nullptr, 10);
+    }
+  }
+  return default_iterations;
+}
+
+struct Result {
+  double ns_per_op_min;
+  double ns_per_op_median;
+};
+
+/// Run `fn(i)` for `iterations` iterations, `runs` times, and print the
+/// min / median time per call.
+template <typename F>
+Result run(std::string_view name, size_t iterations, F &&fn, size_t runs = 7) {
+  std::vector<double> samples;
+  samples.reserve(runs);
+  // warm up
+  for (size_t i = 0; i < std::min<size_t>(iterations, 1000); i++) {
+    fn(i);
+  }
+  for (size_t r = 0; r < runs; r++) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      fn(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    samples.push_back(ns / iterations);
+  }
+  std::sort(samples.begin(), samples.end());
+  Result result{samples.front(), samples[samples.size() / 2]};
+  std::printf("%-40.*s %10.1f ns/op (min) %10.1f ns/op (median)\n", (int)name.size(), name.data(),
+              result.ns_per_op_min, result.ns_per_op_median);
+  return result;
+}
+
+/// Prevent the compiler from optimizing away a value
+template <typename T> inline void do_not_optimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+} // namespace bench
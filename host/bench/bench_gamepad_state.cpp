@@ -0,0 +1,100 @@
+// Compares the cost of mapping raw Xbox report values into the float
+// GamepadInputs (through espp::FloatRangeMapper) with mapping them into the
+// integer GamepadState (through FixedRangeMapper), as well as the cost of the
+// conversion helpers between the two representations.
+
+#include "range_mapper.hpp"
+
+#include "fixed_range_mapper.hpp"
+#include "gamepad_state.hpp"
+
+#include "bench_common.hpp"
+
+struct RawInputs {
+  uint16_t axes[4];
+  uint16_t triggers[2];
+  uint32_t buttons;
+};
+
+int main(int argc, char **argv) {
+  size_t iterations = bench::parse_iterations(argc, argv, 1'000'000);
+
+  auto reports = bench::make_xbox_reports(1024);
+  std::vector<RawInputs> inputs;
+  inputs.reserve(reports.size());
+  for (const auto &r : reports) {
+    RawInputs raw{};
+    for (int i = 0; i < 4; i++) {
+      raw.axes[i] = r[2 * i] | (r[2 * i + 1] << 8);
+    }
+    raw.triggers[0] = r[8] | (r[9] << 8);
+    raw.triggers[1] = r[10] | (r[11] << 8);
+    raw.buttons = r[13] | (r[14] << 8);
+    inputs.push_back(raw);
+  }
+
+  espp::FloatRangeMapper float_stick({.center = 32767, .minimum = 0, .maximum = 65535});
+  espp::FloatRangeMapper float_stick_inverted(
+      {.center = 32767, .minimum = 0, .maximum = 65535, .invert_output = true});
+  espp::FloatRangeMapper float_trigger({.center = 0, .minimum = 0, .maximum = 1023});
+  bench::run("float GamepadInputs (FloatRangeMapper)", iterations, [&](size_t i) {
+    const auto &raw = inputs[i % inputs.size()];
+    GamepadInputs out{};
+    out.buttons.raw = raw.buttons;
+    out.left_joystick.x = float_stick.map(raw.axes[0]);
+    out.left_joystick.y = float_stick_inverted.map(raw.axes[1]);
+    out.right_joystick.x = float_stick.map(raw.axes[2]);
+    out.right_joystick.y = float_stick_inverted.map(raw.axes[3]);
+    out.l2.value = float_trigger.map(raw.triggers[0]);
+    out.r2.value = float_trigger.map(raw.triggers[1]);
+    bench::do_not_optimize(out);
+  });
+
+  FixedRangeMapper fixed_stick({.center = 32767, .minimum = 0, .maximum = 65535});
+  FixedRangeMapper fixed_stick_inverted(
+      {.center = 32767, .minimum = 0, .maximum = 65535, .invert_output = true});
+  FixedRangeMapper fixed_trigger(
+      {.center = 0, .minimum = 0, .maximum = 1023, .output_max = GamepadState::trigger_max});
+  bench::run("int GamepadState (FixedRangeMapper)", iterations, [&](size_t i) {
+    const auto &raw = inputs[i % inputs.size()];
+    GamepadState out;
+    out.buttons = raw.buttons;
+    out.left_joystick.x = fixed_stick.map(raw.axes[0]);
+    out.left_joystick.y = fixed_stick_inverted.map(raw.axes[1]);
+    out.right_joystick.x = fixed_stick.map(raw.axes[2]);
+    out.right_joystick.y = fixed_stick_inverted.map(raw.axes[3]);
+    out.l2 = fixed_trigger.map(raw.triggers[0]);
+    out.r2 = fixed_trigger.map(raw.triggers[1]);
+    bench::do_not_optimize(out);
+  });
+
+  std::vector<GamepadState> states;
+  states.reserve(inputs.size());
+  for (const auto &raw : inputs) {
+    GamepadState state;
+    state.buttons = raw.buttons;
+    state.left_joystick.x = fixed_stick.map(raw.axes[0]);
+    state.left_joystick.y = fixed_stick.map(raw.axes[1]);
+    state.right_joystick.x = fixed_stick.map(raw.axes[2]);
+    state.right_joystick.y = fixed_stick.map(raw.axes[3]);
+    state.l2 = fixed_trigger.map(raw.triggers[0]);
+    state.r2 = fixed_trigger.map(raw.triggers[1]);
+    states.push_back(state);
+  }
+  bench::run("GamepadState::to_gamepad_inputs", iterations, [&](size_t i) {
+    auto out = states[i % states.size()].to_gamepad_inputs();
+    bench::do_not_optimize(out);
+  });
+
+  std::vector<GamepadInputs> float_states;
+  float_states.reserve(states.size());
+  for (const auto &state : states) {
+    float_states.push_back(state.to_gamepad_inputs());
+  }
+  bench::run("GamepadState::from_gamepad_inputs", iterations, [&](size_t i) {
+    auto out = GamepadState::from_gamepad_inputs(float_states[i % float_states.size()]);
+    bench::do_not_optimize(out);
+  });
+
+  return 0;
+}
@@ -0,0 +1,65 @@
+// Measures the per-subcommand latency of the Switch Pro handshake, i.e. the
+// work done in `tud_hid_set_report_cb` (TinyUSB task) to build the reply to
+// each output report the Switch sends while connecting.
+
+#include <memory>
+
+#include "switch_pro.hpp"
+
+#include "bench_common.hpp"
+
+struct HostCommand {
+  const char *name;
+  std::array<uint8_t, sp::REPORT_SIZE + 1> data;
+};
+
+static HostCommand init_command(const char *name, uint8_t command) {
+  HostCommand c{name, {}};
+  c.data[0] = sp::HOST_INIT_REPORT;
+  c.data[1] = command;
+  return c;
+}
+
+static HostCommand subcommand(const char *name, std::initializer_list<uint8_t> subcommand) {
+  HostCommand c{name, {}};
+  c.data[0] = sp::HOST_OUTPUT_REPORT;
+  std::copy(subcommand.begin(), subcommand.end(), c.data.begin() + sp::Message::subcommand_offset);
+  return c;
+}
+
+int main(int argc, char **argv) {
+  size_t iterations = bench::parse_iterations(argc, argv, 100'000);
+
+  // the sequence of output reports the Switch sends when a Pro Controller is
+  // connected over USB
+  const HostCommand handshake[] = {
+      init_command("0x80 0x02 handshake", sp::INIT_COMMAND_HANDSHAKE),
+      init_command("0x80 0x04 enable USB HID", sp::INIT_COMMAND_ENABLE_USB_HID),
+      subcommand("0x01 0x02 device info", {0x02}),
+      subcommand("0x01 0x08 shipment", {0x08, 0x00}),
+      subcommand("0x01 0x10 SPI read 0x6000", {0x10, 0x00, 0x60, 0x00, 0x00, 0x10}),
+      subcommand("0x01 0x10 SPI read 0x603D", {0x10, 0x3D, 0x60, 0x00, 0x00, 0x19}),
+      subcommand("0x01 0x10 SPI read 0x8010", {0x10, 0x10, 0x80, 0x00, 0x00, 0x18}),
+      subcommand("0x01 0x03 set mode", {0x03, 0x30}),
+      subcommand("0x01 0x04 trigger times", {0x04}),
+      subcommand("0x01 0x40 enable IMU", {0x40, 0x01}),
+      subcommand("0x01 0x48 enable vibration", {0x48, 0x01}),
+      subcommand("0x01 0x30 player lights", {0x30, 0x01}),
+      subcommand("0x01 0x21 NFC/IR config", {0x21, 0x21, 0x00, 0x00}),
+      subcommand("0x01 0x22 NFC/IR state", {0x22, 0x00}),
+      subcommand("0x01 0x99 unknown", {0x99}),
+  };
+
+  SwitchPro switch_pro;
+  std::array<uint8_t, GamepadDevice::max_report_size> response;
+  for (const auto &command : handshake) {
+    bench::run(command.name, iterations, [&](size_t) {
+      uint8_t report_id;
+      size_t len = switch_pro.on_hid_report(command.data[0], command.data, report_id, response);
+      bench::do_not_optimize(len);
+      bench::do_not_optimize(response);
+    });
+  }
+
+  return 0;
+}
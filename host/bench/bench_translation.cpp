@@ -0,0 +1,112 @@
+// Measures the per-notification cost of the BLE -> USB translation path, i.e.
+// the work done by `notifyCB` in main/main.cpp on the NimBLE host task:
+//
+//   Xbox::set_report_data -> Xbox::get_gamepad_inputs -> (invert y) ->
+//   SwitchPro::set_gamepad_inputs -> SwitchPro::get_report_data
+
+#include <memory>
+
+#include "bridge.hpp"
+#include "switch_pro.hpp"
+#include "xbox.hpp"
+#include "xbox_to_switch_pro.hpp"
+
+#include "bench_common.hpp"
+
+int main(int argc, char **argv) {
+  size_t iterations = bench::parse_iterations(argc, argv, 200'000);
+  auto reports = bench::make_xbox_reports(1024);
+
+  auto xbox = std::make_shared<Xbox>();
+  auto switch_pro = std::make_shared<SwitchPro>();
+  std::shared_ptr<GamepadDevice> ble_gamepad = xbox;
+  std::shared_ptr<GamepadDevice> usb_gamepad = switch_pro;
+
+  // the switch pro only produces input reports once the host has enabled USB
+  // HID, so perform that step of the handshake first.
+  const uint8_t enable_usb_hid[] = {sp::HOST_INIT_REPORT, sp::INIT_COMMAND_ENABLE_USB_HID};
+  usb_gamepad->on_hid_report(sp::HOST_INIT_REPORT, enable_usb_hid, sizeof(enable_usb_hid));
+
+  const uint8_t ble_report_id = ble_gamepad->get_input_report_id();
+  const uint8_t usb_report_id = usb_gamepad->get_input_report_id();
+
+  std::printf("Translation path, %zu iterations per run\n", iterations);
+
+  bench::run("xbox set_report_data", iterations, [&](size_t i) {
+    const auto &r = reports[i % reports.size()];
+    ble_gamepad->set_report_data(ble_report_id, r.data(), r.size());
+  });
+
+  bench::run("xbox get_gamepad_inputs", iterations, [&](size_t) {
+    auto inputs = ble_gamepad->get_gamepad_inputs();
+    bench::do_not_optimize(inputs);
+  });
+
+  GamepadInputs inputs = ble_gamepad->get_gamepad_inputs();
+  bench::run("switch_pro set_gamepad_inputs", iterations,
+             [&](size_t) { usb_gamepad->set_gamepad_inputs(inputs); });
+
+  bench::run("switch_pro get_report_data", iterations, [&](size_t) {
+    auto report = usb_gamepad->get_report_data(usb_report_id);
+    bench::do_not_optimize(report.data());
+  });
+
+  bench::run("notifyCB (full path)", iterations, [&](size_t i) {
+    const auto &r = reports[i % reports.size()];
+    ble_gamepad->set_report_data(ble_report_id, r.data(), r.size());
+    auto inputs = ble_gamepad->get_gamepad_inputs();
+    inputs.left_joystick.y = -inputs.left_joystick.y;
+    inputs.right_joystick.y = -inputs.right_joystick.y;
+    usb_gamepad->set_gamepad_inputs(inputs);
+    usb_gamepad->set_battery_level(100);
+    auto report = usb_gamepad->get_report_data(usb_report_id);
+    bench::do_not_optimize(report.data());
+  });
+
+  std::array<uint8_t, GamepadDevice::max_report_size> report;
+  bench::run("notifyCB (full path, span api)", iterations, [&](size_t i) {
+    const auto &r = reports[i % reports.size()];
+    ble_gamepad->set_report_data(ble_report_id, std::span<const uint8_t>(r));
+    auto inputs = ble_gamepad->get_gamepad_inputs();
+    inputs.left_joystick.y = -inputs.left_joystick.y;
+    inputs.right_joystick.y = -inputs.right_joystick.y;
+    usb_gamepad->set_gamepad_inputs(inputs);
+    usb_gamepad->set_battery_level(100);
+    size_t len = usb_gamepad->get_report_data(usb_report_id, report);
+    bench::do_not_optimize(len);
+  });
+
+  DynamicBridge dynamic_bridge(xbox, switch_pro);
+  bench::run("DynamicBridge::translate", iterations, [&](size_t i) {
+    const auto &r = reports[i % reports.size()];
+    uint8_t report_id;
+    size_t len = dynamic_bridge.translate(r, report_id, report);
+    bench::do_not_optimize(len);
+  });
+
+  Bridge<Xbox, SwitchPro> static_bridge(xbox, switch_pro);
+  bench::run("Bridge<Xbox, SwitchPro>::translate", iterations, [&](size_t i) {
+    const auto &r = reports[i % reports.size()];
+    uint8_t report_id;
+    size_t len = static_bridge.translate(r, report_id, report);
+    bench::do_not_optimize(len);
+  });
+
+  XboxToSwitchProBridge transcoder(xbox, switch_pro);
+  bench::run("XboxToSwitchProBridge::translate", iterations, [&](size_t i) {
+    const auto &r = reports[i % reports.size()];
+    uint8_t report_id;
+    size_t len = transcoder.translate(r, report_id, report);
+    bench::do_not_optimize(len);
+  });
+
+  bench::run("xbox_to_switch_pro::transcode", iterations, [&](size_t i) {
+    const auto &r = reports[i % reports.size()];
+    sp::ControllerState state;
+    bool ok = xbox_to_switch_pro::transcode(r, state);
+    bench::do_not_optimize(ok);
+    bench::do_not_optimize(state);
+  });
+
+  return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+// Host shim for espp::BaseComponent, built on the host Logger shim.
+
+#include <string>
+#include <string_view>
+
+#include "logger.hpp"
+
+namespace espp {
+class BaseComponent {
+public:
+  const std::string &get_name() const { return name_; }
+  void set_log_level(Logger::Verbosity level) { logger_.set_verbosity(level); }
+  Logger::Verbosity get_log_level() const { return logger_.get_verbosity(); }
+
+protected:
+  explicit BaseComponent(std::string_view name,
+                         Logger::Verbosity level = Logger::Verbosity::WARN)
+      : name_(name)
+      , logger_({.tag = name, .level = level}) {}
+
+  std::string name_;
+  Logger logger_;
+};
+} // namespace espp
@@ -0,0 +1,16 @@
+#pragma once
+
+// Host shim for the subset of ESP-IDF's esp_timer API used by the components.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Get time in microseconds since the host process started
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+
+// Host shim for espp::Logger. Only the interface used by the components is
+// provided; messages are formatted with fmt and written to stderr.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include <fmt/format.h>
+
+namespace espp {
+class Logger {
+public:
+  enum class Verbosity { DEBUG, INFO, WARN, ERROR, NONE };
+
+  struct Config {
+    std::string_view tag;
+    Verbosity level{Verbosity::WARN};
+    std::chrono::duration<float> rate_limit{0};
+  };
+
+  explicit Logger(const Config &config)
+      : tag_(config.tag)
+      , level_(config.level) {}
+
+  void set_tag(std::string_view tag) { tag_ = tag; }
+  void set_verbosity(Verbosity level) { level_ = level; }
+  Verbosity get_verbosity() const { return level_; }
+  void set_rate_limit(std::chrono::duration<float>) {}
+
+  template <typename... Args> void debug(std::string_view rt_fmt_str, Args &&...args) {
+    log(Verbosity::DEBUG, "D", rt_fmt_str, std::forward<Args>(args)...);
+  }
+
+  template <typename... Args> void info(std::string_view rt_fmt_str, Args &&...args) {
+    log(Verbosity::INFO, "I", rt_fmt_str, std::forward<Args>(args)...);
+  }
+
+  template <typename... Args> void warn(std::string_view rt_fmt_str, Args &&...args) {
+    log(Verbosity::WARN, "W", rt_fmt_str, std::forward<Args>(args)...);
+  }
+
+  template <typename... Args> void error(std::string_view rt_fmt_str, Args &&...args) {
+    log(Verbosity::ERROR, "E", rt_fmt_str, std::forward<Args>(args)...);
+  }
+
+protected:
+  template <typename... Args>
+  void log(Verbosity level, const char *prefix, std::string_view rt_fmt_str, Args &&...args) {
+    if (level < level_) {
+      return;
+    }
+    auto msg = fmt::vformat(rt_fmt_str, fmt::make_format_args(args...));
+    fmt::print(stderr, "[{}/{}] {}\n", tag_, prefix, msg);
+  }
+
+  std::string tag_;
+  Verbosity level_;
+};
+} // namespace espp
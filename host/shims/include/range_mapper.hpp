@@ -0,0 +1,68 @@
+#pragma once
+
+// Host shim for espp::RangeMapper / espp::FloatRangeMapper.
+
+#include <algorithm>
+#include <cmath>
+
+namespace espp {
+template <typename T> class RangeMapper {
+public:
+  struct Config {
+    T center;
+    T center_deadband{0};
+    T minimum;
+    T maximum;
+    T range_deadband{0};
+    bool invert_output{false};
+  };
+
+  RangeMapper() = default;
+  explicit RangeMapper(const Config &config) { configure(config); }
+
+  void configure(const Config &config) {
+    center_ = config.center;
+    center_deadband_ = std::abs(config.center_deadband);
+    minimum_ = config.minimum;
+    maximum_ = config.maximum;
+    range_deadband_ = std::abs(config.range_deadband);
+    invert_output_ = config.invert_output;
+    pos_range_ = (maximum_ - center_ - center_deadband_ - range_deadband_);
+    neg_range_ = (center_ - center_deadband_ - minimum_ - range_deadband_);
+  }
+
+  T get_center() const { return center_; }
+  T get_minimum() const { return minimum_; }
+  T get_maximum() const { return maximum_; }
+
+  /// Map a value in [minimum, maximum] to the output range [-1, 1]
+  T map(const T &v) const {
+    T clamped = std::clamp(v, minimum_, maximum_);
+    T offset = clamped - center_;
+    if (std::abs(offset) <= center_deadband_) {
+      return T{0};
+    }
+    T calibrated{0};
+    if (offset > 0) {
+      calibrated = pos_range_ > 0 ? (offset - center_deadband_) / pos_range_ : T{0};
+    } else {
+      calibrated = neg_range_ > 0 ? (offset + center_deadband_) / neg_range_ : T{0};
+    }
+    calibrated = std::clamp(calibrated, T{-1}, T{1});
+    return invert_output_ ? -calibrated : calibrated;
+  }
+
+protected:
+  T center_{0};
+  T center_deadband_{0};
+  T minimum_{0};
+  T maximum_{0};
+  T range_deadband_{0};
+  bool invert_output_{false};
+  T pos_range_{1};
+  T neg_range_{1};
+};
+
+typedef RangeMapper<float> FloatRangeMapper;
+typedef RangeMapper<int> IntRangeMapper;
+} // namespace espp
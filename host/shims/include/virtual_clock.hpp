@@ -0,0 +1,24 @@
+#pragma once
+
+// Host-only control over the esp_timer shim, so that tests can drive
+// esp_timer_get_time() with a deterministic virtual clock.
+
+#include <cstdint>
+
+namespace host {
+/// Make esp_timer_get_time() return a virtual time which only changes when
+/// set_virtual_time() / advance_virtual_time() are called.
+/// @param start_us The initial virtual time in microseconds
+void use_virtual_clock(int64_t start_us = 0);
+
+/// Make esp_timer_get_time() return the real (steady clock) time again.
+void use_real_clock();
+
+/// Set the virtual time.
+/// @param now_us The new virtual time in microseconds
+void set_virtual_time(int64_t now_us);
+
+/// Advance the virtual time.
+/// @param delta_us The number of microseconds to advance by
+void advance_virtual_time(int64_t delta_us);
+} // namespace host
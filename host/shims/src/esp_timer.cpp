@@ -0,0 +1,28 @@
+#include "esp_timer.h"
+#include "virtual_clock.hpp"
+
+#include <atomic>
+#include <chrono>
+
+static const auto start_time = std::chrono::steady_clock::now();
+static std::atomic<bool> virtual_clock_enabled{false};
+static std::atomic<int64_t> virtual_time_us{0};
+
+extern "C" int64_t esp_timer_get_time(void) {
+  if (virtual_clock_enabled.load(std::memory_order_relaxed)) {
+    return virtual_time_us.load(std::memory_order_relaxed);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start_time;
+  return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+void host::use_virtual_clock(int64_t start_us) {
+  virtual_time_us = start_us;
+  virtual_clock_enabled = true;
+}
+
+void host::use_real_clock() { virtual_clock_enabled = false; }
+
+void host::set_virtual_time(int64_t now_us) { virtual_time_us = now_us; }
+
+void host::advance_virtual_time(int64_t delta_us) { virtual_time_us += delta_us; }
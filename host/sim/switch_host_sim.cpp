@@ -0,0 +1,66 @@
+// Plays the Switch's USB enumeration sequence against a fresh SwitchPro,
+// validates every reply and reports the per-step time as well as the time
+// and the number of transfers until input reports are enabled (hid ready) and
+// the first 0x30 report.
+//
+// Usage: switch_host_sim [--iterations N] [--max-transfers N] [--max-us US]
+//
+// The run fails if any reply is invalid. With --max-transfers it also fails
+// if the first input report takes more transfers than the budget, which is
+// deterministic, so ctest gates on it. With --max-us it fails if the (best)
+// time to the first input report exceeds the budget; that is only meaningful
+// for a Release build on an otherwise idle machine, so ctest does not pass it.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include "switch_host_simulator.hpp"
+
+#include "bench_common.hpp"
+
+int main(int argc, char **argv) {
+  size_t iterations = bench::parse_iterations(argc, argv, 100);
+  double max_us = 0;
+  size_t max_transfers = 0;
+  for (int i = 1; i < argc - 1; i++) {
+    if (std::strcmp(argv[i], "--max-us") == 0) {
+      max_us = std::atof(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--max-transfers") == 0) {
+      max_transfers = std::strtoul(argv[i + 1], nullptr, 10);
+    }
+  }
+
+  SwitchHostSimulator simulator;
+  SwitchHostSimulator::Result best;
+  bool ok = true;
+  for (size_t i = 0; i < iterations; i++) {
+    auto switch_pro = std::make_unique<SwitchPro>();
+    auto result = simulator.run(*switch_pro);
+    if (!result.ok()) {
+      std::printf("run %zu failed:\n", i);
+      SwitchHostSimulator::print(result);
+      ok = false;
+      break;
+    }
+    if (i == 0 || result.first_report_ns < best.first_report_ns) {
+      best = result;
+    }
+  }
+  if (!ok) {
+    return 1;
+  }
+
+  std::printf("best of %zu runs:\n", iterations);
+  SwitchHostSimulator::print(best);
+  if (max_transfers > 0 && best.first_report_transfers > max_transfers) {
+    std::printf("FAILED: the first report takes more than %zu transfers\n", max_transfers);
+    return 1;
+  }
+  if (max_us > 0 && best.first_report_ns / 1e3 > max_us) {
+    std::printf("FAILED: time to first report exceeds %.1f us\n", max_us);
+    return 1;
+  }
+  return 0;
+}
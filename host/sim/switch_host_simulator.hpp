@@ -0,0 +1,280 @@
+#pragma once
+
+// Host-side simulator of the Nintendo Switch's side of the Pro Controller USB
+// protocol. It plays the console's enumeration sequence against a
+// GamepadDevice (normally SwitchPro), validates every reply, times each step
+// and counts the USB transfers until input reports flow.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "switch_pro.hpp"
+
+class SwitchHostSimulator {
+public:
+  struct Step {
+    std::string name;
+    std::array<uint8_t, sp::REPORT_SIZE + 1> command{}; // empty for on_attach
+    bool attach{false};
+    // checks the reply, returning an error message if it is invalid
+    std::function<std::string(uint8_t report_id, std::span<const uint8_t> reply)> validate{};
+  };
+
+  struct StepResult {
+    std::string name;
+    uint64_t duration_ns{0};
+    bool hid_ready{false}; // input reports are available after this step
+    std::string error;     // empty if the reply was valid
+  };
+
+  struct Result {
+    std::vector<StepResult> steps;
+    uint64_t total_ns{0};
+    int hid_ready_step{-1};      // index of the step after which input reports flow
+    uint64_t hid_ready_ns{0};    // time until hid_ready_step completed
+    uint64_t first_report_ns{0}; // time until the first 0x30 report was read
+    bool first_report_valid{false};
+    // The transfers (host commands, then input report polls) until input
+    // reports flow. Unlike the times these don't depend on the machine, so
+    // they can gate how quickly the device enumerates.
+    size_t hid_ready_transfers{0};
+    size_t first_report_transfers{0};
+
+    bool ok() const {
+      if (!first_report_valid || hid_ready_step < 0) {
+        return false;
+      }
+      for (const auto &step : steps) {
+        if (!step.error.empty()) {
+          return false;
+        }
+      }
+      return true;
+    }
+  };
+
+  SwitchHostSimulator() { build_sequence(); }
+
+  /// The sequence of steps played against the device
+  const std::vector<Step> &get_steps() const { return steps_; }
+
+  /// Play the enumeration sequence against the device.
+  /// @param device The device under test, freshly constructed
+  /// @return The per-step results and timings
+  Result run(GamepadDevice &device) {
+    using clock = std::chrono::steady_clock;
+    Result result;
+    std::array<uint8_t, GamepadDevice::max_report_size> reply;
+    std::array<uint8_t, GamepadDevice::max_report_size> input;
+    size_t transfers = 0;
+    auto start = clock::now();
+    // the console polls for standard (0x30) input reports once they flow
+    auto poll_input = [&]() {
+      uint8_t input_report_id = device.get_input_report_id();
+      size_t len = device.get_report_data(input_report_id, input);
+      transfers++;
+      if (input_report_id == sp::DEVICE_INPUT_REPORT && len > 0) {
+        result.first_report_ns = std::chrono::nanoseconds(clock::now() - start).count();
+        result.first_report_valid = true;
+        result.first_report_transfers = transfers;
+      }
+    };
+    for (const auto &step : steps_) {
+      auto step_start = clock::now();
+      transfers++;
+      uint8_t report_id = 0;
+      size_t len;
+      if (step.attach) {
+        len = device.on_attach(report_id, reply);
+      } else {
+        len = device.on_hid_report(step.command[0], step.command, report_id, reply);
+      }
+      auto step_end = clock::now();
+
+      StepResult step_result;
+      step_result.name = step.name;
+      step_result.duration_ns = std::chrono::nanoseconds(step_end - step_start).count();
+      if (len == 0) {
+        step_result.error = "no reply";
+      } else if (step.validate) {
+        step_result.error = step.validate(report_id, {reply.data(), len});
+      }
+      // remember the device info so that later replies can be cross-checked
+      if (step.attach && len > sp::device_init_report_data_mac_addr_offset + 6) {
+        std::copy_n(reply.begin() + sp::device_init_report_data_mac_addr_offset, 6,
+                    mac_address_.begin());
+      }
+      // input reports are only produced once the device considers the
+      // handshake done
+      step_result.hid_ready = device.get_report_data(device.get_input_report_id(), input) > 0;
+      if (step_result.hid_ready && result.hid_ready_step < 0) {
+        result.hid_ready_step = result.steps.size();
+        result.hid_ready_ns = std::chrono::nanoseconds(clock::now() - start).count();
+        result.hid_ready_transfers = transfers;
+      }
+      result.steps.push_back(step_result);
+      if (step_result.hid_ready && !result.first_report_valid) {
+        poll_input();
+      }
+    }
+    result.total_ns = std::chrono::nanoseconds(clock::now() - start).count();
+    if (!result.first_report_valid) {
+      poll_input();
+    }
+    return result;
+  }
+
+  /// Print the results of a run
+  static void print(const Result &result) {
+    for (const auto &step : result.steps) {
+      std::printf("  %-32s %8.3f us%s%s%s\n", step.name.c_str(), step.duration_ns / 1e3,
+                  step.hid_ready ? "  [ready]" : "", step.error.empty() ? "" : "  ERROR: ",
+                  step.error.c_str());
+    }
+    std::printf("  time to hid ready:    %8.3f us (after step %d, %zu transfers)\n",
+                result.hid_ready_ns / 1e3, result.hid_ready_step, result.hid_ready_transfers);
+    std::printf("  time to first report: %8.3f us (%zu transfers)%s\n",
+                result.first_report_ns / 1e3, result.first_report_transfers,
+                result.first_report_valid ? "" : "  ERROR: no 0x30 report");
+    std::printf("  total:                %8.3f us\n", result.total_ns / 1e3);
+  }
+
+protected:
+  typedef std::span<const uint8_t> Reply;
+
+  static std::string expect(bool condition, const std::string &error) {
+    return condition ? "" : error;
+  }
+
+  static std::string hex(uint8_t value) {
+    char buf[5];
+    std::snprintf(buf, sizeof(buf), "0x%02X", value);
+    return buf;
+  }
+
+  void add_attach() {
+    Step step{.name = "attach (0x81 0x01 device info)", .attach = true};
+    step.validate = [](uint8_t report_id, Reply reply) {
+      if (report_id != sp::DEVICE_INIT_REPORT) {
+        return "report id " + hex(report_id);
+      }
+      return expect(reply[0] == sp::INIT_COMMAND_DEVICE_INFO && reply[2] == sp::PRO_CONTROLLER.id,
+                    "not a pro controller device info report");
+    };
+    steps_.push_back(step);
+  }
+
+  void add_init(const std::string &name, uint8_t command) {
+    Step step{.name = name};
+    step.command[0] = sp::HOST_INIT_REPORT;
+    step.command[1] = command;
+    step.validate = [command](uint8_t report_id, Reply reply) {
+      if (report_id != sp::DEVICE_INIT_REPORT) {
+        return "report id " + hex(report_id);
+      }
+      return expect(reply[0] == command, "reply to " + hex(reply[0]));
+    };
+    steps_.push_back(step);
+  }
+
+  // validate the common part of a subcommand reply: report id, ACK byte and
+  // subcommand id
+  static std::string check_reply(uint8_t report_id, Reply reply, uint8_t ack, uint8_t id) {
+    if (report_id != sp::DEVICE_RESPONSE_REPORT) {
+      return "report id " + hex(report_id);
+    }
+    if (reply.size() < sp::REPORT_SIZE) {
+      return "reply too short";
+    }
+    if (reply[12] != ack) {
+      return "ACK " + hex(reply[12]) + ", expected " + hex(ack);
+    }
+    if (reply[13] != id) {
+      return "subcommand reply " + hex(reply[13]) + ", expected " + hex(id);
+    }
+    return "";
+  }
+
+  void add_subcommand(const std::string &name, std::initializer_list<uint8_t> subcommand,
+                      uint8_t ack,
+                      std::function<std::string(Reply reply)> check_data = nullptr) {
+    Step step{.name = name};
+    step.command[0] = sp::HOST_OUTPUT_REPORT;
+    step.command[1] = packet_counter_++ & 0x0F;
+    std::copy(subcommand.begin(), subcommand.end(),
+              step.command.begin() + sp::Message::subcommand_offset);
+    uint8_t id = *subcommand.begin();
+    step.validate = [=](uint8_t report_id, Reply reply) {
+      auto error = check_reply(report_id, reply, ack, id);
+      if (error.empty() && check_data) {
+        error = check_data(reply);
+      }
+      return error;
+    };
+    steps_.push_back(step);
+  }
+
+  void add_spi_read(uint16_t address, uint8_t length) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "0x01 0x10 SPI read 0x%04X", address);
+    uint8_t bank = address >> 8;
+    uint8_t reg = address & 0xFF;
+    add_subcommand(name, {0x10, reg, bank, 0x00, 0x00, length}, 0x90, [=](Reply reply) {
+      if (reply[14] != reg || reply[15] != bank || reply[18] != length) {
+        return std::string("SPI read header does not match the request");
+      }
+      const uint8_t *expected = nullptr;
+      if (bank == sp::REG_BANK_FACTORY_CONFIG) {
+        expected = sp::spi_rom_data_60 + reg;
+      } else if (bank == sp::REG_BANK_USER_CAL) {
+        expected = sp::spi_rom_data_80 + reg;
+      }
+      static constexpr size_t data_offset = 19;
+      for (size_t i = 0; expected && i < length; i++) {
+        // the serial number (factory 0x00-0x0F) is generated per device
+        bool serial = bank == sp::REG_BANK_FACTORY_CONFIG && reg + i < 0x10;
+        if (!serial && reply[data_offset + i] != expected[i]) {
+          return "SPI data at " + hex(reg + i) + " does not match the ROM";
+        }
+      }
+      return std::string();
+    });
+  }
+
+  void build_sequence() {
+    add_attach();
+    add_init("0x80 0x02 handshake", sp::INIT_COMMAND_HANDSHAKE);
+    add_init("0x80 0x04 enable USB HID", sp::INIT_COMMAND_ENABLE_USB_HID);
+    add_subcommand("0x01 0x02 device info", {0x02}, 0x82, [this](Reply reply) {
+      if (reply[16] != sp::PRO_CONTROLLER.id) {
+        return std::string("not a pro controller");
+      }
+      // the device info mac address must match the one from the 0x81 report
+      return expect(std::equal(mac_address_.begin(), mac_address_.end(), reply.begin() + 18),
+                    "device info MAC does not match the init report");
+    });
+    add_subcommand("0x01 0x08 shipment", {0x08, 0x00}, 0x80);
+    add_spi_read(0x6000, 0x10); // serial number
+    add_spi_read(0x6050, 0x0D); // colors
+    add_subcommand("0x01 0x03 set mode 0x30", {0x03, 0x30}, 0x80);
+    add_subcommand("0x01 0x04 trigger times", {0x04}, 0x83);
+    add_spi_read(0x6080, 0x18); // factory sensor / stick parameters
+    add_spi_read(0x6098, 0x12); // factory stick parameters 2
+    add_spi_read(0x8010, 0x18); // user stick calibration
+    add_spi_read(0x603D, 0x19); // factory stick calibration
+    add_spi_read(0x6020, 0x18); // factory IMU calibration
+    add_spi_read(0x8028, 0x18); // user IMU calibration
+    add_subcommand("0x01 0x40 enable IMU", {0x40, 0x01}, 0x80);
+    add_subcommand("0x01 0x48 enable vibration", {0x48, 0x01}, 0x82);
+    add_subcommand("0x01 0x30 player lights", {0x30, 0x01}, 0x80);
+  }
+
+  std::vector<Step> steps_;
+  uint8_t packet_counter_{0};
+  std::array<uint8_t, 6> mac_address_{};
+};
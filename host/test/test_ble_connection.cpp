@@ -0,0 +1,208 @@
+// Tests for BleConnectionStateMachine, driven by a fake BLE client: the
+// connection must go from scanning to streaming on the stack's events, fall
+// back to a full discovery when the cached handles are stale or the peer's
+// database changes, forget peers which don't work, drop the connection when a
+// state times out, and publish every transition to the listeners.
+
+#include <string>
+#include <vector>
+
+#include "ble_connection.hpp"
+
+#include "test_util.hpp"
+
+// records the actions the state machine asks for
+class FakeClient : public BleConnectionActions {
+public:
+  void start_search() override { calls.push_back("search"); }
+  void secure() override { calls.push_back("secure"); }
+  void discover(bool use_cache) override {
+    calls.push_back(use_cache ? "discover cached" : "discover full");
+  }
+  void subscribe() override { calls.push_back("subscribe"); }
+  void disconnect() override { calls.push_back("disconnect"); }
+  void forget_peer() override { calls.push_back("forget"); }
+  void forget_handles() override { calls.push_back("forget handles"); }
+
+  bool called(const std::string &call) const {
+    for (const auto &c : calls) {
+      if (c == call) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::string last() const { return calls.empty() ? "" : calls.back(); }
+
+  std::vector<std::string> calls;
+};
+
+using State = BleState;
+using Event = BleEvent;
+
+// run a connection up to streaming
+static void connect(BleConnectionStateMachine &sm, uint64_t now_ms = 0) {
+  sm.handle(Event::START, now_ms);
+  sm.handle(Event::CONNECTING, now_ms);
+  sm.handle(Event::CONNECTED, now_ms);
+  sm.handle(Event::ENCRYPTED, now_ms);
+  sm.handle(Event::DISCOVERED, now_ms);
+  sm.handle(Event::SUBSCRIBED, now_ms);
+}
+
+static void test_happy_path() {
+  FakeClient client;
+  BleConnectionStateMachine sm(client);
+  std::vector<std::pair<State, State>> transitions;
+  sm.add_listener([&](State from, State to) { transitions.push_back({from, to}); });
+
+  expect(sm.get_state() == State::IDLE, "starts idle");
+  sm.handle(Event::CONNECTED, 0);
+  expect(sm.get_state() == State::IDLE, "idle ignores events until started");
+
+  connect(sm);
+  expect(sm.get_state() == State::STREAMING, "streaming");
+  std::vector<std::string> expected_calls = {"search", "secure", "discover cached", "subscribe"};
+  expect(client.calls == expected_calls, "actions in order");
+  std::vector<std::pair<State, State>> expected_transitions = {
+      {State::IDLE, State::SCANNING},          {State::SCANNING, State::CONNECTING},
+      {State::CONNECTING, State::SECURING},    {State::SECURING, State::DISCOVERING},
+      {State::DISCOVERING, State::SUBSCRIBING}, {State::SUBSCRIBING, State::STREAMING},
+  };
+  expect(transitions == expected_transitions, "listener sees every transition");
+  expect(!sm.get_deadline_ms(), "streaming has no timeout");
+
+  // losing the link goes back to searching
+  sm.handle(Event::DISCONNECTED, 0);
+  expect(sm.get_state() == State::SCANNING && client.last() == "search", "search on disconnect");
+
+  // the search continues when a scan ends, without a transition
+  size_t transition_count = transitions.size();
+  sm.handle(Event::SCAN_ENDED, 0);
+  expect(client.last() == "search" && transitions.size() == transition_count,
+         "scan end continues the search");
+
+  // a failed connection attempt goes back to searching
+  sm.handle(Event::CONNECTING, 0);
+  sm.handle(Event::CONNECT_FAILED, 0);
+  expect(sm.get_state() == State::SCANNING, "connect failed");
+}
+
+static void test_stale_cache() {
+  FakeClient client;
+  BleConnectionStateMachine sm(client);
+  sm.handle(Event::START, 0);
+  sm.handle(Event::CONNECTED, 0);
+  sm.handle(Event::ENCRYPTED, 0);
+  sm.handle(Event::DISCOVERED, 0);
+  // the cached handles did not work, so rediscover
+  sm.handle(Event::SUBSCRIBE_FAILED, 0);
+  expect(sm.get_state() == State::DISCOVERING && client.last() == "discover full",
+         "rediscover after a cached subscribe fails");
+  sm.handle(Event::DISCOVERED, 0);
+  // the full discovery did not work either, so give up on this peer
+  sm.handle(Event::SUBSCRIBE_FAILED, 0);
+  expect(client.called("forget") && client.last() == "disconnect", "forget after a full failure");
+  sm.handle(Event::DISCONNECTED, 0);
+  expect(sm.get_state() == State::SCANNING, "search after forgetting");
+
+  // the next connection may use the cache again
+  client.calls.clear();
+  sm.handle(Event::CONNECTED, 0);
+  sm.handle(Event::ENCRYPTED, 0);
+  expect(client.last() == "discover cached", "cache used on the next connection");
+}
+
+static void test_service_changed() {
+  FakeClient client;
+  BleConnectionStateMachine sm(client);
+  sm.handle(Event::START, 0);
+  sm.handle(Event::SERVICE_CHANGED, 0);
+  expect(!client.called("forget handles") && sm.get_state() == State::SCANNING,
+         "service changed ignored while not connected");
+
+  // while streaming, the handles in use are stale: rediscover them
+  connect(sm);
+  client.calls.clear();
+  sm.handle(Event::SERVICE_CHANGED, 0);
+  std::vector<std::string> expected_calls = {"forget handles", "discover full"};
+  expect(client.calls == expected_calls && sm.get_state() == State::DISCOVERING,
+         "rediscover when the database changes");
+  sm.handle(Event::DISCOVERED, 0);
+  sm.handle(Event::SUBSCRIBED, 0);
+  expect(sm.get_state() == State::STREAMING, "streaming after the rediscovery");
+
+  // while securing, only the cache is dropped; the discovery follows anyway
+  sm.handle(Event::DISCONNECTED, 0);
+  sm.handle(Event::CONNECTED, 0);
+  client.calls.clear();
+  sm.handle(Event::SERVICE_CHANGED, 0);
+  expect(client.last() == "forget handles" && sm.get_state() == State::SECURING,
+         "service changed while securing");
+}
+
+static void test_failures() {
+  FakeClient client;
+  BleConnectionStateMachine sm(client);
+  sm.handle(Event::START, 0);
+  sm.handle(Event::CONNECTED, 0);
+  sm.handle(Event::ENCRYPTION_FAILED, 0);
+  expect(client.last() == "disconnect" && !client.called("forget"),
+         "encryption failure disconnects");
+  sm.handle(Event::DISCONNECTED, 0);
+
+  sm.handle(Event::CONNECTED, 0);
+  sm.handle(Event::ENCRYPTED, 0);
+  sm.handle(Event::DISCOVERY_FAILED, 0);
+  expect(client.called("forget") && client.last() == "disconnect", "discovery failure forgets");
+
+  // a new search (e.g. to pair) while connected drops the controller first
+  client.calls.clear();
+  connect(sm);
+  client.calls.clear();
+  sm.handle(Event::START, 0);
+  expect(client.last() == "disconnect" && sm.get_state() == State::STREAMING,
+         "start while connected disconnects");
+  sm.handle(Event::DISCONNECTED, 0);
+  expect(sm.get_state() == State::SCANNING, "search after start");
+}
+
+static void test_timeouts() {
+  FakeClient client;
+  BleConnectionStateMachine::Timeouts timeouts{
+      .connecting_ms = 100, .securing_ms = 200, .discovering_ms = 300, .subscribing_ms = 400};
+  BleConnectionStateMachine sm(client, timeouts);
+  sm.handle(Event::START, 0);
+  expect(!sm.get_deadline_ms(), "scanning has no timeout");
+  sm.handle(Event::CONNECTING, 1000);
+  expect(sm.get_deadline_ms() == 1100u, "connecting deadline");
+  sm.check_timeout(1099);
+  expect(client.last() == "search", "no timeout before the deadline");
+  sm.check_timeout(1100);
+  expect(client.last() == "disconnect" && sm.get_timeout_count() == 1, "connecting times out");
+  sm.handle(Event::CONNECT_FAILED, 1100);
+  expect(sm.get_state() == State::SCANNING && !sm.get_deadline_ms(), "search after timeout");
+
+  sm.handle(Event::CONNECTED, 2000);
+  expect(sm.get_deadline_ms() == 2200u, "securing deadline");
+  sm.handle(Event::ENCRYPTED, 2100);
+  expect(sm.get_deadline_ms() == 2400u, "discovering deadline");
+  sm.handle(Event::DISCOVERED, 2200);
+  expect(sm.get_deadline_ms() == 2600u, "subscribing deadline");
+  client.calls.clear();
+  sm.check_timeout(2600);
+  expect(client.last() == "disconnect", "subscribing times out");
+  // the disconnection is retried if it does not happen
+  sm.check_timeout(3000);
+  expect(client.calls.size() == 2 && sm.get_timeout_count() == 3, "disconnect retried");
+}
+
+int main() {
+  test_happy_path();
+  test_stale_cache();
+  test_service_changed();
+  test_failures();
+  test_timeouts();
+  return test_result();
+}
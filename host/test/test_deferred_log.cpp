@@ -0,0 +1,154 @@
+// Tests for DeferredLogger: messages must be formatted later from the raw
+// arguments, the levels below DEFERRED_LOG_LEVEL compiled out, the rate limit
+// must suppress (and then report) repeated messages, a full ring must drop
+// messages instead of blocking, and concurrent loggers must not lose any.
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "deferred_log.hpp"
+#include "virtual_clock.hpp"
+
+#include "test_util.hpp"
+
+struct Collected {
+  LogLevel level;
+  std::string tag;
+  int64_t timestamp_us;
+  uint32_t suppressed;
+  std::string text;
+};
+
+static std::vector<Collected> flush(DeferredLogger &logger) {
+  std::vector<Collected> messages;
+  logger.flush([&](const DeferredLogger::Message &message) {
+    messages.push_back({message.level, message.tag, message.timestamp_us, message.suppressed,
+                        std::string(message.text)});
+  });
+  return messages;
+}
+
+enum class Color : uint8_t { RED = 1, GREEN = 2 };
+
+static void test_formatting() {
+  host::use_virtual_clock(1'000);
+  DeferredLogger logger;
+  static LogSite<LogLevel::WARN> site{"Test", "{} {:#04x} {:.1f} {} {} {}"};
+  logger.log(site, -5, uint8_t(0x2a), 1.25f, Color::GREEN, true, "green");
+  expect(flush(logger).empty() == false, "message queued");
+
+  logger.log(site, -5, uint8_t(0x2a), 1.25f, Color::GREEN, true, "green");
+  auto messages = flush(logger);
+  expect(messages.size() == 1 && messages[0].text == "-5 0x2a 1.2 2 1 green",
+         "formatted from raw args");
+  expect(messages.size() == 1 && messages[0].level == LogLevel::WARN &&
+             messages[0].tag == "Test" && messages[0].timestamp_us == 1'000,
+         "level, tag and time of the call");
+  expect(flush(logger).empty(), "flushed messages are gone");
+}
+
+static void test_level_elimination() {
+  static_assert(deferred_log_min_level == LogLevel::INFO, "host default level");
+  auto &logger = DeferredLogger::get();
+  flush(logger);
+  static LogSite<LogLevel::DEBUG> debug_site{"Test", "debug {}"};
+  static LogSite<LogLevel::INFO> info_site{"Test", "info {}"};
+  deferred_log(debug_site, 1);
+  deferred_log(info_site, 2);
+  auto messages = flush(logger);
+  expect(messages.size() == 1 && messages[0].text == "info 2", "debug messages compiled out");
+}
+
+static void test_rate_limit() {
+  host::use_virtual_clock(0);
+  DeferredLogger logger;
+  static LogSite<LogLevel::INFO> site{"Test", "tick {}", 1'000'000};
+  for (int i = 0; i < 10; i++) {
+    logger.log(site, i);
+    host::advance_virtual_time(10'000);
+  }
+  auto messages = flush(logger);
+  expect(messages.size() == 1 && messages[0].text == "tick 0", "repeats are suppressed");
+  host::advance_virtual_time(1'000'000);
+  logger.log(site, 10);
+  messages = flush(logger);
+  expect(messages.size() == 1 && messages[0].text == "tick 10" && messages[0].suppressed == 9,
+         "the next message reports the suppressed ones");
+}
+
+static void test_full_ring() {
+  host::use_virtual_clock(0);
+  DeferredLogger logger;
+  static LogSite<LogLevel::INFO> site{"Test", "{}"};
+  for (size_t i = 0; i < DeferredLogger::capacity + 5; i++) {
+    logger.log(site, i);
+  }
+  expect(logger.get_drop_count() == 5, "messages dropped when full");
+  auto messages = flush(logger);
+  expect(messages.size() == DeferredLogger::capacity && messages.front().text == "0" &&
+             messages.back().text == std::to_string(DeferredLogger::capacity - 1),
+         "the queued messages are kept in order");
+  logger.log(site, 123);
+  messages = flush(logger);
+  expect(messages.size() == 1 && messages[0].text == "123", "room again after a flush");
+}
+
+static void test_concurrent_logging() {
+  host::use_real_clock();
+  DeferredLogger logger;
+  static LogSite<LogLevel::INFO> site{"Test", "{} {}"};
+  static constexpr size_t thread_count = 4;
+  static constexpr int messages_per_thread = 2000;
+  std::atomic<bool> done{false};
+  std::vector<int> received(thread_count, 0);
+  bool in_order = true;
+  std::vector<int> last(thread_count, -1);
+  // a single consumer flushes while the producers log
+  std::thread consumer([&]() {
+    auto sink = [&](const DeferredLogger::Message &message) {
+      unsigned thread = 0;
+      int index = 0;
+      std::sscanf(std::string(message.text).c_str(), "%u %d", &thread, &index);
+      if (thread < thread_count) {
+        in_order &= index > last[thread];
+        last[thread] = index;
+        received[thread]++;
+      }
+    };
+    while (!done) {
+      logger.flush(sink);
+    }
+    logger.flush(sink);
+  });
+  std::vector<std::thread> producers;
+  for (size_t t = 0; t < thread_count; t++) {
+    producers.emplace_back([&, t]() {
+      for (int i = 0; i < messages_per_thread; i++) {
+        logger.log(site, t, i);
+      }
+    });
+  }
+  for (auto &producer : producers) {
+    producer.join();
+  }
+  done = true;
+  consumer.join();
+  int total = 0;
+  for (int count : received) {
+    total += count;
+  }
+  expect(total + logger.get_drop_count() == thread_count * messages_per_thread,
+         "every message is either written or counted as dropped");
+  expect(in_order, "each thread's messages stay in order");
+}
+
+int main() {
+  test_formatting();
+  test_level_elimination();
+  test_rate_limit();
+  test_full_ring();
+  test_concurrent_logging();
+  host::use_real_clock();
+  return test_result();
+}
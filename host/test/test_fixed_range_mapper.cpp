@@ -0,0 +1,105 @@
+// Checks the fixed-point FixedRangeMapper against espp::FloatRangeMapper for a
+// set of joystick and trigger calibrations over the whole raw input range,
+// and that GamepadState <-> GamepadInputs conversion round-trips.
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "range_mapper.hpp"
+
+#include "fixed_range_mapper.hpp"
+#include "gamepad_state.hpp"
+
+struct Calibration {
+  const char *name;
+  FixedRangeMapper::Config config;
+};
+
+static size_t check_calibration(const Calibration &calibration, int32_t raw_min, int32_t raw_max) {
+  const auto &config = calibration.config;
+  FixedRangeMapper fixed(config);
+  espp::FloatRangeMapper reference({.center = float(config.center),
+                                    .center_deadband = float(config.deadzone),
+                                    .minimum = float(config.minimum),
+                                    .maximum = float(config.maximum),
+                                    .range_deadband = float(config.range_deadzone),
+                                    .invert_output = config.invert_output});
+  size_t failures = 0;
+  for (int32_t raw = raw_min; raw <= raw_max; raw++) {
+    int32_t expected = std::lround(reference.map(float(raw)) * config.output_max);
+    int32_t actual = fixed.map(raw);
+    if (std::abs(expected - actual) > 1) {
+      if (failures < 10) {
+        std::printf("%s: raw %d expected %d, got %d\n", calibration.name, raw, expected, actual);
+      }
+      failures++;
+    }
+  }
+  return failures;
+}
+
+static size_t check_conversions() {
+  size_t failures = 0;
+  for (int32_t axis = -GamepadState::axis_max; axis <= GamepadState::axis_max; axis++) {
+    GamepadState state;
+    state.buttons = GamepadState::A | GamepadState::HOME | GamepadState::LEFT_SL;
+    state.left_joystick.x = axis;
+    state.right_joystick.y = -axis;
+    state.l2 = uint16_t(axis + GamepadState::axis_max);
+    state.r2 = uint16_t(2 * (axis + GamepadState::axis_max));
+    auto round_trip = GamepadState::from_gamepad_inputs(state.to_gamepad_inputs());
+    if (round_trip.buttons != state.buttons || round_trip.left_joystick.x != state.left_joystick.x ||
+        round_trip.right_joystick.y != state.right_joystick.y || round_trip.l2 != state.l2 ||
+        round_trip.r2 != state.r2) {
+      if (failures < 10) {
+        std::printf("conversion: axis %d does not round-trip\n", axis);
+      }
+      failures++;
+    }
+  }
+  // the button bitmask matches the GamepadInputs bitfield layout
+  GamepadInputs inputs{};
+  inputs.buttons.zr = 1;
+  inputs.buttons.plus = 1;
+  inputs.buttons.left_sl = 1;
+  auto state = GamepadState::from_gamepad_inputs(inputs);
+  if (state.buttons != (GamepadState::R2 | GamepadState::PLUS | GamepadState::LEFT_SL)) {
+    std::printf("conversion: button mask 0x%06x does not match the bitfield\n",
+                (unsigned)state.buttons);
+    failures++;
+  }
+  return failures;
+}
+
+int main() {
+  static constexpr Calibration joysticks[] = {
+      {"joystick", {.center = 32767, .minimum = 0, .maximum = 65535}},
+      {"joystick inverted",
+       {.center = 32767, .minimum = 0, .maximum = 65535, .invert_output = true}},
+      {"joystick deadzone",
+       {.center = 32767, .minimum = 0, .maximum = 65535, .deadzone = 2000, .range_deadzone = 500}},
+      {"joystick off-center",
+       {.center = 30000, .minimum = 1200, .maximum = 64000, .deadzone = 800}},
+  };
+  static constexpr Calibration triggers[] = {
+      {"trigger", {.center = 0, .minimum = 0, .maximum = 1023, .output_max = UINT16_MAX}},
+      {"trigger deadzone",
+       {.center = 0, .minimum = 0, .maximum = 1023, .deadzone = 30, .output_max = UINT16_MAX}},
+  };
+
+  size_t failures = 0;
+  for (const auto &calibration : joysticks) {
+    failures += check_calibration(calibration, 0, 65535);
+  }
+  for (const auto &calibration : triggers) {
+    failures += check_calibration(calibration, 0, 1023);
+  }
+  failures += check_conversions();
+
+  if (failures) {
+    std::printf("%zu failures\n", failures);
+    return 1;
+  }
+  std::printf("all fixed-point mappings match\n");
+  return 0;
+}
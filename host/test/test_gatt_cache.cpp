@@ -0,0 +1,81 @@
+// Tests for GattCache serialization: a cache must round trip through
+// serialize() / deserialize(), and truncated, corrupted or other-version blobs
+// must be rejected rather than producing bogus handles.
+
+#include "gatt_cache.hpp"
+
+#include "test_util.hpp"
+
+static GattCache make_cache() {
+  GattCache cache;
+  for (size_t i = 0; i < cache.db_hash.size(); i++) {
+    cache.db_hash[i] = 0xA0 + i;
+  }
+  cache.db_hash_handle = 0x000C;
+  cache.service_changed_handle = 0x0003;
+  cache.battery_handle = 0x0041;
+  cache.battery_cccd_handle = 0x0042;
+  cache.serial_number_handle = 0x0105;
+  cache.add_report({.value_handle = 0x0020,
+                    .cccd_handle = 0x0021,
+                    .kind = ReportKind::GAMEPAD,
+                    .report_id = 1});
+  cache.add_report({.value_handle = 0x0024,
+                    .cccd_handle = 0x0025,
+                    .kind = ReportKind::CONSUMER,
+                    .report_id = 2});
+  return cache;
+}
+
+static bool equal(const GattCache &a, const GattCache &b) {
+  if (a.db_hash != b.db_hash || a.db_hash_handle != b.db_hash_handle ||
+      a.service_changed_handle != b.service_changed_handle ||
+      a.battery_handle != b.battery_handle || a.battery_cccd_handle != b.battery_cccd_handle ||
+      a.serial_number_handle != b.serial_number_handle || a.report_count != b.report_count) {
+    return false;
+  }
+  for (size_t i = 0; i < a.report_count; i++) {
+    const auto &ra = a.reports[i];
+    const auto &rb = b.reports[i];
+    if (ra.value_handle != rb.value_handle || ra.cccd_handle != rb.cccd_handle ||
+        ra.kind != rb.kind || ra.report_id != rb.report_id) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  auto cache = make_cache();
+  std::array<uint8_t, GattCache::max_serialized_size> data;
+  size_t size = cache.serialize(data);
+  expect(size > 0 && size <= data.size(), "serialize");
+
+  auto loaded = GattCache::deserialize({data.data(), size});
+  expect(loaded.has_value() && equal(*loaded, cache), "round trip");
+
+  for (size_t len = 0; len < size; len++) {
+    expect(!GattCache::deserialize({data.data(), len}), "truncated blob is rejected");
+  }
+  for (size_t i = 0; i < size; i++) {
+    auto corrupt = data;
+    corrupt[i] ^= 0x10;
+    expect(!GattCache::deserialize({corrupt.data(), size}), "corrupted blob is rejected");
+  }
+
+  // a full cache fits in max_serialized_size
+  GattCache full;
+  for (size_t i = 0; i < GattCache::max_reports; i++) {
+    expect(full.add_report({.value_handle = uint16_t(i)}), "add report");
+  }
+  expect(!full.add_report({}), "full cache rejects reports");
+  size = full.serialize(data);
+  expect(size == GattCache::max_serialized_size, "full cache size");
+  loaded = GattCache::deserialize({data.data(), size});
+  expect(loaded.has_value() && equal(*loaded, full), "full cache round trip");
+
+  std::array<uint8_t, 4> small;
+  expect(cache.serialize(small) == 0, "serialize into a small buffer fails");
+
+  return test_result();
+}
@@ -0,0 +1,117 @@
+// Tests for HidTxScheduler against a fake IN endpoint: replies must go out
+// ahead of input reports and in order, pending input reports must be
+// coalesced to the latest one, refused sends must be retried, and a full reply
+// queue must drop (and count) the new reply.
+
+#include <vector>
+
+#include "hid_tx_scheduler.hpp"
+
+#include "test_util.hpp"
+
+// Fake endpoint which records what was sent and can refuse transfers
+struct FakeEndpoint {
+  struct Sent {
+    uint8_t report_id;
+    uint8_t first_byte;
+  };
+  bool ready{true};
+  std::vector<Sent> sent;
+
+  bool send(uint8_t report_id, std::span<const uint8_t> data) {
+    if (!ready) {
+      return false;
+    }
+    sent.push_back({report_id, data[0]});
+    return true;
+  }
+};
+
+static constexpr uint8_t reply_id = 0x21;
+static constexpr uint8_t input_id = 0x30;
+
+static void test_priority_and_coalescing() {
+  FakeEndpoint endpoint;
+  HidTxScheduler scheduler(
+      [&](uint8_t id, std::span<const uint8_t> data) { return endpoint.send(id, data); });
+
+  uint8_t data[1];
+  // the first report starts immediately, since the endpoint is idle
+  data[0] = 0;
+  scheduler.queue_input(input_id, data);
+  expect(endpoint.sent.size() == 1 && scheduler.is_busy(), "idle endpoint sends immediately");
+
+  // while busy: three input reports (coalesced to the last) and two replies
+  for (uint8_t i = 1; i <= 3; i++) {
+    data[0] = i;
+    scheduler.queue_input(input_id, data);
+  }
+  data[0] = 10;
+  scheduler.queue_reply(reply_id, data);
+  data[0] = 11;
+  scheduler.queue_reply(reply_id, data);
+  expect(endpoint.sent.size() == 1, "nothing is sent while busy");
+  expect(scheduler.get_pending_count() == 3, "two replies and one input pending");
+
+  // complete the transfers one by one
+  for (int i = 0; i < 4; i++) {
+    scheduler.on_complete();
+  }
+  expect(endpoint.sent.size() == 4, "all pending reports sent");
+  if (endpoint.sent.size() == 4) {
+    expect(endpoint.sent[1].report_id == reply_id && endpoint.sent[1].first_byte == 10,
+           "first reply sent first");
+    expect(endpoint.sent[2].report_id == reply_id && endpoint.sent[2].first_byte == 11,
+           "second reply sent second");
+    expect(endpoint.sent[3].report_id == input_id && endpoint.sent[3].first_byte == 3,
+           "latest input sent last");
+  }
+  auto stats = scheduler.get_stats();
+  expect(stats.replies_sent == 2 && stats.inputs_sent == 2, "sent counters");
+  expect(stats.inputs_coalesced == 2, "coalesced counter");
+  expect(!scheduler.is_busy(), "idle once everything is sent");
+
+  uint8_t last[4];
+  expect(scheduler.get_last_input(last) == 1 && last[0] == 3, "last input report is kept");
+}
+
+static void test_retry_and_drop() {
+  FakeEndpoint endpoint;
+  HidTxScheduler scheduler(
+      [&](uint8_t id, std::span<const uint8_t> data) { return endpoint.send(id, data); });
+
+  uint8_t data[1] = {0};
+  endpoint.ready = false;
+  for (size_t i = 0; i < HidTxScheduler::reply_queue_size + 1; i++) {
+    data[0] = i;
+    bool queued = scheduler.queue_reply(reply_id, data);
+    expect(queued == (i < HidTxScheduler::reply_queue_size), "reply queued until full");
+  }
+  auto stats = scheduler.get_stats();
+  expect(stats.replies_dropped == 1, "full reply queue drops the new reply");
+  expect(stats.retries == HidTxScheduler::reply_queue_size, "refused sends are counted");
+  expect(endpoint.sent.empty() && !scheduler.is_busy(), "nothing sent while not ready");
+
+  endpoint.ready = true;
+  scheduler.poll();
+  for (size_t i = 0; i < HidTxScheduler::reply_queue_size; i++) {
+    scheduler.on_complete();
+  }
+  expect(endpoint.sent.size() == HidTxScheduler::reply_queue_size, "queued replies retried");
+  for (size_t i = 0; i < endpoint.sent.size(); i++) {
+    expect(endpoint.sent[i].first_byte == i, "replies retried in order");
+  }
+
+  // reset forgets the in-flight report, so the next one starts immediately
+  scheduler.queue_input(input_id, data);
+  scheduler.reset();
+  expect(!scheduler.is_busy() && scheduler.get_pending_count() == 0, "reset clears state");
+  scheduler.queue_input(input_id, data);
+  expect(scheduler.is_busy(), "sends after reset");
+}
+
+int main() {
+  test_priority_and_coalescing();
+  test_retry_and_drop();
+  return test_result();
+}
@@ -0,0 +1,158 @@
+// Tests for LatencyHistogram / LatencyTracer: the buckets must cover every
+// value, the percentiles must match a sorted reference within the resolution
+// of a bucket, partial traces must only count the stages they went through,
+// and replaying the same trace must give identical statistics.
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "latency_trace.hpp"
+
+#include "test_util.hpp"
+
+static void test_buckets() {
+  bool covered = true;
+  bool monotonic = true;
+  size_t previous = 0;
+  for (uint32_t value = 0; value < (1u << 20); value++) {
+    size_t index = LatencyHistogram::bucket_index(value);
+    covered &= LatencyHistogram::bucket_upper_bound(index) >= value;
+    covered &= index == 0 || LatencyHistogram::bucket_upper_bound(index - 1) < value;
+    monotonic &= index >= previous;
+    previous = index;
+  }
+  expect(covered, "each value is in the bucket whose bounds contain it");
+  expect(monotonic, "buckets grow with the value");
+  expect(LatencyHistogram::bucket_index(UINT32_MAX) == LatencyHistogram::num_buckets - 1,
+         "large values go into the last bucket");
+  // a bucket is at most 25% wide above the exact range
+  expect(LatencyHistogram::bucket_upper_bound(LatencyHistogram::bucket_index(1000)) <= 1250,
+         "bucket resolution");
+}
+
+static void test_empty() {
+  LatencyHistogram histogram;
+  auto summary = histogram.summarize();
+  expect(summary.count == 0 && summary.p99_us == 0 && summary.max_us == 0, "empty summary");
+  histogram.record(42);
+  histogram.reset();
+  expect(histogram.summarize().count == 0, "reset forgets the values");
+}
+
+// reference percentile (nearest rank) of sorted values
+static uint32_t reference_percentile(const std::vector<uint32_t> &sorted, uint32_t percent) {
+  size_t rank = (sorted.size() * percent + 99) / 100;
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+// check a percentile is the upper bound of the reference value's bucket
+static bool matches(uint32_t value, uint32_t reference) {
+  return value >= reference && value <= reference + reference / 4 + 1;
+}
+
+// a deterministic pseudo random trace: notifications every ~8 ms with some
+// jitter, a few reports suppressed (decode stages only) and a few slow ones
+static std::vector<ReportTimestamps> make_trace(size_t count) {
+  std::vector<ReportTimestamps> trace;
+  uint32_t seed = 12345;
+  auto next = [&](uint32_t range) {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) % range;
+  };
+  int64_t now = 1'000'000;
+  for (size_t i = 0; i < count; i++) {
+    ReportTimestamps timestamps;
+    now += 7'500 + next(1'000);
+    timestamps.notify_us = now;
+    timestamps.decode_us = timestamps.notify_us + 20 + next(200);
+    timestamps.encode_us = timestamps.decode_us + 5 + next(30);
+    if (next(10) != 0) {
+      timestamps.submit_us = timestamps.encode_us + 10 + next(100);
+      uint32_t poll = next(20) == 0 ? 4'000 + next(4'000) : next(1'000);
+      timestamps.complete_us = timestamps.submit_us + poll;
+    }
+    trace.push_back(timestamps);
+  }
+  return trace;
+}
+
+static void test_replay() {
+  auto trace = make_trace(5000);
+  LatencyTracer tracer;
+  for (const auto &timestamps : trace) {
+    tracer.record(timestamps);
+  }
+
+  // compare each stage with a sorted reference
+  auto check_stage = [&](LatencyStage stage, int64_t ReportTimestamps::*start,
+                         int64_t ReportTimestamps::*end) {
+    std::vector<uint32_t> values;
+    for (const auto &timestamps : trace) {
+      if (timestamps.*start && timestamps.*end) {
+        values.push_back(timestamps.*end - timestamps.*start);
+      }
+    }
+    std::sort(values.begin(), values.end());
+    auto summary = tracer.get(stage).summarize();
+    bool ok = summary.count == values.size() && summary.min_us == values.front() &&
+              summary.max_us == values.back() &&
+              matches(summary.p50_us, reference_percentile(values, 50)) &&
+              matches(summary.p90_us, reference_percentile(values, 90)) &&
+              matches(summary.p99_us, reference_percentile(values, 99));
+    if (!ok) {
+      std::printf("  %s: count %u min %u p50 %u p90 %u p99 %u max %u\n", to_string(stage),
+                  summary.count, summary.min_us, summary.p50_us, summary.p90_us, summary.p99_us,
+                  summary.max_us);
+    }
+    return ok;
+  };
+  expect(check_stage(LatencyStage::QUEUE, &ReportTimestamps::notify_us,
+                     &ReportTimestamps::decode_us),
+         "queue stage matches the reference");
+  expect(check_stage(LatencyStage::TRANSLATE, &ReportTimestamps::decode_us,
+                     &ReportTimestamps::encode_us),
+         "translate stage matches the reference");
+  expect(check_stage(LatencyStage::SUBMIT, &ReportTimestamps::encode_us,
+                     &ReportTimestamps::submit_us),
+         "submit stage matches the reference");
+  expect(check_stage(LatencyStage::COMPLETE, &ReportTimestamps::submit_us,
+                     &ReportTimestamps::complete_us),
+         "complete stage matches the reference");
+  expect(check_stage(LatencyStage::TOTAL, &ReportTimestamps::notify_us,
+                     &ReportTimestamps::complete_us),
+         "total matches the reference");
+  expect(tracer.get(LatencyStage::TOTAL).summarize().count <
+             tracer.get(LatencyStage::QUEUE).summarize().count,
+         "suppressed reports only count the decode stages");
+
+  // replaying the same trace gives the same statistics
+  LatencyTracer replay;
+  for (const auto &timestamps : trace) {
+    replay.record(timestamps);
+  }
+  bool identical = true;
+  for (size_t i = 0; i < LatencyTracer::num_stages; i++) {
+    auto a = tracer.get(static_cast<LatencyStage>(i)).summarize();
+    auto b = replay.get(static_cast<LatencyStage>(i)).summarize();
+    identical &= a.count == b.count && a.min_us == b.min_us && a.p50_us == b.p50_us &&
+                 a.p90_us == b.p90_us && a.p99_us == b.p99_us && a.max_us == b.max_us &&
+                 a.mean_us == b.mean_us;
+  }
+  expect(identical, "replaying a trace gives identical statistics");
+}
+
+static void test_out_of_order() {
+  LatencyTracer tracer;
+  // a timestamp before the previous one (e.g. a reset in between) is ignored
+  tracer.record({.notify_us = 2000, .decode_us = 1000});
+  expect(tracer.get(LatencyStage::QUEUE).summarize().count == 0, "negative latency ignored");
+}
+
+int main() {
+  test_buckets();
+  test_empty();
+  test_replay();
+  test_out_of_order();
+  return test_result();
+}
@@ -0,0 +1,88 @@
+// Tests for LinkMonitor: the link must go idle when the inputs stop changing,
+// become active again on the first change, degrade on weak signal, late
+// notifications or a supervision timeout risk, and only recover after enough
+// good samples.
+
+#include "link_monitor.hpp"
+
+#include "test_util.hpp"
+
+using Mode = LinkMonitor::Mode;
+
+static constexpr int64_t second = 1'000'000;
+
+// send changing reports every period_us for one second, starting at now_us
+static int64_t send_reports(LinkMonitor &monitor, int64_t now_us, int64_t period_us) {
+  for (int64_t t = 0; t < second; t += period_us) {
+    monitor.on_notification(now_us + t, true);
+  }
+  return now_us + second;
+}
+
+static void test_activity() {
+  LinkMonitor monitor;
+  int64_t now = 0;
+  monitor.reset(now);
+  now = send_reports(monitor, now, 10'000);
+  auto sample = monitor.sample(now, -60);
+  expect(sample.mode == Mode::ACTIVE && sample.notifications == 100, "active while changing");
+  expect(sample.late == 0 && sample.max_gap_us == 10'000, "no late reports");
+
+  // unchanged reports don't keep the link active
+  for (int i = 0; i < 3; i++) {
+    now += second;
+    monitor.on_notification(now, false);
+    sample = monitor.sample(now, -60);
+  }
+  expect(sample.mode == Mode::IDLE, "idle when inputs stop changing");
+
+  // the first change wakes the link up immediately
+  expect(!monitor.on_notification(now + 1000, false), "unchanged report does not wake");
+  expect(monitor.on_notification(now + 2000, true), "changed report wakes");
+  expect(monitor.get_mode() == Mode::ACTIVE, "active after wake");
+  expect(!monitor.on_notification(now + 3000, true), "only wakes once");
+}
+
+static void test_degraded() {
+  LinkMonitor monitor;
+  int64_t now = 0;
+  monitor.reset(now);
+  now = send_reports(monitor, now, 10'000);
+  expect(monitor.sample(now, -90).mode == Mode::DEGRADED, "weak signal degrades");
+
+  // recovering takes several good samples in a row
+  for (int i = 0; i < 4; i++) {
+    now = send_reports(monitor, now, 10'000);
+    expect(monitor.sample(now, -60).mode == Mode::DEGRADED, "still degraded");
+  }
+  now = send_reports(monitor, now, 10'000);
+  expect(monitor.sample(now, -60).mode == Mode::ACTIVE, "recovered");
+
+  // a signal between the thresholds neither degrades nor recovers
+  now = send_reports(monitor, now, 10'000);
+  expect(monitor.sample(now, -80).mode == Mode::ACTIVE, "hysteresis");
+
+  // late notifications degrade the link
+  now = send_reports(monitor, now, 100'000);
+  auto sample = monitor.sample(now, -60);
+  expect(sample.late == sample.notifications - 1 && sample.mode == Mode::DEGRADED,
+         "late notifications degrade");
+
+  // a gap close to the supervision timeout degrades the link
+  LinkMonitor risky;
+  risky.reset(0);
+  risky.set_supervision_timeout_us(1 * second);
+  risky.on_notification(100'000, true);
+  risky.on_notification(700'000, true);
+  sample = risky.sample(second, -60);
+  expect(sample.supervision_risk && sample.mode == Mode::DEGRADED, "supervision timeout risk");
+
+  // degraded links don't wake up to active on input changes
+  expect(!risky.on_notification(second + 1000, true), "degraded does not wake");
+}
+
+int main() {
+  test_activity();
+  test_degraded();
+  return test_result();
+}
@@ -0,0 +1,56 @@
+// Tests for the link profiles: their parameters must be valid, and rejected
+// connection parameters must fall back to longer intervals up to the
+// profile's limit and no further.
+
+#include "link_profile.hpp"
+
+#include "test_util.hpp"
+
+int main() {
+  static_assert(is_valid(link_profiles::balanced.params));
+  static_assert(is_valid(link_profiles::low_latency.params));
+  static_assert(is_valid(link_profiles::balanced.idle_params));
+  static_assert(is_valid(link_profiles::low_latency.idle_params));
+  expect(conn_interval_to_ms(link_profiles::low_latency.params.min_interval) == 7.5f,
+         "low latency starts at 7.5 ms");
+  expect(link_profiles::low_latency.params.latency == 0, "low latency has no peripheral latency");
+
+  // the low latency profile steps up to 15 ms
+  auto params = link_profiles::low_latency.params;
+  float expected_ms[] = {10.0f, 11.25f, 15.0f};
+  for (float ms : expected_ms) {
+    auto fallback = fallback_conn_params(params, link_profiles::low_latency.max_interval);
+    expect(fallback.has_value(), "fallback exists");
+    if (!fallback) {
+      break;
+    }
+    expect(conn_interval_to_ms(fallback->min_interval) == ms &&
+               fallback->min_interval == fallback->max_interval,
+           "fallback interval");
+    expect(fallback->latency == params.latency &&
+               fallback->supervision_timeout == params.supervision_timeout,
+           "fallback keeps latency and timeout");
+    params = *fallback;
+  }
+  expect(!fallback_conn_params(params, link_profiles::low_latency.max_interval),
+         "no fallback past the profile's limit");
+
+  // the balanced profile does not fall back at all
+  expect(!fallback_conn_params(link_profiles::balanced.params,
+                               link_profiles::balanced.max_interval),
+         "balanced has no fallback");
+
+  // intervals which would break the supervision timeout are skipped
+  ConnParams tight{.min_interval = 6, .max_interval = 6, .latency = 10, .supervision_timeout = 30};
+  expect(is_valid(tight), "tight params are valid");
+  auto fallback = fallback_conn_params(tight, 24);
+  expect(fallback && fallback->min_interval == 8, "valid fallback");
+  fallback = fallback_conn_params(*fallback, 24);
+  expect(fallback && fallback->min_interval == 9, "valid fallback");
+  expect(!fallback_conn_params(*fallback, 24), "invalid fallbacks are skipped");
+  expect(!is_valid(
+             {.min_interval = 4, .max_interval = 4, .latency = 0, .supervision_timeout = 100}),
+         "interval below 7.5 ms is invalid");
+
+  return test_result();
+}
@@ -0,0 +1,104 @@
+// Tests for MetricsRegistry / MetricsRates: counters and gauges must keep
+// their values when updated from several threads, SwitchPro must count the
+// subcommands per id, and the rates must be the per-second deltas between
+// snapshots (across counter wrap around).
+
+#include <array>
+#include <thread>
+#include <vector>
+
+#include "metrics.hpp"
+#include "switch_pro.hpp"
+
+#include "test_util.hpp"
+
+static void test_counters_and_gauges() {
+  MetricsRegistry metrics;
+  metrics.increment(Metric::SCAN_RESULTS);
+  metrics.increment(Metric::SCAN_RESULTS, 4);
+  metrics.set(Metric::GATT_DISCOVERY_US, 1234);
+  metrics.set(Metric::GATT_DISCOVERY_US, 567);
+  expect(metrics.get_value(Metric::SCAN_RESULTS) == 5, "counter adds up");
+  expect(metrics.get_value(Metric::GATT_DISCOVERY_US) == 567, "gauge holds the last value");
+  expect(metrics.get_value(Metric::RECONNECTS) == 0, "other metrics untouched");
+  expect(is_gauge(Metric::GATT_DISCOVERY_US) && !is_gauge(Metric::RECONNECTS), "metric kinds");
+  metrics.reset();
+  expect(metrics.get_value(Metric::SCAN_RESULTS) == 0, "reset");
+}
+
+static void test_concurrent_increments() {
+  MetricsRegistry metrics;
+  static constexpr size_t thread_count = 4;
+  static constexpr uint32_t increments = 100'000;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < thread_count; i++) {
+    threads.emplace_back([&]() {
+      for (uint32_t j = 0; j < increments; j++) {
+        metrics.increment(Metric::BLE_NOTIFY_GAMEPAD);
+        metrics.increment_subcommand(0x10);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  expect(metrics.get_value(Metric::BLE_NOTIFY_GAMEPAD) == thread_count * increments,
+         "no increments lost between threads");
+  expect(metrics.get_subcommand_count(0x10) == thread_count * increments,
+         "no subcommand increments lost between threads");
+  expect(metrics.get_value(Metric::SUBCOMMANDS) == thread_count * increments,
+         "subcommands counted in the total");
+}
+
+static void test_switch_pro_subcommands() {
+  auto &metrics = MetricsRegistry::get();
+  metrics.reset();
+  SwitchPro switch_pro;
+  std::array<uint8_t, GamepadDevice::max_report_size> response;
+  auto send_subcommand = [&](uint8_t id) {
+    std::array<uint8_t, sp::REPORT_SIZE + 1> data{};
+    data[0] = sp::HOST_OUTPUT_REPORT;
+    data[sp::Message::subcommand_offset] = id;
+    uint8_t report_id;
+    switch_pro.on_hid_report(data[0], data, report_id, response);
+  };
+  send_subcommand(0x02);
+  send_subcommand(0x10);
+  send_subcommand(0x10);
+  send_subcommand(0x99);
+  expect(metrics.get_subcommand_count(0x02) == 1, "device info counted");
+  expect(metrics.get_subcommand_count(0x10) == 2, "SPI reads counted");
+  expect(metrics.get_subcommand_count(0x99) == 1, "unknown subcommands counted");
+  expect(metrics.get_value(Metric::SUBCOMMANDS) == 4, "total subcommands");
+}
+
+static void test_rates() {
+  MetricsRegistry metrics;
+  MetricsRates rates;
+  rates.update(metrics, 0);
+  expect(rates.get_rate(Metric::REPORTS_DECODED) == 0, "no rate before an interval");
+
+  metrics.increment(Metric::REPORTS_DECODED, 250);
+  metrics.set(Metric::GATT_DISCOVERY_US, 800);
+  rates.update(metrics, 2'000'000);
+  expect(rates.get_delta(Metric::REPORTS_DECODED) == 250, "delta over the interval");
+  expect(rates.get_rate(Metric::REPORTS_DECODED) == 125.0f, "per second rate");
+  expect(rates.get_value(Metric::GATT_DISCOVERY_US) == 800, "gauge value in the snapshot");
+
+  // the counter wraps around between two snapshots
+  metrics.increment(Metric::REPORTS_DECODED, UINT32_MAX - 250 - 9);
+  rates.update(metrics, 3'000'000);
+  metrics.increment(Metric::REPORTS_DECODED, 20);
+  rates.update(metrics, 4'000'000);
+  expect(metrics.get_value(Metric::REPORTS_DECODED) == 10, "counter wrapped around");
+  expect(rates.get_delta(Metric::REPORTS_DECODED) == 20, "delta across the wrap around");
+  expect(rates.get_rate(Metric::REPORTS_DECODED) == 20.0f, "rate across the wrap around");
+}
+
+int main() {
+  test_counters_and_gauges();
+  test_concurrent_increments();
+  test_switch_pro_subcommands();
+  test_rates();
+  return test_result();
+}
@@ -0,0 +1,170 @@
+// Tests for classify_report and NotificationRouter: report ids in composite
+// HID report maps must be classified by their top level application
+// collection, and the routing table must find routes by handle, also while
+// the table is being rebuilt.
+
+#include <atomic>
+#include <thread>
+
+#include "notification_router.hpp"
+
+#include "test_util.hpp"
+
+// gamepad (id 1) with a nested physical collection, consumer control (id 2)
+// and keyboard (id 3)
+static constexpr uint8_t composite_map[] = {
+    0x05, 0x01,                   // usage page (generic desktop)
+    0x09, 0x05,                   // usage (gamepad)
+    0xA1, 0x01,                   // collection (application)
+    0x85, 0x01,                   //   report id (1)
+    0x09, 0x01,                   //   usage (pointer)
+    0xA1, 0x00,                   //   collection (physical)
+    0x09, 0x30,                   //     usage (x)
+    0x09, 0x31,                   //     usage (y)
+    0x15, 0x00,                   //     logical minimum (0)
+    0x27, 0xFF, 0xFF, 0x00, 0x00, //     logical maximum (65535)
+    0x95, 0x02,                   //     report count (2)
+    0x75, 0x10,                   //     report size (16)
+    0x81, 0x02,                   //     input (data, var, abs)
+    0xC0,                         //   end collection
+    0xC0,                         // end collection
+    0x05, 0x0C,                   // usage page (consumer)
+    0x09, 0x01,                   // usage (consumer control)
+    0xA1, 0x01,                   // collection (application)
+    0x85, 0x02,                   //   report id (2)
+    0x09, 0xB2,                   //   usage (record)
+    0x15, 0x00,                   //   logical minimum (0)
+    0x25, 0x01,                   //   logical maximum (1)
+    0x95, 0x01,                   //   report count (1)
+    0x75, 0x08,                   //   report size (8)
+    0x81, 0x02,                   //   input (data, var, abs)
+    0xC0,                         // end collection
+    0x05, 0x01,                   // usage page (generic desktop)
+    0x09, 0x06,                   // usage (keyboard)
+    0xA1, 0x01,                   // collection (application)
+    0x85, 0x03,                   //   report id (3)
+    0x05, 0x07,                   //   usage page (keyboard)
+    0x19, 0xE0,                   //   usage minimum (left control)
+    0x29, 0xE7,                   //   usage maximum (right gui)
+    0x75, 0x01,                   //   report size (1)
+    0x95, 0x08,                   //   report count (8)
+    0x81, 0x02,                   //   input (data, var, abs)
+    0xC0,                         // end collection
+};
+
+// joystick without report ids, using a 4 byte (extended) usage
+static constexpr uint8_t extended_usage_map[] = {
+    0x05, 0x0C,                   // usage page (consumer)
+    0x0B, 0x04, 0x00, 0x01, 0x00, // usage (generic desktop: joystick)
+    0xA1, 0x01,                   // collection (application)
+    0x09, 0x30,                   //   usage (x)
+    0x81, 0x02,                   //   input (data, var, abs)
+    0xC0,                         // end collection
+};
+
+// report id declared before the collection it belongs to
+static constexpr uint8_t early_report_id_map[] = {
+    0x85, 0x07, // report id (7)
+    0x05, 0x01, // usage page (generic desktop)
+    0x09, 0x07, // usage (keypad)
+    0xA1, 0x01, // collection (application)
+    0x81, 0x02, //   input (data, var, abs)
+    0xC0,       // end collection
+};
+
+static void test_classify() {
+  expect(classify_report(composite_map, 1) == ReportKind::GAMEPAD, "gamepad report id");
+  expect(classify_report(composite_map, 2) == ReportKind::CONSUMER, "consumer report id");
+  expect(classify_report(composite_map, 3) == ReportKind::KEYBOARD, "keyboard report id");
+  expect(classify_report(composite_map, 4) == ReportKind::UNKNOWN, "missing report id");
+  expect(classify_report(extended_usage_map, 0) == ReportKind::GAMEPAD, "extended usage");
+  expect(classify_report(early_report_id_map, 7) == ReportKind::KEYBOARD, "early report id");
+  expect(classify_report({}, 1) == ReportKind::UNKNOWN, "empty report map");
+  // a truncated map must not read out of bounds
+  for (size_t len = 0; len < sizeof(composite_map); len++) {
+    classify_report(std::span<const uint8_t>(composite_map, len), 3);
+  }
+  static_assert(classify_report(composite_map, 3) == ReportKind::KEYBOARD);
+}
+
+static void test_router() {
+  NotificationRouter router;
+  expect(!router.find(10), "empty router");
+  router.add({.handle = 10, .kind = ReportKind::GAMEPAD, .report_id = 1});
+  router.add({.handle = 14, .kind = ReportKind::CONSUMER, .report_id = 2});
+  router.add({.handle = 30, .kind = ReportKind::BATTERY});
+  expect(!router.find(10) && router.size() == 0, "routes are not used until published");
+  router.publish();
+  auto route = router.find(14);
+  expect(route && route->kind == ReportKind::CONSUMER && route->report_id == 2, "find route");
+  expect(router.find(30) && router.find(30)->kind == ReportKind::BATTERY, "battery route");
+  expect(!router.find(11), "unknown handle");
+  router.add({.handle = 40, .kind = ReportKind::KEYBOARD, .report_id = 3});
+  router.publish();
+  expect(router.size() == 1 && router.find(40) && !router.find(10), "publish replaces the table");
+  router.clear();
+  expect(router.size() == 0 && !router.find(40), "cleared router");
+  for (size_t i = 0; i < NotificationRouter::max_routes; i++) {
+    expect(router.add({.handle = uint16_t(i)}), "add until full");
+  }
+  expect(!router.add({.handle = 100}), "full router rejects routes");
+  router.publish();
+  expect(router.size() == NotificationRouter::max_routes, "full table published");
+}
+
+// rebuild the table over and over while another thread routes notifications:
+// a lookup must only see published tables, so the generation of the routes it
+// finds never goes backwards
+static void test_concurrent_rebuild() {
+  static constexpr uint16_t rebuilds = 20'000;
+  static constexpr uint16_t handles = 8;
+  NotificationRouter router;
+  auto build = [&](uint16_t generation) {
+    // the kind and report id just carry the generation here
+    for (uint16_t handle = 1; handle <= handles; handle++) {
+      router.add({.handle = handle,
+                  .kind = ReportKind(generation >> 8),
+                  .report_id = uint8_t(generation)});
+    }
+    router.publish();
+  };
+  build(1);
+  std::atomic<bool> started{false};
+  std::atomic<bool> done{false};
+  std::atomic<size_t> torn{0};
+  std::atomic<size_t> found{0};
+  std::thread reader([&]() {
+    uint16_t last_generation[handles + 1] = {};
+    started = true;
+    do {
+      for (uint16_t handle = 1; handle <= handles; handle++) {
+        auto route = router.find(handle);
+        if (!route) {
+          continue;
+        }
+        found.fetch_add(1, std::memory_order_relaxed);
+        uint16_t generation = uint16_t(route->kind) << 8 | route->report_id;
+        if (route->handle != handle || generation < last_generation[handle]) {
+          torn.fetch_add(1, std::memory_order_relaxed);
+        }
+        last_generation[handle] = generation;
+      }
+    } while (!done.load(std::memory_order_relaxed));
+  });
+  while (!started) {
+  }
+  for (uint16_t generation = 2; generation <= rebuilds; generation++) {
+    build(generation);
+  }
+  done = true;
+  reader.join();
+  expect(found > 0, "the reader found routes");
+  expect(torn == 0, "lookups only see published tables");
+}
+
+int main() {
+  test_classify();
+  test_router();
+  test_concurrent_rebuild();
+  return test_result();
+}
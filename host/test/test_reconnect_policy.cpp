@@ -0,0 +1,44 @@
+// Tests for ReconnectPolicy: a reconnection must start with a direct
+// connection only when the most recent peer is known, fall back to a fast
+// accept list scan and then keep repeating the slow scan.
+
+#include "reconnect_policy.hpp"
+
+#include "test_util.hpp"
+
+using Phase = ReconnectPolicy::Phase;
+
+int main() {
+  ReconnectPolicy policy;
+  const auto &config = policy.get_config();
+
+  auto step = policy.first(true);
+  expect(step.phase == Phase::DIRECT_CONNECT, "direct connect to the recent peer");
+  expect(step.duration_ms == config.direct_connect_ms, "direct connect timeout");
+
+  step = policy.next(step.phase);
+  expect(step.phase == Phase::FAST_SCAN, "fast scan after direct connect");
+  expect(step.duration_ms == config.fast_scan_ms, "fast scan duration");
+  expect(step.scan.interval_ms == config.fast_scan.interval_ms &&
+             step.scan.window_ms == config.fast_scan.window_ms,
+         "fast scan timing");
+
+  step = policy.next(step.phase);
+  expect(step.phase == Phase::SLOW_SCAN, "slow scan after fast scan");
+  step = policy.next(step.phase);
+  expect(step.phase == Phase::SLOW_SCAN, "slow scan repeats");
+  expect(step.duration_ms == config.slow_scan_ms, "slow scan duration");
+
+  expect(policy.first(false).phase == Phase::FAST_SCAN, "no recent peer starts scanning");
+
+  // the slow scan must use much less radio time than the fast scan
+  expect(ReconnectPolicy::duty_cycle(config.fast_scan) >= 0.5f, "fast scan duty cycle");
+  expect(ReconnectPolicy::duty_cycle(config.slow_scan) < 0.05f, "slow scan duty cycle");
+  expect(ReconnectPolicy::duty_cycle({}) == 0.0f, "empty scan duty cycle");
+
+  // phases can be disabled
+  ReconnectPolicy scan_only({.direct_connect_ms = 0, .fast_scan_ms = 0});
+  expect(scan_only.first(true).phase == Phase::SLOW_SCAN, "disabled phases are skipped");
+
+  return test_result();
+}
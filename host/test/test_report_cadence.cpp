@@ -0,0 +1,74 @@
+// Tests for FrameCadence and IntervalMonitor: the cadence must fire every
+// `period` frames across the 11-bit frame number wrap, stay on its grid when
+// SOFs are missed, and the monitor must report the rate and jitter of a known
+// sequence of intervals.
+
+#include <cmath>
+#include <cstdio>
+
+#include "report_cadence.hpp"
+
+#include "test_util.hpp"
+
+static void test_cadence() {
+  static constexpr uint32_t period = 8;
+  FrameCadence cadence(period);
+  // start just before the frame number wraps, so the wrap is crossed many times
+  uint32_t start = FrameCadence::frame_number_mask - 3;
+  int fired = 0;
+  bool on_grid = true;
+  for (uint32_t i = 0; i < 10'000; i++) {
+    if (cadence.on_frame(start + i)) {
+      fired++;
+      on_grid = on_grid && (i % period == 0);
+    }
+  }
+  expect(fired == 10'000 / period, "fires once per period across the wrap");
+  expect(on_grid, "fires on the frames aligned to the first one");
+  expect(cadence.get_missed_count() == 0, "no missed slots with every SOF");
+
+  // drop SOFs: frames 0, 3, 9, 30, 31, 32 with a period of 8
+  FrameCadence sparse(period);
+  expect(sparse.on_frame(0), "first frame fires");
+  expect(!sparse.on_frame(3), "early frame does not fire");
+  expect(sparse.on_frame(9), "late frame fires");
+  expect(sparse.on_frame(30), "frame after a gap fires");
+  expect(sparse.get_missed_count() == 1, "skipped slot is counted");
+  // the grid is still 0, 8, 16, 24, 32, ... so frame 31 is early
+  expect(!sparse.on_frame(31), "grid is kept after a gap");
+  expect(sparse.on_frame(32), "next grid frame fires");
+}
+
+static void test_interval_monitor() {
+  IntervalMonitor monitor;
+  // alternate 7 ms and 9 ms intervals: 8 ms mean, 1 ms jitter
+  int64_t t = 1'000'000;
+  monitor.add_event(t);
+  for (int i = 0; i < 100; i++) {
+    t += (i % 2) ? 9000 : 7000;
+    monitor.add_event(t);
+  }
+  auto stats = monitor.take_stats();
+  expect(stats.count == 100, "interval count");
+  expect(stats.min_us == 7000 && stats.max_us == 9000, "min / max interval");
+  expect(std::fabs(stats.mean_us - 8000) < 1, "mean interval");
+  expect(std::fabs(stats.jitter_us - 1000) < 1, "jitter");
+  expect(std::fabs(stats.rate_hz - 125) < 0.1, "rate");
+  std::printf("IntervalMonitor: %.1f Hz, mean %.0f us, jitter %.0f us\n", stats.rate_hz,
+              stats.mean_us, stats.jitter_us);
+
+  // the window is reset, but the next event still continues from the last one
+  monitor.add_event(t + 8000);
+  stats = monitor.take_stats();
+  expect(stats.count == 1 && stats.min_us == 8000, "window reset keeps the last event");
+
+  monitor.restart();
+  monitor.add_event(t + 100'000);
+  expect(monitor.take_stats().count == 0, "restart does not start an interval");
+}
+
+int main() {
+  test_cadence();
+  test_interval_monitor();
+  return test_result();
+}
@@ -0,0 +1,104 @@
+// Tests for ReportFilter: identical reports are suppressed until the keepalive
+// interval elapses, changes outside the ignored byte range are always sent,
+// the last report is handed back for resending once its keepalive is due
+// (when no new reports arrive), and the SwitchPro's configuration ignores its
+// free running counter, so a stream of identical Xbox reports bridged through
+// it is mostly suppressed.
+
+#include <cstdio>
+#include <memory>
+
+#include "bench_common.hpp"
+#include "report_filter.hpp"
+#include "switch_pro.hpp"
+#include "virtual_clock.hpp"
+#include "xbox_to_switch_pro.hpp"
+
+#include "test_util.hpp"
+
+static void test_filter() {
+  ReportFilter filter({.keepalive_us = 10'000, .ignore_offset = 0, .ignore_size = 1});
+  uint8_t report[4] = {0, 1, 2, 3};
+  expect(filter.should_send(1, report, 0), "first report is sent");
+  expect(!filter.should_send(1, report, 1'000), "identical report is suppressed");
+  report[0] = 9;
+  expect(!filter.should_send(1, report, 2'000), "change in the ignored range is suppressed");
+  report[3] = 4;
+  expect(filter.should_send(1, report, 3'000), "change is sent");
+  expect(!filter.should_send(1, report, 12'999), "suppressed until the keepalive");
+  expect(filter.should_send(1, report, 13'000), "keepalive is sent");
+  expect(filter.should_send(2, report, 14'000), "different report id is sent");
+  expect(filter.should_send(2, std::span<const uint8_t>(report, 3), 15'000),
+         "different length is sent");
+  expect(filter.get_sent_count() == 5 && filter.get_suppressed_count() == 3, "counters");
+
+  ReportFilter no_keepalive;
+  expect(no_keepalive.should_send(1, report, 0), "first report is sent without keepalive");
+  expect(!no_keepalive.should_send(1, report, 1'000'000'000), "never resent without keepalive");
+  no_keepalive.reset();
+  expect(no_keepalive.should_send(1, report, 1'000'000'001), "sent after reset");
+  uint8_t resend[4];
+  uint8_t resend_id;
+  expect(no_keepalive.get_time_until_keepalive(1'000'000'002) == -1 &&
+             no_keepalive.take_keepalive(1'000'000'002, resend_id, resend) == 0,
+         "no keepalive to resend");
+}
+
+static void test_keepalive_resend() {
+  ReportFilter filter({.keepalive_us = 10'000});
+  uint8_t resend[4];
+  uint8_t resend_id = 0;
+  expect(filter.get_time_until_keepalive(0) == -1 &&
+             filter.take_keepalive(0, resend_id, resend) == 0,
+         "nothing to resend before the first report");
+  uint8_t report[3] = {1, 2, 3};
+  filter.should_send(7, report, 1'000);
+  expect(filter.get_time_until_keepalive(4'000) == 7'000, "time until the keepalive");
+  expect(filter.take_keepalive(10'999, resend_id, resend) == 0, "not resent before it is due");
+  // the input stays steady, so no report arrives
+  expect(filter.get_time_until_keepalive(11'500) == 0 &&
+             filter.take_keepalive(11'500, resend_id, resend) == 3 && resend_id == 7 &&
+             resend[0] == 1 && resend[2] == 3,
+         "the last report is resent when the keepalive is due");
+  expect(filter.get_time_until_keepalive(11'500) == 10'000 &&
+             filter.take_keepalive(12'000, resend_id, resend) == 0,
+         "the keepalive restarts when resent");
+  expect(!filter.should_send(7, report, 12'000), "the resent report is the last one");
+  expect(filter.get_sent_count() == 2 && filter.get_keepalive_count() == 1, "keepalive counter");
+}
+
+static void test_switch_pro() {
+  host::use_virtual_clock();
+  auto xbox = std::make_shared<Xbox>();
+  auto switch_pro = std::make_shared<SwitchPro>();
+  const uint8_t enable_usb_hid[] = {sp::HOST_INIT_REPORT, sp::INIT_COMMAND_ENABLE_USB_HID};
+  switch_pro->on_hid_report(sp::HOST_INIT_REPORT, enable_usb_hid, sizeof(enable_usb_hid));
+  XboxToSwitchProBridge bridge(xbox, switch_pro);
+  ReportFilter filter(switch_pro->get_report_filter_config());
+
+  // 1 s of identical BLE reports every 1 ms, with one change half way
+  auto idle = bench::make_xbox_report(0x8000, 0x8000, 0x8000, 0x8000, 0, 0, 0, 0);
+  auto pressed = bench::make_xbox_report(0x8000, 0x8000, 0x8000, 0x8000, 0, 0, 0, 1);
+  std::array<uint8_t, GamepadDevice::max_report_size> report;
+  uint8_t report_id;
+  size_t sent = 0;
+  for (int i = 0; i < 1000; i++) {
+    host::set_virtual_time(i * 1000);
+    const auto &ble_report = (i == 500) ? pressed : idle;
+    size_t len = bridge.translate(ble_report, report_id, report);
+    if (filter.should_send(report_id, std::span<const uint8_t>(report.data(), len), i * 1000)) {
+      sent++;
+    }
+  }
+  // one keepalive every 100 ms, plus the press and the release
+  std::printf("SwitchPro: %zu sent, %u suppressed\n", sent, filter.get_suppressed_count());
+  expect(sent >= 1000 / 100 && sent <= 1000 / 100 + 4, "switch pro keepalive cadence");
+  host::use_real_clock();
+}
+
+int main() {
+  test_filter();
+  test_keepalive_resend();
+  test_switch_pro();
+  return test_result();
+}
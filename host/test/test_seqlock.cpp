@@ -0,0 +1,145 @@
+// Stress test for SeqLock and the SwitchPro input report snapshot: a writer
+// thread continuously publishes values whose bytes all encode the same
+// sequence number while reader threads check that every snapshot they read is
+// internally consistent (i.e. not torn). Reports the number of reader retries.
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "seqlock.hpp"
+#include "switch_pro.hpp"
+
+static constexpr size_t writes = 1'000'000;
+static constexpr size_t reader_count = 3;
+
+struct Block {
+  uint32_t values[32];
+};
+
+static size_t stress_seqlock() {
+  SeqLock<Block> seqlock;
+  std::atomic<bool> done{false};
+  std::atomic<size_t> torn{0};
+  std::atomic<size_t> reads{0};
+
+  std::vector<std::thread> readers;
+  for (size_t r = 0; r < reader_count; r++) {
+    readers.emplace_back([&]() {
+      size_t local_reads = 0;
+      uint32_t last = 0;
+      while (!done.load(std::memory_order_relaxed)) {
+        auto block = seqlock.load();
+        local_reads++;
+        for (auto value : block.values) {
+          if (value != block.values[0]) {
+            torn++;
+            break;
+          }
+        }
+        // values are published in order, so they must never go backwards
+        if (block.values[0] < last) {
+          torn++;
+        }
+        last = block.values[0];
+      }
+      reads += local_reads;
+    });
+  }
+
+  Block block;
+  for (uint32_t i = 1; i <= writes; i++) {
+    std::fill(std::begin(block.values), std::end(block.values), i);
+    seqlock.store(block);
+  }
+  done = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+
+  std::printf("SeqLock: %zu writes, %zu reads, %u retries, %zu torn\n", writes, reads.load(),
+              seqlock.get_retry_count(), torn.load());
+  return torn;
+}
+
+static size_t stress_switch_pro() {
+  auto switch_pro = std::make_shared<SwitchPro>();
+  const uint8_t enable_usb_hid[] = {sp::HOST_INIT_REPORT, sp::INIT_COMMAND_ENABLE_USB_HID};
+  switch_pro->on_hid_report(sp::HOST_INIT_REPORT, enable_usb_hid, sizeof(enable_usb_hid));
+
+  std::atomic<bool> done{false};
+  std::atomic<size_t> torn{0};
+  std::atomic<size_t> reads{0};
+
+  // the controller state is bytes 2-10 of the input report data
+  auto check = [&](std::span<const uint8_t> report) {
+    for (size_t i = sp::CONTROLLER_STATE_OFFSET;
+         i < sp::CONTROLLER_STATE_OFFSET + sizeof(sp::ControllerState); i++) {
+      if (report[i] != report[sp::CONTROLLER_STATE_OFFSET]) {
+        torn++;
+        return;
+      }
+    }
+  };
+
+  std::vector<std::thread> readers;
+  // the USB task reads the input report for the subcommand replies...
+  readers.emplace_back([&]() {
+    std::array<uint8_t, sp::REPORT_SIZE + 1> command{};
+    command[0] = sp::HOST_OUTPUT_REPORT;
+    command[sp::Message::subcommand_offset] = 0x00; // only controller state
+    std::array<uint8_t, GamepadDevice::max_report_size> response;
+    size_t local_reads = 0;
+    while (!done.load(std::memory_order_relaxed)) {
+      uint8_t report_id;
+      size_t len = switch_pro->on_hid_report(sp::HOST_OUTPUT_REPORT, command, report_id, response);
+      if (len > 0) {
+        check({response.data(), len});
+        local_reads++;
+      }
+    }
+    reads += local_reads;
+  });
+  // ...and the input reports themselves
+  for (size_t r = 1; r < reader_count; r++) {
+    readers.emplace_back([&]() {
+      std::array<uint8_t, GamepadDevice::max_report_size> report;
+      size_t local_reads = 0;
+      while (!done.load(std::memory_order_relaxed)) {
+        size_t len = switch_pro->get_report_data(switch_pro->get_input_report_id(), report);
+        if (len > 0) {
+          check({report.data(), len});
+          local_reads++;
+        }
+      }
+      reads += local_reads;
+    });
+  }
+
+  sp::ControllerState state;
+  for (size_t i = 0; i < writes; i++) {
+    std::memset(&state, uint8_t(i), sizeof(state));
+    switch_pro->set_controller_state(state);
+  }
+  done = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+
+  std::printf("SwitchPro: %zu writes, %zu reads, %u retries, %zu torn\n", writes, reads.load(),
+              switch_pro->get_input_report_retry_count(), torn.load());
+  return torn;
+}
+
+int main() {
+  size_t torn = stress_seqlock();
+  torn += stress_switch_pro();
+  if (torn) {
+    std::printf("FAILED: %zu torn reads\n", torn);
+    return 1;
+  }
+  std::printf("no torn reads\n");
+  return 0;
+}
@@ -0,0 +1,128 @@
+// Tests for SpscRing: checks the latest-wins overflow policy single threaded,
+// then stresses it with a producer thread pushing sequence numbered values
+// (whose bytes all encode the same number) in bursts while a consumer thread
+// checks that every value it pops is intact, in order, and that every pushed
+// value was either popped or counted as dropped.
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "spsc_ring.hpp"
+
+static constexpr size_t capacity = 8;
+static constexpr uint32_t pushes = 1'000'000;
+
+struct Value {
+  uint32_t words[16];
+};
+
+static Value make_value(uint32_t sequence) {
+  Value value{};
+  std::fill(std::begin(value.words), std::end(value.words), sequence);
+  return value;
+}
+
+static int check_overflow() {
+  int failures = 0;
+  SpscRing<Value, capacity> ring;
+  Value value{};
+  if (ring.pop(value)) {
+    std::printf("FAIL: pop from an empty ring succeeded\n");
+    failures++;
+  }
+  static constexpr uint32_t overflow = 3;
+  for (uint32_t i = 0; i < capacity + overflow; i++) {
+    bool expected = i < capacity;
+    if (ring.push(make_value(i)) != expected) {
+      std::printf("FAIL: push %u returned %d\n", i, !expected);
+      failures++;
+    }
+  }
+  if (ring.size() != capacity || ring.get_drop_count() != overflow ||
+      ring.get_max_depth() != capacity) {
+    std::printf("FAIL: size %zu, drops %u, max depth %u after overflow\n", ring.size(),
+                ring.get_drop_count(), ring.get_max_depth());
+    failures++;
+  }
+  // the oldest values were dropped, so the latest ones remain in order
+  for (uint32_t i = overflow; i < capacity + overflow; i++) {
+    if (!ring.pop(value) || value.words[0] != i) {
+      std::printf("FAIL: expected value %u, got %u\n", i, value.words[0]);
+      failures++;
+    }
+  }
+  if (!ring.empty()) {
+    std::printf("FAIL: ring not empty after draining\n");
+    failures++;
+  }
+  return failures;
+}
+
+static int stress() {
+  SpscRing<Value, capacity> ring;
+  std::atomic<bool> done{false};
+  size_t popped = 0;
+  size_t torn = 0;
+  size_t out_of_order = 0;
+
+  std::thread consumer([&]() {
+    Value value{};
+    int64_t last = -1;
+    while (true) {
+      bool finished = done.load(std::memory_order_acquire);
+      while (ring.pop(value)) {
+        popped++;
+        for (auto word : value.words) {
+          if (word != value.words[0]) {
+            torn++;
+            break;
+          }
+        }
+        if (int64_t(value.words[0]) <= last) {
+          out_of_order++;
+        }
+        last = value.words[0];
+      }
+      if (finished) {
+        break;
+      }
+      std::this_thread::yield();
+    }
+  });
+
+  for (uint32_t i = 0; i < pushes; i++) {
+    ring.push(make_value(i));
+    // push in bursts so that the ring both drains and overflows
+    if (i % 64 == 0) {
+      std::this_thread::yield();
+    }
+  }
+  done.store(true, std::memory_order_release);
+  consumer.join();
+
+  size_t drops = ring.get_drop_count();
+  std::printf("SpscRing: %u pushes, %zu pops, %zu drops, max depth %u, %zu torn, %zu out of "
+              "order\n",
+              pushes, popped, drops, ring.get_max_depth(), torn, out_of_order);
+  int failures = 0;
+  if (torn || out_of_order) {
+    std::printf("FAIL: consumer saw corrupted values\n");
+    failures++;
+  }
+  if (popped + drops != pushes || ring.get_push_count() != pushes) {
+    std::printf("FAIL: %zu pops + %zu drops != %u pushes\n", popped, drops, pushes);
+    failures++;
+  }
+  return failures;
+}
+
+int main() {
+  int failures = check_overflow() + stress();
+  if (failures) {
+    std::printf("%d failures\n", failures);
+    return 1;
+  }
+  std::printf("PASS\n");
+  return 0;
+}
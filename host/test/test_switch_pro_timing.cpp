@@ -0,0 +1,155 @@
+// Verifies the on-demand Switch Pro timer counter and trigger button elapsed
+// times against a virtual clock:
+//
+// - the counter (byte 0 of every input report / subcommand reply) must match
+//   a model of the previous implementation, a periodic timer which
+//   incremented a wrapping 8-bit counter every 4.96ms since construction.
+// - subcommand 0x04 must report how long each trigger button has been (or
+//   was last) held, in units of 10ms.
+
+#include <cstdio>
+#include <memory>
+
+#include "switch_pro.hpp"
+#include "virtual_clock.hpp"
+
+static constexpr int64_t counter_period_us = 4960;
+
+// Model of the periodic timer which used to increment the counter
+class ReferenceCounter {
+public:
+  explicit ReferenceCounter(int64_t start_us)
+      : next_fire_us_(start_us + counter_period_us) {}
+
+  uint8_t get(int64_t now_us) {
+    while (next_fire_us_ <= now_us) {
+      counter_++;
+      next_fire_us_ += counter_period_us;
+    }
+    return counter_;
+  }
+
+protected:
+  int64_t next_fire_us_;
+  uint8_t counter_{0};
+};
+
+static std::shared_ptr<SwitchPro> make_ready_switch_pro() {
+  auto switch_pro = std::make_shared<SwitchPro>();
+  const uint8_t enable_usb_hid[] = {sp::HOST_INIT_REPORT, sp::INIT_COMMAND_ENABLE_USB_HID};
+  switch_pro->on_hid_report(sp::HOST_INIT_REPORT, enable_usb_hid, sizeof(enable_usb_hid));
+  return switch_pro;
+}
+
+static size_t send_subcommand(SwitchPro &switch_pro, uint8_t subcommand,
+                              std::array<uint8_t, GamepadDevice::max_report_size> &response) {
+  std::array<uint8_t, sp::REPORT_SIZE + 1> command{};
+  command[0] = sp::HOST_OUTPUT_REPORT;
+  command[sp::Message::subcommand_offset] = subcommand;
+  uint8_t report_id;
+  return switch_pro.on_hid_report(sp::HOST_OUTPUT_REPORT, command, report_id, response);
+}
+
+static size_t check_counter() {
+  static constexpr int64_t start_us = 1'234'567;
+  host::use_virtual_clock(start_us);
+  auto switch_pro = make_ready_switch_pro();
+  ReferenceCounter reference(start_us);
+
+  // step through a few wraps of the counter with a mix of step sizes,
+  // including ones which land exactly on / next to the tick boundaries
+  static constexpr int64_t steps[] = {1, 7, 4959, 4960, 4961, 1000, 8000, 15'000, 2480, 33};
+  std::array<uint8_t, GamepadDevice::max_report_size> report;
+  size_t failures = 0;
+  int64_t now = start_us;
+  for (size_t i = 0; i < 200'000; i++) {
+    now += steps[i % std::size(steps)];
+    host::set_virtual_time(now);
+    uint8_t expected = reference.get(now);
+    size_t len = switch_pro->get_report_data(switch_pro->get_input_report_id(), report);
+    uint8_t input_counter = len ? report[0] : 0xFF;
+    len = send_subcommand(*switch_pro, 0x00, report);
+    uint8_t reply_counter = len ? report[0] : 0xFF;
+    if (input_counter != expected || reply_counter != expected) {
+      if (failures < 10) {
+        std::printf("counter at t=%lld: expected %u, got %u (input) / %u (reply)\n",
+                    (long long)(now - start_us), expected, input_counter, reply_counter);
+      }
+      failures++;
+    }
+  }
+  std::printf("counter: checked %.1f s of virtual time, %zu failures\n",
+              (now - start_us) / 1e6, failures);
+  return failures;
+}
+
+static uint16_t trigger_time(const std::array<uint8_t, GamepadDevice::max_report_size> &reply,
+                             size_t index) {
+  static constexpr size_t trigger_times_offset = 14;
+  size_t offset = trigger_times_offset + 2 * index;
+  return reply[offset] | (reply[offset + 1] << 8);
+}
+
+static size_t check_trigger_times() {
+  host::use_virtual_clock(5'000'000);
+  auto switch_pro = make_ready_switch_pro();
+  std::array<uint8_t, GamepadDevice::max_report_size> reply;
+  size_t failures = 0;
+
+  auto set_buttons = [&](uint32_t buttons) {
+    sp::ControllerState state{};
+    state.buttons[0] = buttons & 0xFF;
+    state.buttons[1] = (buttons >> 8) & 0xFF;
+    state.buttons[2] = (buttons >> 16) & 0xFF;
+    switch_pro->set_controller_state(state);
+  };
+  auto expect = [&](const char *when, uint16_t l, uint16_t zl, uint16_t zr, uint16_t home) {
+    send_subcommand(*switch_pro, 0x04, reply);
+    uint16_t actual[] = {trigger_time(reply, 0), trigger_time(reply, 2), trigger_time(reply, 3),
+                         trigger_time(reply, 6)};
+    uint16_t expected[] = {l, zl, zr, home};
+    if (reply[12] != 0x83 || reply[13] != 0x04 || !std::equal(actual, actual + 4, expected)) {
+      std::printf("trigger times %s: expected l=%u zl=%u zr=%u home=%u, got l=%u zl=%u zr=%u "
+                  "home=%u\n",
+                  when, l, zl, zr, home, actual[0], actual[1], actual[2], actual[3]);
+      failures++;
+    }
+  };
+
+  expect("initially", 0, 0, 0, 0);
+
+  // press ZL, and keep sending the same state while time passes
+  set_buttons(sp::button::ZL);
+  for (int i = 0; i < 100; i++) {
+    host::advance_virtual_time(12'340);
+    set_buttons(sp::button::ZL);
+  }
+  expect("while ZL held", 0, 123, 0, 0);
+
+  // press ZR + HOME as well, then release ZL
+  set_buttons(sp::button::ZL | sp::button::ZR | sp::button::HOME);
+  host::advance_virtual_time(766'000);
+  set_buttons(sp::button::ZR | sp::button::HOME);
+  expect("after ZL released", 0, 200, 76, 76);
+
+  // release everything, time passes, values are kept
+  host::advance_virtual_time(50'000);
+  set_buttons(0);
+  host::advance_virtual_time(10'000'000);
+  expect("after all released", 0, 200, 81, 81);
+
+  // pressing again restarts the measurement
+  set_buttons(sp::button::ZL);
+  host::advance_virtual_time(30'000);
+  expect("after ZL pressed again", 0, 3, 81, 81);
+
+  std::printf("trigger times: %zu failures\n", failures);
+  return failures;
+}
+
+int main() {
+  size_t failures = check_counter();
+  failures += check_trigger_times();
+  host::use_real_clock();
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+// Tests for TaskMonitor: the load of each core must come from its idle task,
+// the load of each task from its run time since the last sample (including
+// tasks created in between and counters wrapping around), and the task with
+// the least free stack must be found.
+
+#include <string>
+#include <vector>
+
+#include "task_monitor.hpp"
+
+#include "test_util.hpp"
+
+static bool near(float a, float b) { return a > b - 0.01f && a < b + 0.01f; }
+
+static const TaskMonitor::TaskStats *find(const TaskMonitor &monitor, const std::string &name) {
+  for (const auto &task : monitor.get_tasks()) {
+    if (task.name == name) {
+      return &task;
+    }
+  }
+  return nullptr;
+}
+
+static void test_loads() {
+  TaskMonitor monitor;
+  std::vector<TaskSample> tasks = {
+      {.id = 1, .name = "IDLE0", .core = 0, .idle = true, .run_time = 0, .stack_free_bytes = 800},
+      {.id = 2, .name = "IDLE1", .core = 1, .idle = true, .run_time = 0, .stack_free_bytes = 800},
+      {.id = 3,
+       .name = "bridge",
+       .core = 1,
+       .idle = false,
+       .run_time = 0,
+       .stack_free_bytes = 1200},
+      {.id = 4,
+       .name = "nimble_host",
+       .core = -1,
+       .idle = false,
+       .run_time = 0,
+       .stack_free_bytes = 300},
+  };
+  monitor.update(tasks, 0);
+  expect(monitor.get_core_load(0) == 0 && monitor.get_tasks().size() == 4 &&
+             monitor.get_tasks()[0].cpu_percent == 0,
+         "the first sample has no loads");
+
+  // over 1 s: core 0 idle 75%, core 1 idle 40%
+  tasks[0].run_time = 750'000;
+  tasks[1].run_time = 400'000;
+  tasks[2].run_time = 500'000;
+  tasks[3].run_time = 350'000;
+  tasks.push_back({.id = 5,
+                   .name = "deferred log",
+                   .core = -1,
+                   .idle = false,
+                   .run_time = 10'000,
+                   .stack_free_bytes = 0});
+  monitor.update(tasks, 1'000'000);
+  expect(near(monitor.get_core_load(0), 25) && near(monitor.get_core_load(1), 60),
+         "core load is the time the idle task did not run");
+  auto bridge = find(monitor, "bridge");
+  expect(bridge && near(bridge->cpu_percent, 50) && bridge->core == 1, "task load");
+  auto deferred = find(monitor, "deferred log");
+  expect(deferred && near(deferred->cpu_percent, 1), "a new task's run time counts in full");
+  const auto &stats = monitor.get_tasks();
+  expect(stats.front().name == "IDLE0" && stats.back().name == "deferred log", "busiest first");
+  auto lowest = monitor.get_lowest_stack();
+  expect(lowest && lowest->name == "deferred log", "the least free stack");
+  expect(monitor.get_elapsed() == 1'000'000, "elapsed run time");
+
+  // the run time clock and the counters wrap around
+  TaskMonitor wrapping;
+  std::vector<TaskSample> wrap = {
+      {.id = 1,
+       .name = "IDLE0",
+       .core = 0,
+       .idle = true,
+       .run_time = 0xFFFF0000,
+       .stack_free_bytes = 800},
+  };
+  wrapping.update(wrap, 0xFFFF0000);
+  wrap[0].run_time = 0x00010000 - 0x8000;
+  wrapping.update(wrap, 0x00010000);
+  expect(near(wrapping.get_core_load(0), 25), "counters wrapping around");
+  expect(wrapping.get_core_load(5) == 0, "unknown core");
+}
+
+static void test_no_tasks() {
+  TaskMonitor monitor;
+  monitor.update({}, 0);
+  monitor.update({}, 1000);
+  expect(monitor.get_tasks().empty() && monitor.get_lowest_stack() == nullptr, "no tasks");
+}
+
+int main() {
+  test_loads();
+  test_no_tasks();
+  return test_result();
+}
@@ -0,0 +1,165 @@
+// Tests for TraceRing and the Chrome trace conversion: the ring must keep the
+// newest events in order, lose none when several threads record at once, and
+// a trace saved as binary or dumped to the log must convert to the same JSON,
+// with subcommands as slices and the timestamps unwrapped.
+
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "chrome_trace.hpp"
+#include "switch_pro.hpp"
+#include "trace_ring.hpp"
+
+#include "test_util.hpp"
+
+static TraceRecord make_record(uint32_t timestamp_us, TraceEvent event, uint16_t arg0 = 0) {
+  return {.timestamp_us = timestamp_us,
+          .event = event,
+          .core = 0,
+          .arg0 = arg0,
+          .arg1 = 0,
+          .arg2 = 0};
+}
+
+static void test_wrap_around() {
+  TraceRing<8> ring;
+  std::vector<TraceRecord> records(8);
+  expect(ring.copy(records) == 0, "empty ring");
+  for (uint32_t i = 0; i < 20; i++) {
+    ring.record(make_record(i, TraceEvent::BLE_NOTIFY, i));
+  }
+  expect(ring.get_total() == 20, "total counts the overwritten events");
+  size_t count = ring.copy(records);
+  bool newest_in_order = count == 8;
+  for (size_t i = 0; i < count; i++) {
+    newest_in_order &= records[i].arg0 == 12 + i;
+  }
+  expect(newest_in_order, "the newest events are kept, oldest first");
+
+  // a smaller buffer gets the newest events
+  std::vector<TraceRecord> last(3);
+  expect(ring.copy(last) == 3 && last[0].arg0 == 17 && last[2].arg0 == 19, "partial copy");
+
+  ring.set_enabled(false);
+  ring.record(make_record(99, TraceEvent::BLE_NOTIFY));
+  expect(ring.get_total() == 20, "nothing recorded while disabled");
+  ring.set_enabled(true);
+  ring.clear();
+  expect(ring.copy(records) == 0, "clear");
+}
+
+static void test_concurrent_recording() {
+  TraceRing<4096> ring;
+  static constexpr size_t thread_count = 4;
+  static constexpr uint16_t events = 1000;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < thread_count; t++) {
+    threads.emplace_back([&, t]() {
+      for (uint16_t i = 0; i < events; i++) {
+        ring.record({.timestamp_us = i,
+                     .event = TraceEvent::USB_REPORT_SUBMIT,
+                     .core = uint8_t(t),
+                     .arg0 = i,
+                     .arg1 = 0,
+                     .arg2 = 0});
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  std::vector<TraceRecord> records(ring.capacity);
+  size_t count = ring.copy(records);
+  std::vector<uint32_t> per_thread(thread_count);
+  for (size_t i = 0; i < count; i++) {
+    if (records[i].core < thread_count && records[i].event == TraceEvent::USB_REPORT_SUBMIT) {
+      per_thread[records[i].core]++;
+    }
+  }
+  bool all = count == thread_count * events;
+  for (auto n : per_thread) {
+    all &= n == events;
+  }
+  expect(all, "no events lost between threads");
+}
+
+// serialize records the way trace_dump.cpp does
+static std::vector<uint8_t> save(const std::vector<TraceRecord> &records) {
+  TraceHeader header;
+  header.count = records.size();
+  header.total = records.size();
+  std::vector<uint8_t> data(sizeof(header) + records.size() * sizeof(TraceRecord));
+  std::memcpy(data.data(), &header, sizeof(header));
+  std::memcpy(data.data() + sizeof(header), records.data(), records.size() * sizeof(TraceRecord));
+  return data;
+}
+
+static void test_conversion() {
+  std::vector<TraceRecord> records = {
+      make_record(0xFFFFFF00, TraceEvent::USB_MOUNT),
+      make_record(0xFFFFFF80, TraceEvent::SUBCOMMAND_BEGIN, 0x02),
+      make_record(0x00000010, TraceEvent::SUBCOMMAND_END, 0x02),
+      make_record(0x00000020, TraceEvent::BLE_NOTIFY, 0x2A),
+  };
+  auto data = save(records);
+
+  std::vector<TraceRecord> parsed;
+  expect(chrome_trace::parse(data, parsed) && parsed.size() == records.size(), "parse binary");
+  auto json = chrome_trace::to_json(parsed);
+  expect(json.find("\"name\":\"subcommand\",\"ph\":\"B\"") != std::string::npos,
+         "subcommand begins a slice");
+  expect(json.find("\"name\":\"subcommand\",\"ph\":\"E\"") != std::string::npos,
+         "subcommand ends the slice");
+  expect(json.find("\"name\":\"usb_mount\",\"ph\":\"i\"") != std::string::npos,
+         "other events are instants");
+  expect(json.find(fmt::format("\"ts\":{}", (1ull << 32) + 0x20)) != std::string::npos,
+         "timestamps are unwrapped");
+  expect(json.find(",\n]}") == std::string::npos, "no trailing comma");
+
+  // the same trace, dumped to the log
+  std::string log = "I (123) Trace: Dumping 4 trace events (4 recorded)\n";
+  for (size_t offset = 0; offset < data.size(); offset += 32) {
+    log += "[Trace/I][1.234]: TRACE ";
+    for (size_t i = offset; i < std::min(data.size(), offset + 32); i++) {
+      log += fmt::format("{:02x}", data[i]);
+    }
+    log += "\n";
+  }
+  std::istringstream stream(log);
+  std::vector<TraceRecord> from_log;
+  expect(chrome_trace::parse(chrome_trace::read_log_bytes(stream), from_log) &&
+             chrome_trace::to_json(from_log) == json,
+         "the log dump converts to the same JSON");
+
+  data[0] ^= 0xFF;
+  expect(!chrome_trace::parse(data, parsed), "bad magic rejected");
+}
+
+static void test_switch_pro_events() {
+  auto &ring = get_trace_ring();
+  ring.clear();
+  SwitchPro switch_pro;
+  std::array<uint8_t, GamepadDevice::max_report_size> response;
+  std::array<uint8_t, sp::REPORT_SIZE + 1> data{};
+  data[0] = sp::HOST_OUTPUT_REPORT;
+  data[sp::Message::subcommand_offset] = 0x02;
+  uint8_t report_id;
+  switch_pro.on_hid_report(data[0], data, report_id, response);
+  std::vector<TraceRecord> records(ring.capacity);
+  size_t count = ring.copy(records);
+  expect(count == 2 && records[0].event == TraceEvent::SUBCOMMAND_BEGIN &&
+             records[1].event == TraceEvent::SUBCOMMAND_END && records[1].arg0 == 0x02 &&
+             records[1].arg1 != 0,
+         "subcommands are traced with their ACK");
+}
+
+int main() {
+  test_wrap_around();
+  test_concurrent_recording();
+  test_conversion();
+  test_switch_pro_events();
+  return test_result();
+}
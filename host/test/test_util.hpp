@@ -0,0 +1,30 @@
+#pragma once
+
+// Shared checks for the host tests: each failed expectation is printed and
+// counted, and main() returns test_result() to print the summary and get the
+// exit code for ctest.
+
+#include <cstdio>
+
+inline int failures = 0;
+
+/// Check a condition, printing and counting a failure if it does not hold.
+/// @param condition The condition which must hold
+/// @param message What is being checked
+inline void expect(bool condition, const char *message) {
+  if (!condition) {
+    std::printf("FAIL: %s\n", message);
+    failures++;
+  }
+}
+
+/// Print the summary of the test.
+/// @return The exit code: 0 if every expectation held, 1 otherwise
+inline int test_result() {
+  if (failures) {
+    std::printf("%d failure(s)\n", failures);
+    return 1;
+  }
+  std::printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,139 @@
+// Golden-vector test for the direct Xbox -> Switch Pro transcoder: every
+// report is translated both through the GamepadInputs path (DynamicBridge)
+// and through XboxToSwitchProBridge, and the resulting Switch Pro input
+// reports must be byte-identical, except for:
+// - the timer byte, which is driven by each device's own counter
+// - the joystick axes, which may differ by 1 LSB: the transcoder maps them
+//   exactly in integers, while the float path can round a value which lands
+//   within float error of an integer boundary across it. How many do is
+//   printed; it depends on hid-rp's to_float / from_float, so run this against
+//   the pinned espp (configure without ESPP_PATH).
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#include "bridge.hpp"
+#include "xbox_to_switch_pro.hpp"
+
+#include "bench_common.hpp"
+
+static std::shared_ptr<SwitchPro> make_ready_switch_pro() {
+  auto switch_pro = std::make_shared<SwitchPro>();
+  const uint8_t enable_usb_hid[] = {sp::HOST_INIT_REPORT, sp::INIT_COMMAND_ENABLE_USB_HID};
+  switch_pro->on_hid_report(sp::HOST_INIT_REPORT, enable_usb_hid, sizeof(enable_usb_hid));
+  return switch_pro;
+}
+
+static constexpr size_t left_stick_offset = sp::CONTROLLER_STATE_OFFSET + 3;
+static constexpr size_t right_stick_offset = sp::CONTROLLER_STATE_OFFSET + 6;
+static constexpr size_t sticks_end = right_stick_offset + 3;
+
+/// Unpack the two 12-bit axes of a stick.
+static std::array<int, 2> unpack_stick(const uint8_t *data) {
+  return {data[0] | (data[1] & 0x0F) << 8, data[1] >> 4 | data[2] << 4};
+}
+
+/// Compare the two reports, ignoring byte 0 (the timer) and allowing the
+/// joystick axes to differ by 1.
+/// @param rounded_axes Incremented for each axis which differs by 1
+static bool reports_match(std::span<const uint8_t> expected, std::span<const uint8_t> actual,
+                          size_t &rounded_axes) {
+  if (expected.size() != actual.size() || expected.size() < sticks_end) {
+    return false;
+  }
+  if (!std::equal(expected.begin() + 1, expected.begin() + left_stick_offset,
+                  actual.begin() + 1) ||
+      !std::equal(expected.begin() + sticks_end, expected.end(), actual.begin() + sticks_end)) {
+    return false;
+  }
+  for (size_t offset : {left_stick_offset, right_stick_offset}) {
+    auto expected_axes = unpack_stick(&expected[offset]);
+    auto actual_axes = unpack_stick(&actual[offset]);
+    for (size_t axis = 0; axis < 2; axis++) {
+      int difference = std::abs(expected_axes[axis] - actual_axes[axis]);
+      if (difference > 1) {
+        return false;
+      }
+      rounded_axes += difference;
+    }
+  }
+  return true;
+}
+
+int main() {
+  DynamicBridge reference(std::make_shared<Xbox>(), make_ready_switch_pro());
+  XboxToSwitchProBridge transcoder(std::make_shared<Xbox>(), make_ready_switch_pro());
+
+  static constexpr uint16_t c = 32767; // xbox joystick center
+  std::vector<bench::XboxReport> vectors;
+  // exhaustive sweep of each joystick axis
+  for (uint32_t v = 0; v <= 0xFFFF; v++) {
+    vectors.push_back(bench::make_xbox_report(v, c, c, c, 0, 0, 0, 0));
+    vectors.push_back(bench::make_xbox_report(c, v, c, c, 0, 0, 0, 0));
+    vectors.push_back(bench::make_xbox_report(c, c, v, c, 0, 0, 0, 0));
+    vectors.push_back(bench::make_xbox_report(c, c, c, v, 0, 0, 0, 0));
+  }
+  // exhaustive sweep of the triggers
+  for (uint16_t t = 0; t < 1024; t++) {
+    vectors.push_back(bench::make_xbox_report(c, c, c, c, t, 0, 0, 0));
+    vectors.push_back(bench::make_xbox_report(c, c, c, c, 0, t, 0, 0));
+  }
+  // every hat value
+  for (uint8_t hat = 0; hat < 16; hat++) {
+    vectors.push_back(bench::make_xbox_report(c, c, c, c, 0, 0, hat, 0));
+  }
+  // every button on its own, then the share (consumer) button
+  for (int bit = 0; bit < 15; bit++) {
+    vectors.push_back(bench::make_xbox_report(c, c, c, c, 0, 0, 0, 1 << bit));
+  }
+  auto share = bench::make_xbox_report(c, c, c, c, 0, 0, 0, 0);
+  share[15] = 0x01;
+  vectors.push_back(share);
+  // random combinations
+  auto random_reports = bench::make_xbox_reports(100'000);
+  vectors.insert(vectors.end(), random_reports.begin(), random_reports.end());
+
+  std::array<uint8_t, GamepadDevice::max_report_size> expected;
+  std::array<uint8_t, GamepadDevice::max_report_size> actual;
+  size_t failures = 0;
+  size_t rounded_axes = 0;
+  for (const auto &v : vectors) {
+    uint8_t expected_id, actual_id;
+    size_t expected_len = reference.translate(v, expected_id, expected);
+    size_t actual_len = transcoder.translate(v, actual_id, actual);
+    bool match = expected_id == actual_id &&
+                 reports_match({expected.data(), expected_len}, {actual.data(), actual_len},
+                               rounded_axes);
+    if (!match) {
+      if (failures < 10) {
+        std::printf("mismatch for xbox report:");
+        for (auto b : v) {
+          std::printf(" %02x", b);
+        }
+        std::printf("\n  expected:");
+        for (size_t i = 1; i < 11 && i < expected_len; i++) {
+          std::printf(" %02x", expected[i]);
+        }
+        std::printf("\n  actual:  ");
+        for (size_t i = 1; i < 11 && i < actual_len; i++) {
+          std::printf(" %02x", actual[i]);
+        }
+        std::printf("\n");
+      }
+      failures++;
+    }
+  }
+
+  std::printf("%zu / %zu golden vectors match (%zu axes rounded the other way)\n",
+              vectors.size() - failures, vectors.size(), rounded_axes);
+  // only values within float error of a boundary may round differently, so a
+  // systematic 1 LSB offset still fails
+  size_t axes = vectors.size() * 4;
+  if (rounded_axes * 1000 > axes) {
+    std::printf("more than 1 in 1000 axes rounded the other way\n");
+    return 1;
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+// Reads the event traces saved by the device (trace_dump.cpp), either as the
+// raw partition contents or as the "TRACE <hex>" lines of the log, and turns
+// them into the Chrome trace event JSON format, which chrome://tracing and
+// https://ui.perfetto.dev open.
+
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "trace_ring.hpp"
+
+namespace chrome_trace {
+
+/// Collect the bytes of the "TRACE <hex>" lines of a device log.
+/// @param log The log
+/// @return The bytes, in order
+inline std::vector<uint8_t> read_log_bytes(std::istream &log) {
+  std::vector<uint8_t> bytes;
+  std::string line;
+  while (std::getline(log, line)) {
+    auto start = line.find("TRACE ");
+    if (start == std::string::npos) {
+      continue;
+    }
+    for (size_t i = start + 6; i + 1 < line.size(); i += 2) {
+      if (!std::isxdigit(line[i]) || !std::isxdigit(line[i + 1])) {
+        break;
+      }
+      bytes.push_back(std::stoi(line.substr(i, 2), nullptr, 16));
+    }
+  }
+  return bytes;
+}
+
+/// Parse a saved trace (a TraceHeader followed by the records).
+/// @param data The saved trace
+/// @param records Filled with the records, oldest first
+/// @return True if the data holds a valid trace
+inline bool parse(std::span<const uint8_t> data, std::vector<TraceRecord> &records) {
+  TraceHeader header;
+  if (data.size() < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+  if (header.magic != TraceHeader::magic_value ||
+      header.version != TraceHeader::current_version ||
+      header.record_size != sizeof(TraceRecord) ||
+      data.size() < sizeof(header) + size_t(header.count) * sizeof(TraceRecord)) {
+    return false;
+  }
+  records.resize(header.count);
+  std::memcpy(records.data(), data.data() + sizeof(header), header.count * sizeof(TraceRecord));
+  return true;
+}
+
+/// Convert the records to Chrome trace event JSON.
+///
+/// Each core is a thread of the trace. Subcommands become slices (from their
+/// begin to their end event) and everything else an instant event with its
+/// arguments. The 32 bit timestamps are unwrapped so the timeline stays
+/// monotonic.
+/// @param records The records, oldest first
+/// @return The JSON document
+inline std::string to_json(std::span<const TraceRecord> records) {
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  auto out = std::back_inserter(json);
+  for (int core = 0; core < 2; core++) {
+    fmt::format_to(out,
+                   "{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},"
+                   "\"args\":{{\"name\":\"core {}\"}}}},\n",
+                   core, core);
+  }
+  uint64_t wraps = 0;
+  uint32_t previous_us = records.empty() ? 0 : records[0].timestamp_us;
+  for (const auto &record : records) {
+    if (record.timestamp_us < previous_us) {
+      wraps++;
+    }
+    previous_us = record.timestamp_us;
+    uint64_t timestamp_us = (wraps << 32) + record.timestamp_us;
+    const char *phase = "i";
+    if (record.event == TraceEvent::SUBCOMMAND_BEGIN) {
+      phase = "B";
+    } else if (record.event == TraceEvent::SUBCOMMAND_END) {
+      phase = "E";
+    }
+    fmt::format_to(out,
+                   "{{\"name\":\"{}\",\"ph\":\"{}\",\"ts\":{},\"pid\":1,\"tid\":{},{}"
+                   "\"args\":{{\"arg0\":{},\"arg1\":{},\"arg2\":{}}}}},\n",
+                   to_string(record.event), phase, timestamp_us, record.core,
+                   phase[0] == 'i' ? "\"s\":\"t\"," : "", record.arg0, record.arg1,
+                   record.arg2);
+  }
+  // remove the trailing comma
+  if (json.ends_with(",\n")) {
+    json.erase(json.size() - 2, 1);
+  }
+  json += "]}\n";
+  return json;
+}
+
+} // namespace chrome_trace
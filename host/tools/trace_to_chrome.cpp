@@ -0,0 +1,49 @@
+// Converts an event trace saved by the device into Chrome trace event JSON,
+// for chrome://tracing or https://ui.perfetto.dev.
+//
+// Usage: trace_to_chrome <trace.bin | device.log> [trace.json]
+//
+// The input is either the contents of the littlefs partition (see
+// save_trace_to_flash()) or a log containing the "TRACE" lines of
+// dump_trace_to_log(). Without an output file the JSON is written to stdout.
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include "chrome_trace.hpp"
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "usage: %s <trace.bin | device.log> [trace.json]\n", argv[0]);
+    return 1;
+  }
+  std::ifstream input(argv[1], std::ios::binary);
+  if (!input) {
+    std::fprintf(stderr, "failed to open %s\n", argv[1]);
+    return 1;
+  }
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(input)),
+                            std::istreambuf_iterator<char>());
+
+  // a raw trace starts with the header, anything else is a log
+  std::vector<TraceRecord> records;
+  if (!chrome_trace::parse(data, records)) {
+    std::istringstream log(std::string(data.begin(), data.end()));
+    if (!chrome_trace::parse(chrome_trace::read_log_bytes(log), records)) {
+      std::fprintf(stderr, "no trace found in %s\n", argv[1]);
+      return 1;
+    }
+  }
+
+  auto json = chrome_trace::to_json(records);
+  if (argc > 2) {
+    std::ofstream output(argv[2]);
+    output << json;
+  } else {
+    std::fputs(json.c_str(), stdout);
+  }
+  std::fprintf(stderr, "converted %zu events\n", records.size());
+  return 0;
+}
@@ -1,23 +1,115 @@
 #include "ble.hpp"
 #include "bsp.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include <esp_timer.h>
+#include <host/ble_hs.h>
+
+#include "ble_connection.hpp"
+#include "deferred_log.hpp"
+#include "gatt_cache_storage.hpp"
 #include "gaussian.hpp"
+#include "link_monitor.hpp"
+#include "link_profile.hpp"
+#include "metrics.hpp"
+#include "reconnect_policy.hpp"
+#include "trace_ring.hpp"
 
 /************* BLE Configuration ****************/
 
+static espp::Logger logger({.tag = "BLE"});
+
 static uint32_t scanTimeMs = 5000; // scan time in milliseconds, 0 = scan forever
-static std::unique_ptr<espp::Timer> scanTimer;
-static bool subscribed = false;
 
 static NimBLEUUID hid_service_uuid(espp::HidService::SERVICE_UUID);
 static NimBLEUUID hid_input_uuid(espp::HidService::REPORT_UUID);
+static NimBLEUUID hid_report_map_uuid((uint16_t)0x2A4B);
+static NimBLEUUID hid_report_reference_uuid((uint16_t)0x2908);
+static constexpr uint8_t hid_report_type_input = 0x01;
 
 static NimBLEUUID battery_service_uuid(espp::BatteryService::BATTERY_SERVICE_UUID);
 static NimBLEUUID battery_level_uuid(espp::BatteryService::BATTERY_LEVEL_CHAR_UUID);
 
-static bool is_pairing = true;
+static NimBLEUUID gatt_service_uuid((uint16_t)0x1801);
+static NimBLEUUID service_changed_uuid((uint16_t)0x2A05);
+static NimBLEUUID database_hash_uuid((uint16_t)0x2B2A);
+static NimBLEUUID cccd_uuid((uint16_t)0x2902);
+static constexpr uint16_t cccd_notify = 0x0001;
+
+static std::atomic<bool> is_pairing{true};
 static notify_callback_t notify_callback = nullptr;
 
+// the connection is driven by the events the callbacks post to the BLE task
+static void post_ble_event(BleEvent event);
+
+// reconnection to bonded peers: direct connection to the most recently used
+// peer, then passive scans filtered by the accept list
+static ReconnectPolicy reconnect_policy;
+static ReconnectPolicy::Step reconnect_step{};
+// whether we are part way through the reconnection steps, and whether the
+// current step ended (rather than its connection attempt failing)
+static std::atomic<bool> reconnecting{false};
+static std::atomic<bool> reconnect_step_done{false};
+static std::optional<NimBLEAddress> recent_peer;
+static bool recent_peer_loaded = false;
+// set while a connection attempt is in progress, so that the scan is not
+// restarted underneath it
+static std::atomic<bool> connecting{false};
+
+// routes for the characteristics we subscribed to, keyed by handle. Only the
+// BLE task changes them (the host task looks them up)
+static NotificationRouter notification_router;
+// handles of the connected peer, and whether they came from the cache
+// (rather than a full discovery)
+static GattCache connected_gatt;
+static bool subscribed_from_cache = false;
+// service changed handle of the connected peer; an indication on it
+// invalidates the cache
+static std::atomic<uint16_t> service_changed_handle{0};
+
+// how much of each gamepad report is compared to detect input changes
+static constexpr size_t max_report_compare_size = 32;
+
+// how the link is set up once connected, and what the peer agreed to
+#if CONFIG_BLE_LINK_PROFILE_LOW_LATENCY
+static constexpr const LinkProfile &link_profile = link_profiles::low_latency;
+#else
+static constexpr const LinkProfile &link_profile = link_profiles::balanced;
+#endif
+static ConnParams requested_conn_params = link_profile.params;
+// the parameters used while the inputs are active (the profile's, or the
+// fallback the peer accepted)
+static ConnParams active_conn_params = link_profile.params;
+// the link monitor mode the connection parameters and PHY are set up for
+static LinkMonitor::Mode applied_link_mode = LinkMonitor::Mode::ACTIVE;
+// the NimBLE host task and the link monitor timer both update the link, so
+// they hold this around every change of the parameters above and every
+// connection parameter / PHY update. Taken before link_mutex.
+static std::mutex link_update_mutex;
+static std::mutex link_mutex;
+static LinkStatus link_status;
+// intervals between gamepad notifications, which show the latency the link adds
+static IntervalMonitor notification_intervals;
+// link quality / activity, which adapts the connection parameters and PHY
+static LinkMonitor link_monitor;
+static LinkMonitor::Sample link_quality;
+static std::unique_ptr<espp::Timer> link_monitor_timer;
+static std::array<uint8_t, max_report_compare_size> last_gamepad_report{};
+static uint16_t last_gamepad_report_length = 0;
+
+// time from connecting to receiving the first gamepad report
+static int64_t connect_time_us = 0;
+static std::atomic<bool> first_report_pending{false};
+static std::atomic<int64_t> connect_to_first_report_us{-1};
+
 // LED configuration for BLE pairing / reconnecting
 static constexpr float pairing_breathing_period = 1.0f;
 static constexpr float reconnecting_breathing_period = 3.0f;
@@ -45,50 +137,103 @@ static auto led_callback = [](auto &m, auto &cv) -> bool {
 static auto led_task =
     espp::Task::make_unique({.callback = led_callback, .task_config = {.name = "breathe"}});
 
-class ClientCallbacks : public NimBLEClientCallbacks {
-  static constexpr uint16_t min_conn_interval = 12;    // 1.25ms units = 15ms
-  static constexpr uint16_t max_conn_interval = 12;    // 1.25ms units = 15ms
-  static constexpr uint16_t latency = 4;               // 4 packets at 15ms = 60ms
-  static constexpr uint16_t supervision_timeout = 400; // 4s
+static void update_conn_params(NimBLEClient *pClient, const ConnParams &params) {
+  pClient->updateConnParams(params.min_interval, params.max_interval, params.latency,
+                            params.supervision_timeout);
+}
+
+// read the negotiated connection parameters into link_status
+static void read_conn_params(uint16_t conn_handle) {
+  struct ble_gap_conn_desc desc;
+  if (ble_gap_conn_find(conn_handle, &desc) != 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(link_mutex);
+  link_status.interval = desc.conn_itvl;
+  link_status.latency = desc.conn_latency;
+  link_status.supervision_timeout = desc.supervision_timeout;
+  link_monitor.set_supervision_timeout_us(desc.supervision_timeout * 10'000);
+  trace(TraceEvent::BLE_CONN_UPDATE, desc.conn_itvl, desc.conn_latency, desc.supervision_timeout);
+  logger.info("Link: interval {:.2f} ms, latency {}, supervision timeout {} ms",
+              conn_interval_to_ms(desc.conn_itvl), desc.conn_latency,
+              desc.supervision_timeout * 10);
+}
 
+class ClientCallbacks : public NimBLEClientCallbacks {
   espp::Logger logger =
       espp::Logger({.tag = "BLE Client Callbacks", .level = espp::Logger::Verbosity::INFO});
   void onConnect(NimBLEClient *pClient) override {
     logger.info("connected to: {}", pClient->getPeerAddress().toString());
-    static constexpr bool async = true;
-    // set the connection parameters now that we've connected
-    pClient->setConnectionParams(min_conn_interval, max_conn_interval, latency,
-                                 supervision_timeout);
-    // bond / secure the connection
-    pClient->secureConnection(async);
-    // stop the led task
-    led_task->stop();
-    static auto &bsp = Bsp::get();
-    static espp::Rgb black(0.0f, 0.0f, 0.0f); // blue
-    bsp.led(black);
+    trace(TraceEvent::BLE_CONNECT, pClient->getConnHandle());
+    connecting = false;
+    if (reconnecting) {
+      MetricsRegistry::get().increment(Metric::RECONNECTS);
+    }
+    connect_time_us = esp_timer_get_time();
+    first_report_pending = true;
+    {
+      std::lock_guard<std::mutex> lock(link_mutex);
+      link_status = {};
+      notification_intervals.restart();
+      link_monitor.reset(connect_time_us);
+      link_quality = {};
+      last_gamepad_report_length = 0;
+    }
+    std::lock_guard<std::mutex> update_lock(link_update_mutex);
+    active_conn_params = link_profile.params;
+    applied_link_mode = LinkMonitor::Mode::ACTIVE;
+    read_conn_params(pClient->getConnHandle());
+    // the PHY and packet size can change while the link is being secured; the
+    // connection parameters are updated once it is
+    if (link_profile.use_2m_phy) {
+      pClient->updatePhy(BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_2M_MASK);
+    }
+    if (link_profile.data_length_extension) {
+      static constexpr uint16_t max_tx_octets = 251;
+      pClient->setDataLen(max_tx_octets);
+    }
+    post_ble_event(BleEvent::CONNECTED);
   }
 
   void onDisconnect(NimBLEClient *pClient, int reason) override {
-    logger.info("{} Disconnected, reason = {} - Starting scan",
-                pClient->getPeerAddress().toString(), reason);
-    // if we are not scanning, then start scanning
-    if (!NimBLEDevice::getScan()->isScanning()) {
-      start_ble_reconnection_thread(notify_callback);
-    }
-    subscribed = false;
+    logger.info("{} Disconnected, reason = {}", pClient->getPeerAddress().toString(), reason);
+    trace(TraceEvent::BLE_DISCONNECT, 0, reason);
+    // the routes are cleared by the BLE task, their only writer
+    service_changed_handle = 0;
+    post_ble_event(BleEvent::DISCONNECTED);
+  }
+
+  void onConnectFail(NimBLEClient *pClient, int reason) override {
+    logger.info("Failed to connect to {}, reason = {}", pClient->getPeerAddress().toString(),
+                reason);
+    connecting = false;
+    post_ble_event(BleEvent::CONNECT_FAILED);
+  }
+
+  bool onConnParamsUpdateRequest(NimBLEClient *pClient,
+                                 const ble_gap_upd_params *params) override {
+    logger.info("Peer requested interval {:.2f}-{:.2f} ms, latency {}, supervision timeout {} ms",
+                conn_interval_to_ms(params->itvl_min), conn_interval_to_ms(params->itvl_max),
+                params->latency, params->supervision_timeout * 10);
+    return true;
   }
 
   void onAuthenticationComplete(NimBLEConnInfo &connInfo) override {
+    trace(TraceEvent::BLE_ENCRYPTED, connInfo.isEncrypted());
     if (!connInfo.isEncrypted()) {
       logger.error("Encrypt connection failed - disconnecting");
-      /** Find the client with the connection handle provided in connInfo */
-      NimBLEDevice::getClientByHandle(connInfo.getConnHandle())->disconnect();
+      post_ble_event(BleEvent::ENCRYPTION_FAILED);
       return;
     } else {
       logger.info("Encryption successful!");
       // set the connection parameters
-      NimBLEDevice::getClientByHandle(connInfo.getConnHandle())
-          ->updateConnParams(min_conn_interval, max_conn_interval, latency, supervision_timeout);
+      {
+        std::lock_guard<std::mutex> update_lock(link_update_mutex);
+        requested_conn_params = active_conn_params;
+        update_conn_params(NimBLEDevice::getClientByHandle(connInfo.getConnHandle()),
+                           requested_conn_params);
+      }
+      post_ble_event(BleEvent::ENCRYPTED);
     }
   }
 };
@@ -99,55 +244,554 @@ class ScanCallbacks : public NimBLEScanCallbacks {
   espp::Logger logger =
       espp::Logger({.tag = "BLE Scan Callbacks", .level = espp::Logger::Verbosity::INFO});
   void onResult(const NimBLEAdvertisedDevice *advertisedDevice) override {
-    logger.info("Advertised Device found: {}", advertisedDevice->toString());
+    MetricsRegistry::get().increment(Metric::SCAN_RESULTS);
     bool should_connect = false;
-    bool is_pairable_device =
-        advertisedDevice->isAdvertisingService(hid_service_uuid) ||
-        advertisedDevice->getAppearance() == (uint16_t)espp::BleAppearance::GAMEPAD;
-    if (is_pairing && is_pairable_device) {
-      // if we're pairing, then simply connect to the first device that advertises
-      // the HID service. The connection callback will try to bond to it.
-      should_connect = true;
-    } else if (!is_pairing && NimBLEDevice::isBonded(advertisedDevice->getAddress())) {
-      // if we're not pairing, then we're reconnecting, so we need to check if
-      // the device is bonded
-      should_connect = true;
+    if (is_pairing) {
+      // called for every advertisement, so only log the raw values here
+      static LogSite<LogLevel::INFO> advertisement_site{
+          "BLE Scan Callbacks",
+          "Advertised Device found: {:012x}, RSSI {} dBm, appearance {:#06x}, HID service {}",
+          100'000};
+      deferred_log(advertisement_site, uint64_t(advertisedDevice->getAddress()),
+                   advertisedDevice->getRSSI(), advertisedDevice->getAppearance(),
+                   advertisedDevice->isAdvertisingService(hid_service_uuid));
+      // if we're pairing, then simply connect to the first device that
+      // advertises the HID service. The connection callback will try to bond to
+      // it.
+      should_connect = advertisedDevice->isAdvertisingService(hid_service_uuid) ||
+                       advertisedDevice->getAppearance() ==
+                           (uint16_t)espp::BleAppearance::GAMEPAD;
+    } else {
+      // if we're not pairing, then we're reconnecting. The accept list only
+      // lets bonded devices through, but check anyway in case the controller
+      // could not apply it.
+      should_connect = NimBLEDevice::isBonded(advertisedDevice->getAddress());
     }
     if (should_connect) {
-      /** stop scan before connecting, since we use async connections and don't
-          want to possibly try to connect to multiple devices. */
-      NimBLEDevice::getScan()->stop();
+      logger.info("Found Our Device: {}", advertisedDevice->getAddress().toString());
+      connect_to(advertisedDevice->getAddress(), 0);
+    }
+  }
 
-      logger.info("Found Our Device");
+  void onScanEnd(const NimBLEScanResults &results, int reason) override {
+    logger.debug("Scan Ended, reason = {}", reason);
+    if (connecting) {
+      // we stopped the scan to connect
+      return;
+    }
+    if (is_pairing) {
+      // the pairing window is over, go back to reconnecting (if we have bonds)
+      is_pairing = false;
+    } else {
+      reconnect_step_done = true;
+    }
+    post_ble_event(BleEvent::SCAN_ENDED);
+  }
 
-      /** Async connections can be made directly in the scan callbacks */
-      auto pClient = NimBLEDevice::getDisconnectedClient();
+public:
+  /// Connect to a peer asynchronously; onConnect / onConnectFail post the
+  /// result.
+  /// @param address The address of the peer
+  /// @param timeout_ms The connection timeout, 0 for the default
+  /// @return True if the connection was started
+  bool connect_to(const NimBLEAddress &address, uint32_t timeout_ms) {
+    // stop scan before connecting, since we use async connections and don't
+    // want to possibly try to connect to multiple devices.
+    connecting = true;
+    post_ble_event(BleEvent::CONNECTING);
+    if (NimBLEDevice::getScan()->isScanning()) {
+      NimBLEDevice::getScan()->stop();
+    }
+    auto pClient = NimBLEDevice::getDisconnectedClient();
+    if (!pClient) {
+      pClient = NimBLEDevice::createClient(address);
       if (!pClient) {
-        pClient = NimBLEDevice::createClient(advertisedDevice->getAddress());
-        if (!pClient) {
-          logger.error("Failed to create client");
-          return;
-        }
+        logger.error("Failed to create client");
+        connecting = false;
+        post_ble_event(BleEvent::CONNECT_FAILED);
+        return false;
       }
+    }
+    // and set our callbacks
+    pClient->setClientCallbacks(&clientCallbacks, false);
+    static constexpr bool delete_on_disconnect = true;
+    static constexpr bool delete_on_connect_fail = true;
+    pClient->setSelfDelete(delete_on_disconnect, delete_on_connect_fail);
+    if (timeout_ms) {
+      pClient->setConnectTimeout(timeout_ms);
+    }
+    // connect with the link profile's parameters
+    const auto &params = link_profile.params;
+    pClient->setConnectionParams(params.min_interval, params.max_interval, params.latency,
+                                 params.supervision_timeout);
+    static constexpr bool delete_attributes = true;
+    static constexpr bool async = true;
+    if (!pClient->connect(address, delete_attributes, async, link_profile.exchange_mtu)) {
+      logger.error("Failed to connect");
+      connecting = false;
+      post_ble_event(BleEvent::CONNECT_FAILED);
+      return false;
+    }
+    return true;
+  }
+};
+
+static ScanCallbacks scanCallbacks;
+
+/********* GATT client helpers ***************/
+
+// State of the raw GATT request the BLE task is waiting on. Only one request
+// is outstanding at a time. The callbacks get the generation of their request
+// rather than a pointer to it, since a request we gave up on may still
+// complete (the ATT timeout is 30 s) while a later one is in progress.
+struct GattRequest {
+  TaskHandle_t waiter{nullptr};
+  uint32_t generation{0};
+  int status{0};
+  std::array<uint8_t, 64> data{};
+  uint16_t length{0};
+};
+static std::mutex gatt_request_mutex;
+static GattRequest gatt_request;
+static constexpr TickType_t gatt_timeout = pdMS_TO_TICKS(2000);
+
+static int on_gatt_access(uint16_t conn_handle, const struct ble_gatt_error *error,
+                          struct ble_gatt_attr *attr, void *arg) {
+  std::lock_guard<std::mutex> lock(gatt_request_mutex);
+  if (reinterpret_cast<uintptr_t>(arg) != gatt_request.generation) {
+    // the completion of a request which timed out
+    return 0;
+  }
+  gatt_request.status = error->status;
+  if (error->status == 0 && attr && attr->om) {
+    ble_hs_mbuf_to_flat(attr->om, gatt_request.data.data(), gatt_request.data.size(),
+                        &gatt_request.length);
+  }
+  xTaskNotifyGive(gatt_request.waiter);
+  return 0;
+}
+
+// start a new request, returning the argument for its callback
+static void *begin_gatt_request() {
+  std::lock_guard<std::mutex> lock(gatt_request_mutex);
+  gatt_request = {.waiter = xTaskGetCurrentTaskHandle(),
+                  .generation = gatt_request.generation + 1};
+  ulTaskNotifyTake(pdTRUE, 0); // clear any stale completion
+  return reinterpret_cast<void *>(uintptr_t(gatt_request.generation));
+}
+
+static bool wait_for_gatt_request() {
+  bool completed = ulTaskNotifyTake(pdTRUE, gatt_timeout);
+  std::lock_guard<std::mutex> lock(gatt_request_mutex);
+  if (!completed) {
+    // ignore the completion if it still comes
+    gatt_request.generation++;
+    return false;
+  }
+  return gatt_request.status == 0;
+}
+
+// read a characteristic by handle, without requiring it to be discovered
+static size_t gatt_read(uint16_t conn_handle, uint16_t handle, std::span<uint8_t> buffer) {
+  void *arg = begin_gatt_request();
+  if (ble_gattc_read(conn_handle, handle, on_gatt_access, arg) != 0 || !wait_for_gatt_request()) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock(gatt_request_mutex);
+  size_t length = std::min<size_t>(gatt_request.length, buffer.size());
+  std::copy_n(gatt_request.data.begin(), length, buffer.begin());
+  return length;
+}
 
-      // and set our callbacks
-      pClient->setClientCallbacks(&clientCallbacks, false);
-      static constexpr bool delete_on_disconnect = true;
-      static constexpr bool delete_on_connect_fail = true;
-      pClient->setSelfDelete(delete_on_disconnect, delete_on_connect_fail);
-      if (!pClient->connect(true, true,
-                            false)) { // delete attributes, async connect, no MTU exchange
-        logger.error("Failed to connect");
-        return;
+// enable notifications by writing the CCCD directly, without discovering it
+static bool gatt_write_cccd(uint16_t conn_handle, uint16_t cccd_handle, uint16_t value) {
+  uint8_t data[2] = {uint8_t(value & 0xFF), uint8_t(value >> 8)};
+  void *arg = begin_gatt_request();
+  return ble_gattc_write_flat(conn_handle, cccd_handle, data, sizeof(data), on_gatt_access,
+                              arg) == 0 &&
+         wait_for_gatt_request();
+}
+
+/********* Notifications ***************/
+
+// All notifications / indications are received here (instead of through
+// NimBLERemoteCharacteristic) so that they are routed with a single lookup, and
+// so that characteristics subscribed through cached handles (which NimBLE-cpp
+// has not discovered) are delivered too.
+static struct ble_gap_event_listener gap_event_listener;
+static constexpr size_t max_notification_size = 64;
+
+static uint8_t get_profile_phy_mask() {
+  return link_profile.use_2m_phy ? BLE_GAP_LE_PHY_2M_MASK : BLE_GAP_LE_PHY_1M_MASK;
+}
+
+// set the link up for the mode the link monitor is in, unless it already is.
+// Applying the monitor's current mode (rather than the one the caller saw)
+// keeps the link right when the timer and a notification change it at once.
+// Returns true if the mode changed, with the previous mode in from
+static bool apply_link_mode(NimBLEClient *pClient, LinkMonitor::Mode &from, LinkMonitor::Mode &to) {
+  std::lock_guard<std::mutex> update_lock(link_update_mutex);
+  {
+    std::lock_guard<std::mutex> lock(link_mutex);
+    to = link_monitor.get_mode();
+  }
+  from = applied_link_mode;
+  if (to == from) {
+    return false;
+  }
+  applied_link_mode = to;
+  switch (to) {
+  case LinkMonitor::Mode::ACTIVE:
+    requested_conn_params = active_conn_params;
+    break;
+  case LinkMonitor::Mode::IDLE:
+    requested_conn_params = link_profile.idle_params;
+    break;
+  case LinkMonitor::Mode::DEGRADED:
+    // keep the interval, but give the link longer to recover before dropping it
+    requested_conn_params = active_conn_params;
+    requested_conn_params.supervision_timeout = link_profile.degraded_supervision_timeout;
+    break;
+  }
+  update_conn_params(pClient, requested_conn_params);
+  // the coded PHY trades throughput for range
+  if (to == LinkMonitor::Mode::DEGRADED) {
+    pClient->updatePhy(BLE_GAP_LE_PHY_CODED_MASK, BLE_GAP_LE_PHY_CODED_MASK,
+                       BLE_GAP_LE_PHY_CODED_ANY);
+  } else if (from == LinkMonitor::Mode::DEGRADED) {
+    pClient->updatePhy(get_profile_phy_mask(), get_profile_phy_mask());
+  }
+  return true;
+}
+
+// sample the link quality and adapt the link to it
+static bool link_monitor_callback() {
+  if (get_ble_state() != BleState::STREAMING) {
+    return false; // don't stop the timer
+  }
+  auto clients = NimBLEDevice::getConnectedClients();
+  if (clients.empty()) {
+    return false;
+  }
+  auto pClient = clients[0];
+  int8_t rssi = 0;
+  ble_gap_conn_rssi(pClient->getConnHandle(), &rssi);
+  LinkMonitor::Sample sample;
+  {
+    std::lock_guard<std::mutex> lock(link_mutex);
+    sample = link_monitor.sample(esp_timer_get_time(), rssi);
+    link_quality = sample;
+  }
+  logger.debug("Link: {} dBm, {} notifications, {} late, max gap {} us, {}", sample.rssi,
+               sample.notifications, sample.late, sample.max_gap_us, to_string(sample.mode));
+  if (sample.supervision_risk) {
+    logger.warn("Gap of {} ms between reports is close to the supervision timeout",
+                sample.max_gap_us / 1000);
+  }
+  trace(TraceEvent::LINK_MONITOR_TIMER, static_cast<uint16_t>(sample.mode), uint8_t(sample.rssi));
+  LinkMonitor::Mode from, to;
+  if (apply_link_mode(pClient, from, to)) {
+    logger.info("Link mode: {} -> {}", to_string(from), to_string(to));
+  }
+  return false; // don't stop the timer
+}
+
+// log the link as it is negotiated, and fall back to longer connection
+// intervals when the peer rejects ours
+static void on_link_event(struct ble_gap_event *event) {
+  switch (event->type) {
+  case BLE_GAP_EVENT_CONN_UPDATE: {
+    uint16_t conn_handle = event->conn_update.conn_handle;
+    if (event->conn_update.status == 0) {
+      read_conn_params(conn_handle);
+      break;
+    }
+    std::lock_guard<std::mutex> update_lock(link_update_mutex);
+    auto fallback = fallback_conn_params(requested_conn_params, link_profile.max_interval);
+    auto pClient = NimBLEDevice::getClientByHandle(conn_handle);
+    if (!fallback || !pClient) {
+      logger.warn("Connection parameters rejected ({}), keeping the current ones",
+                  event->conn_update.status);
+      read_conn_params(conn_handle);
+      break;
+    }
+    logger.warn("Connection interval {:.2f} ms rejected ({}), trying {:.2f} ms",
+                conn_interval_to_ms(requested_conn_params.min_interval),
+                event->conn_update.status, conn_interval_to_ms(fallback->min_interval));
+    requested_conn_params = *fallback;
+    if (requested_conn_params.latency == active_conn_params.latency) {
+      // remember it for the next time the inputs become active
+      active_conn_params = requested_conn_params;
+    }
+    update_conn_params(pClient, requested_conn_params);
+    break;
+  }
+  case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+    if (event->phy_updated.status == 0) {
+      std::lock_guard<std::mutex> lock(link_mutex);
+      link_status.tx_phy = event->phy_updated.tx_phy;
+      link_status.rx_phy = event->phy_updated.rx_phy;
+    }
+    logger.info("PHY update ({}): tx {}, rx {}", event->phy_updated.status,
+                event->phy_updated.tx_phy, event->phy_updated.rx_phy);
+    break;
+  case BLE_GAP_EVENT_MTU: {
+    std::lock_guard<std::mutex> lock(link_mutex);
+    link_status.mtu = event->mtu.value;
+    logger.info("MTU: {}", event->mtu.value);
+    break;
+  }
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+  case BLE_GAP_EVENT_DATA_LEN_CHG: {
+    std::lock_guard<std::mutex> lock(link_mutex);
+    link_status.tx_octets = event->data_len_chg.max_tx_octets;
+    logger.info("Data length: tx {} octets, rx {} octets", event->data_len_chg.max_tx_octets,
+                event->data_len_chg.max_rx_octets);
+    break;
+  }
+#endif
+  default:
+    break;
+  }
+}
+
+// count the notifications of each kind of characteristic
+static void count_notification(ReportKind kind) {
+  static auto &metrics = MetricsRegistry::get();
+  switch (kind) {
+  case ReportKind::GAMEPAD:
+    metrics.increment(Metric::BLE_NOTIFY_GAMEPAD);
+    break;
+  case ReportKind::KEYBOARD:
+    metrics.increment(Metric::BLE_NOTIFY_KEYBOARD);
+    break;
+  case ReportKind::CONSUMER:
+    metrics.increment(Metric::BLE_NOTIFY_CONSUMER);
+    break;
+  case ReportKind::BATTERY:
+    metrics.increment(Metric::BLE_NOTIFY_BATTERY);
+    break;
+  default:
+    break;
+  }
+}
+
+static int on_gap_event(struct ble_gap_event *event, void *arg) {
+  if (event->type != BLE_GAP_EVENT_NOTIFY_RX) {
+    on_link_event(event);
+    return 0;
+  }
+  uint16_t attr_handle = event->notify_rx.attr_handle;
+  if (attr_handle != 0 && attr_handle == service_changed_handle) {
+    // the peer's database changed, so neither the cached handles nor the ones
+    // in use can be trusted; the BLE task drops them and rediscovers
+    logger.warn("Service Changed indication received, rediscovering");
+    post_ble_event(BleEvent::SERVICE_CHANGED);
+    return 0;
+  }
+  auto route = notification_router.find(attr_handle);
+  if (!route || !notify_callback) {
+    return 0;
+  }
+  count_notification(route->kind);
+  trace(TraceEvent::BLE_NOTIFY, attr_handle, OS_MBUF_PKTLEN(event->notify_rx.om));
+  uint8_t data[max_notification_size];
+  uint16_t length = 0;
+  ble_hs_mbuf_to_flat(event->notify_rx.om, data, sizeof(data), &length);
+  if (route->kind == ReportKind::GAMEPAD) {
+    int64_t now = esp_timer_get_time();
+    size_t compare_length = std::min<size_t>(length, last_gamepad_report.size());
+    bool wake = false;
+    {
+      std::lock_guard<std::mutex> lock(link_mutex);
+      notification_intervals.add_event(now);
+      bool changed = compare_length != last_gamepad_report_length ||
+                     !std::equal(data, data + compare_length, last_gamepad_report.begin());
+      std::copy_n(data, compare_length, last_gamepad_report.begin());
+      last_gamepad_report_length = compare_length;
+      wake = link_monitor.on_notification(now, changed);
+    }
+    // tighten the link as soon as the inputs change, not at the next sample
+    auto pClient = wake ? NimBLEDevice::getClientByHandle(event->notify_rx.conn_handle) : nullptr;
+    LinkMonitor::Mode from, to;
+    if (pClient && apply_link_mode(pClient, from, to)) {
+      // formatted later, off the notification path
+      static LogSite<LogLevel::INFO> wake_site{"BLE", "Link mode: {} -> {} (inputs changed)"};
+      deferred_log(wake_site, to_string(from), to_string(to));
+    }
+  }
+  if (route->kind == ReportKind::GAMEPAD && first_report_pending.exchange(false)) {
+    connect_to_first_report_us = esp_timer_get_time() - connect_time_us;
+    logger.info("Connect to first report: {:.1f} ms ({})", connect_to_first_report_us / 1000.0f,
+                subscribed_from_cache ? "cached handles" : "full discovery");
+  }
+  notify_callback(*route, data, length);
+  return 0;
+}
+
+/********* Discovery / Subscription ***************/
+
+// get the handles cached from a previous connection, if they are still valid
+static bool discover_from_cache(NimBLEClient *pClient) {
+  auto address = pClient->getConnInfo().getIdAddress();
+  auto cache = load_gatt_cache(address);
+  if (!cache) {
+    return false;
+  }
+  if (cache->db_hash_handle) {
+    std::array<uint8_t, GattCache::db_hash_size> db_hash;
+    if (gatt_read(pClient->getConnHandle(), cache->db_hash_handle, db_hash) != db_hash.size() ||
+        db_hash != cache->db_hash) {
+      logger.info("GATT database hash changed, rediscovering");
+      erase_gatt_cache(address);
+      return false;
+    }
+  }
+  connected_gatt = *cache;
+  return true;
+}
+
+// discover the peer's services and record the handles we need
+static bool discover_with_discovery(NimBLEClient *pClient) {
+  static constexpr bool refresh = true;
+  GattCache cache;
+  // refresh services
+  pClient->getServices(refresh);
+  auto pSvc = pClient->getService(hid_service_uuid);
+  if (!pSvc) {
+    return false;
+  }
+  // refresh chars
+  pSvc->getCharacteristics(refresh);
+  // read the report map, so we know which kind of device each report id
+  // belongs to
+  std::string report_map;
+  auto pReportMapChr = pSvc->getCharacteristic(hid_report_map_uuid);
+  if (pReportMapChr && pReportMapChr->canRead()) {
+    report_map = pReportMapChr->readValue();
+  }
+  // find each of the input reports and what kind of report it is
+  for (auto pChr : pSvc->getCharacteristics()) {
+    if (!pChr->getUUID().equals(hid_input_uuid) || !pChr->canNotify()) {
+      continue;
+    }
+    uint8_t report_id = 0;
+    auto pRefDsc = pChr->getDescriptor(hid_report_reference_uuid);
+    if (pRefDsc) {
+      std::string reference = pRefDsc->readValue();
+      // report reference is the report id followed by the report type
+      if (reference.size() >= 2 && reference[1] != hid_report_type_input) {
+        continue;
+      }
+      if (reference.size() >= 1) {
+        report_id = reference[0];
+      }
+    }
+    auto kind = classify_report(
+        {reinterpret_cast<const uint8_t *>(report_map.data()), report_map.size()}, report_id);
+    if (kind == ReportKind::UNKNOWN && report_map.empty()) {
+      // without a report map, assume it is the gamepad we are bridging
+      kind = ReportKind::GAMEPAD;
+    }
+    if (kind == ReportKind::UNKNOWN) {
+      logger.warn("Ignoring input report {} (handle {}) of unknown kind", report_id,
+                  pChr->getHandle());
+      continue;
+    }
+    auto pCccd = pChr->getDescriptor(cccd_uuid);
+    if (!pCccd) {
+      logger.warn("Input report {} (handle {}) has no CCCD", report_id, pChr->getHandle());
+      continue;
+    }
+    if (!cache.add_report({.value_handle = pChr->getHandle(),
+                           .cccd_handle = pCccd->getHandle(),
+                           .kind = kind,
+                           .report_id = report_id})) {
+      logger.warn("Too many input reports");
+      break;
+    }
+  }
+  if (!cache.report_count) {
+    return false;
+  }
+  // also use the battery service if it exists.
+  auto pBatterySvc = pClient->getService(battery_service_uuid);
+  if (pBatterySvc) {
+    pBatterySvc->getCharacteristics(refresh);
+    auto pBatteryChr = pBatterySvc->getCharacteristic(battery_level_uuid);
+    auto pCccd = pBatteryChr ? pBatteryChr->getDescriptor(cccd_uuid) : nullptr;
+    if (pBatteryChr && pBatteryChr->canNotify() && pCccd) {
+      cache.battery_handle = pBatteryChr->getHandle();
+      cache.battery_cccd_handle = pCccd->getHandle();
+    }
+  }
+  // record what we need to validate the cache next time
+  auto pGattSvc = pClient->getService(gatt_service_uuid);
+  if (pGattSvc) {
+    pGattSvc->getCharacteristics(refresh);
+    auto pServiceChangedChr = pGattSvc->getCharacteristic(service_changed_uuid);
+    if (pServiceChangedChr) {
+      // the peer keeps this subscription for the bond, so it is not repeated
+      // when subscribing from the cache
+      static constexpr bool notifications = false; // service changed is indicated
+      pServiceChangedChr->subscribe(notifications, nullptr);
+      cache.service_changed_handle = pServiceChangedChr->getHandle();
+    }
+    auto pDbHashChr = pGattSvc->getCharacteristic(database_hash_uuid);
+    if (pDbHashChr && pDbHashChr->canRead()) {
+      std::string db_hash = pDbHashChr->readValue();
+      if (db_hash.size() == GattCache::db_hash_size) {
+        std::copy(db_hash.begin(), db_hash.end(), cache.db_hash.begin());
+        cache.db_hash_handle = pDbHashChr->getHandle();
       }
     }
   }
+  auto pDeviceInfoSvc = pClient->getService(espp::DeviceInfoService::SERVICE_UUID);
+  if (pDeviceInfoSvc) {
+    auto pSerialChr =
+        pDeviceInfoSvc->getCharacteristic(espp::DeviceInfoService::SERIAL_NUMBER_CHAR_UUID);
+    if (pSerialChr && pSerialChr->canRead()) {
+      cache.serial_number_handle = pSerialChr->getHandle();
+    }
+  }
+  connected_gatt = cache;
+  return true;
+}
 
-  void onScanEnd(const NimBLEScanResults &results, int reason) override {
-    printf("Scan Ended\n");
-    start_ble_reconnection_thread(notify_callback);
+// enable notifications on the handles in connected_gatt, routing them by handle
+static bool subscribe_to_reports(NimBLEClient *pClient) {
+  uint16_t conn_handle = pClient->getConnHandle();
+  // publish the whole table before subscribing, so the first notification
+  // finds its route
+  for (const auto &report : connected_gatt.get_reports()) {
+    notification_router.add(
+        {.handle = report.value_handle, .kind = report.kind, .report_id = report.report_id});
   }
-};
+  bool battery_routed = connected_gatt.battery_handle &&
+                        notification_router.add({.handle = connected_gatt.battery_handle,
+                                                 .kind = ReportKind::BATTERY});
+  notification_router.publish();
+  for (const auto &report : connected_gatt.get_reports()) {
+    if (!gatt_write_cccd(conn_handle, report.cccd_handle, cccd_notify)) {
+      logger.warn("Failed to subscribe to input report {} (handle {})", report.report_id,
+                  report.value_handle);
+      notification_router.clear();
+      return false;
+    }
+    logger.info("Subscribed to input report {} (handle {}, kind {})", report.report_id,
+                report.value_handle, (int)report.kind);
+  }
+  if (battery_routed) {
+    // ignore success here since it's not high priority
+    gatt_write_cccd(conn_handle, connected_gatt.battery_cccd_handle, cccd_notify);
+  }
+  service_changed_handle = connected_gatt.service_changed_handle;
+  if (!subscribed_from_cache &&
+      !save_gatt_cache(pClient->getConnInfo().getIdAddress(), connected_gatt)) {
+    logger.warn("Failed to cache GATT handles");
+  }
+  return true;
+}
 
 std::string get_connected_client_serial_number() {
   auto clients = NimBLEDevice::getConnectedClients();
@@ -155,6 +799,13 @@ std::string get_connected_client_serial_number() {
     return "";
   }
   auto client = clients[0];
+  // if we subscribed using cached handles, then the device info service has
+  // not been discovered, so read the serial number by its cached handle
+  if (subscribed_from_cache && connected_gatt.serial_number_handle) {
+    uint8_t serial[32];
+    size_t length = gatt_read(client->getConnHandle(), connected_gatt.serial_number_handle, serial);
+    return std::string(reinterpret_cast<const char *>(serial), length);
+  }
   // get the device info service
   auto svc = client->getService(espp::DeviceInfoService::SERVICE_UUID);
   if (!svc) {
@@ -171,64 +822,260 @@ std::string get_connected_client_serial_number() {
   return value;
 }
 
-static ScanCallbacks scanCallbacks;
+/********* Search ***************/
 
-static bool timer_callback() {
-  if (subscribed) {
-    return false; // don't stop the timer
+/// Start scanning.
+/// @param params The scan interval and window
+/// @param duration_ms How long to scan for, 0 = scan forever
+/// @param use_accept_list If true, do a passive scan which only reports the
+///        devices on the accept list (our bonds); otherwise do an active scan
+///        which reports every device
+static void start_scan(const ReconnectPolicy::ScanParams &params, uint32_t duration_ms,
+                       bool use_accept_list) {
+  // if scanning, then stop
+  if (NimBLEDevice::getScan()->isScanning()) {
+    NimBLEDevice::getScan()->stop();
   }
 
-  auto pClients = NimBLEDevice::getConnectedClients();
+  NimBLEScan *pScan = NimBLEDevice::getScan();
+
+  // Set the callbacks to call when scan events occur, no duplicates
+  pScan->setScanCallbacks(&scanCallbacks);
+
+  // Set scan interval (how often) and window (how long) in milliseconds
+  pScan->setInterval(params.interval_ms);
+  pScan->setWindow(params.window_ms);
 
-  // if there are no clients, then ensure we're scanning and return.
-  if (!pClients.size()) {
-    if (!NimBLEDevice::getScan()->isScanning()) {
-      start_ble_reconnection_thread(notify_callback);
+  // Let the controller drop advertisements from devices which are not bonded,
+  // so we don't wake up for every advertiser around us
+  pScan->setFilterPolicy(use_accept_list ? BLE_HCI_SCAN_FILT_USE_WL : BLE_HCI_SCAN_FILT_NO_WL);
+
+  // Active scan will gather scan response data from advertisers
+  // but will use more energy from both devices. We only need it to identify
+  // new devices when pairing.
+  pScan->setActiveScan(!use_accept_list);
+
+  // Start scanning for advertisers
+  pScan->start(duration_ms);
+}
+
+/// Put all bonded peers on the controller's accept list.
+static void load_accept_list() {
+  int num_bonds = NimBLEDevice::getNumBonds();
+  for (int i = 0; i < num_bonds; i++) {
+    auto address = NimBLEDevice::getBondedAddress(i);
+    if (!NimBLEDevice::onWhiteList(address) && !NimBLEDevice::whiteListAdd(address)) {
+      logger.warn("Failed to add {} to the accept list", address.toString());
     }
-    return false; // don't stop the timer
   }
+}
 
-  // try to subscribe to notifications for each connected client
-  for (auto &pClient : pClients) {
-    static constexpr bool refresh = true;
-    // refresh services
-    pClient->getServices(refresh);
-    auto pSvc = pClient->getService(hid_service_uuid);
-    if (pSvc) {
-      // refresh chars
-      pSvc->getCharacteristics(refresh);
-      auto pChr = pSvc->getCharacteristic(hid_input_uuid);
-      if (!pChr) {
-        continue;
-      }
-      // subscribe to the characteristic
-      if (!pChr->subscribe(pChr->canNotify(), notify_callback)) {
-        pClient->disconnect();
-      } else {
-        subscribed = true;
-      }
-      if (subscribed) {
-        // we were able to get the HID service and subscribe, so also subscribe
-        // to the battery service if it exists.
-        auto pBatterySvc = pClient->getService(battery_service_uuid);
-        if (pBatterySvc) {
-          pBatterySvc->getCharacteristics(refresh);
-          auto pBatteryChr = pBatterySvc->getCharacteristic(battery_level_uuid);
-          if (pBatteryChr) {
-            // ignore success here since it's not high priority
-            pBatteryChr->subscribe(pBatteryChr->canNotify(), notify_callback);
-          }
-        }
+static void run_reconnect_step(const ReconnectPolicy::Step &step) {
+  reconnect_step = step;
+  reconnect_step_done = false;
+  switch (step.phase) {
+  case ReconnectPolicy::Phase::DIRECT_CONNECT:
+    logger.info("Connecting directly to {}", recent_peer->toString());
+    // the result (or failure to start) is posted as an event
+    scanCallbacks.connect_to(*recent_peer, step.duration_ms);
+    return;
+  case ReconnectPolicy::Phase::FAST_SCAN:
+    logger.info("Fast scanning for bonded devices");
+    break;
+  case ReconnectPolicy::Phase::SLOW_SCAN:
+    logger.info("Slow scanning for bonded devices");
+    break;
+  }
+  static constexpr bool use_accept_list = true;
+  start_scan(step.scan, step.duration_ms, use_accept_list);
+}
+
+// look for a new device to pair with, or run the next reconnection step
+static void start_search() {
+  // if there are no bonded devices, then we can only pair
+  if (NimBLEDevice::getNumBonds() == 0) {
+    is_pairing = true;
+  }
+  if (is_pairing) {
+    breathing_period = pairing_breathing_period;
+    static constexpr ReconnectPolicy::ScanParams pairing_scan{.interval_ms = 100,
+                                                              .window_ms = 100};
+    static constexpr bool use_accept_list = false;
+    start_scan(pairing_scan, scanTimeMs, use_accept_list);
+    return;
+  }
+  breathing_period = reconnecting_breathing_period;
+  if (!reconnecting.exchange(true)) {
+    // the accept list can't be changed while scanning
+    if (NimBLEDevice::getScan()->isScanning()) {
+      NimBLEDevice::getScan()->stop();
+    }
+    load_accept_list();
+    if (!recent_peer_loaded) {
+      recent_peer = load_recent_peer();
+      recent_peer_loaded = true;
+    }
+    bool has_recent_peer = recent_peer && NimBLEDevice::isBonded(*recent_peer);
+    run_reconnect_step(reconnect_policy.first(has_recent_peer));
+  } else if (reconnect_step.phase == ReconnectPolicy::Phase::DIRECT_CONNECT ||
+             reconnect_step_done) {
+    // the most recent peer is not around (the direct connection timed out), or
+    // the scan ended, so move on
+    run_reconnect_step(reconnect_policy.next(reconnect_step.phase));
+  } else {
+    // connecting to a device we found failed, so keep scanning
+    run_reconnect_step(reconnect_step);
+  }
+}
+
+/********* Connection state machine ***************/
+
+static NimBLEClient *get_connected_client() {
+  auto clients = NimBLEDevice::getConnectedClients();
+  return clients.empty() ? nullptr : clients[0];
+}
+
+class BleClient : public BleConnectionActions {
+public:
+  void start_search() override { ::start_search(); }
+
+  void secure() override {
+    static constexpr bool async = true;
+    auto pClient = get_connected_client();
+    // bond / restore the encryption of the bond; the result is posted by
+    // onAuthenticationComplete
+    if (!pClient || !pClient->secureConnection(async)) {
+      post_ble_event(BleEvent::ENCRYPTION_FAILED);
+    }
+  }
+
+  void discover(bool use_cache) override {
+    auto pClient = get_connected_client();
+    if (!pClient) {
+      post_ble_event(BleEvent::DISCOVERY_FAILED);
+      return;
+    }
+    int64_t start = esp_timer_get_time();
+    subscribed_from_cache = use_cache && discover_from_cache(pClient);
+    bool discovered = subscribed_from_cache || discover_with_discovery(pClient);
+    if (discovered) {
+      MetricsRegistry::get().set(Metric::GATT_DISCOVERY_US, esp_timer_get_time() - start);
+    }
+    post_ble_event(discovered ? BleEvent::DISCOVERED : BleEvent::DISCOVERY_FAILED);
+  }
+
+  void subscribe() override {
+    auto pClient = get_connected_client();
+    if (!pClient || !subscribe_to_reports(pClient)) {
+      if (pClient && subscribed_from_cache) {
+        logger.warn("Failed to subscribe using cached handles, rediscovering");
+        erase_gatt_cache(pClient->getConnInfo().getIdAddress());
       }
+      post_ble_event(BleEvent::SUBSCRIBE_FAILED);
+      return;
     }
-    if (!subscribed) {
-      // if we could not subscribe, then delete the bond info for the client so
-      // that we don't try to reconnect to them in the future.
-      NimBLEDevice::deleteBond(pClient->getConnInfo().getIdAddress());
+    logger.info("Subscribed to {} reports using {}", connected_gatt.report_count,
+                subscribed_from_cache ? "cached handles" : "full discovery");
+    // reconnect to this peer directly next time
+    auto address = pClient->getConnInfo().getIdAddress();
+    if (!recent_peer || *recent_peer != address) {
+      recent_peer = address;
+      save_recent_peer(address);
     }
+    reconnecting = false;
+    post_ble_event(BleEvent::SUBSCRIBED);
   }
 
-  return false; // don't stop the timer
+  void disconnect() override {
+    if (connecting) {
+      // onConnectFail posts the result
+      ble_gap_conn_cancel();
+      return;
+    }
+    auto pClient = get_connected_client();
+    if (pClient) {
+      pClient->disconnect();
+    } else {
+      post_ble_event(BleEvent::DISCONNECTED);
+    }
+  }
+
+  void forget_peer() override {
+    // delete the bond info for the peer so that we don't try to reconnect to
+    // it in the future.
+    auto pClient = get_connected_client();
+    if (!pClient) {
+      return;
+    }
+    auto address = pClient->getConnInfo().getIdAddress();
+    logger.warn("Forgetting {}", address.toString());
+    NimBLEDevice::deleteBond(address);
+    erase_gatt_cache(address);
+  }
+
+  void forget_handles() override {
+    // stop routing the stale handles until they are found again
+    notification_router.clear();
+    auto pClient = get_connected_client();
+    if (pClient) {
+      erase_gatt_cache(pClient->getConnInfo().getIdAddress());
+    }
+  }
+};
+
+static BleClient ble_client;
+static BleConnectionStateMachine ble_state_machine(ble_client);
+
+// events are handled (and the actions, which may block on GATT requests, run)
+// on the BLE task
+static QueueHandle_t ble_event_queue = nullptr;
+static constexpr size_t ble_event_queue_size = 16;
+static constexpr uint32_t ble_task_stack_size = 6144;
+static constexpr UBaseType_t ble_task_priority = 5;
+
+static void post_ble_event(BleEvent event) {
+  if (!ble_event_queue || xQueueSend(ble_event_queue, &event, 0) != pdTRUE) {
+    logger.error("Failed to post BLE event {}", (int)event);
+  }
+}
+
+static uint64_t get_time_ms() { return esp_timer_get_time() / 1000; }
+
+static void ble_task(void *) {
+  while (true) {
+    // sleep until the next event, or until the current state times out
+    TickType_t wait = portMAX_DELAY;
+    auto deadline_ms = ble_state_machine.get_deadline_ms();
+    if (deadline_ms) {
+      uint64_t now_ms = get_time_ms();
+      wait = *deadline_ms > now_ms ? pdMS_TO_TICKS(*deadline_ms - now_ms) + 1 : 0;
+    }
+    BleEvent event;
+    if (xQueueReceive(ble_event_queue, &event, wait) == pdTRUE) {
+      if (event == BleEvent::DISCONNECTED) {
+        // stop routing the old peer's handles
+        notification_router.clear();
+      }
+      ble_state_machine.handle(event, get_time_ms());
+    }
+    ble_state_machine.check_timeout(get_time_ms());
+  }
+}
+
+// show the search on the LED, and log the transitions
+static void on_ble_state_changed(BleState from, BleState to) {
+  logger.info("State: {} -> {}", to_string(from), to_string(to));
+  trace(TraceEvent::BLE_STATE, static_cast<uint16_t>(from), static_cast<uint32_t>(to));
+  bool searching = to == BleState::SCANNING || to == BleState::CONNECTING;
+  if (searching && !led_task->is_running()) {
+    breathing_start = std::chrono::high_resolution_clock::now();
+    led_task->start();
+  } else if (!searching && led_task->is_running()) {
+    led_task->stop();
+    static auto &bsp = Bsp::get();
+    static espp::Rgb black(0.0f, 0.0f, 0.0f);
+    bsp.led(black);
+  }
 }
 
 void init_ble(const std::string &device_name) {
@@ -247,75 +1094,69 @@ void init_ble(const std::string &device_name) {
   bool mitm = false;
   bool secure_connections = true;
   NimBLEDevice::setSecurityAuth(bonding, mitm, secure_connections);
-}
-
-static void start_scan() {
-  // if scanning, then stop
-  if (NimBLEDevice::getScan()->isScanning()) {
-    NimBLEDevice::getScan()->stop();
-  }
 
-  NimBLEScan *pScan = NimBLEDevice::getScan();
+  // receive all notifications through on_gap_event
+  ble_gap_event_listener_register(&gap_event_listener, on_gap_event, nullptr);
 
-  // Set the callbacks to call when scan events occur, no duplicates
-  pScan->setScanCallbacks(&scanCallbacks);
+  // and drive the connection from the BLE task
+  ble_state_machine.add_listener(on_ble_state_changed);
+  ble_event_queue = xQueueCreate(ble_event_queue_size, sizeof(BleEvent));
+  xTaskCreate(ble_task, "ble", ble_task_stack_size, nullptr, ble_task_priority, nullptr);
 
-  // Set scan interval (how often) and window (how long) in milliseconds
-  pScan->setInterval(100);
-  pScan->setWindow(100);
-
-  // Active scan will gather scan response data from advertisers
-  // but will use more energy from both devices
-  pScan->setActiveScan(true);
-
-  // Start scanning for advertisers
-  pScan->start(scanTimeMs);
-
-  // if the led task is not running, set the led breathing start time to now
-  if (!led_task->is_running()) {
-    breathing_start = std::chrono::high_resolution_clock::now();
-  }
-
-  // now start the led task
-  led_task->start();
+  // and sample the link quality while streaming
+  using namespace std::chrono_literals;
+  link_monitor_timer = std::make_unique<espp::Timer>(
+      espp::Timer::Config{.name = "Link Monitor",
+                          .period = 1s,
+                          .callback = link_monitor_callback,
+                          .log_level = espp::Logger::Verbosity::WARN});
+}
 
-  if (!scanTimer) {
-    // now start a thread to register for notifications if connected or restart
-    // scanning if not connected
-    using namespace std::chrono_literals;
-    scanTimer = std::make_unique<espp::Timer>(
-        espp::Timer::Config{.name = "Scan Timer",
-                            .period = 100ms,
-                            .callback = timer_callback,
-                            .log_level = espp::Logger::Verbosity::INFO});
-  }
+bool add_ble_state_listener(const BleConnectionStateMachine::Listener &listener) {
+  return ble_state_machine.add_listener(listener);
 }
 
 void start_ble_reconnection_thread(notify_callback_t callback) {
-  // if there are no bonded devices, then instead call the pairing thread
-  if (NimBLEDevice::getNumBonds() == 0) {
-    start_ble_pairing_thread(callback);
+  // save the callback
+  notify_callback = callback;
+  // if we already have a controller, then there's nothing to reconnect
+  auto state = ble_state_machine.get_state();
+  if (state != BleState::IDLE && state != BleState::SCANNING) {
     return;
   }
   // set pairing to false
   is_pairing = false;
-  // save the callback
-  notify_callback = callback;
-  // set the breathing period
-  breathing_period = reconnecting_breathing_period;
-  // now start the scan
-  start_scan();
+  reconnecting = false;
+  post_ble_event(BleEvent::START);
 }
 
 void start_ble_pairing_thread(notify_callback_t callback) {
-  // set pairing to true
-  is_pairing = true;
   // save the callback
   notify_callback = callback;
-  // set the breathing period
-  breathing_period = pairing_breathing_period;
-  // now start the scan
-  start_scan();
+  // set pairing to true; this drops the current controller (if any)
+  is_pairing = true;
+  post_ble_event(BleEvent::START);
+}
+
+BleState get_ble_state() { return ble_state_machine.get_state(); }
+
+bool is_ble_subscribed() { return get_ble_state() == BleState::STREAMING; }
+
+int64_t get_connect_to_first_report_us() { return connect_to_first_report_us; }
+
+const char *get_ble_link_profile_name() { return link_profile.name; }
+
+LinkStatus get_ble_link_status() {
+  std::lock_guard<std::mutex> lock(link_mutex);
+  return link_status;
+}
+
+LinkMonitor::Sample get_ble_link_quality() {
+  std::lock_guard<std::mutex> lock(link_mutex);
+  return link_quality;
 }
 
-bool is_ble_subscribed() { return subscribed; }
+IntervalMonitor::Stats take_ble_notification_timing() {
+  std::lock_guard<std::mutex> lock(link_mutex);
+  return notification_intervals.take_stats();
+}
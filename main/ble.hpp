@@ -7,14 +7,43 @@
 
 #include "battery_service.hpp"
 #include "ble_appearances.hpp"
+#include "ble_connection.hpp"
 #include "device_info_service.hpp"
 #include "hid_service.hpp"
+#include "link_monitor.hpp"
+#include "link_profile.hpp"
+#include "notification_router.hpp"
+#include "report_cadence.hpp"
 #include "timer.hpp"
 
-typedef NimBLERemoteCharacteristic::notify_callback notify_callback_t;
+/// Called with each notification from a subscribed characteristic, along with
+/// the route which says how to decode it
+typedef void (*notify_callback_t)(const NotificationRoute &route, const uint8_t *data,
+                                  size_t length);
 
 void init_ble(const std::string &device_name);
 void start_ble_reconnection_thread(notify_callback_t callback);
 void start_ble_pairing_thread(notify_callback_t callback);
+/// Add a function to call (from the BLE task) on each change of the
+/// connection state. Must be called after init_ble() and before starting the
+/// reconnection / pairing.
+/// @param listener The function to call with the previous and the new state
+/// @return True if it was added
+bool add_ble_state_listener(const BleConnectionStateMachine::Listener &listener);
+BleState get_ble_state();
 bool is_ble_subscribed();
+/// Get the time from connecting to the peer to receiving its first gamepad
+/// report, for the most recent connection.
+/// @return The time in microseconds, or -1 if no report has been received yet
+int64_t get_connect_to_first_report_us();
+/// Get the name of the link profile (CONFIG_BLE_LINK_PROFILE) in use.
+const char *get_ble_link_profile_name();
+/// Get the connection parameters, PHY and packet sizes negotiated with the
+/// connected peer.
+LinkStatus get_ble_link_status();
+/// Get the most recent link quality sample (RSSI, late notifications, mode).
+LinkMonitor::Sample get_ble_link_quality();
+/// Get the timing of the gamepad notifications since the last call, which
+/// shows how often the link delivers reports.
+IntervalMonitor::Stats take_ble_notification_timing();
 std::string get_connected_client_serial_number();
@@ -0,0 +1,104 @@
+#include "gatt_cache_storage.hpp"
+
+#include <algorithm>
+#include <array>
+
+#include <nvs.h>
+
+#include "logger.hpp"
+
+static espp::Logger logger({.tag = "GATT Cache"});
+
+static constexpr const char *nvs_namespace = "gatt_cache";
+static constexpr const char *recent_peer_key = "recent";
+
+// NVS keys are limited to 15 characters, so use "gc" + the 12 hex digit address
+static std::string make_key(const NimBLEAddress &address) {
+  const uint8_t *value = address.getVal();
+  return fmt::format("gc{:02x}{:02x}{:02x}{:02x}{:02x}{:02x}", value[5], value[4], value[3],
+                     value[2], value[1], value[0]);
+}
+
+std::optional<GattCache> load_gatt_cache(const NimBLEAddress &address) {
+  nvs_handle_t handle;
+  if (nvs_open(nvs_namespace, NVS_READONLY, &handle) != ESP_OK) {
+    return {};
+  }
+  std::array<uint8_t, GattCache::max_serialized_size> data;
+  size_t size = data.size();
+  esp_err_t err = nvs_get_blob(handle, make_key(address).c_str(), data.data(), &size);
+  nvs_close(handle);
+  if (err != ESP_OK) {
+    return {};
+  }
+  auto cache = GattCache::deserialize({data.data(), size});
+  if (!cache) {
+    logger.warn("Ignoring invalid GATT cache for {}", address.toString());
+  }
+  return cache;
+}
+
+bool save_gatt_cache(const NimBLEAddress &address, const GattCache &cache) {
+  std::array<uint8_t, GattCache::max_serialized_size> data;
+  size_t size = cache.serialize(data);
+  if (!size) {
+    return false;
+  }
+  nvs_handle_t handle;
+  if (nvs_open(nvs_namespace, NVS_READWRITE, &handle) != ESP_OK) {
+    logger.error("Failed to open NVS namespace {}", nvs_namespace);
+    return false;
+  }
+  esp_err_t err = nvs_set_blob(handle, make_key(address).c_str(), data.data(), size);
+  if (err == ESP_OK) {
+    err = nvs_commit(handle);
+  }
+  nvs_close(handle);
+  if (err != ESP_OK) {
+    logger.error("Failed to store GATT cache for {}: {}", address.toString(),
+                 esp_err_to_name(err));
+    return false;
+  }
+  return true;
+}
+
+std::optional<NimBLEAddress> load_recent_peer() {
+  nvs_handle_t handle;
+  if (nvs_open(nvs_namespace, NVS_READONLY, &handle) != ESP_OK) {
+    return {};
+  }
+  // address bytes followed by the address type
+  std::array<uint8_t, 7> data;
+  size_t size = data.size();
+  esp_err_t err = nvs_get_blob(handle, recent_peer_key, data.data(), &size);
+  nvs_close(handle);
+  if (err != ESP_OK || size != data.size()) {
+    return {};
+  }
+  return NimBLEAddress(data.data(), data[6]);
+}
+
+void save_recent_peer(const NimBLEAddress &address) {
+  std::array<uint8_t, 7> data;
+  std::copy_n(address.getVal(), 6, data.begin());
+  data[6] = address.getType();
+  nvs_handle_t handle;
+  if (nvs_open(nvs_namespace, NVS_READWRITE, &handle) != ESP_OK) {
+    return;
+  }
+  if (nvs_set_blob(handle, recent_peer_key, data.data(), data.size()) == ESP_OK) {
+    nvs_commit(handle);
+  }
+  nvs_close(handle);
+}
+
+void erase_gatt_cache(const NimBLEAddress &address) {
+  nvs_handle_t handle;
+  if (nvs_open(nvs_namespace, NVS_READWRITE, &handle) != ESP_OK) {
+    return;
+  }
+  if (nvs_erase_key(handle, make_key(address).c_str()) == ESP_OK) {
+    nvs_commit(handle);
+  }
+  nvs_close(handle);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <optional>
+
+#include <NimBLEDevice.h>
+
+#include "gatt_cache.hpp"
+
+/// Load the GATT cache stored for a bonded peer.
+/// @param address The identity address of the peer
+/// @return The cache, or nullopt if there is none (or it is corrupt)
+std::optional<GattCache> load_gatt_cache(const NimBLEAddress &address);
+
+/// Store the GATT cache for a bonded peer in NVS.
+/// @param address The identity address of the peer
+/// @param cache The cache to store
+/// @return True if the cache was stored
+bool save_gatt_cache(const NimBLEAddress &address, const GattCache &cache);
+
+/// Remove the GATT cache stored for a peer, e.g. when it is invalidated or the
+/// bond is deleted.
+/// @param address The identity address of the peer
+void erase_gatt_cache(const NimBLEAddress &address);
+
+/// Load the address of the peer we most recently subscribed to.
+/// @return The identity address, or nullopt if there is none
+std::optional<NimBLEAddress> load_recent_peer();
+
+/// Store the address of the peer we most recently subscribed to, so that the
+/// next reconnection can connect to it directly.
+/// @param address The identity address of the peer
+void save_recent_peer(const NimBLEAddress &address);
@@ -1,14 +1,30 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <span>
 #include <thread>
 
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
 #include "logger.hpp"
 #include "task.hpp"
 
+#include "bridge.hpp"
+#include "deferred_log.hpp"
+#include "metrics.hpp"
+#include "report_filter.hpp"
+#include "spsc_ring.hpp"
 #include "switch_pro.hpp"
+#include "task_monitor.hpp"
+#include "trace_ring.hpp"
 #include "xbox.hpp"
+#include "xbox_to_switch_pro.hpp"
 
 #include "ble.hpp"
 #include "bsp.hpp"
+#include "trace_dump.hpp"
 #include "usb.hpp"
 #include "keycodes.h"
 
@@ -19,6 +35,13 @@
 // is no BLE device connected. Not recommended unless you want to annoy
 // yourself.
 #define DEBUG_NO_BLE_TEST_BUTTONS 0
+// set to 1 to benchmark the static and dynamic bridge pipelines at bootup and
+// log the number of cycles per report for each.
+#define DEBUG_BENCHMARK_BRIDGE 0
+
+#if DEBUG_BENCHMARK_BRIDGE
+#include <esp_cpu.h>
+#endif
 
 using namespace std::chrono_literals;
 
@@ -30,7 +53,17 @@ static std::shared_ptr<Gui> gui;
 static std::vector<uint8_t> hid_report_descriptor;
 static std::shared_ptr<GamepadDevice> ble_gamepad;
 static std::shared_ptr<GamepadDevice> usb_gamepad;
-static int battery_level_percent = 100;
+#if CONFIG_BRIDGE_PIPELINE_STATIC
+using GamepadBridge = Bridge<Xbox, SwitchPro>;
+#elif CONFIG_BRIDGE_PIPELINE_TRANSCODE
+using GamepadBridge = XboxToSwitchProBridge;
+#else
+using GamepadBridge = DynamicBridge;
+#endif
+static std::unique_ptr<GamepadBridge> bridge;
+static std::unique_ptr<ReportFilter> report_filter;
+static std::atomic<int> battery_level_percent = 100;
+static std::atomic<bool> trace_dump_requested = false;
 static std::string serial_number = "";
 
 struct KeyState {
@@ -40,24 +73,114 @@ struct KeyState {
 };
 static KeyState key_state;
 
+// BLE input report, copied out of the NimBLE host task for the bridge task
+struct BleReport {
+  ReportKind kind;
+  int64_t notify_us; ///< When the notification arrived, to trace the latency
+  uint8_t length;
+  uint8_t data[GamepadDevice::max_report_size];
+};
+static SpscRing<BleReport, CONFIG_BRIDGE_QUEUE_SIZE> bridge_queue;
+static TaskHandle_t bridge_task_handle = nullptr;
+// set by the USB / BLE callbacks; the bridge task owns the report filter, so
+// it does the reset
+static std::atomic<bool> report_filter_reset_requested = false;
+static constexpr size_t bridge_task_stack_size = 4096;
+// formats the messages of deferred_log() off the BLE / USB paths
+static constexpr size_t deferred_log_task_stack_size = 4096;
+static constexpr UBaseType_t deferred_log_task_priority = 1;
+static constexpr uint32_t deferred_log_period_ms = 50;
+
+#if DEBUG_BENCHMARK_BRIDGE
+template <typename B> static uint32_t benchmark_bridge(B &bridge, size_t iterations) {
+  std::array<uint8_t, GamepadDevice::max_report_size> report;
+  uint8_t ble_report[16] = {0};
+  uint8_t report_id;
+  uint32_t start = esp_cpu_get_cycle_count();
+  for (size_t i = 0; i < iterations; i++) {
+    // vary the left joystick and the buttons
+    ble_report[0] = i & 0xFF;
+    ble_report[1] = (i >> 8) & 0xFF;
+    ble_report[13] = i & 0x7F;
+    bridge.translate(ble_report, report_id, report);
+  }
+  return (esp_cpu_get_cycle_count() - start) / iterations;
+}
+
+static void benchmark_bridges(espp::Logger &logger) {
+  static constexpr size_t iterations = 10'000;
+  auto xbox = std::make_shared<Xbox>();
+  auto switch_pro = std::make_shared<SwitchPro>();
+  // the switch pro only produces input reports once the host has enabled USB
+  // HID, so perform that step of the handshake first.
+  const uint8_t enable_usb_hid[] = {sp::HOST_INIT_REPORT, sp::INIT_COMMAND_ENABLE_USB_HID};
+  switch_pro->on_hid_report(sp::HOST_INIT_REPORT, enable_usb_hid, sizeof(enable_usb_hid));
+
+  Bridge<Xbox, SwitchPro> static_bridge(xbox, switch_pro);
+  DynamicBridge dynamic_bridge(xbox, switch_pro);
+  XboxToSwitchProBridge transcoder(xbox, switch_pro);
+  auto static_cycles = benchmark_bridge(static_bridge, iterations);
+  auto dynamic_cycles = benchmark_bridge(dynamic_bridge, iterations);
+  auto transcoder_cycles = benchmark_bridge(transcoder, iterations);
+  logger.info("Bridge benchmark: static {} cycles/report, dynamic {} cycles/report, transcoder {} "
+              "cycles/report",
+              static_cycles, dynamic_cycles, transcoder_cycles);
+}
+#endif // DEBUG_BENCHMARK_BRIDGE
+
 /********* BLE callbacks ***************/
 
 /** Notification / Indication receiving handler callback */
-void notifyCB(NimBLERemoteCharacteristic *pRemoteCharacteristic, uint8_t *pData, size_t length,
-              bool isNotify) {
-  // if it's the battery level characteristic, then store the battery level and
-  // return.
-  if (pRemoteCharacteristic->getUUID().equals(
-          NimBLEUUID(espp::BatteryService::BATTERY_LEVEL_CHAR_UUID))) {
+void notifyCB(const NotificationRoute &route, const uint8_t *pData, size_t length) {
+  if (length == 0) {
+    return;
+  }
+  // the route says what this characteristic carries (set up when we subscribed)
+  switch (route.kind) {
+  case ReportKind::BATTERY:
+    // store the battery level and return.
     battery_level_percent = pData[0];
     return;
+  case ReportKind::GAMEPAD:
+  case ReportKind::KEYBOARD:
+    break;
+  case ReportKind::CONSUMER:
+    // the usb gamepad has no consumer control interface to forward these to
+    return;
+  default:
+    return;
   }
-  // otherwise this is a HID input report
+  // otherwise this is a HID input report, which we hand off to the bridge task
+  // so that USB / LED stalls never block the NimBLE host task
+  BleReport ble_report;
+  ble_report.kind = route.kind;
+  ble_report.notify_us = esp_timer_get_time();
+  ble_report.length = std::min(length, sizeof(ble_report.data));
+  std::copy_n(pData, ble_report.length, ble_report.data);
+  bridge_queue.push(ble_report);
+  if (bridge_task_handle) {
+    xTaskNotifyGive(bridge_task_handle);
+  }
+}
 
-  // first check for keyboard combos
-  if (length >= 8) {
-    uint8_t modifiers = pData[0];
-    uint8_t keycode = pData[2];
+/********* Bridge task ***************/
+
+/// Have the bridge task forget the last report, so that the next one is sent
+/// even if it is unchanged; called when the host mounts the device and when
+/// the controller stops streaming
+static void request_report_filter_reset() {
+  report_filter_reset_requested = true;
+  if (bridge_task_handle) {
+    xTaskNotifyGive(bridge_task_handle);
+  }
+}
+
+/// Check a BLE keyboard report for the key combos we forward as special keys
+static void handle_keyboard_report(std::span<const uint8_t> data) {
+  // modifiers, reserved, keycodes[6]
+  if (data.size() >= 3) {
+    uint8_t modifiers = data[0];
+    uint8_t keycode = data[2];
 
     key_state.alt_pressed = modifiers & (MOD_LEFT_ALT | MOD_RIGHT_ALT);
     key_state.ctrl_pressed = modifiers & (MOD_LEFT_CTRL | MOD_RIGHT_CTRL);
@@ -79,30 +202,38 @@ void notifyCB(NimBLERemoteCharacteristic *pRemoteCharacteristic, uint8_t *pData,
       return;
     }
   }
-  // otherwise this is a gamepad input report
-
-  // set the data in the ble gamepad
-  ble_gamepad->set_report_data(ble_gamepad->get_input_report_id(), pData, length);
-
-  // convert it to GamepadInputs
-  auto inputs = ble_gamepad->get_gamepad_inputs();
-
-  // invert the y-axis for the joysticks
-  inputs.left_joystick.y = -inputs.left_joystick.y;
-  inputs.right_joystick.y = -inputs.right_joystick.y;
-
-  // now set the data in the usb gamepad
-  usb_gamepad->set_gamepad_inputs(inputs);
-  usb_gamepad->set_battery_level(battery_level_percent);
+}
 
-  // then get the output report from the usb gamepad
-  uint8_t usb_report_id = usb_gamepad->get_input_report_id();
-  auto report = usb_gamepad->get_report_data(usb_report_id);
+/// Translate a BLE gamepad input report and send it over USB
+static void handle_gamepad_report(std::span<const uint8_t> data, int64_t notify_us) {
+  ReportTimestamps timestamps{.notify_us = notify_us, .decode_us = esp_timer_get_time()};
+  // translate the ble gamepad report into a usb gamepad report
+  static std::array<uint8_t, GamepadDevice::max_report_size> report;
+  uint8_t usb_report_id;
+  bridge->set_battery_level(battery_level_percent);
+  size_t report_len = bridge->translate(data, usb_report_id, report);
+  timestamps.encode_us = esp_timer_get_time();
+  MetricsRegistry::get().increment(Metric::REPORTS_DECODED);
 
   // send the report via tiny usb
   if (tud_mounted()) {
+#if CONFIG_USB_REPORT_CADENCE
+    // the usb gamepad now holds the latest state, which usb.cpp sends on the
+    // next report period
+    (void)report_len;
+    set_input_report_timestamps(timestamps);
+#else
+    // skip the report if nothing changed and no keepalive is due
+    std::span<const uint8_t> report_data(report.data(), report_len);
+    if (!report_filter->should_send(usb_report_id, report_data, timestamps.encode_us)) {
+      // it ends here, so only the decode stages are traced
+      get_latency_tracer().record(timestamps);
+      return;
+    }
     // and send it over USB
-    send_hid_report(usb_report_id, report);
+    set_input_report_timestamps(timestamps);
+    send_hid_report(usb_report_id, report_data);
+#endif
 
     // toggle the LED each send, so mod 2
     static auto &bsp = Bsp::get();
@@ -114,6 +245,150 @@ void notifyCB(NimBLERemoteCharacteristic *pRemoteCharacteristic, uint8_t *pData,
   }
 }
 
+#if !CONFIG_USB_REPORT_CADENCE
+/// Resend the last report once its keepalive is due, since the controller
+/// sends nothing while its input is steady
+static void send_keepalive_report() {
+  // the last report is stale once the controller stops streaming
+  if (!is_ble_subscribed()) {
+    return;
+  }
+  static std::array<uint8_t, GamepadDevice::max_report_size> report;
+  uint8_t report_id;
+  size_t report_len = report_filter->take_keepalive(esp_timer_get_time(), report_id, report);
+  if (!report_len || !tud_mounted()) {
+    return;
+  }
+  // the device's copy of the same state has the bytes the filter ignores
+  // (e.g. the Switch Pro's timer) up to date
+  size_t current_len = usb_gamepad->get_report_data(report_id, report);
+  if (current_len) {
+    report_len = current_len;
+  }
+  send_hid_report(report_id, std::span<const uint8_t>(report.data(), report_len));
+}
+#endif // !CONFIG_USB_REPORT_CADENCE
+
+/// Drain the bridge queue each time notifyCB signals that reports are waiting,
+/// and resend the last report when its keepalive is due
+static void bridge_task(void *) {
+  BleReport ble_report;
+  while (true) {
+    TickType_t wait_ticks = portMAX_DELAY;
+#if !CONFIG_USB_REPORT_CADENCE
+    int64_t keepalive_us = report_filter->get_time_until_keepalive(esp_timer_get_time());
+    if (keepalive_us >= 0 && is_ble_subscribed()) {
+      wait_ticks = pdMS_TO_TICKS((keepalive_us + 999) / 1000);
+    }
+#endif
+    ulTaskNotifyTake(pdTRUE, wait_ticks);
+    if (report_filter_reset_requested.exchange(false)) {
+      report_filter->reset();
+    }
+    while (bridge_queue.pop(ble_report)) {
+      std::span<const uint8_t> data(ble_report.data, ble_report.length);
+      if (ble_report.kind == ReportKind::KEYBOARD) {
+        handle_keyboard_report(data);
+      } else {
+        handle_gamepad_report(data, ble_report.notify_us);
+      }
+    }
+#if !CONFIG_USB_REPORT_CADENCE
+    send_keepalive_report();
+#endif
+  }
+}
+
+/********* Deferred log task ***************/
+
+/// Write out a message logged with deferred_log(), the way espp::Logger does
+static void write_deferred_log_message(const DeferredLogger::Message &message) {
+#if DEBUG_USB
+  // the output reports and their replies go on the display
+  if (std::string_view(message.tag) == usb_debug_tag) {
+    gui->set_label_text(message.text);
+  }
+#endif // DEBUG_USB
+  if (message.suppressed) {
+    fmt::print("[{}/{}][{:.3f}]: {} ({} more suppressed)\n", message.tag,
+               to_char(message.level), message.timestamp_us / 1e6f, message.text,
+               message.suppressed);
+  } else {
+    fmt::print("[{}/{}][{:.3f}]: {}\n", message.tag, to_char(message.level),
+               message.timestamp_us / 1e6f, message.text);
+  }
+}
+
+/// Periodically format and write out the deferred log messages, at a low
+/// priority so it never delays the BLE / USB handling
+static void deferred_log_task(void *) {
+  espp::Logger logger({.tag = "Deferred Log", .level = espp::Logger::Verbosity::WARN});
+  auto &deferred_logger = DeferredLogger::get();
+  uint32_t last_drop_count = 0;
+  while (true) {
+    vTaskDelay(pdMS_TO_TICKS(deferred_log_period_ms));
+    deferred_logger.flush(write_deferred_log_message);
+    uint32_t drop_count = deferred_logger.get_drop_count();
+    if (drop_count != last_drop_count) {
+      logger.warn("Deferred log dropped {} messages", drop_count - last_drop_count);
+      last_drop_count = drop_count;
+    }
+  }
+}
+
+/********* Task monitor ***************/
+
+/// Sample the run time and stack high water mark of every task from the
+/// FreeRTOS run-time statistics
+/// @param samples Filled with the tasks
+/// @param names Holds copies of the task names the samples point to, since a
+///        task may be deleted before the samples are used
+/// @param total_run_time Set to the run time clock at the sample
+static void sample_tasks(std::vector<TaskSample> &samples, std::vector<std::string> &names,
+                         uint32_t &total_run_time) {
+  static std::vector<TaskStatus_t> statuses;
+  // leave room for tasks created while sampling
+  statuses.resize(uxTaskGetNumberOfTasks() + 4);
+  configRUN_TIME_COUNTER_TYPE total = 0;
+  statuses.resize(uxTaskGetSystemState(statuses.data(), statuses.size(), &total));
+  total_run_time = total;
+  samples.clear();
+  names.clear();
+  names.reserve(statuses.size());
+  for (const auto &status : statuses) {
+    names.emplace_back(status.pcTaskName);
+    bool pinned = status.xCoreID >= 0 && status.xCoreID < portNUM_PROCESSORS;
+    samples.push_back({
+        .id = status.xTaskNumber,
+        .name = names.back().c_str(),
+        .core = pinned ? int(status.xCoreID) : -1,
+        .idle = pinned && status.xHandle == xTaskGetIdleTaskHandleForCore(status.xCoreID),
+        .run_time = status.ulRunTimeCounter,
+        // the same as uxTaskGetStackHighWaterMark(), which is in bytes on the ESP32
+        .stack_free_bytes = status.usStackHighWaterMark,
+    });
+  }
+}
+
+/// Show the connected controller (and its serial number) when the BLE
+/// connection starts / stops streaming; called from the BLE task
+static void on_ble_state_changed(BleState from, BleState to) {
+  if (to == BleState::STREAMING) {
+    serial_number = get_connected_client_serial_number();
+  } else if (from == BleState::STREAMING) {
+    // make sure to reset the connected device serial number
+    serial_number = "";
+    request_report_filter_reset();
+  } else {
+    return;
+  }
+#if HAS_DISPLAY
+  // show the BLE icon if the BLE subsystem is subscribed (receiving data)
+  gui->set_ble_connected(to == BleState::STREAMING);
+  gui->set_label_text(serial_number);
+#endif // HAS_DISPLAY
+}
+
 extern "C" void app_main(void) {
   espp::Logger logger({.tag = "ESP USB BLE HID", .level = espp::Logger::Verbosity::DEBUG});
 
@@ -151,17 +426,27 @@ extern "C" void app_main(void) {
 #endif // HAS_DISPLAY
 
   // MARK: BLE pairing timer (for use with button)
+  auto on_pairing_timer = [&]() {
+    trace(TraceEvent::PAIRING_TIMER);
+    start_ble_pairing_thread(notifyCB);
+  };
   espp::HighResolutionTimer ble_pairing_timer{
-      {.name = "Pairing Timer", .callback = [&]() { start_ble_pairing_thread(notifyCB); }}};
+      {.name = "Pairing Timer", .callback = on_pairing_timer}};
 
   // MARK: Pairing button initialization
-  // initialize the button, which we'll use to cycle the rotation of the display
+  // initialize the button: holding it for 3 seconds starts pairing, and a
+  // short press dumps the event trace
   logger.info("Initializing the button");
   auto on_button_pressed = [&](const auto &event) {
     if (event.active) {
       // start ble pairing timer
       ble_pairing_timer.oneshot(3'000'000); // 3 seconds
     } else {
+      // released before the pairing started, so dump the trace (from the
+      // main loop, since writing the flash takes a while)
+      if (ble_pairing_timer.is_running()) {
+        trace_dump_requested = true;
+      }
       // cancel the ble pairing timer
       ble_pairing_timer.stop();
     }
@@ -169,21 +454,40 @@ extern "C" void app_main(void) {
   bsp.initialize_button(on_button_pressed);
 
   // MARK: Gamepad initialization
-  usb_gamepad = std::make_shared<SwitchPro>();
-  ble_gamepad = std::make_shared<Xbox>();
+  auto switch_pro = std::make_shared<SwitchPro>();
+  auto xbox = std::make_shared<Xbox>();
+  usb_gamepad = switch_pro;
+  ble_gamepad = xbox;
+  bridge = std::make_unique<GamepadBridge>(xbox, switch_pro);
+  report_filter = std::make_unique<ReportFilter>(usb_gamepad->get_report_filter_config());
+
+#if DEBUG_BENCHMARK_BRIDGE
+  benchmark_bridges(logger);
+#endif // DEBUG_BENCHMARK_BRIDGE
+
+  // MARK: Deferred log task initialization
+  xTaskCreate(deferred_log_task, "deferred log", deferred_log_task_stack_size, nullptr,
+              deferred_log_task_priority, nullptr);
 
   // MARK: USB initialization
   logger.info("USB initialization");
-#if DEBUG_USB
-  set_gui(gui);
-#endif // DEBUG_USB
+  set_usb_mount_callback(request_report_filter_reset);
   start_usb_gamepad(usb_gamepad);
 
+  // MARK: Bridge task initialization
+  logger.info("Starting bridge task on core {} with priority {}", CONFIG_BRIDGE_TASK_CORE,
+              CONFIG_BRIDGE_TASK_PRIORITY);
+  xTaskCreatePinnedToCore(bridge_task, "bridge", bridge_task_stack_size, nullptr,
+                          CONFIG_BRIDGE_TASK_PRIORITY, &bridge_task_handle,
+                          CONFIG_BRIDGE_TASK_CORE);
+
   // MARK: BLE initialization
   logger.info("BLE initialization");
   std::string device_name = "Switch";
   init_ble(device_name);
 
+  add_ble_state_listener(on_ble_state_changed);
+
   logger.info("Scanning for peripherals");
   start_ble_reconnection_thread(notifyCB);
 
@@ -192,32 +496,176 @@ extern "C" void app_main(void) {
     // sleep for a bit
     std::this_thread::sleep_for(1s);
 
+    // dump the event trace when asked to with the button
+    if (trace_dump_requested.exchange(false)) {
+      dump_trace_to_log();
+      save_trace_to_flash();
+    }
+
+    // the rates of the bridge's counters over the last second
+    auto &metrics = MetricsRegistry::get();
+    static MetricsRates display_rates;
+    display_rates.update(metrics, esp_timer_get_time());
+
+    // and the CPU load and stack headroom of the tasks over the last second
+    static std::vector<TaskSample> task_samples;
+    static std::vector<std::string> task_names;
+    uint32_t total_run_time;
+    sample_tasks(task_samples, task_names, total_run_time);
+    static TaskMonitor display_tasks;
+    display_tasks.update(task_samples, total_run_time);
+
+    // report if the bridge task has fallen behind and dropped reports
+    static uint32_t last_drop_count = 0;
+    uint32_t drop_count = bridge_queue.get_drop_count();
+    if (drop_count != last_drop_count) {
+      logger.warn("Bridge queue dropped {} reports (depth {}, max depth {}, {} total drops)",
+                  drop_count - last_drop_count, bridge_queue.size(), bridge_queue.get_max_depth(),
+                  drop_count);
+      last_drop_count = drop_count;
+    }
+
+    // report if the USB IN endpoint could not keep up with the subcommand replies
+    static uint32_t last_reply_drop_count = 0;
+    auto usb_tx_stats = get_usb_tx_stats();
+    if (usb_tx_stats.replies_dropped != last_reply_drop_count) {
+      logger.warn("USB TX dropped {} replies ({} replies sent, {} inputs sent, {} inputs "
+                  "coalesced, {} retries)",
+                  usb_tx_stats.replies_dropped - last_reply_drop_count, usb_tx_stats.replies_sent,
+                  usb_tx_stats.inputs_sent, usb_tx_stats.inputs_coalesced, usb_tx_stats.retries);
+      last_reply_drop_count = usb_tx_stats.replies_dropped;
+    }
+
+    // periodically log the rate and jitter of the input reports the host received
+    static constexpr int report_timing_log_period = 10; // seconds
+    static int report_timing_counter = 0;
+    if (++report_timing_counter >= report_timing_log_period) {
+      report_timing_counter = 0;
+      auto timing = take_usb_report_timing();
+      if (timing.reports.count) {
+        logger.info("USB reports: {:.1f} Hz, interval {:.0f} us (min {} us, max {} us, jitter "
+                    "{:.0f} us), host poll period {:.0f} us ({} samples)",
+                    timing.reports.rate_hz, timing.reports.mean_us, timing.reports.min_us,
+                    timing.reports.max_us, timing.reports.jitter_us, timing.polls.mean_us,
+                    timing.polls.count);
+      }
+      logger.info("USB report filter: {} sent ({} keepalives), {} suppressed",
+                  report_filter->get_sent_count(), report_filter->get_keepalive_count(),
+                  report_filter->get_suppressed_count());
+      // and how the BLE link delivers them, to compare link profiles
+      auto notifications = take_ble_notification_timing();
+      if (notifications.count) {
+        auto link = get_ble_link_status();
+        logger.info("BLE reports ({} link): {:.1f} Hz, interval {:.0f} us (min {} us, max {} us, "
+                    "jitter {:.0f} us), connection interval {:.2f} ms, latency {}, PHY {}/{}, "
+                    "MTU {}, connect to first report {:.1f} ms",
+                    get_ble_link_profile_name(), notifications.rate_hz, notifications.mean_us,
+                    notifications.min_us, notifications.max_us, notifications.jitter_us,
+                    conn_interval_to_ms(link.interval), link.latency, link.tx_phy, link.rx_phy,
+                    link.mtu, get_connect_to_first_report_us() / 1000.0f);
+      }
+      auto quality = get_ble_link_quality();
+      if (is_ble_subscribed()) {
+        logger.info("BLE link: {} dBm, {} late of {} reports, max gap {} us, mode {}",
+                    quality.rssi, quality.late, quality.notifications, quality.max_gap_us,
+                    to_string(quality.mode));
+      }
+      // and where the time between the BLE notification and the host reading
+      // the USB report goes
+      auto &latency = get_latency_tracer();
+      for (size_t i = 0; i < LatencyTracer::num_stages; i++) {
+        auto stage = static_cast<LatencyStage>(i);
+        auto summary = latency.get(stage).summarize();
+        if (summary.count) {
+          logger.info("Latency {}: p50 {} us, p90 {} us, p99 {} us, max {} us ({} reports)",
+                      to_string(stage), summary.p50_us, summary.p90_us, summary.p99_us,
+                      summary.max_us, summary.count);
+        }
+      }
+      latency.reset();
+      // and the rates of all the counters since the last log
+      static MetricsRates log_rates;
+      log_rates.update(metrics, esp_timer_get_time());
+      std::string metrics_text;
+      for (size_t i = 0; i < MetricsRates::metric_count; i++) {
+        auto metric = static_cast<Metric>(i);
+        if (is_gauge(metric)) {
+          fmt::format_to(std::back_inserter(metrics_text), " {} {}", to_string(metric),
+                         log_rates.get_value(metric));
+        } else {
+          fmt::format_to(std::back_inserter(metrics_text), " {} {:.1f}/s", to_string(metric),
+                         log_rates.get_rate(metric));
+        }
+      }
+      logger.info("Metrics:{}", metrics_text);
+      std::string subcommands_text;
+      for (size_t id = 0; id < MetricsRegistry::subcommand_id_count; id++) {
+        uint32_t count = metrics.get_subcommand_count(id);
+        if (count) {
+          fmt::format_to(std::back_inserter(subcommands_text), " {:#04x}: {}", id, count);
+        }
+      }
+      if (!subcommands_text.empty()) {
+        logger.info("Subcommands received:{}", subcommands_text);
+      }
+      // and the load of each core and task since the last log, with the
+      // stack headroom of each task, to size the stacks
+      static TaskMonitor log_tasks;
+      log_tasks.update(task_samples, total_run_time);
+      logger.info("CPU load: core 0 {:.1f}%, core 1 {:.1f}%", log_tasks.get_core_load(0),
+                  log_tasks.get_core_load(1));
+      std::string tasks_text;
+      for (const auto &task : log_tasks.get_tasks()) {
+        fmt::format_to(std::back_inserter(tasks_text), " {} {:.1f}% ({} B free)", task.name,
+                       task.cpu_percent, task.stack_free_bytes);
+        if (task.stack_free_bytes < CONFIG_TASK_STACK_WARNING_BYTES) {
+          logger.warn("Task '{}' has only {} bytes of stack left", task.name,
+                      task.stack_free_bytes);
+        }
+      }
+      logger.info("Tasks:{}", tasks_text);
+    }
+
     // update the display if we have one
 #if HAS_DISPLAY
     // show the usb icon if the USB is mounted
     gui->set_usb_connected(tud_mounted());
-    // show the BLE icon if the BLE subsystem is subscribed (receiving data)
-    gui->set_ble_connected(is_ble_subscribed());
+    // and the quality of the BLE link
+    if (is_ble_subscribed()) {
+      auto quality = get_ble_link_quality();
+      auto link = get_ble_link_status();
+      gui->set_link_text(fmt::format("{} dBm {:.1f} ms {}", quality.rssi,
+                                     conn_interval_to_ms(link.interval), to_string(quality.mode)));
+    } else {
+      gui->set_link_text("");
+    }
+    // and the report rates with the end to end latency since the last log
+    // (keeping the previous latency just after the statistics were reset)
+    static std::string latency_text;
+    auto total_latency = get_latency_tracer().get(LatencyStage::TOTAL).summarize();
+    if (total_latency.count) {
+      latency_text = fmt::format("p50 {:.1f} p99 {:.1f} ms", total_latency.p50_us / 1000.0f,
+                                 total_latency.p99_us / 1000.0f);
+    }
+    // and the load of each core
+    auto cpu_text = fmt::format("CPU {:.0f}% {:.0f}%", display_tasks.get_core_load(0),
+                                display_tasks.get_core_load(1));
+    if (is_ble_subscribed()) {
+      gui->set_stats_text(fmt::format("BLE {:.0f} USB {:.0f} Hz\n{}\n{}",
+                                      display_rates.get_rate(Metric::BLE_NOTIFY_GAMEPAD),
+                                      display_rates.get_rate(Metric::USB_REPORTS_COMPLETED),
+                                      latency_text, cpu_text));
+    } else {
+      latency_text.clear();
+      gui->set_stats_text(cpu_text);
+    }
 #endif // HAS_DISPLAY
 
+#if DEBUG_NO_BLE_TWIRL_JOYSTICKS
     // if we're subscribed, then don't do anything else
     if (is_ble_subscribed()) {
-      // if we haven't gotten the serial number, then get that and save it
-      if (serial_number.empty()) {
-        serial_number = get_connected_client_serial_number();
-#if HAS_DISPLAY
-        gui->set_label_text(serial_number);
-#endif // HAS_DISPLAY
-      }
       continue;
     }
-    // make sure to reset the connected device serial number
-    serial_number = "";
-#if HAS_DISPLAY
-    gui->set_label_text(serial_number);
-#endif // HAS_DISPLAY
-
-#if DEBUG_NO_BLE_TWIRL_JOYSTICKS
     // otherwise, just twirl the joysticks
     static constexpr int num_segments = 16;
     static int index = 0;
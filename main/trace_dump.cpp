@@ -0,0 +1,88 @@
+#include "trace_dump.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <span>
+#include <string>
+
+#include <esp_partition.h>
+
+#include "logger.hpp"
+#include "trace_ring.hpp"
+
+static espp::Logger logger({.tag = "Trace"});
+
+static constexpr const char *partition_label = "littlefs";
+static constexpr size_t bytes_per_line = 32;
+
+// the trace is copied here (it is too large for the stack), so only one dump
+// may run at a time
+static std::mutex dump_mutex;
+static std::array<TraceRecord, BridgeTraceRing::capacity> records;
+
+// copy the trace without the events being recorded while we copy it
+static TraceHeader copy_trace() {
+  auto &ring = get_trace_ring();
+  bool was_enabled = ring.is_enabled();
+  ring.set_enabled(false);
+  TraceHeader header;
+  header.count = ring.copy(records);
+  header.total = ring.get_total();
+  ring.set_enabled(was_enabled);
+  return header;
+}
+
+static void log_hex(std::span<const uint8_t> data) {
+  for (size_t offset = 0; offset < data.size(); offset += bytes_per_line) {
+    auto line = data.subspan(offset, std::min(bytes_per_line, data.size() - offset));
+    std::string text;
+    for (uint8_t byte : line) {
+      fmt::format_to(std::back_inserter(text), "{:02x}", byte);
+    }
+    logger.info("TRACE {}", text);
+  }
+}
+
+void dump_trace_to_log() {
+  std::lock_guard<std::mutex> lock(dump_mutex);
+  auto header = copy_trace();
+  logger.info("Dumping {} trace events ({} recorded)", header.count, header.total);
+  log_hex({reinterpret_cast<const uint8_t *>(&header), sizeof(header)});
+  log_hex({reinterpret_cast<const uint8_t *>(records.data()), header.count * sizeof(TraceRecord)});
+  logger.info("Trace dump done");
+}
+
+bool save_trace_to_flash() {
+  auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                            partition_label);
+  if (!partition) {
+    logger.error("No {} partition to save the trace to", partition_label);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(dump_mutex);
+  auto header = copy_trace();
+  size_t size = sizeof(header) + header.count * sizeof(TraceRecord);
+  if (size > partition->size) {
+    logger.error("Trace ({} bytes) does not fit in the {} partition", size, partition_label);
+    return false;
+  }
+  // erase whole sectors, then write the header and the records after it
+  size_t erase_size = (size + partition->erase_size - 1) / partition->erase_size *
+                      partition->erase_size;
+  esp_err_t err = esp_partition_erase_range(partition, 0, erase_size);
+  if (err == ESP_OK) {
+    err = esp_partition_write(partition, 0, &header, sizeof(header));
+  }
+  if (err == ESP_OK) {
+    err = esp_partition_write(partition, sizeof(header), records.data(),
+                              header.count * sizeof(TraceRecord));
+  }
+  if (err != ESP_OK) {
+    logger.error("Failed to save the trace: {}", esp_err_to_name(err));
+    return false;
+  }
+  logger.info("Saved {} trace events to the {} partition", header.count, partition_label);
+  return true;
+}
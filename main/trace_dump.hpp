@@ -0,0 +1,14 @@
+#pragma once
+
+/// Write the trace to the log, as hex lines starting with "TRACE " which the
+/// host trace_to_chrome tool turns into a Chrome / Perfetto trace. Recording
+/// is paused while the trace is copied.
+void dump_trace_to_log();
+
+/// Write the trace to the (otherwise unused) "littlefs" data partition, as a
+/// raw TraceHeader followed by the records, for the host trace_to_chrome tool.
+/// Read it back with
+/// `parttool.py read_partition --partition-name littlefs --output trace.bin`.
+/// Recording is paused while the trace is copied.
+/// @return True if the trace was written
+bool save_trace_to_flash();
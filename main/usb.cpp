@@ -1,13 +1,19 @@
 #include "usb.hpp"
 #include "bsp.hpp"
 
+#include <mutex>
+
+#include <esp_timer.h>
+
+#include "deferred_log.hpp"
+#include "latency_trace.hpp"
+#include "metrics.hpp"
+#include "report_cadence.hpp"
+#include "trace_ring.hpp"
+
 static espp::Logger logger({.tag = "USB"});
 static std::shared_ptr<GamepadDevice> usb_gamepad;
-
-// DEUBGGING:
-#if DEBUG_USB
-static std::shared_ptr<Gui> gui;
-#endif
+static std::function<void()> mount_callback;
 
 /************* TinyUSB descriptors ****************/
 
@@ -19,8 +25,57 @@ static std::shared_ptr<Gui> gui;
 static_assert(CFG_TUD_HID >= 1, "CFG_TUD_HID must be at least 1");
 
 static std::vector<uint8_t> hid_report_descriptor;
-static uint8_t usb_hid_input_report[CFG_TUD_HID_EP_BUFSIZE];
-static size_t usb_hid_input_report_len = 0;
+// scratch buffer for the responses generated by the gamepad device
+static uint8_t usb_hid_output_report[CFG_TUD_HID_EP_BUFSIZE];
+
+// latency of the input reports through each stage of the bridge, with the
+// timestamps of the newest input report which has not been handed to the
+// endpoint yet, and of the one in flight
+static std::mutex latency_mutex;
+static LatencyTracer latency_tracer;
+static ReportTimestamps pending_timestamps;
+static ReportTimestamps in_flight_timestamps;
+
+// the input report is in flight, so its trace continues on completion
+static void on_input_report_submitted(int64_t now) {
+  std::lock_guard<std::mutex> lock(latency_mutex);
+  if (in_flight_timestamps.notify_us) {
+    // its completion was never reported, so record what we have
+    latency_tracer.record(in_flight_timestamps);
+  }
+  in_flight_timestamps = pending_timestamps;
+  in_flight_timestamps.submit_us = pending_timestamps.notify_us ? now : 0;
+  pending_timestamps = {};
+}
+
+// queues the reports for the IN endpoint, sending the next one each time the
+// previous one completes
+static HidTxScheduler tx_scheduler([](uint8_t report_id, std::span<const uint8_t> data) {
+  if (!tud_hid_ready() || !tud_hid_report(report_id, data.data(), data.size())) {
+    MetricsRegistry::get().increment(Metric::USB_REPORTS_FAILED);
+    return false;
+  }
+  MetricsRegistry::get().increment(Metric::USB_REPORTS_SUBMITTED);
+  trace(TraceEvent::USB_REPORT_SUBMIT, report_id, data.size());
+  if (report_id == usb_gamepad->get_input_report_id()) {
+    on_input_report_submitted(esp_timer_get_time());
+  }
+  return true;
+});
+
+// intervals between completed input reports, and between completions which
+// were immediately followed by another transfer (i.e. the host's poll period)
+static std::mutex report_timing_mutex;
+static IntervalMonitor report_intervals;
+static IntervalMonitor poll_intervals;
+static int64_t last_report_complete_us = 0;
+static bool report_back_to_back = false;
+
+#if CONFIG_USB_REPORT_CADENCE
+// emits the latest input report every CONFIG_USB_REPORT_PERIOD_MS frames
+static FrameCadence report_cadence(CONFIG_USB_REPORT_PERIOD_MS);
+static uint8_t usb_hid_cadence_report[CFG_TUD_HID_EP_BUFSIZE];
+#endif
 
 static tusb_desc_device_t desc_device = {.bLength = sizeof(tusb_desc_device_t),
                                          .bDescriptorType = TUSB_DESC_DEVICE,
@@ -119,44 +174,106 @@ void stop_usb_gamepad() {
 }
 
 bool send_hid_report(uint8_t report_id, const std::vector<uint8_t> &report) {
+  return send_hid_report(report_id, std::span<const uint8_t>(report));
+}
+
+bool send_hid_report(uint8_t report_id, std::span<const uint8_t> report) {
   if (report.size() == 0 || report.size() > CFG_TUD_HID_EP_BUFSIZE) {
     return false;
   }
-  // copy the report data into the usb_hid_input_report buffer
-  std::memcpy(usb_hid_input_report, report.data(), report.size());
-  usb_hid_input_report_len = report.size();
-  // now try to send it
-  return tud_hid_report(report_id, usb_hid_input_report, usb_hid_input_report_len);
+  // queue the report, replacing any input report which has not been sent yet
+  return tx_scheduler.queue_input(report_id, report);
 }
 
 bool send_special_key(uint8_t code) {
-  uint8_t keycodes[6] = {0};
-  keycodes[0] = code;
-  bool res = tud_hid_keyboard_report(0, 0, keycodes);
-  uint8_t empty[6] = {0};
-  tud_hid_keyboard_report(0, 0, empty);
+  // keyboard report: modifier, reserved, keycodes[6]. The press and release
+  // are queued as replies so that they are sent in order and not coalesced.
+  uint8_t pressed[8] = {0, 0, code};
+  uint8_t released[8] = {0};
+  bool res = tx_scheduler.queue_reply(0, pressed);
+  tx_scheduler.queue_reply(0, released);
   return res;
 }
 
-#if DEBUG_USB
-void set_gui(std::shared_ptr<Gui> gui_ptr) { gui = gui_ptr; }
-#endif
+void set_input_report_timestamps(const ReportTimestamps &timestamps) {
+  std::lock_guard<std::mutex> lock(latency_mutex);
+  if (pending_timestamps.notify_us) {
+    // the previous report is replaced before it was sent
+    latency_tracer.record(pending_timestamps);
+  }
+  pending_timestamps = timestamps;
+}
+
+LatencyTracer &get_latency_tracer() { return latency_tracer; }
+
+HidTxScheduler::Stats get_usb_tx_stats() { return tx_scheduler.get_stats(); }
+
+void set_usb_mount_callback(const std::function<void()> &callback) { mount_callback = callback; }
+
+UsbReportTiming take_usb_report_timing() {
+  std::lock_guard<std::mutex> lock(report_timing_mutex);
+  return {.reports = report_intervals.take_stats(), .polls = poll_intervals.take_stats()};
+}
 
 /********* TinyUSB HID callbacks ***************/
 
 extern "C" void tud_mount_cb(void) {
   // Invoked when device is mounted
   logger.info("USB Mounted");
-  auto maybe_transmission = usb_gamepad->on_attach();
-  if (maybe_transmission.has_value()) {
-    auto &[report_id, report] = maybe_transmission.value();
-    send_hid_report(report_id, report);
+  trace(TraceEvent::USB_MOUNT);
+#if CONFIG_USB_REPORT_CADENCE
+  report_cadence.reset();
+#endif
+  // the start of frame callback retries the reports the endpoint refused
+  tud_sof_cb_enable(true);
+  uint8_t report_id = 0;
+  size_t report_len = usb_gamepad->on_attach(report_id, usb_hid_output_report);
+  if (report_len) {
+    tx_scheduler.queue_reply(report_id,
+                             std::span<const uint8_t>(usb_hid_output_report, report_len));
+  }
+  if (mount_callback) {
+    mount_callback();
   }
 }
 
 extern "C" void tud_umount_cb(void) {
   // Invoked when device is unmounted
   logger.info("USB Unmounted");
+  trace(TraceEvent::USB_UNMOUNT);
+  // nothing queued or in flight will complete now
+  tx_scheduler.reset();
+  {
+    std::lock_guard<std::mutex> lock(latency_mutex);
+    pending_timestamps = {};
+    in_flight_timestamps = {};
+  }
+  std::lock_guard<std::mutex> lock(report_timing_mutex);
+  report_intervals.restart();
+  last_report_complete_us = 0;
+}
+
+// Invoked when the bus resumes, so retry anything refused while suspended
+extern "C" void tud_resume_cb(void) { tx_scheduler.poll(); }
+
+// Invoked on each start of frame (1 ms at full speed), once enabled with
+// tud_sof_cb_enable()
+extern "C" void tud_sof_cb(uint32_t frame_count) {
+  // retry a report the endpoint refused, e.g. a subcommand reply during the
+  // handshake, when nothing else is being queued
+  tx_scheduler.poll();
+#if CONFIG_USB_REPORT_CADENCE
+  if (!report_cadence.on_frame(frame_count)) {
+    return;
+  }
+  // send the latest state, regardless of when the last BLE report arrived
+  uint8_t report_id = usb_gamepad->get_input_report_id();
+  size_t report_len = usb_gamepad->get_report_data(report_id, usb_hid_cadence_report);
+  if (report_len) {
+    tx_scheduler.queue_input(report_id,
+                             std::span<const uint8_t>(usb_hid_cadence_report, report_len));
+  }
+#endif // CONFIG_USB_REPORT_CADENCE
 }
 
 // Invoked when received GET HID REPORT DESCRIPTOR request
@@ -179,8 +296,7 @@ extern "C" uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
   case HID_REPORT_TYPE_INVALID:
     return 0;
   case HID_REPORT_TYPE_INPUT:
-    std::memcpy(buffer, usb_hid_input_report, usb_hid_input_report_len);
-    return usb_hid_input_report_len;
+    return tx_scheduler.get_last_input(std::span<uint8_t>(buffer, reqlen));
   case HID_REPORT_TYPE_OUTPUT:
     return 0;
   case HID_REPORT_TYPE_FEATURE:
@@ -194,28 +310,39 @@ extern "C" uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
 extern "C" void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
                                       hid_report_type_t report_type, uint8_t const *buffer,
                                       uint16_t bufsize) {
+  // the first bytes say which command / subcommand this is
+  uint32_t first_bytes = 0;
+  std::memcpy(&first_bytes, buffer, std::min<size_t>(bufsize, sizeof(first_bytes)));
+  trace(TraceEvent::USB_SET_REPORT, report_id, bufsize, first_bytes);
   if (report_type == HID_REPORT_TYPE_FEATURE) {
     // TODO: pro controller supports feature reports
   } else if (report_type == HID_REPORT_TYPE_OUTPUT) {
     // pass the report along to the currently configured usb gamepad device
-    auto maybe_response = usb_gamepad->on_hid_report(report_id, buffer, bufsize);
-#if DEBUG_USB
-    std::string debug_string =
-        fmt::format("In: {:02x}, {:02x}, {:02x}", buffer[0], buffer[1], buffer[2]);
-#endif
-    if (maybe_response.has_value()) {
-      auto &[response_report_id, response_data] = maybe_response.value();
-      if (response_data.size()) {
-        // send_hid_report(response_report_id, response_data);
-        tud_hid_report(response_report_id, response_data.data(), response_data.size());
+    uint8_t response_report_id = 0;
+    size_t response_len =
+        usb_gamepad->on_hid_report(report_id, std::span<const uint8_t>(buffer, bufsize),
+                                   response_report_id, usb_hid_output_report);
+    if (response_len) {
+      // replies go out ahead of any pending input report
+      if (!tx_scheduler.queue_reply(response_report_id,
+                                    std::span<const uint8_t>(usb_hid_output_report,
+                                                             response_len))) {
+        static LogSite<LogLevel::WARN> dropped_reply_site{
+            "USB", "Dropped reply to report {:#04x}, reply queue full", 1'000'000};
+        deferred_log(dropped_reply_site, report_id);
       }
-#if DEBUG_USB
-      debug_string += fmt::format("\nOut: {:02x}, {:02x}, {:02x}", response_report_id,
-                                  response_data[0], response_data[1]);
-#endif
     }
 #if DEBUG_USB
-    gui->set_label_text(debug_string);
+    // formatted (and shown on the display) by the deferred log task
+    static LogSite<LogLevel::INFO> debug_in_site{usb_debug_tag, "In: {:02x}, {:02x}, {:02x}"};
+    static LogSite<LogLevel::INFO> debug_in_out_site{
+        usb_debug_tag, "In: {:02x}, {:02x}, {:02x}\nOut: {:02x}, {:02x}, {:02x}"};
+    if (response_len) {
+      deferred_log(debug_in_out_site, buffer[0], buffer[1], buffer[2], response_report_id,
+                   usb_hid_output_report[0], usb_hid_output_report[1]);
+    } else {
+      deferred_log(debug_in_site, buffer[0], buffer[1], buffer[2]);
+    }
 #endif
   }
 }
@@ -223,6 +350,29 @@ extern "C" void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
 // Invoked when sent REPORT successfully to host
 // Application can use this to send the next report
 // Note: For composite reports, report[0] is report ID
-extern "C" void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *reprot, uint16_t len) {
-  // TODO: debug this
+extern "C" void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len) {
+  int64_t now = esp_timer_get_time();
+  MetricsRegistry::get().increment(Metric::USB_REPORTS_COMPLETED);
+  trace(TraceEvent::USB_REPORT_COMPLETE, 0, len);
+  {
+    // finish the trace of the input report (if it was one) before the next
+    // report takes its place
+    std::lock_guard<std::mutex> lock(latency_mutex);
+    if (in_flight_timestamps.notify_us) {
+      in_flight_timestamps.complete_us = now;
+      latency_tracer.record(in_flight_timestamps);
+      in_flight_timestamps = {};
+    }
+  }
+  // the endpoint is free, so start the next queued report
+  bool back_to_back = tx_scheduler.on_complete();
+  std::lock_guard<std::mutex> lock(report_timing_mutex);
+  report_intervals.add_event(now);
+  // if the previous completion immediately started this transfer, then the
+  // time between them is how often the host polls the endpoint
+  if (report_back_to_back && last_report_complete_us) {
+    poll_intervals.add_interval(now - last_report_complete_us);
+  }
+  report_back_to_back = back_to_back;
+  last_report_complete_us = now;
 }
@@ -1,11 +1,16 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
+#include <span>
 #include <vector>
 
 #include "logger.hpp"
 
 #include "gamepad_device.hpp"
+#include "hid_tx_scheduler.hpp"
+#include "latency_trace.hpp"
+#include "report_cadence.hpp"
 
 #include "bsp.hpp"
 
@@ -16,8 +21,26 @@ extern "C" {
 }
 
 void start_usb_gamepad(const std::shared_ptr<GamepadDevice> &gamepad_device);
+/// Set the function to call when the host mounts the device. It is called from
+/// the TinyUSB task, so it must not block; set it before start_usb_gamepad().
+void set_usb_mount_callback(const std::function<void()> &callback);
 bool send_hid_report(uint8_t report_id, const std::vector<uint8_t> &report);
+bool send_hid_report(uint8_t report_id, std::span<const uint8_t> report);
 bool send_special_key(uint8_t code);
+
+/// Set the timestamps of the next input report to be queued, so its latency is
+/// traced until the host reads it. Must be called before the report is queued.
+void set_input_report_timestamps(const ReportTimestamps &timestamps);
+/// Get the per-stage latency histograms of the input reports.
+LatencyTracer &get_latency_tracer();
+HidTxScheduler::Stats get_usb_tx_stats();
+
+/// Timing of the completed input reports since the last call
+struct UsbReportTiming {
+  IntervalMonitor::Stats reports; ///< Intervals between completed reports
+  IntervalMonitor::Stats polls;   ///< Host poll period, from back-to-back transfers
+};
+UsbReportTiming take_usb_report_timing();
 void stop_usb_gamepad();
 
 // debugging
@@ -28,8 +51,9 @@ void stop_usb_gamepad();
 #define DEBUG_USB 0
 
 #if DEBUG_USB
-#include "gui.hpp"
-void set_gui(std::shared_ptr<Gui> gui_ptr);
+/// Tag of the deferred log messages with the bytes of the output reports and
+/// their replies, which main shows on the display
+inline constexpr const char *usb_debug_tag = "USB Debug";
 #endif // DEBUG_USB
 
 #endif // HAS_DISPLAY